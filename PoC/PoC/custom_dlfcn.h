@@ -21,6 +21,8 @@
 #define __CUSTOM_DLFCN__
 
 #include <dlfcn.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -32,6 +34,93 @@ extern void* custom_dlopen(const char* __path, int __mode);
 extern void* custom_dlsym(void* __handle, const char* __symbol);
 extern void* custom_dlopen_from_memory(void* mh, int len);
 
+/* Resolves __count names with one pass over the export trie. __addresses[i]
+ * gets the address of __symbols[i] or NULL, __found (may be NULL) gets 1 or 0
+ * per name. Returns the number of names resolved, or -1 on error. */
+extern int custom_dlsym_many(void* __handle, const char* const* __symbols, size_t __count,
+                             void** __addresses, int* __found);
+
+/* Like custom_dlopen_from_memory, but takes ownership of |mh|, which must be a
+ * page aligned mmap()/vm_allocate() buffer. When segment file offsets match
+ * their VM offsets the pages are used in place, otherwise they are copied and
+ * the buffer is released. Either way the caller must not touch it afterwards. */
+extern void* custom_dlopen_from_memory_adopt(void* mh, size_t len);
+/* Number of adopted images that were mapped in place and that were copied.
+ * Same as images_adopted_in_place/images_adopted_by_copy of custom_dl_stats(). */
+extern void custom_dlopen_adopt_counters(unsigned* in_place, unsigned* copied);
+
+/* What loading took, see custom_dl_stats(). Times are in nanoseconds. */
+struct custom_dl_stats {
+  uint64_t segments_mapped;           /* process totals: currently mapped */
+  uint64_t bytes_mapped;              /* process totals: currently mapped */
+  uint64_t bytes_remapped;            /* from memory images, copy-on-write */
+  uint64_t bytes_copied;              /* from memory images */
+  uint64_t bytes_zero_pages_skipped;  /* all-zero pages of memory images left as zero-fill */
+  uint64_t images_adopted_in_place;
+  uint64_t images_adopted_by_copy;
+  uint64_t images_rebase_skipped;     /* loaded at their linked address */
+  uint64_t preferred_address_misses;  /* linked address was in use */
+  uint64_t rebase_fixups;
+  uint64_t bind_fixups;
+  uint64_t lazy_bind_fixups;
+  uint64_t symbols_resolved;          /* imports bound, including repeats */
+  uint64_t symbol_lookups;            /* distinct imports actually looked up */
+  uint64_t trie_searches;             /* export trie lookups */
+  uint64_t objc_classes_registered;
+  uint64_t objc_selectors_registered;
+  uint64_t load_dependents_ns;        /* counted on the image that was opened */
+  uint64_t map_ns;
+  uint64_t rebase_ns;
+  uint64_t bind_ns;
+  uint64_t weak_bind_ns;
+  uint64_t dof_ns;
+  uint64_t objc_setup_ns;
+  uint64_t init_ns;
+};
+/* Fills __stats with what loading __handle took, or with the totals of every
+ * load in the process when __handle is NULL. Safe to call while other threads
+ * load. Returns 0, or -1 on error. */
+extern int custom_dl_stats(void* __handle, struct custom_dl_stats* __stats);
+
+/* Starts (non-zero) or stops (0) recording how long each load phase (mapping,
+ * rebasing, binding, initializers, ...) takes per image and thread. */
+extern void custom_dl_trace_enable(int enable);
+/* Writes the recorded phases to __path as Chrome trace event JSON, which
+ * chrome://tracing and Perfetto open. Returns 0, or -1 if __path could not be
+ * written. */
+extern int custom_dl_trace_dump(const char* __path);
+
+#define CUSTOM_DL_PREFLIGHT_RESOLVE        0x1  /* also look up every import */
+#define CUSTOM_DL_PREFLIGHT_MAX_UNRESOLVED 16
+#define CUSTOM_DL_PREFLIGHT_MAX_MISSING    16
+
+/* What custom_dlpreflight() found out about an image. */
+struct custom_dl_preflight_report {
+  uint64_t mapped_size;               /* address space loading would reserve */
+  uint32_t segment_count;
+  uint32_t library_count;             /* dylibs the image links against */
+  uint64_t rebase_fixups;
+  uint64_t bind_fixups;
+  uint64_t lazy_bind_fixups;
+  uint64_t weak_bind_fixups;
+  uint64_t chained_fixup_pages;       /* pages with chained fixups */
+  uint64_t imports_checked;           /* lookups made with CUSTOM_DL_PREFLIGHT_RESOLVE */
+  uint32_t unresolved_count;          /* imports that did not resolve, weak imports excepted */
+  const char* unresolved[CUSTOM_DL_PREFLIGHT_MAX_UNRESOLVED]; /* the first of them, point into __buffer */
+  uint32_t missing_library_count;     /* dylibs linked against, not weakly, that are not loaded */
+  const char* missing_libraries[CUSTOM_DL_PREFLIGHT_MAX_MISSING]; /* the first of them, point into __buffer */
+};
+/* Checks whether the image in __buffer would load without loading it: parses
+ * its load commands, checks segment bounds and decodes every rebase, bind and
+ * chained fixup. Nothing is mapped, copied or run. With
+ * CUSTOM_DL_PREFLIGHT_RESOLVE in __mode imports are looked up the way
+ * custom_dlopen_from_memory would bind them, in the dylibs the process
+ * already has loaded; none is opened. A dylib that is not loaded is reported
+ * in missing_libraries, not through its imports. Fills __report and returns 0
+ * if the image would load, or -1. */
+extern int custom_dlpreflight(const void* __buffer, size_t __len,
+                              struct custom_dl_preflight_report* __report, int __mode);
+
 #ifdef __cplusplus
 }
 #endif
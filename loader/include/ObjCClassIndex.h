@@ -0,0 +1,44 @@
+// Hash set of classes known to be registered with the Objective-C runtime.
+// Seeded from the full class list the first time it is queried and kept up
+// to date by the loader as it registers and disposes classes, so a lookup no
+// longer walks every class in the process.
+
+#pragma once
+
+#include "ObjCRuntimeInterface.h"
+
+#include <mutex>
+#include <unordered_set>
+
+namespace mull
+{
+  namespace objc
+  {
+
+    class ClassIndex
+    {
+      RuntimeInterface &runtime;
+      std::unordered_set<const void *> classes;
+      std::mutex lock;
+      bool seeded;
+
+      void seedIfNeeded();
+
+    public:
+      explicit ClassIndex(RuntimeInterface &runtime);
+
+      // Classes registered after seeding by someone other than the loader
+      // are not in the set; callers fall back to a lookup by name for them.
+      bool contains(const void *cls);
+
+      void insert(const void *cls);
+      void erase(const void *cls);
+
+      size_t size();
+    };
+
+    // Index over systemRuntime(), shared by every image in the process.
+    ClassIndex &registeredClasses();
+
+  }
+}
@@ -0,0 +1,42 @@
+// Orders the classes of an image's __objc_classlist so that every class is
+// registered after its superclass. Works on opaque pointers only and does not
+// touch the Objective-C runtime.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace mull
+{
+  namespace objc
+  {
+
+    struct ClassPlanEntry
+    {
+      const void *cls;
+      const void *superclass;
+    };
+
+    enum ClassPlanStatus
+    {
+      ClassPlanOK,
+      ClassPlanCycle,
+    };
+
+    // parents[i] for a class whose superclass lives outside the plan.
+    static const size_t kClassPlanNoParent = (size_t)-1;
+
+    // Topologically sorts `entries` by superclass in O(n). On success `order`
+    // holds every index exactly once, parents before children, and
+    // `parents[i]` is the index of entry i's superclass within `entries` or
+    // kClassPlanNoParent. On ClassPlanCycle `*culprit` is set to an entry
+    // that could not be ordered.
+    ClassPlanStatus planClassRegistration(const std::vector<ClassPlanEntry> &entries,
+                                          std::vector<size_t> &order,
+                                          std::vector<size_t> &parents,
+                                          size_t *culprit);
+
+  }
+}
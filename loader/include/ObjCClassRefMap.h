@@ -0,0 +1,34 @@
+// Classes and metaclasses defined by an image, mapped to the runtime classes
+// registered for them. Class and superclass references in the image are
+// rewritten with one pointer lookup instead of a search and a lookup by name.
+// Works on opaque pointers only and does not touch the Objective-C runtime.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <unordered_map>
+
+namespace mull
+{
+  namespace objc
+  {
+
+    class ClassRefMap
+    {
+      std::unordered_map<const void *, const void *> registered;
+
+    public:
+      void reserve(size_t classCount);
+
+      // Records a class and its metaclass as found in the image, along with
+      // what the runtime registered for each.
+      void add(const void *cls, const void *runtimeClass,
+               const void *metaclass, const void *runtimeMetaclass);
+
+      // What `ref` was registered as, or NULL if the image does not define it.
+      const void *find(const void *ref) const;
+    };
+
+  }
+}
@@ -4,12 +4,16 @@
 
 #pragma once
 
+#include "ObjCClassRefMap.h"
 #include "ObjCType.h"
 #include <objc/objc.h>
 
+#include <string.h>
+
 #include <queue>
 #include <vector>
 #include <set>
+#include <unordered_map>
 
 #pragma mark -
 
@@ -18,17 +22,45 @@ namespace mull
   namespace objc
   {
 
+    struct SelectorNameHash
+    {
+      size_t operator()(const char *name) const
+      {
+        // FNV-1a
+        size_t hash = (size_t)14695981039346656037ULL;
+        for (; *name; name++)
+          hash = (hash ^ (unsigned char)*name) * (size_t)1099511628211ULL;
+        return hash;
+      }
+    };
+
+    struct SelectorNameEqual
+    {
+      bool operator()(const char *a, const char *b) const
+      {
+        return strcmp(a, b) == 0;
+      }
+    };
+
     class Runtime
     {
       std::queue<class64_t **> classesToRegister;
 
-      std::vector<class64_t *> classRefs;
-      std::vector<class64_t *> metaclassRefs;
+      // Source class/metaclass in the image -> class registered for it.
+      ClassRefMap classRefs;
+
+      // Selectors already registered for this image, by the pointer found in
+      // the image and by name. The linker uniques method names within an
+      // image, so the pointer map catches almost every repeat.
+      std::unordered_map<const void *, SEL> selectorsByRef;
+      std::unordered_map<const char *, SEL, SelectorNameHash, SelectorNameEqual> selectorsByName;
 
       std::set<Class> runtimeClasses;
       std::vector<std::pair<class64_t **, Class>> oldAndNewClassesMap;
 
       Class registerOneClass(class64_t **classrefPtr, Class superclass);
+      Class remapClassRef(Class classref);
+      SEL uniqueSelector(SEL selector);
       void parsePropertyAttributes(const char *const attributesStr,
                                    char *const stringStorage,
                                    objc_property_attribute_t *attributes,
@@ -50,6 +82,10 @@ namespace mull
                                     uintptr_t sectionSize);
 
       void registerClasses();
+
+      // What this image added to the runtime, for the load statistics.
+      size_t registeredClassCount() const { return runtimeClasses.size(); }
+      size_t registeredSelectorCount() const { return selectorsByName.size(); }
     };
 
   }
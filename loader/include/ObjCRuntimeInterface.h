@@ -0,0 +1,27 @@
+// Narrow view of the Objective-C runtime used by the class bookkeeping in
+// ObjCRuntime.cpp. The real implementation forwards to libobjc; keeping the
+// algorithms behind this interface lets them run against a fake runtime on
+// hosts without one.
+
+#pragma once
+
+namespace mull
+{
+  namespace objc
+  {
+
+    class RuntimeInterface
+    {
+    public:
+      virtual ~RuntimeInterface() {}
+
+      // Same contract as objc_getClassList(): returns the total number of
+      // registered classes and copies at most `capacity` of them.
+      virtual int copyClassList(const void **buffer, int capacity) = 0;
+    };
+
+    // The process' libobjc.
+    RuntimeInterface &systemRuntime();
+
+  }
+}
@@ -0,0 +1,209 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "AddressArena.h"
+
+#include <atomic>
+#include <iterator>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if __APPLE__
+	#include <mach/vm_statistics.h>
+	// anonymous mmap()s take their VM tag in place of the fd
+	#define ARENA_MMAP_TAG	VM_MAKE_TAG(VM_MEMORY_DYLIB)
+#else
+	#define ARENA_MMAP_TAG	(-1)
+#endif
+
+#ifndef MAP_ANON
+	#define MAP_ANON MAP_ANONYMOUS
+#endif
+#ifndef MAP_NORESERVE
+	#define MAP_NORESERVE 0
+#endif
+
+namespace isolator {
+
+static std::atomic<AddressArena*>	sSharedArena(nullptr);
+static std::mutex					sSharedArenaLock;
+
+static void* reserveNone(void* address, size_t length, int extraFlags)
+{
+	return mmap(address, length, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | extraFlags, ARENA_MMAP_TAG, 0);
+}
+
+AddressArena::AddressArena(size_t size, size_t granule)
+	: fBase(0), fEnd(0), fNext(0), fGranule(granule), fInUse(0)
+{
+	const size_t pageSize = (size_t)getpagesize();
+	if ( fGranule < pageSize )
+		fGranule = pageSize;
+	size = (size + fGranule - 1) & ~(fGranule - 1);
+	if ( size == 0 )
+		return;
+
+	// over-reserve by a granule so the arena itself can start on a granule boundary
+	void* raw = reserveNone(NULL, size + fGranule, 0);
+	if ( raw == MAP_FAILED )
+		return;
+	const uintptr_t rawStart = (uintptr_t)raw;
+	const uintptr_t rawEnd = rawStart + size + fGranule;
+	fBase = (rawStart + fGranule - 1) & ~(uintptr_t)(fGranule - 1);
+	fEnd = fBase + size;
+	if ( fBase > rawStart )
+		munmap(raw, fBase - rawStart);
+	if ( rawEnd > fEnd )
+		munmap((void*)fEnd, rawEnd - fEnd);
+	fNext = fBase;
+}
+
+AddressArena::~AddressArena()
+{
+	if ( fBase != 0 )
+		munmap((void*)fBase, fEnd - fBase);
+}
+
+AddressArena* AddressArena::shared()
+{
+	return sSharedArena.load(std::memory_order_acquire);
+}
+
+AddressArena* AddressArena::createShared(size_t size, size_t granule)
+{
+	std::lock_guard<std::mutex> guard(sSharedArenaLock);
+	AddressArena* arena = sSharedArena.load(std::memory_order_relaxed);
+	if ( arena == NULL ) {
+		// never destroyed, images may still live in it when static destructors run
+		arena = new AddressArena(size, granule);
+		if ( !arena->reserved() ) {
+			delete arena;
+			return NULL;
+		}
+		sSharedArena.store(arena, std::memory_order_release);
+	}
+	return arena;
+}
+
+void AddressArena::removeFree(std::map<uintptr_t, size_t>::iterator it)
+{
+	fFreeBySize.erase(SizeKey(it->second, it->first));
+	fFree.erase(it);
+}
+
+void AddressArena::addFree(uintptr_t start, size_t length)
+{
+	// merge with the free neighbours on either side
+	auto next = fFree.lower_bound(start);
+	if ( (next != fFree.end()) && (start + length == next->first) ) {
+		length += next->second;
+		removeFree(next++);
+	}
+	if ( next != fFree.begin() ) {
+		auto prev = std::prev(next);
+		if ( prev->first + prev->second == start ) {
+			start = prev->first;
+			length += prev->second;
+			removeFree(prev);
+		}
+	}
+	if ( start + length == fNext ) {
+		fNext = start;
+		return;
+	}
+	fFree[start] = length;
+	fFreeBySize.insert(SizeKey(length, start));
+}
+
+bool AddressArena::takeFree(size_t length, uintptr_t& start)
+{
+	auto best = fFreeBySize.lower_bound(SizeKey(length, 0));
+	if ( best == fFreeBySize.end() )
+		return false;
+	start = best->second;
+	const size_t bestLength = best->first;
+	removeFree(fFree.find(start));
+	if ( bestLength > length ) {
+		fFree[start + length] = bestLength - length;
+		fFreeBySize.insert(SizeKey(bestLength - length, start + length));
+	}
+	return true;
+}
+
+uintptr_t AddressArena::allocate(size_t length)
+{
+	if ( (fBase == 0) || (length == 0) )
+		return 0;
+	length = (length + fGranule - 1) & ~(fGranule - 1);
+
+	uintptr_t start = 0;
+	{
+		std::lock_guard<std::mutex> guard(fLock);
+		if ( !takeFree(length, start) ) {
+			if ( length > fEnd - fNext )
+				return 0;
+			start = fNext;
+			fNext += length;
+		}
+		fLive[start] = length;
+		fInUse += length;
+	}
+	// the range is ours now, make it look like vm_allocate()d memory without holding the lock
+	if ( mprotect((void*)start, length, PROT_READ | PROT_WRITE) != 0 ) {
+		release(start, length);
+		return 0;
+	}
+	return start;
+}
+
+bool AddressArena::release(uintptr_t start, size_t length)
+{
+	length = (length + fGranule - 1) & ~(fGranule - 1);
+	{
+		std::lock_guard<std::mutex> guard(fLock);
+		auto it = fLive.find(start);
+		if ( (it == fLive.end()) || (it->second != length) )
+			return false;
+		fLive.erase(it);
+		fInUse -= length;
+	}
+	// mapping fresh PROT_NONE pages over the range drops whatever the image left there
+	// but keeps the addresses reserved; if that fails the range is not handed out again
+	if ( reserveNone((void*)start, length, MAP_FIXED) == MAP_FAILED )
+		return true;
+
+	std::lock_guard<std::mutex> guard(fLock);
+	addFree(start, length);
+	return true;
+}
+
+size_t AddressArena::bytesInUse() const
+{
+	std::lock_guard<std::mutex> guard(fLock);
+	return fInUse;
+}
+
+}
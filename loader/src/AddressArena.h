@@ -0,0 +1,100 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * One large PROT_NONE reservation that loaded images are packed into, so a
+ * process with hundreds of modules keeps them next to each other instead of
+ * scattering one VM range per image across the address space.
+ *
+ * Ranges are handed out by bumping a pointer. A released range goes back to
+ * PROT_NONE (its pages are dropped) and is merged with the free ranges next
+ * to it, or lowers the bump pointer if it sits right below it. allocate()
+ * takes the smallest free range that fits, the lowest one among equals, and
+ * splits off the rest; only when nothing fits does it bump. Free ranges are
+ * kept both by address (for merging) and by size (for the best fit), so
+ * either step costs a logarithm of the number of free ranges, never a walk.
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __ADDRESS_ARENA__
+#define __ADDRESS_ARENA__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+namespace isolator {
+
+class AddressArena {
+public:
+	// Reserves size bytes (rounded to granule, a power of two multiple of the page size).
+	// reserved() is false if the reservation could not be made.
+							AddressArena(size_t size, size_t granule);
+							~AddressArena();
+
+	// process wide arena, NULL until createShared() made one
+	static AddressArena*	shared();
+	// creates the shared arena once, later calls return the existing one
+	static AddressArena*	createShared(size_t size, size_t granule);
+
+	bool					reserved() const { return fBase != 0; }
+	bool					contains(uintptr_t address) const { return (address >= fBase) && (address < fEnd); }
+
+	// Returns the start of length bytes (rounded up to the granule) readable and writable like
+	// fresh vm_allocate() memory, or 0 if the arena has no room left for them.
+	uintptr_t				allocate(size_t length);
+	// Drops the pages of a range returned by allocate() and makes it available again. start and
+	// length are what allocate() returned and was asked for. Returns false, and leaves the arena
+	// as it was, if they are not those of a live range.
+	bool					release(uintptr_t start, size_t length);
+
+	size_t					bytesInUse() const;
+
+private:
+	typedef std::pair<size_t, uintptr_t>	SizeKey;		// length, start
+
+	bool						takeFree(size_t length, uintptr_t& start);
+	void						addFree(uintptr_t start, size_t length);
+	void						removeFree(std::map<uintptr_t, size_t>::iterator it);
+
+	mutable std::mutex						fLock;
+	uintptr_t								fBase;
+	uintptr_t								fEnd;
+	uintptr_t								fNext;			// bump pointer
+	size_t									fGranule;
+	size_t									fInUse;
+	std::map<uintptr_t, size_t>				fFree;			// start -> length of free ranges
+	std::set<SizeKey>						fFreeBySize;
+	std::unordered_map<uintptr_t, size_t>	fLive;			// start -> length of allocated ranges
+};
+
+}
+
+#endif // __ADDRESS_ARENA__
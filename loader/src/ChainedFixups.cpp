@@ -0,0 +1,531 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include "ChainedFixups.h"
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#ifndef __has_feature
+	#define __has_feature(x) 0
+#endif
+
+namespace isolator {
+
+// pages handed to a worker at a time, and the fewest pages worth waking the pool for
+static const size_t kPagesPerChunk		= 4;
+static const size_t kParallelPagesMin	= 32;
+
+static size_t importSize(uint32_t format)
+{
+	switch ( format ) {
+		case DYLD_CHAINED_IMPORT:			return sizeof(dyld_chained_import);
+		case DYLD_CHAINED_IMPORT_ADDEND:	return sizeof(dyld_chained_import_addend);
+		case DYLD_CHAINED_IMPORT_ADDEND64:	return sizeof(dyld_chained_import_addend64);
+	}
+	return 0;
+}
+
+static bool supportedPointerFormat(uint16_t format)
+{
+	switch ( format ) {
+		case DYLD_CHAINED_PTR_ARM64E:
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND:
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND24:
+		case DYLD_CHAINED_PTR_64:
+		case DYLD_CHAINED_PTR_64_OFFSET:
+		case DYLD_CHAINED_PTR_32:
+			return true;
+	}
+	return false;
+}
+
+const char* ChainedFixups::validate(const void* payload, uint64_t size, uint64_t imageSize)
+{
+	const uint8_t* const base = (const uint8_t*)payload;
+	if ( size < sizeof(dyld_chained_fixups_header) )
+		return "payload too small";
+	const dyld_chained_fixups_header* header = (const dyld_chained_fixups_header*)payload;
+	if ( header->fixups_version != 0 )
+		return "unknown fixups version";
+	if ( header->symbols_format != 0 )
+		return "compressed symbol strings are not supported";
+	const size_t entrySize = importSize(header->imports_format);
+	if ( entrySize == 0 )
+		return "unknown imports format";
+	if ( (header->imports_offset % sizeof(uint32_t)) != 0 )
+		return "imports table not aligned";
+	if ( (header->imports_offset > size) || ((uint64_t)header->imports_count * entrySize > size - header->imports_offset) )
+		return "imports table overruns payload";
+	if ( header->symbols_offset > size )
+		return "symbol strings overrun payload";
+
+	// every name has to be NUL terminated inside the strings
+	const char* const symbols = (const char*)base + header->symbols_offset;
+	const uint64_t symbolsSize = size - header->symbols_offset;
+	ChainedFixups fixups(payload);
+	for (uint32_t i=0; i < header->imports_count; ++i) {
+		const uint64_t nameOffset = (uint64_t)(fixups.import(i).name - symbols);
+		if ( (nameOffset >= symbolsSize) || (memchr(symbols + nameOffset, '\0', (size_t)(symbolsSize - nameOffset)) == NULL) )
+			return "import name overruns payload";
+	}
+
+	if ( (header->starts_offset > size) || (size - header->starts_offset < sizeof(uint32_t)) )
+		return "starts overrun payload";
+	if ( (header->starts_offset % sizeof(uint32_t)) != 0 )
+		return "starts not aligned";
+	const dyld_chained_starts_in_image* imageStarts = fixups.starts();
+	const uint64_t startsSize = size - header->starts_offset;
+	if ( ((uint64_t)imageStarts->seg_count + 1) * sizeof(uint32_t) > startsSize )
+		return "segment starts overrun payload";
+	for (uint32_t i=0; i < imageStarts->seg_count; ++i) {
+		const uint32_t segInfoOffset = imageStarts->seg_info_offset[i];
+		if ( segInfoOffset == 0 )
+			continue;
+		if ( (segInfoOffset > startsSize) || (startsSize - segInfoOffset < offsetof(dyld_chained_starts_in_segment, page_start)) )
+			return "segment starts overrun payload";
+		if ( ((header->starts_offset + segInfoOffset) % sizeof(uint64_t)) != 0 )
+			return "segment starts not aligned";
+		const dyld_chained_starts_in_segment* segInfo = (const dyld_chained_starts_in_segment*)((const uint8_t*)imageStarts + segInfoOffset);
+		if ( (segInfo->size > startsSize - segInfoOffset)
+		  || (segInfo->size < offsetof(dyld_chained_starts_in_segment, page_start) + segInfo->page_count * sizeof(uint16_t)) )
+			return "segment starts overrun payload";
+		if ( (segInfo->page_size != 0x1000) && (segInfo->page_size != 0x4000) )
+			return "bad page size";
+		if ( !supportedPointerFormat(segInfo->pointer_format) )
+			return "unsupported pointer format";
+		if ( segInfo->segment_offset >= imageSize )
+			return "segment outside of image";
+
+		// chain_starts[] of pages with several chains follow page_start[], all inside segInfo->size
+		const size_t startCount = (segInfo->size - offsetof(dyld_chained_starts_in_segment, page_start)) / sizeof(uint16_t);
+		for (uint16_t page=0; page < segInfo->page_count; ++page) {
+			const uint16_t start = segInfo->page_start[page];
+			if ( start == DYLD_CHAINED_PTR_START_NONE )
+				continue;
+			if ( segInfo->segment_offset + (uint64_t)page * segInfo->page_size >= imageSize )
+				return "page outside of image";
+			if ( (start & DYLD_CHAINED_PTR_START_MULTI) == 0 )
+				continue;
+			if ( segInfo->pointer_format != DYLD_CHAINED_PTR_32 )
+				return "multiple chain starts on a page of a 64-bit format";
+			size_t index = start & ~DYLD_CHAINED_PTR_START_MULTI;
+			for (;;) {
+				if ( index >= startCount )
+					return "chain starts overrun payload";
+				if ( segInfo->page_start[index++] & DYLD_CHAINED_PTR_START_LAST )
+					break;
+			}
+		}
+	}
+	return NULL;
+}
+
+ChainedImport ChainedFixups::import(uint32_t index) const
+{
+	const uint8_t* const imports = (const uint8_t*)fHeader + fHeader->imports_offset;
+	const char* const symbols = (const char*)fHeader + fHeader->symbols_offset;
+	ChainedImport result;
+	switch ( fHeader->imports_format ) {
+		case DYLD_CHAINED_IMPORT: {
+			const dyld_chained_import& entry = ((const dyld_chained_import*)imports)[index];
+			result.name = symbols + entry.name_offset;
+			result.libOrdinal = (int8_t)entry.lib_ordinal;		// 0xFF etc. are the negative special ordinals
+			result.weakImport = entry.weak_import;
+			result.addend = 0;
+			break;
+		}
+		case DYLD_CHAINED_IMPORT_ADDEND: {
+			const dyld_chained_import_addend& entry = ((const dyld_chained_import_addend*)imports)[index];
+			result.name = symbols + entry.name_offset;
+			result.libOrdinal = (int8_t)entry.lib_ordinal;
+			result.weakImport = entry.weak_import;
+			result.addend = entry.addend;
+			break;
+		}
+		default: {
+			const dyld_chained_import_addend64& entry = ((const dyld_chained_import_addend64*)imports)[index];
+			result.name = symbols + entry.name_offset;
+			result.libOrdinal = (int16_t)entry.lib_ordinal;
+			result.weakImport = entry.weak_import;
+			result.addend = (int64_t)entry.addend;
+			break;
+		}
+	}
+	return result;
+}
+
+
+namespace {
+
+union ChainedPointer64 {
+	uint64_t									raw;
+	dyld_chained_ptr_arm64e_rebase				arm64eRebase;
+	dyld_chained_ptr_arm64e_bind				arm64eBind;
+	dyld_chained_ptr_arm64e_auth_rebase			arm64eAuthRebase;
+	dyld_chained_ptr_arm64e_auth_bind			arm64eAuthBind;
+	dyld_chained_ptr_arm64e_bind24				arm64eBind24;
+	dyld_chained_ptr_arm64e_auth_bind24			arm64eAuthBind24;
+	dyld_chained_ptr_64_rebase					generic64Rebase;
+	dyld_chained_ptr_64_bind					generic64Bind;
+};
+
+union ChainedPointer32 {
+	uint32_t									raw;
+	dyld_chained_ptr_32_rebase					generic32Rebase;
+	dyld_chained_ptr_32_bind					generic32Bind;
+};
+
+struct ChainContext {
+	uint8_t*				imageBase;
+	uint64_t				imageSize;
+	uintptr_t				slide;
+	const uintptr_t*		targets;
+	size_t					targetCount;
+};
+
+struct PageWork;
+typedef void (*PageFixer)(const ChainContext& ctx, const PageWork& work, ChainedFixupStats& stats);
+
+struct PageWork {
+	const dyld_chained_starts_in_segment*		segInfo;
+	PageFixer									fixer;
+	uint32_t									page;
+};
+
+}
+
+static uint64_t signPointer(void* loc, uint64_t target, uint16_t diversity, bool addrDiv, uint8_t key)
+{
+#if __has_feature(ptrauth_calls)
+	uint64_t discriminator = diversity;
+	if ( addrDiv )
+		discriminator = __builtin_ptrauth_blend_discriminator(loc, discriminator);
+	switch ( key ) {
+		case 0: return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)target, 0, discriminator);
+		case 1: return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)target, 1, discriminator);
+		case 2: return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)target, 2, discriminator);
+		case 3: return (uint64_t)__builtin_ptrauth_sign_unauthenticated((void*)target, 3, discriminator);
+	}
+#else
+	(void)loc;
+	(void)diversity;
+	(void)addrDiv;
+	(void)key;
+#endif
+	// no pointer authentication in this process, the plain target is what will be loaded
+	return target;
+}
+
+static uintptr_t bindTarget(const ChainContext& ctx, uint32_t ordinal)
+{
+	if ( ordinal >= ctx.targetCount )
+		throw "bind ordinal out of range";
+	return ctx.targets[ordinal];
+}
+
+// Per format decoding of one chain entry. Each walker below is instantiated once per format, so
+// the format tests fold away and the loop over a chain only branches on rebase/bind/auth.
+template <uint16_t kFormat>
+struct ChainedFormat {
+	static const bool		kIs32		= (kFormat == DYLD_CHAINED_PTR_32);
+	static const bool		kIsGeneric64= (kFormat == DYLD_CHAINED_PTR_64) || (kFormat == DYLD_CHAINED_PTR_64_OFFSET);
+	static const bool		kBind24		= (kFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND24);
+	// rebase targets are vmaddrs (slid) rather than offsets from the image
+	static const bool		kVMAddr		= (kFormat == DYLD_CHAINED_PTR_64) || (kFormat == DYLD_CHAINED_PTR_ARM64E);
+	typedef typename std::conditional<kIs32, uint32_t, uint64_t>::type Raw;
+};
+
+// Rewrites one entry at loc and returns how many bytes further the chain continues, 0 at its end.
+template <uint16_t kFormat>
+static inline uint64_t fixupEntry(const ChainContext& ctx, const dyld_chained_starts_in_segment* segInfo, uint8_t* loc,
+								  size_t& binds, size_t& rebases)
+{
+	typedef ChainedFormat<kFormat> Format;
+	if ( Format::kIs32 ) {
+		ChainedPointer32 ptr;
+		memcpy(&ptr.raw, loc, sizeof(ptr.raw));
+		uint32_t newValue;
+		if ( ptr.generic32Bind.bind ) {
+			newValue = (uint32_t)bindTarget(ctx, ptr.generic32Bind.ordinal) + ptr.generic32Bind.addend;
+			++binds;
+		}
+		else if ( ptr.generic32Rebase.target > segInfo->max_valid_pointer ) {
+			// not a pointer, just a value co-opted into the chain with a bias
+			newValue = ptr.generic32Rebase.target - (0x04000000 + segInfo->max_valid_pointer) / 2;
+		}
+		else {
+			newValue = ptr.generic32Rebase.target + (uint32_t)ctx.slide;
+			++rebases;
+		}
+		memcpy(loc, &newValue, sizeof(newValue));
+		return ptr.generic32Rebase.next * 4;
+	}
+
+	ChainedPointer64 ptr;
+	memcpy(&ptr.raw, loc, sizeof(ptr.raw));
+	uint64_t newValue;
+	uint64_t next;
+	if ( Format::kIsGeneric64 ) {
+		if ( ptr.generic64Bind.bind ) {
+			newValue = bindTarget(ctx, ptr.generic64Bind.ordinal) + ptr.generic64Bind.addend;
+			++binds;
+		}
+		else {
+			const uint64_t target = ((uint64_t)ptr.generic64Rebase.high8 << 56) | ptr.generic64Rebase.target;
+			newValue = Format::kVMAddr ? target + ctx.slide : (uint64_t)ctx.imageBase + target;
+			++rebases;
+		}
+		next = ptr.generic64Rebase.next * 4;
+	}
+	else {
+		if ( ptr.arm64eRebase.auth ) {
+			if ( ptr.arm64eRebase.bind ) {
+				newValue = bindTarget(ctx, Format::kBind24 ? ptr.arm64eAuthBind24.ordinal : ptr.arm64eAuthBind.ordinal);
+				// missing weak imports stay NULL, unsigned
+				if ( newValue != 0 )
+					newValue = signPointer(loc, newValue, ptr.arm64eAuthBind.diversity, ptr.arm64eAuthBind.addrDiv, ptr.arm64eAuthBind.key);
+				++binds;
+			}
+			else {
+				newValue = signPointer(loc, (uint64_t)ctx.imageBase + ptr.arm64eAuthRebase.target,
+									   ptr.arm64eAuthRebase.diversity, ptr.arm64eAuthRebase.addrDiv, ptr.arm64eAuthRebase.key);
+				++rebases;
+			}
+		}
+		else if ( ptr.arm64eRebase.bind ) {
+			// 19-bit signed addend
+			int64_t addend = ptr.arm64eBind.addend;
+			if ( addend & 0x40000 )
+				addend |= ~(int64_t)0x3FFFF;
+			newValue = bindTarget(ctx, Format::kBind24 ? ptr.arm64eBind24.ordinal : ptr.arm64eBind.ordinal) + addend;
+			++binds;
+		}
+		else {
+			// old format target is a vmaddr, newer ones an offset from the image
+			const uint64_t target = ((uint64_t)ptr.arm64eRebase.high8 << 56) | ptr.arm64eRebase.target;
+			newValue = Format::kVMAddr ? target + ctx.slide : (uint64_t)ctx.imageBase + target;
+			++rebases;
+		}
+		next = ptr.arm64eRebase.next * 8;
+	}
+	memcpy(loc, &newValue, sizeof(newValue));
+	return next;
+}
+
+// Rewrites the chain starting offsetInPage bytes into the page.
+template <uint16_t kFormat>
+static void walkChain(const ChainContext& ctx, const dyld_chained_starts_in_segment* segInfo, uint32_t page,
+					  uint64_t offsetInPage, ChainedFixupStats& stats)
+{
+	typedef typename ChainedFormat<kFormat>::Raw Raw;
+	const uint64_t pageOffset = segInfo->segment_offset + (uint64_t)page * segInfo->page_size;
+	const uint64_t pageEnd = (pageOffset + segInfo->page_size < ctx.imageSize) ? segInfo->page_size : ctx.imageSize - pageOffset;
+	uint8_t* const pageStart = ctx.imageBase + pageOffset;
+	const uint8_t* const pageLimit = pageStart + pageEnd;
+	// the next entry's address only depends on the entry just read, keep that path to a single add
+	uint8_t* loc = pageStart + offsetInPage;
+	size_t binds = 0;
+	size_t rebases = 0;
+	for (;;) {
+		if ( loc + sizeof(Raw) > pageLimit )
+			throw "chain runs off its page";
+		const uint64_t next = fixupEntry<kFormat>(ctx, segInfo, loc, binds, rebases);
+		if ( next == 0 )
+			break;
+		loc += next;
+	}
+	stats.binds += binds;
+	stats.rebases += rebases;
+}
+
+template <uint16_t kFormat>
+static void fixupPage(const ChainContext& ctx, const PageWork& work, ChainedFixupStats& stats)
+{
+	const dyld_chained_starts_in_segment* segInfo = work.segInfo;
+	const uint16_t start = segInfo->page_start[work.page];
+	if ( (start & DYLD_CHAINED_PTR_START_MULTI) == 0 ) {
+		walkChain<kFormat>(ctx, segInfo, work.page, start, stats);
+	}
+	else {
+		// validate() made sure the list ends inside the segment info
+		size_t index = start & ~DYLD_CHAINED_PTR_START_MULTI;
+		uint16_t chainStart;
+		do {
+			chainStart = segInfo->page_start[index++];
+			walkChain<kFormat>(ctx, segInfo, work.page, chainStart & ~DYLD_CHAINED_PTR_START_LAST, stats);
+		} while ( (chainStart & DYLD_CHAINED_PTR_START_LAST) == 0 );
+	}
+	++stats.pages;
+}
+
+// the pointer format is looked at once per segment, pages carry the walker it picked
+static PageFixer pageFixer(uint16_t format)
+{
+	switch ( format ) {
+		case DYLD_CHAINED_PTR_ARM64E:				return &fixupPage<DYLD_CHAINED_PTR_ARM64E>;
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND:		return &fixupPage<DYLD_CHAINED_PTR_ARM64E_USERLAND>;
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND24:	return &fixupPage<DYLD_CHAINED_PTR_ARM64E_USERLAND24>;
+		case DYLD_CHAINED_PTR_64:					return &fixupPage<DYLD_CHAINED_PTR_64>;
+		case DYLD_CHAINED_PTR_64_OFFSET:			return &fixupPage<DYLD_CHAINED_PTR_64_OFFSET>;
+		case DYLD_CHAINED_PTR_32:					return &fixupPage<DYLD_CHAINED_PTR_32>;
+	}
+	return NULL;
+}
+
+const char* ChainedFixups::apply(uint8_t* imageBase, uint64_t imageSize, uintptr_t slide,
+								 const uintptr_t targets[], size_t targetCount,
+								 WorkerPool* pool, ChainedFixupStats* stats) const
+{
+	// flatten the page starts of all segments into one list of work items
+	const dyld_chained_starts_in_image* imageStarts = starts();
+	std::vector<PageWork> pages;
+	for (uint32_t i=0; i < imageStarts->seg_count; ++i) {
+		if ( imageStarts->seg_info_offset[i] == 0 )
+			continue;
+		const dyld_chained_starts_in_segment* segInfo = (const dyld_chained_starts_in_segment*)((const uint8_t*)imageStarts + imageStarts->seg_info_offset[i]);
+		const PageFixer fixer = pageFixer(segInfo->pointer_format);
+		for (uint32_t page=0; page < segInfo->page_count; ++page) {
+			if ( segInfo->page_start[page] != DYLD_CHAINED_PTR_START_NONE ) {
+				PageWork work = { segInfo, fixer, page };
+				pages.push_back(work);
+			}
+		}
+	}
+
+	const ChainContext ctx = { imageBase, imageSize, slide, targets, targetCount };
+	std::atomic<size_t> rebaseCount(0);
+	std::atomic<size_t> bindCount(0);
+	std::atomic<size_t> pageCount(0);
+	try {
+		auto fixupPages = [&](size_t begin, size_t end) {
+			ChainedFixupStats local = { 0, 0, 0 };
+			for (size_t i=begin; i < end; ++i)
+				pages[i].fixer(ctx, pages[i], local);
+			rebaseCount.fetch_add(local.rebases, std::memory_order_relaxed);
+			bindCount.fetch_add(local.binds, std::memory_order_relaxed);
+			pageCount.fetch_add(local.pages, std::memory_order_relaxed);
+		};
+		if ( (pool == NULL) || (pages.size() < kParallelPagesMin) )
+			fixupPages(0, pages.size());
+		else
+			pool->parallelFor(pages.size(), kPagesPerChunk, fixupPages);
+	}
+	catch (const char* msg) {
+		return msg;
+	}
+
+	if ( stats != NULL ) {
+		stats->rebases = rebaseCount;
+		stats->binds = bindCount;
+		stats->pages = pageCount;
+	}
+	return NULL;
+}
+
+// Decodes one entry without rewriting it, returning the bind ordinal or -1 for anything else.
+static int64_t inspectEntry(uint16_t format, const dyld_chained_starts_in_segment* segInfo, const uint8_t* loc, uint64_t& next)
+{
+	if ( format == DYLD_CHAINED_PTR_32 ) {
+		ChainedPointer32 ptr;
+		memcpy(&ptr.raw, loc, sizeof(ptr.raw));
+		next = ptr.generic32Rebase.next * 4;
+		if ( ptr.generic32Bind.bind )
+			return ptr.generic32Bind.ordinal;
+		// values co-opted into the chain are neither
+		return ( ptr.generic32Rebase.target > segInfo->max_valid_pointer ) ? -2 : -1;
+	}
+	ChainedPointer64 ptr;
+	memcpy(&ptr.raw, loc, sizeof(ptr.raw));
+	if ( (format == DYLD_CHAINED_PTR_64) || (format == DYLD_CHAINED_PTR_64_OFFSET) ) {
+		next = ptr.generic64Rebase.next * 4;
+		return ptr.generic64Bind.bind ? (int64_t)ptr.generic64Bind.ordinal : -1;
+	}
+	next = ptr.arm64eRebase.next * 8;
+	if ( !ptr.arm64eRebase.bind )
+		return -1;
+	if ( format == DYLD_CHAINED_PTR_ARM64E_USERLAND24 )
+		return ptr.arm64eRebase.auth ? ptr.arm64eAuthBind24.ordinal : ptr.arm64eBind24.ordinal;
+	return ptr.arm64eRebase.auth ? ptr.arm64eAuthBind.ordinal : ptr.arm64eBind.ordinal;
+}
+
+const char* ChainedFixups::count(ContentReader content, void* context, ChainedFixupStats* stats) const
+{
+	ChainedFixupStats found = { 0, 0, 0 };
+	const dyld_chained_starts_in_image* imageStarts = starts();
+	for (uint32_t i=0; i < imageStarts->seg_count; ++i) {
+		if ( imageStarts->seg_info_offset[i] == 0 )
+			continue;
+		const dyld_chained_starts_in_segment* segInfo = (const dyld_chained_starts_in_segment*)((const uint8_t*)imageStarts + imageStarts->seg_info_offset[i]);
+		const size_t entrySize = (segInfo->pointer_format == DYLD_CHAINED_PTR_32) ? sizeof(uint32_t) : sizeof(uint64_t);
+		for (uint16_t page=0; page < segInfo->page_count; ++page) {
+			const uint16_t pageStart = segInfo->page_start[page];
+			if ( pageStart == DYLD_CHAINED_PTR_START_NONE )
+				continue;
+			uint64_t available = 0;
+			const uint8_t* const bytes = content(context, segInfo->segment_offset + (uint64_t)page * segInfo->page_size, &available);
+			if ( bytes == NULL )
+				return "chain starts in a page with no file content";
+			const uint64_t pageSize = (available < segInfo->page_size) ? available : segInfo->page_size;
+
+			// validate() made sure a list of starts ends inside the segment info
+			size_t index = pageStart & ~DYLD_CHAINED_PTR_START_MULTI;
+			bool last = (pageStart & DYLD_CHAINED_PTR_START_MULTI) == 0;
+			uint16_t chainStart = pageStart;
+			do {
+				if ( !last ) {
+					chainStart = segInfo->page_start[index++];
+					last = (chainStart & DYLD_CHAINED_PTR_START_LAST) != 0;
+					chainStart &= ~DYLD_CHAINED_PTR_START_LAST;
+				}
+				uint64_t offset = chainStart;
+				for (;;) {
+					if ( offset + entrySize > pageSize )
+						return "chain runs off its page";
+					uint64_t next;
+					const int64_t ordinal = inspectEntry(segInfo->pointer_format, segInfo, bytes + offset, next);
+					if ( ordinal >= (int64_t)importCount() )
+						return "bind ordinal out of range";
+					if ( ordinal >= 0 )
+						++found.binds;
+					else if ( ordinal == -1 )
+						++found.rebases;
+					if ( next == 0 )
+						break;
+					offset += next;
+				}
+			} while ( !last );
+			++found.pages;
+		}
+	}
+	if ( stats != NULL )
+		*stats = found;
+	return NULL;
+}
+
+}
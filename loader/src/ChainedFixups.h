@@ -0,0 +1,98 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Portable reader and applier of LC_DYLD_CHAINED_FIXUPS payloads (see
+ * <mach-o/fixup-chains.h>). validate() checks a payload once, after which the
+ * import table can be read and the chains of a mapped image rewritten.
+ *
+ * A chain never leaves the page it starts on, so pages are independent units
+ * of work. apply() lists every page that has a chain and lets the threads of
+ * a WorkerPool claim them a few at a time from a shared counter: a thread that
+ * lands on pages with short chains simply comes back for more, so uneven pages
+ * balance out without per-thread queues.
+ *
+ * Only user space pointer formats are handled (ARM64E, ARM64E_USERLAND,
+ * ARM64E_USERLAND24, 64, 64_OFFSET and 32). Nothing in here depends on the
+ * Mach kernel API, so it builds and runs on any host.
+ */
+
+#ifndef __CHAINED_FIXUPS__
+#define __CHAINED_FIXUPS__
+
+#include <cstddef>
+#include <cstdint>
+#include <mach-o/fixup-chains.h>
+
+namespace isolator {
+
+class WorkerPool;
+
+struct ChainedImport {
+	const char*		name;				// points into the payload
+	int				libOrdinal;			// special BIND_SPECIAL_DYLIB_* ordinals are negative
+	bool			weakImport;
+	int64_t			addend;
+};
+
+struct ChainedFixupStats {
+	size_t			rebases;
+	size_t			binds;
+	size_t			pages;
+};
+
+class ChainedFixups {
+public:
+	// Returns NULL if `payload` is a well formed chained fixups payload of `size` bytes whose
+	// chains all start inside an image spanning `imageSize` bytes, otherwise why it is not.
+	static const char*		validate(const void* payload, uint64_t size, uint64_t imageSize);
+
+	explicit				ChainedFixups(const void* payload) : fHeader((const dyld_chained_fixups_header*)payload) {}
+
+	uint32_t				importCount() const { return fHeader->imports_count; }
+	ChainedImport			import(uint32_t index) const;
+
+	// Rewrites every chain of the image mapped at imageBase. targets[i] is the final address of
+	// import i, its addend included. pool may be NULL to stay on the calling thread. Returns NULL
+	// or, if some chain could not be applied, why; other pages may already be fixed up by then.
+	const char*				apply(uint8_t* imageBase, uint64_t imageSize, uintptr_t slide,
+								  const uintptr_t targets[], size_t targetCount,
+								  WorkerPool* pool, ChainedFixupStats* stats=NULL) const;
+
+	// Counts the fixups of an image that is not mapped, without writing anything. content returns
+	// the file bytes backing an offset from the image start and how many follow it, or NULL for
+	// zero fill. Returns NULL or, if some chain is broken or binds past the imports, why.
+	typedef const uint8_t*	(*ContentReader)(void* context, uint64_t vmOffset, uint64_t* available);
+	const char*				count(ContentReader content, void* context, ChainedFixupStats* stats) const;
+
+private:
+	const dyld_chained_starts_in_image*	starts() const { return (const dyld_chained_starts_in_image*)((const uint8_t*)fHeader + fHeader->starts_offset); }
+
+	const dyld_chained_fixups_header*	fHeader;
+};
+
+}
+
+#endif // __CHAINED_FIXUPS__
@@ -0,0 +1,172 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "ExportIndex.h"
+
+#include <cstring>
+#include <string>
+
+namespace isolator {
+
+static bool readULEB(const uint8_t*& p, const uint8_t* end, uint64_t& result)
+{
+	result = 0;
+	int bit = 0;
+	do {
+		if ( (p >= end) || (bit > 63) )
+			return false;
+		uint64_t slice = *p & 0x7f;
+		result |= (slice << bit);
+		bit += 7;
+	} while ( *p++ & 0x80 );
+	return true;
+}
+
+uint64_t ExportIndex::hash(const char* name, size_t length, uint64_t seed)
+{
+	// FNV-1a, seed chains hashes of consecutive pieces
+	uint64_t h = seed;
+	for (size_t i=0; i < length; ++i) {
+		h ^= (uint8_t)name[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+void ExportIndex::insert(uint64_t h, uint32_t index)
+{
+	uint32_t slot = (uint32_t)h & fMask;
+	while ( fSlots[slot] != 0 )
+		slot = (slot + 1) & fMask;
+	fSlots[slot] = index + 1;
+}
+
+bool ExportIndex::build(const uint8_t* start, const uint8_t* end)
+{
+	fEntries.clear();
+	fNames.clear();
+	fSlots.clear();
+	fMask = 0;
+	if ( start >= end )
+		return true;
+	if ( !walk(start, end) ) {
+		fEntries.clear();
+		fNames.clear();
+		return false;
+	}
+
+	// at most half full
+	uint32_t capacity = 16;
+	while ( capacity < fEntries.size()*2 )
+		capacity *= 2;
+	fSlots.assign(capacity, 0);
+	fMask = capacity - 1;
+	for (uint32_t i=0; i < fEntries.size(); ++i)
+		insert(fEntries[i].hash, i);
+	return true;
+}
+
+bool ExportIndex::walk(const uint8_t* start, const uint8_t* end)
+{
+	const uint64_t trieSize = (uint64_t)(end - start);
+	if ( trieSize > UINT32_MAX )
+		return false;
+
+	// Depth first walk with an explicit stack. Every node is at least two
+	// bytes, so a well formed trie never has more nodes than trieSize; that
+	// bound also stops malformed tries whose child offsets form a cycle.
+	// Because the walk is depth first, everything popped between a child and
+	// its parent shares the parent's prefix, so `name` only ever needs to be
+	// truncated to the parent prefix and extended by the child's edge.
+	struct Pending {
+		uint32_t	nodeOffset;
+		uint32_t	edgeOffset;
+		uint32_t	edgeLength;
+		uint32_t	parentPrefixLength;
+	};
+	std::vector<Pending> stack;
+	std::string name;
+	stack.push_back({ 0, 0, 0, 0 });
+	uint64_t visited = 0;
+	while ( !stack.empty() ) {
+		const Pending node = stack.back();
+		stack.pop_back();
+		if ( ++visited > trieSize )
+			return false;
+		name.resize(node.parentPrefixLength);
+		name.append((const char*)start + node.edgeOffset, node.edgeLength);
+
+		const uint8_t* p = start + node.nodeOffset;
+		uint64_t terminalSize;
+		if ( !readULEB(p, end, terminalSize) || (terminalSize > (uint64_t)(end - p)) )
+			return false;
+		if ( terminalSize != 0 ) {
+			if ( fNames.size() + name.size() >= UINT32_MAX )
+				return false;
+			Entry e;
+			e.hash				= hash(name.data(), name.size());
+			e.nameOffset		= (uint32_t)fNames.size();
+			e.terminalOffset	= (uint32_t)(p - start);
+			fNames.insert(fNames.end(), name.begin(), name.end());
+			fNames.push_back('\0');
+			fEntries.push_back(e);
+		}
+		const uint8_t* children = p + terminalSize;
+		if ( children >= end )
+			return false;
+		uint8_t childrenRemaining = *children++;
+		p = children;
+		for (; childrenRemaining > 0; --childrenRemaining) {
+			const uint8_t* edge = p;
+			while ( (p < end) && (*p != '\0') )
+				++p;
+			if ( p >= end )
+				return false;
+			const uint32_t edgeLength = (uint32_t)(p - edge);
+			++p;
+			uint64_t childOffset;
+			if ( !readULEB(p, end, childOffset) || (childOffset == 0) || (childOffset >= trieSize) )
+				return false;
+			stack.push_back({ (uint32_t)childOffset, (uint32_t)(edge - start), edgeLength, (uint32_t)name.size() });
+		}
+	}
+	return true;
+}
+
+const uint8_t* ExportIndex::find(const uint8_t* start, const char* prefix, const char* name) const
+{
+	if ( fSlots.empty() )
+		return NULL;
+	const size_t prefixLength = strlen(prefix);
+	const uint64_t h = hash(name, strlen(name), hash(prefix, prefixLength));
+	for (uint32_t slot = (uint32_t)h & fMask; fSlots[slot] != 0; slot = (slot + 1) & fMask) {
+		const Entry& e = fEntries[fSlots[slot]-1];
+		const char* entryName = &fNames[e.nameOffset];
+		if ( (e.hash == h) && (strncmp(entryName, prefix, prefixLength) == 0) && (strcmp(&entryName[prefixLength], name) == 0) )
+			return start + e.terminalOffset;
+	}
+	return NULL;
+}
+
+}
@@ -0,0 +1,81 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Hash index over an image's export trie. build() walks the trie once and
+ * records, for every exported name, the offset of its terminal payload (the
+ * same place trieWalk() returns), so a lookup becomes one hash probe and a
+ * string compare instead of a byte-by-byte descent through the trie.
+ *
+ * The index is an open-addressing table of indexes into a flat entry array;
+ * names are kept in one string arena. It only reads the trie bytes and does
+ * not depend on mach-o headers.
+ */
+
+#ifndef __EXPORT_INDEX__
+#define __EXPORT_INDEX__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace isolator {
+
+class ExportIndex {
+public:
+						ExportIndex() : fMask(0) { }
+
+	// returns false, leaving the index empty, if the trie is malformed
+	bool				build(const uint8_t* start, const uint8_t* end);
+
+	// pointer to the terminal payload of `name` in the trie build() was given,
+	// or NULL if the trie does not export it
+	const uint8_t*		find(const uint8_t* start, const char* name) const { return find(start, "", name); }
+	// same for the concatenation prefix+name, without building it
+	const uint8_t*		find(const uint8_t* start, const char* prefix, const char* name) const;
+
+	size_t				count() const { return fEntries.size(); }
+
+	static const uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+	static uint64_t		hash(const char* name, size_t length, uint64_t seed = kHashSeed);
+
+private:
+	struct Entry {
+		uint64_t	hash;
+		uint32_t	nameOffset;			// into fNames, NUL terminated
+		uint32_t	terminalOffset;		// from the start of the trie
+	};
+
+	bool				walk(const uint8_t* start, const uint8_t* end);
+	void				insert(uint64_t h, uint32_t index);
+
+	std::vector<Entry>		fEntries;
+	std::vector<char>		fNames;
+	std::vector<uint32_t>	fSlots;			// index+1 into fEntries, 0 for empty
+	uint32_t				fMask;
+};
+
+}
+
+#endif // __EXPORT_INDEX__
@@ -36,6 +36,7 @@
 #include <sys/mount.h>
 #include <sys/sysctl.h>
 #include <libkern/OSAtomic.h>
+#include <string>
 #include <string_view>
 
 #include <atomic>
@@ -50,25 +51,7 @@ uint32_t								ImageLoader::fgImagesUsedFromSharedCache = 0;
 uint32_t								ImageLoader::fgImagesWithUsedPrebinding = 0;
 uint32_t								ImageLoader::fgImagesRequiringCoalescing = 0;
 uint32_t								ImageLoader::fgImagesHasWeakDefinitions = 0;
-uint32_t								ImageLoader::fgTotalRebaseFixups = 0;
-uint32_t								ImageLoader::fgTotalBindFixups = 0;
-uint32_t								ImageLoader::fgTotalBindSymbolsResolved = 0;
-uint32_t								ImageLoader::fgTotalBindImageSearches = 0;
-uint32_t								ImageLoader::fgTotalLazyBindFixups = 0;
-uint32_t								ImageLoader::fgTotalPossibleLazyBindFixups = 0;
-uint32_t								ImageLoader::fgTotalSegmentsMapped = 0;
-uint64_t								ImageLoader::fgTotalBytesMapped = 0;
-uint64_t								ImageLoader::fgTotalLoadLibrariesTime;
-uint64_t								ImageLoader::fgTotalObjCSetupTime = 0;
-uint64_t								ImageLoader::fgTotalDebuggerPausedTime = 0;
-uint64_t								ImageLoader::fgTotalRebindCacheTime = 0;
-uint64_t								ImageLoader::fgTotalRebaseTime;
-uint64_t								ImageLoader::fgTotalBindTime;
-uint64_t								ImageLoader::fgTotalWeakBindTime;
-uint64_t								ImageLoader::fgTotalDOF;
-uint64_t								ImageLoader::fgTotalInitTime;
 uint16_t								ImageLoader::fgLoadOrdinal = 0;
-uint32_t								ImageLoader::fgSymbolTrieSearchs = 0;
 std::vector<ImageLoader::InterposeTuple>ImageLoader::fgInterposingTuples;
 uintptr_t								ImageLoader::fgNextPIEDylibAddress = 0;
 
@@ -326,6 +309,20 @@ bool ImageLoader::findExportedSymbolAddress(const LinkContext& context, const ch
 }
 
 
+void ImageLoader::findExportedSymbols(const char* prefix, const char* const names[], size_t count,
+									  const Symbol* results[], const ImageLoader* foundIn[]) const
+{
+	// one buffer reused for every prefix+name
+	std::string name(prefix);
+	const size_t prefixLength = name.size();
+	for (size_t i=0; i < count; ++i) {
+		name.resize(prefixLength);
+		name.append(names[i]);
+		results[i] = this->findExportedSymbol(name.c_str(), true, &foundIn[i]);
+	}
+}
+
+
 // private method that handles circular dependencies by only search any image once
 const ImageLoader::Symbol* ImageLoader::findExportedSymbolInDependentImagesExcept(const char* name,
 			const ImageLoader** dsiStart, const ImageLoader**& dsiCur, const ImageLoader** dsiEnd, const ImageLoader** foundIn) const
@@ -384,7 +381,7 @@ const ImageLoader::Symbol* ImageLoader::findExportedSymbolInImageOrDependentImag
 // this is called by initializeMainExecutable() to interpose on the initial set of images
 void ImageLoader::applyInterposing(const LinkContext& context)
 {
-	dyld3::ScopedTimer timer(DBG_DYLD_TIMING_APPLY_INTERPOSING, 0, 0, 0);
+	dyld3::ScopedTimer timer(DBG_DYLD_TIMING_APPLY_INTERPOSING, 0, 0, 0, this->getShortName());
 	if ( fgInterposingTuples.size() != 0 )
 		this->recursiveApplyInterposing(context);
 }
@@ -500,6 +497,12 @@ void ImageLoader::vmAccountingSetSuspended(const LinkContext& context, bool susp
 
 
 void ImageLoader::link(const LinkContext& context, bool forceLazysBound, bool preflightOnly, bool neverUnload, const RPathChain& loaderRPaths, const char* imagePath)
+{
+	if ( const char* whyNot = this->tryLink(context, forceLazysBound, preflightOnly, neverUnload, loaderRPaths, imagePath) )
+		throw whyNot;
+}
+
+const char* ImageLoader::tryLink(const LinkContext& context, bool forceLazysBound, bool preflightOnly, bool neverUnload, const RPathChain& loaderRPaths, const char* imagePath)
 {
 	//dyld::log("ImageLoader::link(%s) refCount=%d, neverUnload=%d\n", imagePath, fDlopenReferenceCount, fNeverUnload);
 
@@ -508,46 +511,44 @@ void ImageLoader::link(const LinkContext& context, bool forceLazysBound, bool pr
 	(*context.setErrorStrings)(0, NULL, NULL, NULL);
 
 	uint64_t t0 = mach_absolute_time();
-	this->recursiveLoadLibraries(context, preflightOnly, loaderRPaths, imagePath);
+	if ( const char* whyNot = this->recursiveLoadLibraries(context, preflightOnly, loaderRPaths, imagePath) )
+		return whyNot;
 	context.notifyBatch(dyld_image_state_dependents_mapped, preflightOnly);
 
     
 	// we only do the loading step for preflights
 	if ( preflightOnly )
-		return;
+		return NULL;
 
 	uint64_t t1 = mach_absolute_time();
 	context.clearAllDepths();
 	this->updateDepth(context.imageCount());
    
-	__block uint64_t t2, t3, t4, t5;
 	{
-        dyld3::ScopedTimer(DBG_DYLD_TIMING_APPLY_FIXUPS, 0, 0, 0);
-		t2 = mach_absolute_time();
+        dyld3::ScopedTimer timer(DBG_DYLD_TIMING_APPLY_FIXUPS, 0, 0, 0, this->getShortName());
         
+		// rebase, bind and weak bind time is counted per image as each one is fixed up
 		this->recursiveRebaseWithAccounting(context);
         
 		context.notifyBatch(dyld_image_state_rebased, false);
         
 
-		t3 = mach_absolute_time();
 		if ( !context.linkingMainExecutable )
         {
     
-            this->recursiveBindWithAccounting(context, forceLazysBound, neverUnload);
+            if ( const char* whyNot = this->recursiveBindWithAccounting(context, forceLazysBound, neverUnload) )
+                return whyNot;
             
         }
 
-		t4 = mach_absolute_time();
 		if ( !context.linkingMainExecutable )
 			this->weakBind(context);
-		t5 = mach_absolute_time();
 
 	}
     
 	// interpose any dynamically loaded images
 	if ( !context.linkingMainExecutable && (fgInterposingTuples.size() != 0) ) {
-		dyld3::ScopedTimer timer(DBG_DYLD_TIMING_APPLY_INTERPOSING, 0, 0, 0);
+		dyld3::ScopedTimer timer(DBG_DYLD_TIMING_APPLY_INTERPOSING, 0, 0, 0, this->getShortName());
 		this->recursiveApplyInterposing(context);
 	}
     
@@ -569,14 +570,13 @@ void ImageLoader::link(const LinkContext& context, bool forceLazysBound, bool pr
 	// clear error strings
 	(*context.setErrorStrings)(0, NULL, NULL, NULL);
 
-	fgTotalLoadLibrariesTime += t1 - t0;
-	fgTotalRebaseTime += t3 - t2;
-	fgTotalBindTime += t4 - t3;
-	fgTotalWeakBindTime += t5 - t4;
-	fgTotalDOF += t7 - t6;
+	// dependents are loaded (and registered as DOF) on behalf of the image being linked
+	this->addStat(kLoadStatLoadLibrariesTime, t1 - t0);
+	this->addStat(kLoadStatDOFTime, t7 - t6);
 
 	// done with initial dylib loads
 	fgNextPIEDylibAddress = 0;
+	return NULL;
 }
 
 
@@ -619,7 +619,7 @@ void ImageLoader::processInitializers(const LinkContext& context, mach_port_t th
 
 void ImageLoader::runInitializers(const LinkContext& context, InitializerTimingList& timingInfo)
 {
-	uint64_t t1 = mach_absolute_time();
+	// initializer time is counted per image by recursiveInitialization()
 	mach_port_t thisThread = mach_thread_self();
 	ImageLoader::UninitedUpwards up;
 	up.count = 1;
@@ -627,8 +627,6 @@ void ImageLoader::runInitializers(const LinkContext& context, InitializerTimingL
 	processInitializers(context, thisThread, timingInfo, up);
 	context.notifyBatch(dyld_image_state_initialized, false);
 	mach_port_deallocate(mach_task_self(), thisThread);
-	uint64_t t2 = mach_absolute_time();
-	fgTotalInitTime += (t2 - t1);
 }
 
 
@@ -732,8 +730,28 @@ unsigned int ImageLoader::recursiveUpdateDepth(unsigned int maxDepth, dyld3::Arr
 }
 
 
-void ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool preflightOnly, const RPathChain& loaderRPaths, const char* loadPath)
+const char* ImageLoader::libraryNotLoaded(const LinkContext& context, const DependentLibraryInfo& requiredLibInfo, const char* msg)
 {
+	fState = dyld_image_state_mapped;
+	// record values for possible use by CrashReporter or Finder
+	if ( strstr(msg, "Incompatible library version") != NULL )
+		(*context.setErrorStrings)(DYLD_EXIT_REASON_DYLIB_WRONG_VERSION, this->getPath(), requiredLibInfo.name, NULL);
+	else if ( strstr(msg, "architecture") != NULL )
+		(*context.setErrorStrings)(DYLD_EXIT_REASON_DYLIB_WRONG_ARCH, this->getPath(), requiredLibInfo.name, NULL);
+	else if ( strstr(msg, "file system sandbox") != NULL )
+		(*context.setErrorStrings)(DYLD_EXIT_REASON_FILE_SYSTEM_SANDBOX, this->getPath(), requiredLibInfo.name, NULL);
+	else if ( strstr(msg, "code signature") != NULL )
+		(*context.setErrorStrings)(DYLD_EXIT_REASON_CODE_SIGNATURE, this->getPath(), requiredLibInfo.name, NULL);
+	else if ( strstr(msg, "malformed") != NULL )
+		(*context.setErrorStrings)(DYLD_EXIT_REASON_MALFORMED_MACHO, this->getPath(), requiredLibInfo.name, NULL);
+	else
+		(*context.setErrorStrings)(DYLD_EXIT_REASON_DYLIB_MISSING, this->getPath(), requiredLibInfo.name, NULL);
+	return dyld::mkstringf("Library not loaded: %s\n  Referenced from: %s\n  Reason: %s", requiredLibInfo.name, this->getRealPath(), msg);
+}
+
+const char* ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool preflightOnly, const RPathChain& loaderRPaths, const char* loadPath)
+{
+	const char* whyNot = NULL;
 	if ( fState < dyld_image_state_dependents_mapped ) {
 		// break cycles
 		fState = dyld_image_state_dependents_mapped;
@@ -750,7 +768,7 @@ void ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool prefli
 		// try to load each
 		bool canUsePrelinkingInfo = true;
 		for(unsigned int i=0; i < fLibraryCount; ++i){
-			ImageLoader* dependentLib;
+			ImageLoader* dependentLib = NULL;
 			bool depLibReExported = false;
 			DependentLibraryInfo& requiredLibInfo = libraryInfos[i];
 			if ( preflightOnly && context.inSharedCache(requiredLibInfo.name) ) {
@@ -759,9 +777,25 @@ void ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool prefli
 				setLibImage(i, NULL, false, false);
 				continue;
 			}
+			if ( context.tryLoadLibrary != NULL ) {
+				// a library that does not open is reported without unwinding
+				const char* whyNotLoaded = NULL;
+				dependentLib = context.tryLoadLibrary(requiredLibInfo.name, &whyNotLoaded);
+				if ( dependentLib == NULL ) {
+					if ( requiredLibInfo.required ) {
+						whyNot = this->libraryNotLoaded(context, requiredLibInfo, whyNotLoaded);
+						break;
+					}
+					// ok if weak library not found
+					canUsePrelinkingInfo = false;
+					setLibImage(i, NULL, false, requiredLibInfo.upward);
+					continue;
+				}
+			}
 			try {
 				unsigned cacheIndex;
-				dependentLib = context.loadLibrary(requiredLibInfo.name, true, this->getPath(), &thisRPaths, cacheIndex);
+				if ( dependentLib == NULL )
+					dependentLib = context.loadLibrary(requiredLibInfo.name, true, this->getPath(), &thisRPaths, cacheIndex);
 				if ( dependentLib == this ) {
 					// found circular reference, perhaps DYLD_LIBARY_PATH is causing this rdar://problem/3684168
 					dependentLib = context.loadLibrary(requiredLibInfo.name, false, NULL, NULL, cacheIndex);
@@ -813,25 +847,9 @@ void ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool prefli
 				//if ( context.verbosePrebinding )
 				//	fprintf(stderr, "dyld: exception during processing for %s referencing %s\n", this->getPath(), dependentLib->getPath());
 				if ( requiredLibInfo.required ) {
-					fState = dyld_image_state_mapped;
-					// record values for possible use by CrashReporter or Finder
-					if ( strstr(msg, "Incompatible library version") != NULL )
-						(*context.setErrorStrings)(DYLD_EXIT_REASON_DYLIB_WRONG_VERSION, this->getPath(), requiredLibInfo.name, NULL);
-					else if ( strstr(msg, "architecture") != NULL )
-						(*context.setErrorStrings)(DYLD_EXIT_REASON_DYLIB_WRONG_ARCH, this->getPath(), requiredLibInfo.name, NULL);
-					else if ( strstr(msg, "file system sandbox") != NULL )
-						(*context.setErrorStrings)(DYLD_EXIT_REASON_FILE_SYSTEM_SANDBOX, this->getPath(), requiredLibInfo.name, NULL);
-					else if ( strstr(msg, "code signature") != NULL )
-						(*context.setErrorStrings)(DYLD_EXIT_REASON_CODE_SIGNATURE, this->getPath(), requiredLibInfo.name, NULL);
-					else if ( strstr(msg, "malformed") != NULL )
-						(*context.setErrorStrings)(DYLD_EXIT_REASON_MALFORMED_MACHO, this->getPath(), requiredLibInfo.name, NULL);
-					else
-						(*context.setErrorStrings)(DYLD_EXIT_REASON_DYLIB_MISSING, this->getPath(), requiredLibInfo.name, NULL);
-					const char* newMsg = dyld::mkstringf("Library not loaded: %s\n  Referenced from: %s\n  Reason: %s", requiredLibInfo.name, this->getRealPath(), msg);
-					free((void*)msg); 	// our free() will do nothing if msg is a string literal
-					throw newMsg;
+					whyNot = this->libraryNotLoaded(context, requiredLibInfo, msg);
+					break;
 				}
-				free((void*)msg); 	// our free() will do nothing if msg is a string literal
 				// ok if weak library not found
 				dependentLib = NULL;
 				canUsePrelinkingInfo = false;  // this disables all prebinding, we may want to just slam import vectors for this lib to zero
@@ -841,14 +859,14 @@ void ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool prefli
 		fAllLibraryChecksumsAndLoadAddressesMatch = canUsePrelinkingInfo;
 
 		// tell each to load its dependents
-		for(unsigned int i=0; i < libraryCount(); ++i) {
+		for(unsigned int i=0; (whyNot == NULL) && (i < libraryCount()); ++i) {
 			ImageLoader* dependentImage = libImage(i);
 			if ( dependentImage != NULL ) {
-				dependentImage->recursiveLoadLibraries(context, preflightOnly, thisRPaths, libraryInfos[i].name);
+				whyNot = dependentImage->recursiveLoadLibraries(context, preflightOnly, thisRPaths, libraryInfos[i].name);
 			}
 		}
 		// do deep prebind check
-		if ( fAllLibraryChecksumsAndLoadAddressesMatch ) {
+		if ( (whyNot == NULL) && fAllLibraryChecksumsAndLoadAddressesMatch ) {
 			for(unsigned int i=0; i < libraryCount(); ++i){
 				ImageLoader* dependentImage = libImage(i);
 				if ( dependentImage != NULL ) {
@@ -865,6 +883,7 @@ void ImageLoader::recursiveLoadLibraries(const LinkContext& context, bool prefli
 		}
 
 	}
+	return whyNot;
 }
 
 
@@ -889,7 +908,14 @@ void ImageLoader::recursiveRebase(const LinkContext& context)
 			}
 
 			// rebase this image
-			doRebase(context);
+			{
+				dyld3::ScopedTimer timer(DBG_DYLD_TIMING_REBASE, 0, 0, 0, this->getShortName());
+				const uint64_t fixupsBefore = fLoadStats.get(kLoadStatRebaseFixups);
+				const uint64_t t0 = mach_absolute_time();
+				doRebase(context);
+				this->addStat(kLoadStatRebaseTime, mach_absolute_time() - t0);
+				timer.setCounter(fLoadStats.get(kLoadStatRebaseFixups) - fixupsBefore);
+			}
 
 			// notify
 			context.notifySingle(dyld_image_state_rebased, this, NULL);
@@ -953,13 +979,14 @@ void ImageLoader::recursiveMakeDataReadOnly(const LinkContext& context)
 }
 
 
-void ImageLoader::recursiveBindWithAccounting(const LinkContext& context, bool forceLazysBound, bool neverUnload)
+const char* ImageLoader::recursiveBindWithAccounting(const LinkContext& context, bool forceLazysBound, bool neverUnload)
 {
-	this->recursiveBind(context, forceLazysBound, neverUnload, nullptr);
+	const char* whyNot = this->recursiveBind(context, forceLazysBound, neverUnload, nullptr);
 	vmAccountingSetSuspended(context, false);
+	return whyNot;
 }
 
-void ImageLoader::recursiveBind(const LinkContext& context, bool forceLazysBound, bool neverUnload, const ImageLoader* parent)
+const char* ImageLoader::recursiveBind(const LinkContext& context, bool forceLazysBound, bool neverUnload, const ImageLoader* parent)
 {
 	// Normally just non-lazy pointers are bound immediately.
 	// The exceptions are:
@@ -978,12 +1005,28 @@ void ImageLoader::recursiveBind(const LinkContext& context, bool forceLazysBound
 					const ImageLoader* reExportParent = nullptr;
 					if ( libReExported(i) )
 						reExportParent = this;
-					dependentImage->recursiveBind(context, forceLazysBound, neverUnload, reExportParent);
+					if ( const char* whyNot = dependentImage->recursiveBind(context, forceLazysBound, neverUnload, reExportParent) ) {
+						fState = dyld_image_state_rebased;
+						return whyNot;
+					}
 				}
 			}
             
             // bind this image
-			this->doBind(context, forceLazysBound, parent);
+			{
+				dyld3::ScopedTimer timer(DBG_DYLD_TIMING_BIND, 0, 0, 0, this->getShortName());
+				const uint64_t fixupsBefore = fLoadStats.get(kLoadStatBindFixups);
+				const uint64_t t0 = mach_absolute_time();
+				const char* whyNot = this->doBind(context, forceLazysBound, parent);
+				this->addStat(kLoadStatBindTime, mach_absolute_time() - t0);
+				timer.setCounter(fLoadStats.get(kLoadStatBindFixups) - fixupsBefore);
+				if ( whyNot != NULL ) {
+					// restore state, as the catch below does for a throw
+					fState = dyld_image_state_rebased;
+					CRSetCrashLogMessage2(NULL);
+					return whyNot;
+				}
+			}
             // mark if lazys are also bound
 			if ( forceLazysBound || this->usablePrebinding(context) )
             {
@@ -1004,6 +1047,7 @@ void ImageLoader::recursiveBind(const LinkContext& context, bool forceLazysBound
 			throw;
 		}
 	}
+	return NULL;
 }
 
 
@@ -1326,7 +1370,7 @@ void ImageLoader::weakBind(const LinkContext& context)
 	}
 
 	uint64_t t2 = mach_absolute_time();
-	fgTotalWeakBindTime += t2  - t1;
+	this->addStat(kLoadStatWeakBindTime, t2 - t1);
 
 	if ( context.verboseWeakBind )
 		dyld::log("dyld: weak bind end\n");
@@ -1543,7 +1587,7 @@ void ImageLoader::weakBindOld(const LinkContext& context)
 	}
 
 	uint64_t t2 = mach_absolute_time();
-	fgTotalWeakBindTime += t2  - t1;
+	this->addStat(kLoadStatWeakBindTime, t2 - t1);
 
 	if ( context.verboseWeakBind )
 		dyld::log("dyld: weak bind end\n");
@@ -1663,6 +1707,7 @@ void ImageLoader::recursiveInitialization(const LinkContext& context, mach_port_
 			if ( hasInitializers ) {
 				uint64_t t2 = mach_absolute_time();
 				timingInfo.addTime(this->getShortName(), t2-t1);
+				this->addStat(kLoadStatInitTime, t2-t1);
 			}
 		}
 		catch (const char* msg) {
@@ -1731,62 +1776,74 @@ static char* commatize(uint64_t in, char* out)
 
 void ImageLoader::printStatistics(unsigned int imageCount, const InitializerTimingList& timingInfo)
 {
-	uint64_t totalTime = fgTotalLoadLibrariesTime  + fgTotalRebaseTime + fgTotalBindTime + fgTotalWeakBindTime + fgTotalDOF + fgTotalInitTime;
+	LoadStatValues stats;
+	loadstats::snapshot(stats);
+	uint64_t totalTime = stats[kLoadStatLoadLibrariesTime] + stats[kLoadStatRebaseTime] + stats[kLoadStatBindTime] + stats[kLoadStatWeakBindTime]
+					   + stats[kLoadStatDOFTime] + stats[kLoadStatInitTime];
 
-	uint64_t totalDyldTime = totalTime - fgTotalDebuggerPausedTime - fgTotalRebindCacheTime;
+	uint64_t totalDyldTime = totalTime - stats[kLoadStatRebindCacheTime];
 	printTime("Total pre-main time", totalDyldTime, totalDyldTime);
-	printTime("         dylib loading time", fgTotalLoadLibrariesTime-fgTotalDebuggerPausedTime, totalDyldTime);
-	printTime("        rebase/binding time", fgTotalRebaseTime+fgTotalBindTime+fgTotalWeakBindTime-fgTotalRebindCacheTime, totalDyldTime);
-	printTime("            ObjC setup time", fgTotalObjCSetupTime, totalDyldTime);
-	printTime("           initializer time", fgTotalInitTime-fgTotalObjCSetupTime, totalDyldTime);
+	printTime("         dylib loading time", stats[kLoadStatLoadLibrariesTime], totalDyldTime);
+	printTime("        rebase/binding time", stats[kLoadStatRebaseTime]+stats[kLoadStatBindTime]+stats[kLoadStatWeakBindTime]-stats[kLoadStatRebindCacheTime], totalDyldTime);
+	printTime("            ObjC setup time", stats[kLoadStatObjCSetupTime], totalDyldTime);
+	printTime("           initializer time", stats[kLoadStatInitTime], totalDyldTime);
 	dyld::log("           slowest intializers :\n");
 	for (uintptr_t i=0; i < timingInfo.count; ++i) {
 		uint64_t t = timingInfo.images[i].initTime;
 		if ( t*50 < totalDyldTime )
 			continue;
 		dyld::log("%30s ", timingInfo.images[i].shortName);
-		if ( strncmp(timingInfo.images[i].shortName, "libSystem.", 10) == 0 )
-			t -= fgTotalObjCSetupTime;
-			printTime("", t, totalDyldTime);
+		printTime("", t, totalDyldTime);
 	}
 	dyld::log("\n");
 }
 
 void ImageLoader::printStatisticsDetails(unsigned int imageCount, const InitializerTimingList& timingInfo)
 {
-	uint64_t totalTime = fgTotalLoadLibrariesTime  + fgTotalRebaseTime + fgTotalBindTime + fgTotalWeakBindTime + fgTotalDOF + fgTotalInitTime;
+	LoadStatValues stats;
+	loadstats::snapshot(stats);
+	uint64_t totalTime = stats[kLoadStatLoadLibrariesTime] + stats[kLoadStatRebaseTime] + stats[kLoadStatBindTime] + stats[kLoadStatWeakBindTime]
+					   + stats[kLoadStatDOFTime] + stats[kLoadStatInitTime];
 	char commaNum1[40];
 	char commaNum2[40];
 
 	printTime("  total time", totalTime, totalTime);
 	dyld::log("  total images loaded:  %d (%u from dyld shared cache)\n", imageCount, fgImagesUsedFromSharedCache);
-	dyld::log("  total segments mapped: %u, into %llu pages\n", fgTotalSegmentsMapped, fgTotalBytesMapped/4096);
-	printTime("  total images loading time", fgTotalLoadLibrariesTime, totalTime);
-	printTime("  total load time in ObjC", fgTotalObjCSetupTime, totalTime);
-	printTime("  total debugger pause time", fgTotalDebuggerPausedTime, totalTime);
-	printTime("  total dtrace DOF registration time", fgTotalDOF, totalTime);
-	dyld::log("  total rebase fixups:  %s\n", commatize(fgTotalRebaseFixups, commaNum1));
-	printTime("  total rebase fixups time", fgTotalRebaseTime, totalTime);
-	dyld::log("  total binding fixups: %s\n", commatize(fgTotalBindFixups, commaNum1));
-	if ( fgTotalBindSymbolsResolved != 0 ) {
-		uint32_t avgTimesTen = (fgTotalBindImageSearches * 10) / fgTotalBindSymbolsResolved;
-		uint32_t avgInt = fgTotalBindImageSearches / fgTotalBindSymbolsResolved;
-		uint32_t avgTenths = avgTimesTen - (avgInt*10);
-		dyld::log("total binding symbol lookups: %s, average images searched per symbol: %u.%u\n",
-				commatize(fgTotalBindSymbolsResolved, commaNum1), avgInt, avgTenths);
+	dyld::log("  total segments mapped: %llu, into %llu pages\n", stats[kLoadStatSegmentsMapped], stats[kLoadStatBytesMapped]/4096);
+	dyld::log("  total segment bytes from memory images: %llu remapped, %llu copied, %llu left as zero-fill\n",
+			  stats[kLoadStatBytesRemapped], stats[kLoadStatBytesCopied], stats[kLoadStatBytesZeroPagesSkipped]);
+	dyld::log("  total adopted images mapped in place: %llu, copied: %llu\n", stats[kLoadStatImagesAdoptedInPlace], stats[kLoadStatImagesAdoptedByCopy]);
+	dyld::log("  total images not slid (rebase skipped): %llu, preferred address already in use: %llu\n",
+			  stats[kLoadStatImagesRebaseSkipped], stats[kLoadStatPreferredLoadAddressMisses]);
+	printTime("  total images loading time", stats[kLoadStatLoadLibrariesTime], totalTime);
+	printTime("  total segment mapping time", stats[kLoadStatMapTime], totalTime);
+	printTime("  total load time in ObjC", stats[kLoadStatObjCSetupTime], totalTime);
+	dyld::log("  total ObjC classes registered: %s, selectors: %s\n",
+			  commatize(stats[kLoadStatObjCClassesRegistered], commaNum1), commatize(stats[kLoadStatObjCSelectorsRegistered], commaNum2));
+	printTime("  total dtrace DOF registration time", stats[kLoadStatDOFTime], totalTime);
+	dyld::log("  total rebase fixups:  %s\n", commatize(stats[kLoadStatRebaseFixups], commaNum1));
+	printTime("  total rebase fixups time", stats[kLoadStatRebaseTime], totalTime);
+	dyld::log("  total binding fixups: %s\n", commatize(stats[kLoadStatBindFixups], commaNum1));
+	if ( stats[kLoadStatBindSymbolsResolved] != 0 ) {
+		// lookups that did not go through resolve(), in tenths of a percent
+		uint64_t memoHits = stats[kLoadStatBindSymbolsResolved] - stats[kLoadStatBindImageSearches];
+		uint64_t hitRateTimesTen = (memoHits * 1000) / stats[kLoadStatBindSymbolsResolved];
+		dyld::log("  total binding symbol lookups: %s, resolved: %s\n",
+				commatize(stats[kLoadStatBindSymbolsResolved], commaNum1), commatize(stats[kLoadStatBindImageSearches], commaNum2));
+		dyld::log("  total binding lookups served from link memo: %s, memo hit rate: %llu.%llu%%\n",
+				commatize(memoHits, commaNum1), hitRateTimesTen / 10, hitRateTimesTen % 10);
 	}
-	printTime("  total binding fixups time", fgTotalBindTime, totalTime);
-	printTime("  total weak binding fixups time", fgTotalWeakBindTime, totalTime);
-	printTime("  total redo shared cached bindings time", fgTotalRebindCacheTime, totalTime);
-	dyld::log("  total bindings lazily fixed up: %s of %s\n", commatize(fgTotalLazyBindFixups, commaNum1), commatize(fgTotalPossibleLazyBindFixups, commaNum2));
-	printTime("  total time in initializers and ObjC +load", fgTotalInitTime-fgTotalObjCSetupTime, totalTime);
+	printTime("  total binding fixups time", stats[kLoadStatBindTime], totalTime);
+	printTime("  total weak binding fixups time", stats[kLoadStatWeakBindTime], totalTime);
+	printTime("  total redo shared cached bindings time", stats[kLoadStatRebindCacheTime], totalTime);
+	dyld::log("  total bindings lazily fixed up: %s\n", commatize(stats[kLoadStatLazyBindFixups], commaNum1));
+	dyld::log("  total symbol trie searches: %s\n", commatize(stats[kLoadStatSymbolTrieSearches], commaNum1));
+	printTime("  total time in initializers and ObjC +load", stats[kLoadStatInitTime], totalTime);
 	for (uintptr_t i=0; i < timingInfo.count; ++i) {
 		uint64_t t = timingInfo.images[i].initTime;
 		if ( t*1000 < totalTime )
 			continue;
 		dyld::log("%42s ", timingInfo.images[i].shortName);
-		if ( strncmp(timingInfo.images[i].shortName, "libSystem.", 10) == 0 )
-			t -= fgTotalObjCSetupTime;
 		printTime("", t, totalTime);
 	}
 
@@ -1830,7 +1887,6 @@ void ImageLoader::addSuffix(const char* path, const char* suffix, char* result)
 const uint8_t* ImageLoader::trieWalk(const uint8_t* start, const uint8_t* end, const char* s)
 {
 	//dyld::log("trieWalk(%p, %p, %s)\n", start, end, s);
-	++fgSymbolTrieSearchs;
 	const uint8_t* p = start;
 	while ( p != NULL ) {
 		uintptr_t terminalSize = *p++;
@@ -1904,6 +1960,102 @@ const uint8_t* ImageLoader::trieWalk(const uint8_t* start, const uint8_t* end, c
 }
 
 
+//
+// Looks up several names in one pass. `order` lists the indexes of `names`
+// sorted by strcmp(), so consecutive names share the longest prefixes; the
+// nodes reached for one name are kept on a stack and the next name resumes
+// from the deepest node still on its path instead of from the root. Every
+// name is looked up as prefix+name without building that string.
+//
+void ImageLoader::trieWalkSorted(const uint8_t* start, const uint8_t* end, const char* prefix,
+								 const char* const names[], const uint32_t order[], size_t count, const uint8_t* results[])
+{
+	struct Frame { const uint8_t* node; size_t depth; };
+	std::vector<Frame> path;
+	path.push_back({ start, 0 });
+	const size_t prefixLength = strlen(prefix);
+	const char* previous = NULL;
+	for (size_t n=0; n < count; ++n) {
+		const char* name = names[order[n]];
+		results[order[n]] = NULL;
+
+		// drop the nodes that are not on this name's path
+		size_t shared = prefixLength;
+		if ( previous != NULL ) {
+			const char* a = previous;
+			const char* b = name;
+			while ( (*a != '\0') && (*a == *b) ) {
+				++a;
+				++b;
+				++shared;
+			}
+		}
+		previous = name;
+		while ( path.back().depth > shared )
+			path.pop_back();
+
+		const size_t length = prefixLength + strlen(name);
+		size_t depth = path.back().depth;
+		const uint8_t* p = path.back().node;
+		while ( p != NULL ) {
+			uintptr_t terminalSize = *p++;
+			if ( terminalSize > 127 ) {
+				--p;
+				terminalSize = read_uleb128(p, end);
+			}
+			if ( (depth == length) && (terminalSize != 0) ) {
+				results[order[n]] = p;
+				break;
+			}
+			const uint8_t* children = p + terminalSize;
+			if ( children >= end ) {
+				dyld::log("trieWalkSorted() malformed trie node, terminalSize=0x%lx extends past end of trie\n", terminalSize);
+				break;
+			}
+			uint8_t childrenRemaining = *children++;
+			p = children;
+			const uint8_t* next = NULL;
+			for (; childrenRemaining > 0; --childrenRemaining) {
+				// match the edge against the rest of prefix+name
+				size_t matched = depth;
+				bool wrongEdge = false;
+				while ( *p != '\0' ) {
+					if ( !wrongEdge ) {
+						const char c = (matched < prefixLength) ? prefix[matched] : name[matched-prefixLength];
+						if ( (matched >= length) || (c != (char)*p) )
+							wrongEdge = true;
+						++matched;
+					}
+					++p;
+				}
+				++p; // skip over zero terminator
+				if ( wrongEdge || (matched == depth) ) {
+					// skip over uleb128 until last byte is found
+					while ( (*p & 0x80) != 0 )
+						++p;
+					++p;
+					if ( p > end ) {
+						dyld::log("trieWalkSorted() malformed trie node, child node extends past end of trie\n");
+						break;
+					}
+					continue;
+				}
+				const uintptr_t nodeOffset = read_uleb128(p, end);
+				if ( (nodeOffset == 0) || (&start[nodeOffset] > end) ) {
+					dyld::log("trieWalkSorted() malformed trie child, nodeOffset=0x%lx out of range\n", nodeOffset);
+					break;
+				}
+				next = &start[nodeOffset];
+				depth = matched;
+				path.push_back({ next, depth });
+				break;
+			}
+			p = next;
+		}
+	}
+}
+
+
 
 uintptr_t ImageLoader::read_uleb128(const uint8_t*& p, const uint8_t* end)
 {
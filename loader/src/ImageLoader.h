@@ -57,6 +57,7 @@
 #include "DyldSharedCache.h"
 #endif
 #include "Map.h"
+#include "LoadStats.h"
 
 #if __arm__
  #include <mach/vm_page_size.h>
@@ -188,6 +189,9 @@ enum dyld_image_states
 };
 typedef const char* (*dyld_image_state_change_handler)(enum dyld_image_states state, uint32_t infoCount, const struct dyld_image_info info[]);
 
+class AddressArena;
+class WorkerPool;
+
 //
 // ImageLoader is an abstract base class.  To support loading a particular executable
 // file format, you make a concrete subclass of ImageLoader.
@@ -261,6 +265,8 @@ public:
 
 	struct LinkContext {
 		ImageLoader*	(*loadLibrary)(const char* libraryName, bool search, const char* origin, const RPathChain* rpaths, unsigned& cacheIndex);
+		// loadLibrary() that returns NULL and sets *whyNot instead of throwing, used by tryLink() when set
+		ImageLoader*	(*tryLoadLibrary)(const char* libraryName, const char** whyNot);
 		void			(*terminationRecorder)(ImageLoader* image);
 		bool			(*flatExportFinder)(const char* name, const Symbol** sym, const ImageLoader** image);
 		bool			(*coalescedExportFinder)(const char* name, const Symbol** sym, const ImageLoader** image, CoalesceNotifier);
@@ -347,6 +353,16 @@ public:
 		bool			verboseRPaths;
 		bool			verboseInterposing;
 		bool			verboseCodeSignatures;
+		// directory holding precompiled link plans (see LinkPlan.h), NULL disables them
+		const char*		linkPlanCacheDir;
+		// build export indexes (see ExportIndex.h) when an image is loaded instead of on first lookup
+		bool			eagerExportIndex;
+		// pool resolving the imports and fixing up the pages of one image (see WorkerPool.h), NULL binds serially
+		WorkerPool*		bindPool;
+		// map images at their linked address whenever that whole span is free, so they need no rebasing
+		bool			preferLoadAddress;
+		// reservation images are packed into (see AddressArena.h), NULL gives each image its own
+		AddressArena*	addressArena;
 	};
 
 	struct CoalIterator
@@ -384,6 +400,9 @@ public:
 										// link() takes a newly instantiated ImageLoader and does all
 										// fixups needed to make it usable by the process
 	void								link(const LinkContext& context, bool forceLazysBound, bool preflight, bool neverUnload, const RPathChain& loaderRPaths, const char* imagePath);
+										// link() that returns NULL, or why a dependent library did not load or an import
+										// could not be bound instead of throwing it. Malformed fixups still throw.
+	const char*							tryLink(const LinkContext& context, bool forceLazysBound, bool preflight, bool neverUnload, const RPathChain& loaderRPaths, const char* imagePath);
 
 										// runInitializers() is normally called in link() but the main executable must
 										// run crt code before initializers
@@ -401,6 +420,12 @@ public:
 										// returns leaf name
 	static const char*					shortName(const char* fullName);
 
+										// counts work done loading this image, in its own and in the process statistics
+	void								addStat(LoadStat stat, uint64_t count) const { fLoadStats.add(stat, count); loadstats::add(stat, count); }
+
+										// what loading this image took so far
+	const ImageLoadStats&				loadStats() const { return fLoadStats; }
+
 										// get path used to load this image, not necessarily the "real" path
 	const char*							getPath() const { return fPath; }
 
@@ -480,6 +505,11 @@ public:
 											return findExportedSymbol(name, searchReExports, this->getPath(), foundIn);
 										}
 
+										// search for several names at once, each looked up as prefix+name with searchReExports;
+										// results[i] is NULL if names[i] is not found, otherwise foundIn[i] is set
+	virtual void						findExportedSymbols(const char* prefix, const char* const names[], size_t count,
+															const Symbol* results[], const ImageLoader* foundIn[]) const;
+
 										// gets address of implementation (code) of the specified exported symbol
 	virtual uintptr_t					getExportedSymbolAddress(const Symbol* sym, const LinkContext& context,
 													const ImageLoader* requestor=NULL, bool runResolver=false, const char* symbolName=NULL) const = 0;
@@ -626,8 +656,8 @@ public:
 										// when resolving symbols look in subImage if symbol can't be found
 	void								reExport(ImageLoader* subImage);
 
-	virtual void						recursiveBind(const LinkContext& context, bool forceLazysBound, bool neverUnload, const ImageLoader* parent);
-	void								recursiveBindWithAccounting(const LinkContext& context, bool forceLazysBound, bool neverUnload);
+	virtual const char*					recursiveBind(const LinkContext& context, bool forceLazysBound, bool neverUnload, const ImageLoader* parent);
+	const char*							recursiveBindWithAccounting(const LinkContext& context, bool forceLazysBound, bool neverUnload);
 	void								recursiveRebaseWithAccounting(const LinkContext& context);
 	void								weakBind(const LinkContext& context);
 
@@ -663,7 +693,7 @@ public:
 	virtual void						recursiveMakeDataReadOnly(const LinkContext& context);
 
 	virtual uintptr_t					resolveWeak(const LinkContext& context, const char* symbolName, bool weak_import, bool runResolver,
-													const ImageLoader** foundIn) { return 0; }
+													const ImageLoader** foundIn, const char** whyNot=NULL) { return 0; }
 
 										// triggered by DYLD_PRINT_STATISTICS to write info on work done and how fast
 	static void							printStatistics(unsigned int imageCount, const InitializerTimingList& timingInfo);
@@ -675,6 +705,8 @@ public:
 	static uint32_t						hash(const char*);
 
 	static const uint8_t*				trieWalk(const uint8_t* start, const uint8_t* end, const char* stringToFind);
+	static void							trieWalkSorted(const uint8_t* start, const uint8_t* end, const char* prefix, const char* const names[],
+													   const uint32_t order[], size_t count, const uint8_t* results[]);
 
 										// used instead of directly deleting image
 	static void							deleteImage(ImageLoader*);
@@ -762,7 +794,9 @@ protected:
 
 						// To link() an image, its dependent libraries are loaded, it is rebased, bound, and initialized.
 						// These methods do the above, exactly once, and it the right order
-	virtual void		recursiveLoadLibraries(const LinkContext& context, bool preflightOnly, const RPathChain& loaderRPaths, const char* loadPath);
+	virtual const char*	recursiveLoadLibraries(const LinkContext& context, bool preflightOnly, const RPathChain& loaderRPaths, const char* loadPath);
+						// records why a required library did not load and returns the message link() throws for it
+	const char*			libraryNotLoaded(const LinkContext& context, const DependentLibraryInfo& requiredLibInfo, const char* msg);
 	virtual unsigned 	recursiveUpdateDepth(unsigned int maxDepth, dyld3::Array<ImageLoader*>& danglingUpwards);
 	virtual unsigned 	updateDepth(unsigned int maxDepth);
 	virtual void		recursiveRebase(const LinkContext& context);
@@ -780,8 +814,8 @@ protected:
 								// do any fix ups in this image that depend only on the load address of the image
 	virtual void				doRebase(const LinkContext& context) = 0;
 
-								// do any symbolic fix ups in this image
-	virtual void				doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent) = 0;
+								// do any symbolic fix ups in this image, returns why an import could not be bound
+	virtual const char*			doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent) = 0;
 
 								// called later via API to force all lazy pointer to be bound
 	virtual void				doBindJustLazies(const LinkContext& context) = 0;
@@ -833,27 +867,7 @@ protected:
 	static uint32_t				fgImagesUsedFromSharedCache;
 	static uint32_t				fgImagesHasWeakDefinitions;
 	static uint32_t				fgImagesRequiringCoalescing;
-	static uint32_t				fgTotalRebaseFixups;
-	static uint32_t				fgTotalBindFixups;
-	static uint32_t				fgTotalBindSymbolsResolved;
-	static uint32_t				fgTotalBindImageSearches;
-	static uint32_t				fgTotalLazyBindFixups;
-	static uint32_t				fgTotalPossibleLazyBindFixups;
-	static uint32_t				fgTotalSegmentsMapped;
-	static uint32_t				fgSymbolTrieSearchs;
-	static uint64_t				fgTotalBytesMapped;
-	static uint64_t				fgTotalLoadLibrariesTime;
-public:
-	static uint64_t				fgTotalObjCSetupTime;
-	static uint64_t				fgTotalDebuggerPausedTime;
-	static uint64_t				fgTotalRebindCacheTime;
-	static uint64_t				fgTotalRebaseTime;
-	static uint64_t				fgTotalBindTime;
-	static uint64_t				fgTotalWeakBindTime;
-	static uint64_t				fgTotalDOF;
-	static uint64_t				fgTotalInitTime;
 
-protected:
 	static std::vector<InterposeTuple>	fgInterposingTuples;
 
 #if __x86_64__
@@ -866,6 +880,7 @@ protected:
 	time_t						fLastModified;
 	uint32_t					fPathHash;
 	uint32_t					fDlopenReferenceCount;	// count of how many dlopens have been done on this image
+	mutable ImageLoadStats		fLoadStats;
 
 	struct recursive_lock {
 						recursive_lock(mach_port_t t) : thread(t), count(0) {}
@@ -57,6 +57,9 @@
 #if SUPPORT_CLASSIC_MACHO
 #include "ImageLoaderMachOClassic.h"
 #endif
+#include "AddressArena.h"
+#include "Logging.h"
+#include "SegmentCopy.h"
 #include "Tracing.h"
 #if !UNSIGN_TOLERANT
 #include "dyld2.h"
@@ -96,7 +99,7 @@ uint32_t ImageLoaderMachO::fgSymbolTableBinarySearchs = 0;
 ImageLoaderMachO::ImageLoaderMachO(const macho_header* mh, const char* path, unsigned int segCount, 
 																uint32_t segOffsets[], unsigned int libCount)
  : ImageLoader(path, libCount), fCoveredCodeLength(0), fMachOData((uint8_t*)mh), fLinkEditBase(NULL), fSlide(0),
-	fEHFrameSectionOffset(0), fUnwindInfoSectionOffset(0), fDylibIDOffset(0), 
+	fEHFrameSectionOffset(0), fUnwindInfoSectionOffset(0), fDylibIDOffset(0), fArenaStart(0), fArenaLength(0),
 fSegmentsCount(segCount), fIsSplitSeg(false), fInSharedCache(false),
 #if TEXT_RELOC_SUPPORT
 	fTextSegmentRebases(false),
@@ -632,7 +635,7 @@ ImageLoader* ImageLoaderMachO::instantiateFromCache(const macho_header* mh, cons
 }
 
 // create image by copying an in-memory mach-o file
-ImageLoader* ImageLoaderMachO::instantiateFromMemory(const char* moduleName, const macho_header* mh, uint64_t len, const LinkContext& context)
+ImageLoader* ImageLoaderMachO::instantiateFromMemory(const char* moduleName, const macho_header* mh, uint64_t len, const LinkContext& context, int fd, bool adoptMemory)
 {
 	bool compressed;
 	unsigned int segCount;
@@ -645,7 +648,7 @@ ImageLoader* ImageLoaderMachO::instantiateFromMemory(const char* moduleName, con
     
 	// instantiate concrete class based on content of load commands
 	if ( compressed ) 
-		return ImageLoaderMachOCompressed::instantiateFromMemory(moduleName, mh, len, segCount, libCount, context);
+		return ImageLoaderMachOCompressed::instantiateFromMemory(moduleName, mh, len, segCount, libCount, context, fd, adoptMemory);
 	else
 #if SUPPORT_CLASSIC_MACHO
 		return ImageLoaderMachOClassic::instantiateFromMemory(moduleName, mh, len, segCount, libCount, context);
@@ -730,6 +733,7 @@ void ImageLoaderMachO::parseLoadCmds(const LinkContext& context)
 	const uint32_t cmd_count = ((macho_header*)fMachOData)->ncmds;
 	const struct load_command* const cmds = (struct load_command*)&fMachOData[sizeof(macho_header)];
 	const struct load_command* cmd = cmds;
+	fSectionIndex.clear();
 	for (uint32_t i = 0; i < cmd_count; ++i) {
 		switch (cmd->cmd) {
 			case LC_SYMTAB:
@@ -779,6 +783,8 @@ void ImageLoaderMachO::parseLoadCmds(const LinkContext& context)
 					const struct macho_section* const sectionsEnd = &sectionsStart[seg->nsects];
 					for (const struct macho_section* sect=sectionsStart; sect < sectionsEnd; ++sect) {
 						const uint8_t type = sect->flags & SECTION_TYPE;
+						fSectionIndex.add(sect->segname, sect->sectname, sect->addr, sect->size, type,
+										  (uint32_t)((uint8_t*)sect - fMachOData), (uint32_t)((uint8_t*)seg - fMachOData));
 						if ( type == S_MOD_INIT_FUNC_POINTERS )
 							fHasInitializers = true;
 						else if ( type == S_INIT_FUNC_OFFSETS )
@@ -849,6 +855,7 @@ void ImageLoaderMachO::parseLoadCmds(const LinkContext& context)
 		}
 		cmd = (const struct load_command*)(((char*)cmd)+cmd->cmdsize);
 	}
+	fSectionIndex.seal();
 	if ( firstUnknownCmd != NULL ) {
 		if ( minOSVersionCmd != NULL )  {
 			dyld::throwf("cannot load '%s' because it was built for OS version %u.%u (load command 0x%08X is unknown)", 
@@ -866,7 +873,7 @@ void ImageLoaderMachO::parseLoadCmds(const LinkContext& context)
 		this->setDyldInfo(dyldInfo);
 	if ( chainedFixupsCmd != NULL )
     {
-        printf("setChainedFixups\n");
+        DL_LOG_DEBUG(logging::kLogBind, "dyld: %s uses chained fixups\n", this->getShortName());
         this->setChainedFixups(chainedFixupsCmd);
     }
 	if ( exportsTrieCmd != NULL )
@@ -1035,6 +1042,19 @@ void ImageLoaderMachO::UnmapSegments()
 {
 	// usually unmap image when done
 	if ( ! this->leaveMapped() && (this->getState() >= dyld_image_state_mapped) ) {
+		// images packed into the address arena hand back exactly the range allocate() gave them,
+		// which does not start at the lowest segment when the image slid inside it. Unmapping
+		// segments in there would punch holes the arena still hands out with MAP_FIXED.
+		if ( fArenaStart != 0 ) {
+			uint64_t totalSize = 0;
+			for(unsigned int i=0; i < fSegmentsCount; ++i)
+				totalSize += segSize(i);
+			if ( !AddressArena::shared()->release(fArenaStart, fArenaLength) )
+				dyld::warn("0x%08lX is not a live range of the address arena, leaving %s mapped\n", fArenaStart, this->getPath());
+			loadstats::add(kLoadStatSegmentsMapped, -(uint64_t)fSegmentsCount);
+			loadstats::add(kLoadStatBytesMapped, -totalSize);
+			return;
+		}
 		// unmap TEXT segment last because it contains load command being inspected
 		unsigned int textSegmentIndex = 0;
 		for(unsigned int i=0; i < fSegmentsCount; ++i) {
@@ -1043,15 +1063,15 @@ void ImageLoaderMachO::UnmapSegments()
 				textSegmentIndex = i;
 			}
 			else {
-				// update stats
-				--ImageLoader::fgTotalSegmentsMapped;
-				ImageLoader::fgTotalBytesMapped -= segSize(i);
+				// update stats, what the image mapped stays in its own statistics
+				loadstats::add(kLoadStatSegmentsMapped, -(uint64_t)1);
+				loadstats::add(kLoadStatBytesMapped, -(uint64_t)segSize(i));
 				munmap((void*)segActualLoadAddress(i), segSize(i));
 			}
 		}
 		// now unmap TEXT
-		--ImageLoader::fgTotalSegmentsMapped;
-		ImageLoader::fgTotalBytesMapped -= segSize(textSegmentIndex);
+		loadstats::add(kLoadStatSegmentsMapped, -(uint64_t)1);
+		loadstats::add(kLoadStatBytesMapped, -(uint64_t)segSize(textSegmentIndex));
 		munmap((void*)segActualLoadAddress(textSegmentIndex), segSize(textSegmentIndex));
 	}
 }
@@ -1141,7 +1161,7 @@ void ImageLoaderMachO::setSlide(intptr_t slide)
 
 void ImageLoaderMachO::loadCodeSignature(const struct linkedit_data_command* codeSigCmd, int fd,  uint64_t offsetInFatFile, const LinkContext& context)
 {
-	dyld3::ScopedTimer(DBG_DYLD_TIMING_ATTACH_CODESIGNATURE, 0, 0, 0);
+	dyld3::ScopedTimer timer(DBG_DYLD_TIMING_ATTACH_CODESIGNATURE, 0, 0, 0, this->getShortName());
 	// if dylib being loaded has no code signature load command
 	if ( codeSigCmd == NULL) {
 		disableCoverageCheck();
@@ -1200,21 +1220,21 @@ void ImageLoaderMachO::loadCodeSignature(const struct linkedit_data_command* cod
 void ImageLoaderMachO::validateFirstPages(const struct linkedit_data_command* codeSigCmd, int fd, const uint8_t *fileData, size_t lenFileData, off_t offsetInFat, const LinkContext& context)
 {
     
-    printf("ImageLoaderMachO::validateFirstPages\n\n");
+    DL_LOG_DEBUG(logging::kLogCodeSign, "dyld: validating first pages of %s\n", this->getShortName());
     
     
 #if TARGET_OS_OSX
 	// rdar://problem/21839703> 15A226d: dyld crashes in mageLoaderMachO::validateFirstPages during dlopen() after encountering an mmap failure
 	// We need to ignore older code signatures because they will be bad.
 	if ( this->sdkVersion() < DYLD_PACKED_VERSION(10,9,0) ) {
-        printf("ImageLoaderMachO::validateFirstPages: 0\n\n");
+        DL_LOG_DEBUG(logging::kLogCodeSign, "dyld: %s predates 10.9, first pages not validated\n", this->getShortName());
         
 		return;
 	}
 #endif
 #if !UNSIGN_TOLERANT
 	if (codeSigCmd != NULL) {
-        printf("ImageLoaderMachO::validateFirstPages: 1\n\n");
+        DL_LOG_DEBUG(logging::kLogCodeSign, "dyld: comparing first pages of %s with its file\n", this->getShortName());
         
 		void *fdata = xmmap(NULL, lenFileData, PROT_READ, MAP_SHARED, fd, offsetInFat);
 		if ( fdata == MAP_FAILED ) {
@@ -1234,7 +1254,7 @@ void ImageLoaderMachO::validateFirstPages(const struct linkedit_data_command* co
 	}
     else
     {
-        printf("ImageLoaderMachO::validateFirstPages: 2\n\n");
+        DL_LOG_DEBUG(logging::kLogCodeSign, "dyld: %s has no code signature\n", this->getShortName());
     }
 #endif
 }
@@ -1657,8 +1677,10 @@ void ImageLoaderMachO::doRebase(const LinkContext& context)
 #endif
 
 	// if loaded at preferred address, no rebasing necessary
-	if ( this->fSlide == 0 )
+	if ( this->fSlide == 0 ) {
+		this->addStat(kLoadStatImagesRebaseSkipped, 1);
 		return;
+	}
 
 #if TEXT_RELOC_SUPPORT
 	// if there are __TEXT fixups, temporarily make __TEXT writable
@@ -1792,27 +1814,10 @@ const char* ImageLoaderMachO::getImportedSymbolName(const ImageLoader::Symbol* s
 
 bool ImageLoaderMachO::getSectionContent(const char* segmentName, const char* sectionName, void** start, size_t* length)
 {
-	const uint32_t cmd_count = ((macho_header*)fMachOData)->ncmds;
-	const struct load_command* const cmds = (struct load_command*)&fMachOData[sizeof(macho_header)];
-	const struct load_command* cmd = cmds;
-	for (uint32_t i = 0; i < cmd_count; ++i) {
-		switch (cmd->cmd) {
-			case LC_SEGMENT_COMMAND:
-				{
-					const struct macho_segment_command* seg = (struct macho_segment_command*)cmd;
-					const struct macho_section* const sectionsStart = (struct macho_section*)((char*)seg + sizeof(struct macho_segment_command));
-					const struct macho_section* const sectionsEnd = &sectionsStart[seg->nsects];
-					for (const struct macho_section* sect=sectionsStart; sect < sectionsEnd; ++sect) {
-						if ( (strcmp(sect->segname, segmentName) == 0) && (strcmp(sect->sectname, sectionName) == 0) ) {
-							*start = (uintptr_t*)(sect->addr + fSlide);
-							*length = sect->size;
-							return true;
-						}
-					}
-				}
-				break;
-		}
-		cmd = (const struct load_command*)(((char*)cmd)+cmd->cmdsize);
+	if ( const SectionIndex::Entry* sect = fSectionIndex.find(segmentName, sectionName) ) {
+		*start = (uintptr_t*)(sect->addr + fSlide);
+		*length = sect->size;
+		return true;
 	}
 	*start = NULL;
 	*length = 0;
@@ -1885,29 +1890,9 @@ bool ImageLoaderMachO::findSection(const mach_header* mh, const char* segmentNam
 
 const macho_section* ImageLoaderMachO::findSection(const void* imageInterior) const
 {
-	const uint32_t cmd_count = ((macho_header*)fMachOData)->ncmds;
-	const struct load_command* const cmds = (struct load_command*)&fMachOData[sizeof(macho_header)];
-	const struct load_command* cmd = cmds;
 	const uintptr_t unslidInteriorAddress = (uintptr_t)imageInterior - this->getSlide();
-	for (uint32_t i = 0; i < cmd_count; ++i) {
-		switch (cmd->cmd) {
-			case LC_SEGMENT_COMMAND:
-				{
-					const struct macho_segment_command* seg = (struct macho_segment_command*)cmd;
-					if ( (unslidInteriorAddress >= seg->vmaddr) && (unslidInteriorAddress < (seg->vmaddr+seg->vmsize)) ) {
-						const struct macho_section* const sectionsStart = (struct macho_section*)((char*)seg + sizeof(struct macho_segment_command));
-						const struct macho_section* const sectionsEnd = &sectionsStart[seg->nsects];
-						for (const struct macho_section* sect=sectionsStart; sect < sectionsEnd; ++sect) {
-							if ((sect->addr <= unslidInteriorAddress) && (unslidInteriorAddress < (sect->addr+sect->size))) {
-								return sect;
-							}
-						}
-					}
-				}
-				break;
-		}
-		cmd = (const struct load_command*)(((char*)cmd)+cmd->cmdsize);
-	}
+	if ( const SectionIndex::Entry* sect = fSectionIndex.findContaining(unslidInteriorAddress) )
+		return (macho_section*)&fMachOData[sect->sectionOffset];
 	return nullptr;
 }
 
@@ -1961,11 +1946,17 @@ const char* ImageLoaderMachO::libPath(unsigned int index) const
 void __attribute__((noreturn)) ImageLoaderMachO::throwSymbolNotFound(const LinkContext& context, const char* symbol, 
 																	const char* referencedFrom, const char* fromVersMismatch,
 																	const char* expectedIn)
+{
+	throw symbolNotFound(context, symbol, referencedFrom, fromVersMismatch, expectedIn);
+}
+
+const char* ImageLoaderMachO::symbolNotFound(const LinkContext& context, const char* symbol, const char* referencedFrom,
+											 const char* fromVersMismatch, const char* expectedIn)
 {
 	// record values for possible use by CrashReporter or Finder
 	(*context.setErrorStrings)(DYLD_EXIT_REASON_SYMBOL_MISSING, referencedFrom, expectedIn, symbol);
-	dyld::throwf("Symbol not found: %s\n  Referenced from: %s%s\n  Expected in: %s\n",
-					symbol, referencedFrom, fromVersMismatch, expectedIn);
+	return dyld::mkstringf("Symbol not found: %s\n  Referenced from: %s%s\n  Expected in: %s\n",
+						   symbol, referencedFrom, fromVersMismatch, expectedIn);
 }
 
 const mach_header* ImageLoaderMachO::machHeader() const
@@ -2069,9 +2060,6 @@ uintptr_t ImageLoaderMachO::bindLocation(const LinkContext& context, uintptr_t b
 			dyld::throwf("bad bind type %d", type);
 	}
 	
-	// update statistics
-	++fgTotalBindFixups;
-	
 	return newValue;
 }
 
@@ -2292,7 +2280,7 @@ void ImageLoaderMachO::doImageInit(const LinkContext& context)
 					if ( context.verboseInit )
 						dyld::log("dyld: calling -init function %p in %s\n", func, this->getPath());
 					{
-						dyld3::ScopedTimer(DBG_DYLD_TIMING_STATIC_INITIALIZER, (uint64_t)fMachOData, (uint64_t)func, 0);
+						dyld3::ScopedTimer timer(DBG_DYLD_TIMING_STATIC_INITIALIZER, (uint64_t)fMachOData, (uint64_t)func, 0, this->getShortName());
 						func(context.argc, context.argv, context.envp, context.apple, &context.programVars);
 					}
 					break;
@@ -2349,7 +2337,7 @@ void ImageLoaderMachO::doModInitFunctions(const LinkContext& context)
 								dyld::log("dyld: calling initializer function %p in %s\n", func, this->getPath());
 							bool haveLibSystemHelpersBefore = (dyld::gLibSystemHelpers != NULL);
 							{
-								dyld3::ScopedTimer(DBG_DYLD_TIMING_STATIC_INITIALIZER, (uint64_t)fMachOData, (uint64_t)func, 0);
+								dyld3::ScopedTimer timer(DBG_DYLD_TIMING_STATIC_INITIALIZER, (uint64_t)fMachOData, (uint64_t)func, 0, this->getShortName());
 								func(context.argc, context.argv, context.envp, context.apple, &context.programVars);
 							}
 							bool haveLibSystemHelpersAfter = (dyld::gLibSystemHelpers != NULL);
@@ -2387,7 +2375,7 @@ void ImageLoaderMachO::doModInitFunctions(const LinkContext& context)
 #endif
 							bool haveLibSystemHelpersBefore = (dyld::gLibSystemHelpers != NULL);
 							{
-								dyld3::ScopedTimer(DBG_DYLD_TIMING_STATIC_INITIALIZER, (uint64_t)fMachOData, (uint64_t)func, 0);
+								dyld3::ScopedTimer timer(DBG_DYLD_TIMING_STATIC_INITIALIZER, (uint64_t)fMachOData, (uint64_t)func, 0, this->getShortName());
                                 func(context.argc, context.argv, context.envp, context.apple, &context.programVars);
                             }
 							bool haveLibSystemHelpersAfter = (dyld::gLibSystemHelpers != NULL);
@@ -2409,33 +2397,19 @@ void ImageLoaderMachO::doModInitFunctions(const LinkContext& context)
 void ImageLoaderMachO::doGetDOFSections(const LinkContext& context, std::vector<ImageLoader::DOFInfo>& dofs)
 {
 	if ( fHasDOFSections ) {
-		// walk load commands (mapped in at start of __TEXT segment)
-		const uint32_t cmd_count = ((macho_header*)fMachOData)->ncmds;
-		const struct load_command* const cmds = (struct load_command*)&fMachOData[sizeof(macho_header)];
-		const struct load_command* cmd = cmds;
-		for (uint32_t i = 0; i < cmd_count; ++i) {
-			switch (cmd->cmd) {
-				case LC_SEGMENT_COMMAND:
-					{
-						const struct macho_segment_command* seg = (struct macho_segment_command*)cmd;
-						const struct macho_section* const sectionsStart = (struct macho_section*)((char*)seg + sizeof(struct macho_segment_command));
-						const struct macho_section* const sectionsEnd = &sectionsStart[seg->nsects];
-						for (const struct macho_section* sect=sectionsStart; sect < sectionsEnd; ++sect) {
-							if ( (sect->flags & SECTION_TYPE) == S_DTRACE_DOF ) {
-								// <rdar://problem/23929217> Ensure section is within segment
-								if ( (sect->addr < seg->vmaddr) || (sect->addr+sect->size > seg->vmaddr+seg->vmsize) || (sect->addr+sect->size < sect->addr) )
-									dyld::throwf("DOF section has malformed address range for %s\n", this->getPath());
-								ImageLoader::DOFInfo info;
-								info.dof			= (void*)(sect->addr + fSlide);
-								info.imageHeader	= this->machHeader();
-								info.imageShortName = this->getShortName();
-								dofs.push_back(info);
-							}
-						}
-					}
-					break;
+		for (size_t i=0; i < fSectionIndex.count(); ++i) {
+			const SectionIndex::Entry& sect = fSectionIndex.entry(i);
+			if ( sect.type == S_DTRACE_DOF ) {
+				const struct macho_segment_command* seg = (struct macho_segment_command*)&fMachOData[sect.segmentOffset];
+				// <rdar://problem/23929217> Ensure section is within segment
+				if ( (sect.addr < seg->vmaddr) || (sect.addr+sect.size > seg->vmaddr+seg->vmsize) || (sect.addr+sect.size < sect.addr) )
+					dyld::throwf("DOF section has malformed address range for %s\n", this->getPath());
+				ImageLoader::DOFInfo info;
+				info.dof			= (void*)(sect.addr + fSlide);
+				info.imageHeader	= this->machHeader();
+				info.imageShortName = this->getShortName();
+				dofs.push_back(info);
 			}
-			cmd = (const struct load_command*)(((char*)cmd)+cmd->cmdsize);
 		}
 	}
 }	
@@ -2510,7 +2484,6 @@ void ImageLoaderMachO::doTermination(const LinkContext& context)
 void ImageLoaderMachO::printStatisticsDetails(unsigned int imageCount, const InitializerTimingList& timingInfo)
 {
 	ImageLoader::printStatisticsDetails(imageCount, timingInfo);
-	dyld::log("total symbol trie searches:    %d\n", fgSymbolTrieSearchs);
 	dyld::log("total symbol table binary searches:    %d\n", fgSymbolTableBinarySearchs);
 	dyld::log("total images defining weak symbols:  %u\n", fgImagesHasWeakDefinitions);
 	dyld::log("total images using weak symbols:  %u\n", fgImagesRequiringCoalescing);
@@ -2557,15 +2530,31 @@ intptr_t ImageLoaderMachO::assignSegmentAddresses(const LinkContext& context, si
 				}
 			}
 #endif
+			// with preferLoadAddress the whole span is reserved at once below
+			if ( context.preferLoadAddress )
+				continue;
 			if ( needsToSlide || !imageHasPreferredLoadAddress || inPIE || !reserveAddressRange(segPreferredLoadAddress(i), segSize(i)) )
 				needsToSlide = true;
 		}
+		bool spanReserved = false;
+		if ( context.preferLoadAddress && !needsToSlide && imageHasPreferredLoadAddress ) {
+			// one reservation covering every segment and the extra allocation, even in PIE programs,
+			// so a partial fit never leaves segments reserved that then have to slide anyway
+			spanReserved = reserveAddressRange(lowAddr, highAddr-lowAddr+extraAllocationSize);
+			if ( !spanReserved ) {
+				this->addStat(kLoadStatPreferredLoadAddressMisses, 1);
+				needsToSlide = true;
+			}
+			if ( context.verboseMapping )
+				dyld::log("dyld: %s preferred address 0x%08lX->0x%08lX for %s\n", spanReserved ? "using" : "can't use",
+						  lowAddr, highAddr-1, this->getPath());
+		}
 		if ( needsToSlide ) {
 			// find a chunk of address space to hold all segments
 			size_t size = highAddr-lowAddr+segmentReAlignSlide;
 			uintptr_t addr = reserveAnAddressRange(size+extraAllocationSize, context);
 			slide = addr - lowAddr + segmentReAlignSlide;
-		} else if ( extraAllocationSize ) {
+		} else if ( extraAllocationSize && !spanReserved ) {
 			if (!reserveAddressRange(highAddr, extraAllocationSize)) {
 				throw "failed to reserve space for aot";
 			}
@@ -2598,6 +2587,17 @@ intptr_t ImageLoaderMachO::assignSegmentAddresses(const LinkContext& context, si
 
 uintptr_t ImageLoaderMachO::reserveAnAddressRange(size_t length, const ImageLoader::LinkContext& context)
 {
+	// pack images next to each other, only a full arena falls back to a range of their own
+	if ( context.addressArena != NULL ) {
+		if ( uintptr_t addr = context.addressArena->allocate(length) ) {
+			fArenaStart = addr;
+			fArenaLength = length;
+			return addr;
+		}
+		if ( context.verboseMapping )
+			dyld::log("dyld: address arena full, reserving 0x%08lX bytes outside of it\n", (uintptr_t)length);
+	}
+
 	vm_address_t addr = 0;
 	vm_size_t size = length;
 	// in PIE programs, load initial dylibs after main executable so they don't have fixed addresses either
@@ -2645,6 +2645,8 @@ void ImageLoaderMachO::mapSegments(int fd, uint64_t offsetInFat, uint64_t lenInF
 #endif
 
 	// find address range for image
+	dyld3::ScopedTimer timer(DBG_DYLD_TIMING_MAP_IMAGE, 0, 0, 0, this->getShortName());
+	const uint64_t t0 = mach_absolute_time();
 	intptr_t slide = this->assignSegmentAddresses(context, extra_allocation_size);
 	if ( context.verboseMapping ) {
 		if ( offsetInFat != 0 )
@@ -2725,8 +2727,8 @@ void ImageLoaderMachO::mapSegments(int fd, uint64_t offsetInFat, uint64_t lenInF
 			}
 		}
 		// update stats
-		++ImageLoader::fgTotalSegmentsMapped;
-		ImageLoader::fgTotalBytesMapped += size;
+		this->addStat(kLoadStatSegmentsMapped, 1);
+		this->addStat(kLoadStatBytesMapped, size);
 		if ( context.verboseMapping )
 			dyld::log("%18s at 0x%08lX->0x%08lX with permissions %c%c%c\n", segName(i), requestedLoadAddress, requestedLoadAddress+size-1,
 				(protection & PROT_READ) ? 'r' : '.',  (protection & PROT_WRITE) ? 'w' : '.',  (protection & PROT_EXEC) ? 'x' : '.' );
@@ -2752,11 +2754,14 @@ void ImageLoaderMachO::mapSegments(int fd, uint64_t offsetInFat, uint64_t lenInF
 
 	// update slide to reflect load location			
 	this->setSlide(slide);
+	this->addStat(kLoadStatMapTime, mach_absolute_time() - t0);
 }
 
-void ImageLoaderMachO::mapSegments(const void* memoryImage, uint64_t imageLen, const LinkContext& context)
+void ImageLoaderMachO::mapSegments(const void* memoryImage, uint64_t imageLen, const LinkContext& context, int fd)
 {
 	// find address range for image
+	dyld3::ScopedTimer timer(DBG_DYLD_TIMING_MAP_IMAGE, 0, 0, 0, this->getShortName());
+	const uint64_t t0 = mach_absolute_time();
 	intptr_t slide = this->assignSegmentAddresses(context, 0);
 	if ( context.verboseMapping )
 		dyld::log("dyld: Mapping memory %p\n", memoryImage);
@@ -2765,14 +2770,40 @@ void ImageLoaderMachO::mapSegments(const void* memoryImage, uint64_t imageLen, c
 		vm_address_t loadAddress = segPreferredLoadAddress(i) + slide;
 		vm_address_t srcAddr = (uintptr_t)memoryImage + segFileOffset(i);
 		vm_size_t size = segFileSize(i);
-		kern_return_t r = vm_copy(mach_task_self(), srcAddr, size, loadAddress);
-        
-                     
-        
-		if ( r != KERN_SUCCESS )
-			throw "can't map segment";
+		SegmentCopyStrategy strategy = kSegmentCopyMemcpy;
+		// wholly zero-fill segments have nothing to copy in
+		if ( size > 0 ) {
+			if ( (segFileOffset(i)+size) > imageLen )
+				dyld::throwf("truncated mach-o error: segment %s extends to %llu which is past end of image %llu",
+								segName(i), (uint64_t)(segFileOffset(i)+size), imageLen);
+			// when the memory image is a mapping of fd, read-only data (e.g. __LINKEDIT) is
+			// mapped straight from the file; the destination is fresh zero-fill memory, so
+			// copies leave all-zero pages untouched
+			const SegmentPlacement placed = placeSegment((void*)loadAddress, (const void*)srcAddr, size, dyld_page_size,
+														 segWriteable(i), segExecutable(i), fd, segFileOffset(i));
+			strategy = placed.strategy;
+			if ( placed.error != 0 )
+				dyld::throwf("mmap() errno=%d at address=0x%08lX, size=0x%08lX segment=%s mapping %s",
+					placed.error, (uintptr_t)loadAddress, (uintptr_t)size, segName(i), getPath());
+			if ( strategy == kSegmentCopyRemap ) {
+				// vm_copy() of a page aligned source is copy-on-write, so pages are
+				// only duplicated once something (fixups) writes to them
+				kern_return_t r = vm_copy(mach_task_self(), srcAddr, size, loadAddress);
+				if ( r != KERN_SUCCESS )
+					throw "can't map segment";
+				this->addStat(kLoadStatBytesRemapped, size);
+			}
+			else if ( strategy != kSegmentCopyMapFile ) {
+				this->addStat(kLoadStatBytesCopied, placed.written);
+				this->addStat(kLoadStatBytesZeroPagesSkipped, size - placed.written);
+			}
+		}
+		// update stats
+		this->addStat(kLoadStatSegmentsMapped, 1);
+		this->addStat(kLoadStatBytesMapped, size);
 		if ( context.verboseMapping )
-			dyld::log("%18s at 0x%08lX->0x%08lX\n", segName(i), (uintptr_t)loadAddress, (uintptr_t)loadAddress+size-1);
+			dyld::log("%18s at 0x%08lX->0x%08lX (%s)\n", segName(i), (uintptr_t)loadAddress, (uintptr_t)loadAddress+size-1,
+					  segmentCopyName(strategy));
         
         /*
         if (mlock((void *)loadAddress, size) != 0) {
@@ -2790,6 +2821,76 @@ void ImageLoaderMachO::mapSegments(const void* memoryImage, uint64_t imageLen, c
 	for(unsigned int i=0, e=segmentCount(); i < e; ++i) {
 		segProtect(i, context);
 	}
+	this->addStat(kLoadStatMapTime, mach_absolute_time() - t0);
+}
+
+bool ImageLoaderMachO::adoptSegments(void* memoryImage, uint64_t imageLen, const LinkContext& context)
+{
+	// caller gave us ownership of a page aligned buffer holding the whole file.  If every
+	// segment already sits at its VM offset in that buffer, use those pages as the image
+	const uintptr_t bufferStart = (uintptr_t)memoryImage;
+	const uintptr_t bufferEnd = bufferStart + dyld_page_round(imageLen);
+	bool inPlace = ((bufferStart & (dyld_page_size-1)) == 0) && this->segmentsCanSlide() && this->segmentsMustSlideTogether();
+	uintptr_t lowAddr = (unsigned long)(-1);
+	for(unsigned int i=0, e=segmentCount(); inPlace && (i < e); ++i) {
+		if ( segPreferredLoadAddress(i) < lowAddr )
+			lowAddr = segPreferredLoadAddress(i);
+	}
+	for(unsigned int i=0, e=segmentCount(); inPlace && (i < e); ++i) {
+		const uintptr_t vmOffset = segPreferredLoadAddress(i) - lowAddr;
+		const uintptr_t segEnd = bufferStart + dyld_page_round(vmOffset + segSize(i));
+		if ( (segFileSize(i) != 0) && (segFileOffset(i) != vmOffset) )
+			inPlace = false;
+		else if ( (segFileSize(i) > segSize(i)) || (segEnd > bufferEnd) )
+			inPlace = false;
+	}
+	if ( !inPlace ) {
+		if ( context.verboseMapping )
+			dyld::log("dyld: Segments of %p do not match their VM layout, copying\n", memoryImage);
+		this->addStat(kLoadStatImagesAdoptedByCopy, 1);
+		this->mapSegments(memoryImage, imageLen, context);
+		return false;
+	}
+
+	if ( context.verboseMapping )
+		dyld::log("dyld: Mapping memory %p in place\n", memoryImage);
+	for(unsigned int i=0, e=segmentCount(); i < e; ++i) {
+		uint8_t* loadAddress = (uint8_t*)(bufferStart + segPreferredLoadAddress(i) - lowAddr);
+		// whatever follows the file content up to the end of the segment must read as zero-fill
+		if ( segSize(i) > segFileSize(i) )
+			bzero(&loadAddress[segFileSize(i)], segSize(i) - segFileSize(i));
+		this->addStat(kLoadStatSegmentsMapped, 1);
+		this->addStat(kLoadStatBytesMapped, segFileSize(i));
+		if ( context.verboseMapping )
+			dyld::log("%18s at 0x%08lX->0x%08lX (in place)\n", segName(i), (uintptr_t)loadAddress, (uintptr_t)loadAddress+segSize(i)-1);
+	}
+	this->addStat(kLoadStatImagesAdoptedInPlace, 1);
+
+	this->setSlide(bufferStart - lowAddr);
+	for(unsigned int i=0, e=segmentCount(); i < e; ++i) {
+		segProtect(i, context);
+	}
+
+	// pages between the segments and past the last one (e.g. padding, rounding slack) are not
+	// part of the image and nothing would ever unmap them, so give them back now
+	uintptr_t covered = bufferStart;
+	while ( covered < bufferEnd ) {
+		// lowest segment that reaches past what is covered so far
+		uintptr_t nextStart = bufferEnd;
+		uintptr_t nextEnd = bufferEnd;
+		for(unsigned int i=0, e=segmentCount(); i < e; ++i) {
+			const uintptr_t segStart = segActualLoadAddress(i);
+			const uintptr_t segEnd = dyld_page_round(segStart + segSize(i));
+			if ( (segEnd > covered) && (dyld_page_trunc(segStart) < nextStart) ) {
+				nextStart = dyld_page_trunc(segStart);
+				nextEnd = segEnd;
+			}
+		}
+		if ( nextStart > covered )
+			munmap((void*)covered, nextStart - covered);
+		covered = nextEnd;
+	}
+	return true;
 }
 
 static vm_prot_t protectionForSegIndex(const ImageLoaderMachO* image, unsigned int segIndex)
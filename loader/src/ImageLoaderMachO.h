@@ -37,6 +37,7 @@
 #endif
 
 #include "ImageLoader.h"
+#include "SectionIndex.h"
 
 #define BIND_TYPE_THREADED_BIND 100
 
@@ -55,7 +56,8 @@ public:
 	static ImageLoader*					instantiateFromFile(const char* path, int fd, const uint8_t firstPages[], size_t firstPagesSize, uint64_t offsetInFat,
 															uint64_t lenInFat, const struct stat& info, const LinkContext& context);
 	static ImageLoader*					instantiateFromCache(const macho_header* mh, const char* path, long slide, const struct stat& info, const LinkContext& context);
-	static ImageLoader*					instantiateFromMemory(const char* moduleName, const macho_header* mh, uint64_t len, const LinkContext& context);
+	static ImageLoader*					instantiateFromMemory(const char* moduleName, const macho_header* mh, uint64_t len, const LinkContext& context,
+															int fd=-1, bool adoptMemory=false);
 
 
 	bool								inSharedCache() const { return fInSharedCache; }
@@ -201,7 +203,7 @@ protected:
 	virtual	void		getRPaths(const LinkContext& context, std::vector<const char*>&) const;
 	virtual	bool		getUUID(uuid_t) const;
 	virtual void		doRebase(const LinkContext& context);
-	virtual void		doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent) = 0;
+	virtual const char*	doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent) = 0;
 	virtual void		doBindJustLazies(const LinkContext& context) = 0;
 	virtual bool		doInitialization(const LinkContext& context);
 	virtual void		doGetDOFSections(const LinkContext& context, std::vector<ImageLoader::DOFInfo>& dofs);
@@ -237,11 +239,15 @@ protected:
 			uintptr_t	reserveAnAddressRange(size_t length, const ImageLoader::LinkContext& context);
 			bool		reserveAddressRange(uintptr_t start, size_t length);
 			void		mapSegments(int fd, uint64_t offsetInFat, uint64_t lenInFat, uint64_t fileLen, const LinkContext& context);
-			void		mapSegments(const void* memoryImage, uint64_t imageLen, const LinkContext& context);
+			void		mapSegments(const void* memoryImage, uint64_t imageLen, const LinkContext& context, int fd=-1);
+			bool		adoptSegments(void* memoryImage, uint64_t imageLen, const LinkContext& context);
 			void		UnmapSegments();
 			void		__attribute__((noreturn)) throwSymbolNotFound(const LinkContext& context, const char* symbol, 
 																	const char* referencedFrom, const char* fromVersMismatch,
 																	const char* expectedIn);
+			// the message throwSymbolNotFound() throws, for callers that report it instead
+			const char*	symbolNotFound(const LinkContext& context, const char* symbol, const char* referencedFrom,
+											const char* fromVersMismatch, const char* expectedIn);
 			void		doImageInit(const LinkContext& context);
 			void		doModInitFunctions(const LinkContext& context);
 			void		setupLazyPointerHandler(const LinkContext& context);
@@ -264,6 +270,9 @@ protected:
 	uint32_t								fEHFrameSectionOffset;
 	uint32_t								fUnwindInfoSectionOffset;
 	uint32_t								fDylibIDOffset;
+	SectionIndex							fSectionIndex;		// filled by parseLoadCmds()
+	uintptr_t								fArenaStart;		// range allocate() gave the image in the address arena, 0 if none
+	size_t									fArenaLength;
 	uint32_t								fSegmentsCount : 8,
 											fIsSplitSeg : 1,
 											fInSharedCache : 1,
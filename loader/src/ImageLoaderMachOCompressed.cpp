@@ -48,6 +48,17 @@
 #include "Closure.h"
 #endif
 #include "Array.h"
+#include "ChainedFixups.h"
+#include "ImageLoaderProxy.h"
+#include "MappedFile.h"
+#include "RebaseRuns.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
 
 #ifndef BIND_SUBOPCODE_THREADED_SET_JOP
    #define BIND_SUBOPCODE_THREADED_SET_JOP								0x0F
@@ -72,6 +83,22 @@ namespace isolator {
 	struct macho_routines_command	: public routines_command  {};	
 #endif
 
+//
+// Link plans used in this process, keyed by plan file path.  Besides the mapped plan they
+// remember imports that resolved into system libraries (ImageLoaderProxy), which stay at
+// the same address for the life of the process, so later loads skip those lookups too.
+//
+struct CachedLinkPlan {
+	MappedFile							file;
+	std::mutex							lock;
+	std::vector<bool>					resolved;
+	std::vector<uintptr_t>				resolvedAddress;
+	std::vector<const ImageLoader*>		resolvedIn;
+};
+
+static std::mutex								sLinkPlansLock;
+static std::map<std::string, CachedLinkPlan*>	sLinkPlans;
+
 
 
 // create image for main executable
@@ -233,21 +260,26 @@ ImageLoaderMachOCompressed* ImageLoaderMachOCompressed::instantiateFromCache(con
 
 // create image by copying an in-memory mach-o file
 ImageLoaderMachOCompressed* ImageLoaderMachOCompressed::instantiateFromMemory(const char* moduleName, const macho_header* mh, uint64_t len,
-															unsigned int segCount, unsigned int libCount, const LinkContext& context)
+															unsigned int segCount, unsigned int libCount, const LinkContext& context,
+															int fd, bool adoptMemory)
 {
     
     //printf("instantiateFromMemory\n");
     
     
 	ImageLoaderMachOCompressed* image = ImageLoaderMachOCompressed::instantiateStart(mh, moduleName, segCount, libCount);
+	bool adoptedInPlace = false;
 	try {
 		// map segments 
 		if ( mh->filetype == MH_EXECUTE ) 
 			throw "can't load another MH_EXECUTE";
 		
-		// vmcopy segments
+		// vmcopy segments, or use caller's pages directly when it gave them to us
         //printf("invoking 'image->mapSegments' \n");
-		image->mapSegments((const void*)mh, len, context);
+		if ( adoptMemory )
+			adoptedInPlace = image->adoptSegments((void*)mh, len, context);
+		else
+			image->mapSegments((const void*)mh, len, context, fd);
 
 		// for compatibility, never unload dylibs loaded from memory
 #if !UNSIGN_TOLERANT
@@ -261,13 +293,28 @@ ImageLoaderMachOCompressed* ImageLoaderMachOCompressed::instantiateFromMemory(co
 
 		image->instantiateFinish(context);
 		image->setMapped(context);
+
+		// load commands were read from the adopted buffer until now, so only
+		// release it once the copy is fully set up
+		if ( adoptMemory && !adoptedInPlace )
+			munmap((void*)mh, (size_t)dyld_page_round(len));
 	}
 	catch (...) {
         
         //printf("instantiateFromMemory: catch\n");
 		// ImageLoader::setMapped() can throw an exception to block loading of image
 		// <rdar://problem/6169686> Leaked fSegmentsArray and image segments during failed dlopen_preflight
+		// Segments adopted in place are what is left of the buffer, so they are unmapped exactly
+		// once: by the image when it unmaps itself, otherwise here. Unmapping the whole buffer
+		// after that could hit whatever has been mapped there since.
+		if ( adoptedInPlace && (image->leaveMapped() || (image->getState() < dyld_image_state_mapped)) ) {
+			for(unsigned int i=0, e=image->segmentCount(); i < e; ++i)
+				munmap((void*)image->segActualLoadAddress(i), image->segSize(i));
+		}
 		delete image;
+		// a buffer whose segments were copied out still belongs to us when loading fails
+		if ( adoptMemory && !adoptedInPlace )
+			munmap((void*)mh, (size_t)dyld_page_round(len));
 		throw;
 	}
     
@@ -279,7 +326,8 @@ ImageLoaderMachOCompressed* ImageLoaderMachOCompressed::instantiateFromMemory(co
 
 ImageLoaderMachOCompressed::ImageLoaderMachOCompressed(const macho_header* mh, const char* path, unsigned int segCount, 
 																		uint32_t segOffsets[], unsigned int libCount)
- : ImageLoaderMachO(mh, path, segCount, segOffsets, libCount), fDyldInfo(NULL), fChainedFixups(NULL), fExportsTrie(NULL)
+ : ImageLoaderMachO(mh, path, segCount, segOffsets, libCount), fDyldInfo(NULL), fChainedFixups(NULL), fExportsTrie(NULL),
+	fLinkPlan(NULL), fLinkPlanBuilder(NULL), fLinkPlanLookedUp(false), fExportIndex(NULL)
 {
 }
 
@@ -287,6 +335,8 @@ ImageLoaderMachOCompressed::~ImageLoaderMachOCompressed()
 {
 	// don't do clean up in ~ImageLoaderMachO() because virtual call to segmentCommandOffsets() won't work
 	destroy();
+	delete fLinkPlanBuilder;
+	delete fExportIndex;
 }
 
 
@@ -310,6 +360,9 @@ void ImageLoaderMachOCompressed::instantiateFinish(const LinkContext& context)
 {
 	// now that segments are mapped in, get real fMachOData, fLinkEditBase, and fSlide
 	this->parseLoadCmds(context);
+
+	if ( context.eagerExportIndex )
+		this->exportIndex();
 }
 
 uint32_t* ImageLoaderMachOCompressed::segmentCommandOffsets() const
@@ -352,25 +405,6 @@ void ImageLoaderMachOCompressed::setLibImage(unsigned int libIndex, ImageLoader*
 }
 
 
-void ImageLoaderMachOCompressed::rebaseAt(const LinkContext& context, uintptr_t addr, uintptr_t slide, uint8_t type)
-{
-	if ( context.verboseRebase ) {
-		dyld::log("dyld: rebase: %s:*0x%08lX += 0x%08lX\n", this->getShortName(), (uintptr_t)addr, slide);
-	}
-	//dyld::log("0x%08lX type=%d\n", addr, type);
-	uintptr_t* locationToFix = (uintptr_t*)addr;
-	switch (type) {
-		case REBASE_TYPE_POINTER:
-			*locationToFix += slide;
-			break;
-		case REBASE_TYPE_TEXT_ABSOLUTE32:
-			*locationToFix += slide;
-			break;
-		default:
-			dyld::throwf("bad rebase type %d", type);
-	}
-}
-
 void ImageLoaderMachOCompressed::throwBadRebaseAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 										const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos)
 {
@@ -379,12 +413,42 @@ void ImageLoaderMachOCompressed::throwBadRebaseAddress(uintptr_t address, uintpt
 		segActualLoadAddress(segmentIndex), segmentEndAddress); 
 }
 
+static void checkRebaseType(uint8_t type)
+{
+	if ( (type != REBASE_TYPE_POINTER) && (type != REBASE_TYPE_TEXT_ABSOLUTE32) )
+		dyld::throwf("bad rebase type %d", type);
+}
+
+void ImageLoaderMachOCompressed::addRebaseRun(const LinkContext& context, RebaseSlider& slider, uintptr_t address, uintptr_t count, uintptr_t stride)
+{
+	if ( context.verboseRebase ) {
+		for (uintptr_t i=0; i < count; ++i)
+			dyld::log("dyld: rebase: %s:*0x%08lX += 0x%08lX\n", this->getShortName(), address + i*stride, slider.slide());
+	}
+	slider.add(address, count, stride);
+}
+
 void ImageLoaderMachOCompressed::rebase(const LinkContext& context, uintptr_t slide)
 {
 	// binary uses chained fixups where are applied during binding
 	if ( fDyldInfo == NULL )
 		return;
 
+	// replay precompiled plan instead of interpreting opcodes
+	if ( CachedLinkPlan* plan = this->linkPlan(context) ) {
+		LinkPlanView view(plan->file.address());
+		const LinkPlanFixup* const fixups = view.fixups();
+		RebaseSlider slider(slide);
+		for (uint32_t i=0, e=view.header().fixupCount; i < e; ++i) {
+			if ( fixups[i].kind != kLinkPlanRebase )
+				continue;
+			checkRebaseType(fixups[i].type);
+			addRebaseRun(context, slider, segActualLoadAddress(fixups[i].segIndex) + fixups[i].segOffset, 1, sizeof(uintptr_t));
+		}
+		this->addStat(kLoadStatRebaseFixups, slider.pointerCount());
+		return;
+	}
+
 	CRSetCrashLogMessage2(this->getPath());
 	const uint8_t* const start = fLinkEditBase + fDyldInfo->rebase_off;
 	const uint8_t* const end = &start[fDyldInfo->rebase_size];
@@ -398,6 +462,7 @@ void ImageLoaderMachOCompressed::rebase(const LinkContext& context, uintptr_t sl
 	vmAccountingSetSuspended(context, bindingBecauseOfRoot);
 
 	try {
+		RebaseSlider slider(slide);
 		uint8_t type = 0;
 		int segmentIndex = 0;
 		uintptr_t address = segActualLoadAddress(0);
@@ -405,6 +470,26 @@ void ImageLoaderMachOCompressed::rebase(const LinkContext& context, uintptr_t sl
 		uintptr_t segmentEndAddress = segActualEndAddress(0);
 		uintptr_t count;
 		uintptr_t skip;
+		// every slot of a run must start inside the segment, checked once for the whole run
+		auto addRun = [&](uintptr_t runCount, uintptr_t stride) {
+			if ( runCount == 0 )
+				return;
+			if ( (address < segmentStartAddress) || (address >= segmentEndAddress) )
+				throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
+			// a single slot needs no division, the common REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB case
+			if ( runCount > 1 ) {
+				const uintptr_t inRange = (segmentEndAddress - 1 - address) / stride + 1;
+				if ( runCount > inRange )
+					throwBadRebaseAddress(address + inRange*stride, segmentEndAddress, segmentIndex, start, end, p);
+			}
+			checkRebaseType(type);
+			addRebaseRun(context, slider, address, runCount, stride);
+			if ( fLinkPlanBuilder != NULL ) {
+				for (uintptr_t i=0; i < runCount; ++i)
+					fLinkPlanBuilder->addRebase(segmentIndex, address + i*stride - segmentStartAddress, type);
+			}
+			address += runCount * stride;
+		};
 		bool done = false;
 		while ( !done && (p < end) ) {
 			uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
@@ -440,50 +525,29 @@ void ImageLoaderMachOCompressed::rebase(const LinkContext& context, uintptr_t sl
 					address += immediate*sizeof(uintptr_t);
 					break;
 				case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
-					for (int i=0; i < immediate; ++i) {
-						if ( (address < segmentStartAddress) || (address >= segmentEndAddress) )
-							throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-						rebaseAt(context, address, slide, type);
-						address += sizeof(uintptr_t);
-					}
-					fgTotalRebaseFixups += immediate;
+					addRun(immediate, sizeof(uintptr_t));
 					break;
 				case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
 					count = read_uleb128(p, end);
-					for (uint32_t i=0; i < count; ++i) {
-						if ( (address < segmentStartAddress) || (address >= segmentEndAddress) )
-							throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-						rebaseAt(context, address, slide, type);
-						address += sizeof(uintptr_t);
-					}
-					fgTotalRebaseFixups += count;
+					addRun(count, sizeof(uintptr_t));
 					break;
 				case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
-					if ( (address < segmentStartAddress) || (address >= segmentEndAddress) )
-						throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-					rebaseAt(context, address, slide, type);
-					address += read_uleb128(p, end) + sizeof(uintptr_t);
-					++fgTotalRebaseFixups;
+					addRun(1, sizeof(uintptr_t));
+					address += read_uleb128(p, end);
 					break;
 				case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
 					count = read_uleb128(p, end);
 					skip = read_uleb128(p, end);
-					for (uint32_t i=0; i < count; ++i) {
-						if ( (address < segmentStartAddress) || (address >= segmentEndAddress) )
-							throwBadRebaseAddress(address, segmentEndAddress, segmentIndex, start, end, p);
-						rebaseAt(context, address, slide, type);
-						address += skip + sizeof(uintptr_t);
-					}
-					fgTotalRebaseFixups += count;
+					addRun(count, skip + sizeof(uintptr_t));
 					break;
 				default:
 					dyld::throwf("bad rebase opcode %d", *(p-1));
 			}
 		}
+		this->addStat(kLoadStatRebaseFixups, slider.pointerCount());
 	}
 	catch (const char* msg) {
 		const char* newMsg = dyld::mkstringf("%s in %s", msg, this->getPath());
-		free((void*)msg);
 		throw newMsg;
 	}
 	CRSetCrashLogMessage2(NULL);
@@ -499,10 +563,11 @@ const ImageLoader::Symbol* ImageLoaderMachOCompressed::findShallowExportedSymbol
 #if LOG_BINDINGS
 	dyld::logBindings("%s: %s\n", this->getShortName(), symbol);
 #endif
-	++ImageLoaderMachO::fgSymbolTrieSearchs;
+	this->addStat(kLoadStatSymbolTrieSearches, 1);
 	const uint8_t* start = &fLinkEditBase[trieFileOffset];
 	const uint8_t* end = &start[trieFileSize];
-	const uint8_t* foundNodeStart = this->trieWalk(start, end, symbol); 
+	const ExportIndex* index = this->exportIndex();
+	const uint8_t* foundNodeStart = (index != NULL) ? index->find(start, symbol) : this->trieWalk(start, end, symbol);
 	if ( foundNodeStart != NULL ) {
 		const uint8_t* p = foundNodeStart;
 		const uintptr_t flags = read_uleb128(p, end);
@@ -539,6 +604,73 @@ const ImageLoader::Symbol* ImageLoaderMachOCompressed::findShallowExportedSymbol
 }
 
 
+void ImageLoaderMachOCompressed::findExportedSymbols(const char* prefix, const char* const names[], size_t count,
+													 const Symbol* results[], const ImageLoader* foundIn[]) const
+{
+	if ( count == 0 )
+		return;
+	uint32_t trieFileOffset = fDyldInfo ? fDyldInfo->export_off  : fExportsTrie->dataoff;
+	uint32_t trieFileSize   = fDyldInfo ? fDyldInfo->export_size : fExportsTrie->datasize;
+	if ( trieFileSize == 0 )
+		return ImageLoader::findExportedSymbols(prefix, names, count, results, foundIn);
+	const uint8_t* start = &fLinkEditBase[trieFileOffset];
+	const uint8_t* end = &start[trieFileSize];
+
+	std::vector<const uint8_t*> nodes(count);
+	if ( const ExportIndex* index = this->exportIndex() ) {
+		for (size_t i=0; i < count; ++i)
+			nodes[i] = index->find(start, prefix, names[i]);
+	}
+	else {
+		// sorted, so neighbouring names share trie prefixes
+		std::vector<uint32_t> order(count);
+		for (uint32_t i=0; i < count; ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [names](uint32_t a, uint32_t b) { return strcmp(names[a], names[b]) < 0; });
+		trieWalkSorted(start, end, prefix, names, &order[0], count, &nodes[0]);
+	}
+	this->addStat(kLoadStatSymbolTrieSearches, count);
+
+	// Re-exports and names missing here (which may come from a re-exported
+	// dylib) take the regular path, one name at a time.
+	std::string name;
+	for (size_t i=0; i < count; ++i) {
+		const uint8_t* p = nodes[i];
+		if ( (p != NULL) && ((read_uleb128(p, end) & EXPORT_SYMBOL_FLAGS_REEXPORT) == 0) ) {
+			results[i] = (const Symbol*)nodes[i];
+			foundIn[i] = this;
+			continue;
+		}
+		name.assign(prefix);
+		name.append(names[i]);
+		results[i] = this->findExportedSymbol(name.c_str(), true, &foundIn[i]);
+	}
+}
+
+
+const ExportIndex* ImageLoaderMachOCompressed::exportIndex() const
+{
+	std::call_once(fExportIndexOnce, [this]() {
+		if ( (fDyldInfo == NULL) && (fExportsTrie == NULL) )
+			return;
+		uint32_t trieFileOffset = fDyldInfo ? fDyldInfo->export_off  : fExportsTrie->dataoff;
+		uint32_t trieFileSize   = fDyldInfo ? fDyldInfo->export_size : fExportsTrie->datasize;
+		if ( trieFileSize == 0 )
+			return;
+		const uint8_t* start = &fLinkEditBase[trieFileOffset];
+		ExportIndex* index = new ExportIndex();
+		if ( index->build(start, &start[trieFileSize]) ) {
+			fExportIndex = index;
+		}
+		else {
+			// keep using trieWalk(), which reports the malformed node on lookup
+			delete index;
+		}
+	});
+	return fExportIndex;
+}
+
+
 bool ImageLoaderMachOCompressed::containsSymbol(const void* addr) const
 {
 	uint32_t trieFileOffset = fDyldInfo ? fDyldInfo->export_off  : fExportsTrie->dataoff;
@@ -644,7 +776,7 @@ const char* ImageLoaderMachOCompressed::importedSymbolName(const Symbol* symbol)
 
 
 uintptr_t ImageLoaderMachOCompressed::resolveFlat(const LinkContext& context, const char* symbolName, bool weak_import, 
-													bool runResolver, const ImageLoader** foundIn)
+													bool runResolver, const ImageLoader** foundIn, const char** whyNot)
 {
 	const Symbol* sym;
 	if ( context.flatExportFinder(symbolName, &sym, foundIn) ) {
@@ -663,7 +795,10 @@ uintptr_t ImageLoaderMachOCompressed::resolveFlat(const LinkContext& context, co
 		// definition can't be found anywhere, ok because it is weak, just return 0
 		return 0;
 	}
-	throwSymbolNotFound(context, symbolName, this->getPath(), "", "flat namespace");
+	if ( whyNot == NULL )
+		throwSymbolNotFound(context, symbolName, this->getPath(), "", "flat namespace");
+	*whyNot = symbolNotFound(context, symbolName, this->getPath(), "", "flat namespace");
+	return 0;
 }
 
 #if !UNSIGN_TOLERANT
@@ -703,7 +838,7 @@ static void patchCacheUsesOf(const ImageLoader::LinkContext& context, const dyld
 
 
 uintptr_t ImageLoaderMachOCompressed::resolveWeak(const LinkContext& context, const char* symbolName, bool weak_import,
-												  bool runResolver, const ImageLoader** foundIn)
+												  bool runResolver, const ImageLoader** foundIn, const char** whyNot)
 {
 	const Symbol* sym;
 	CoalesceNotifier notifier = nullptr;
@@ -757,19 +892,33 @@ uintptr_t ImageLoaderMachOCompressed::resolveWeak(const LinkContext& context, co
 		// definition can't be found anywhere, ok because it is weak, just return 0
 		return 0;
 	}
-	throwSymbolNotFound(context, symbolName, this->getPath(), "", "weak");
+	if ( whyNot == NULL )
+		throwSymbolNotFound(context, symbolName, this->getPath(), "", "weak");
+	*whyNot = symbolNotFound(context, symbolName, this->getPath(), "", "weak");
+	return 0;
 }
 
 
 uintptr_t ImageLoaderMachOCompressed::resolveTwolevel(const LinkContext& context, const char* symbolName, const ImageLoader* definedInImage,
 													  const ImageLoader* requestorImage, unsigned requestorOrdinalOfDef, bool weak_import, bool runResolver,
-													  const ImageLoader** foundIn)
+													  const ImageLoader** foundIn, const char** whyNot)
 {
 	// two level lookup
 	uintptr_t address;
 	if ( definedInImage->findExportedSymbolAddress(context, symbolName, requestorImage, requestorOrdinalOfDef, runResolver, foundIn, &address) )
 		return address;
 
+#if UNSIGN_TOLERANT
+	// the proxy handle only sees what dlopen() of the install name exposes, which can miss symbols
+	// the static linker found through umbrellas or re-exports, so fall back to a process-wide search
+	const Symbol* sym;
+	if ( context.flatExportFinder(symbolName, &sym, foundIn) ) {
+		if ( context.verboseBind )
+			dyld::log("dyld: %s not found in %s, bound with flat lookup\n", symbolName, definedInImage->getPath());
+		return (*foundIn)->getExportedSymbolAddress(sym, context, this, runResolver);
+	}
+#endif
+
 	if ( weak_import ) {
 		// definition can't be found anywhere, ok because it is weak, just return 0
 		return 0;
@@ -791,36 +940,76 @@ uintptr_t ImageLoaderMachOCompressed::resolveTwolevel(const LinkContext& context
 		const char* msg = dyld::mkstringf(" (which was built for iOS %d.%d)", imageMinOS >> 16, (imageMinOS >> 8) & 0xFF);
 #endif
 		strcpy(versMismatch, msg);
-		::free((void*)msg);
 	}
 #endif
-	throwSymbolNotFound(context, symbolName, this->getPath(), versMismatch, definedInImage->getPath());
+	if ( whyNot == NULL )
+		throwSymbolNotFound(context, symbolName, this->getPath(), versMismatch, definedInImage->getPath());
+	*whyNot = symbolNotFound(context, symbolName, this->getPath(), versMismatch, definedInImage->getPath());
+	return 0;
+}
+
+
+size_t ImageLoaderMachOCompressed::LookupKeyHash::hash(const LookupKey& key)
+{
+	return ImageLoader::hash(key.name) ^ ((size_t)key.ordinal << 8) ^ key.flags;
+}
+
+bool ImageLoaderMachOCompressed::LookupKeyEqual::equal(const LookupKey& a, const LookupKey& b)
+{
+	return (a.ordinal == b.ordinal) && (a.flags == b.flags) && ((a.name == b.name) || (strcmp(a.name, b.name) == 0));
 }
 
 
 uintptr_t ImageLoaderMachOCompressed::resolve(const LinkContext& context, const char* symbolName, 
 													uint8_t symboFlags, long libraryOrdinal, const ImageLoader** targetImage,
-													LastLookup* last, bool runResolver)
+													LookupMemo* memo, bool runResolver)
 {
 	*targetImage = NULL;
 	
-	// only clients that benefit from caching last lookup pass in a LastLookup struct
-	if ( last != NULL ) {
-		if ( (last->ordinal == libraryOrdinal)
-			&& (last->flags == symboFlags)
-			&& (last->name == symbolName) ) {
-				*targetImage = last->foundIn;
-				return last->result;
-			}
+	// only clients that benefit from caching lookups pass in a LookupMemo
+	LookupKey key = { libraryOrdinal, symboFlags, symbolName };
+	if ( memo != NULL ) {
+		this->addStat(kLoadStatBindSymbolsResolved, 1);
+		LookupMemo::const_iterator pos = memo->find(key);
+		if ( pos != memo->end() ) {
+			*targetImage = pos->second.foundIn;
+			return pos->second.result;
+		}
+		this->addStat(kLoadStatBindImageSearches, 1);
 	}
 	
-	bool weak_import = (symboFlags & BIND_SYMBOL_FLAGS_WEAK_IMPORT);
 	uintptr_t symbolAddress;
+	if ( const char* whyNot = this->resolveImport(context, symbolName, symboFlags, libraryOrdinal, targetImage, runResolver, &symbolAddress) )
+		throw whyNot;
+
+	// save off lookup results if client wants 
+	if ( memo != NULL ) {
+		LookupResult found = { symbolAddress, *targetImage };
+		memo->insert(std::make_pair(key, found));
+	}
+	
+	return symbolAddress;
+}
+
+const char* ImageLoaderMachOCompressed::resolveImport(const LinkContext& context, const char* symbolName, uint8_t symboFlags,
+													  long libraryOrdinal, const ImageLoader** targetImage, bool runResolver,
+													  uintptr_t* symbolAddress)
+{
+	*targetImage = NULL;
+	*symbolAddress = 0;
+	const char* whyNot = NULL;
+	bool weak_import = (symboFlags & BIND_SYMBOL_FLAGS_WEAK_IMPORT);
 	if ( context.bindFlat || (libraryOrdinal == BIND_SPECIAL_DYLIB_FLAT_LOOKUP) ) {
-		symbolAddress = this->resolveFlat(context, symbolName, weak_import, runResolver, targetImage);
+		*symbolAddress = this->resolveFlat(context, symbolName, weak_import, runResolver, targetImage, &whyNot);
 	}
+#if UNSIGN_TOLERANT
+	else if ( (libraryOrdinal == BIND_SPECIAL_DYLIB_WEAK_LOOKUP) || (libraryOrdinal == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE) ) {
+		// no coalescing and no main executable image in this loader, the process-wide search stands in for both
+		*symbolAddress = this->resolveFlat(context, symbolName, weak_import, runResolver, targetImage, &whyNot);
+	}
+#endif
 	else if ( libraryOrdinal == BIND_SPECIAL_DYLIB_WEAK_LOOKUP ) {
-		symbolAddress = this->resolveWeak(context, symbolName, weak_import, runResolver, targetImage);
+		*symbolAddress = this->resolveWeak(context, symbolName, weak_import, runResolver, targetImage, &whyNot);
 	}
 	else {
 		if ( libraryOrdinal == BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE ) {
@@ -830,54 +1019,44 @@ uintptr_t ImageLoaderMachOCompressed::resolve(const LinkContext& context, const
 			*targetImage = this;
 		}
 		else if ( libraryOrdinal <= 0 ) {
-			dyld::throwf("bad mach-o binary, unknown special library ordinal (%ld) too big for symbol %s in %s",
+			return dyld::mkstringf("bad mach-o binary, unknown special library ordinal (%ld) too big for symbol %s in %s",
 				libraryOrdinal, symbolName, this->getPath());
 		}
 		else if ( (unsigned)libraryOrdinal <= libraryCount() ) {
 			*targetImage = libImage((unsigned int)libraryOrdinal-1);
 		}
 		else {
-			dyld::throwf("bad mach-o binary, library ordinal (%ld) too big (max %u) for symbol %s in %s",
+			return dyld::mkstringf("bad mach-o binary, library ordinal (%ld) too big (max %u) for symbol %s in %s",
 				libraryOrdinal, libraryCount(), symbolName, this->getPath());
 		}
 		if ( *targetImage == NULL ) {
 			if ( weak_import ) {
 				// if target library not loaded and reference is weak or library is weak return 0
-				symbolAddress = 0;
+				*symbolAddress = 0;
 			}
 			else {
 				// Try get the path from the load commands
 				if ( const char* depPath = libPath((unsigned int)libraryOrdinal-1) ) {
-					dyld::throwf("can't resolve symbol %s in %s because dependent dylib %s could not be loaded",
-								 symbolName, this->getPath(), depPath);
+					return dyld::mkstringf("can't resolve symbol %s in %s because dependent dylib %s could not be loaded",
+										   symbolName, this->getPath(), depPath);
 				} else {
-					dyld::throwf("can't resolve symbol %s in %s because dependent dylib #%ld could not be loaded",
-								 symbolName, this->getPath(), libraryOrdinal);
+					return dyld::mkstringf("can't resolve symbol %s in %s because dependent dylib #%ld could not be loaded",
+										   symbolName, this->getPath(), libraryOrdinal);
 				}
 			}
 		}
 		else {
-			symbolAddress = resolveTwolevel(context, symbolName, *targetImage, this, (unsigned)libraryOrdinal, weak_import, runResolver, targetImage);
+			*symbolAddress = resolveTwolevel(context, symbolName, *targetImage, this, (unsigned)libraryOrdinal, weak_import, runResolver, targetImage, &whyNot);
 		}
 	}
-
-	// save off lookup results if client wants 
-	if ( last != NULL ) {
-		last->ordinal	= libraryOrdinal;
-		last->flags		= symboFlags;
-		last->name		= symbolName;
-		last->foundIn	= *targetImage;
-		last->result	= symbolAddress;
-	}
-	
-	return symbolAddress;
+	return whyNot;
 }
 
 uintptr_t ImageLoaderMachOCompressed::bindAt(const LinkContext& context, ImageLoaderMachOCompressed* image,
 											 uintptr_t addr, uint8_t type, const char* symbolName,
 											 uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 											 ExtraBindData *extraBindData,
-											 const char* msg, LastLookup* last, bool runResolver)
+											 const char* msg, LookupMemo* memo, bool runResolver)
 {
 	const ImageLoader*	targetImage;
 	uintptr_t			symbolAddress;
@@ -887,13 +1066,116 @@ uintptr_t ImageLoaderMachOCompressed::bindAt(const LinkContext& context, ImageLo
         symbolAddress = 0;
         targetImage = nullptr;
     } else
-        symbolAddress = image->resolve(context, symbolName, symbolFlags, libraryOrdinal, &targetImage, last, runResolver);
+        symbolAddress = image->resolve(context, symbolName, symbolFlags, libraryOrdinal, &targetImage, memo, runResolver);
 
 	// do actual update
+	image->addStat(kLoadStatBindFixups, 1);
 	return image->bindLocation(context, image->imageBaseAddress(), addr, symbolAddress, type, symbolName, addend, image->getPath(), targetImage ? targetImage->getPath() : NULL, msg, extraBindData, image->fSlide);
 }
 
 
+// imports per chunk handed to a worker, and the fewest worth waking the pool for
+static const size_t kResolveImportsGrain		= 64;
+static const size_t kResolveImportsParallelMin	= 256;
+
+const char* ImageLoaderMachOCompressed::resolveImports(const LinkContext& context, size_t count, const ImportRef imports[],
+													   uintptr_t targets[], const ImageLoader* targetImages[], bool runResolver)
+{
+	// each lookup is a dlsym() on a proxy or a read of an export trie, so distinct imports
+	// can be resolved concurrently; the link memo is not thread safe and is left out of it
+	if ( (context.bindPool == NULL) || (count < kResolveImportsParallelMin) ) {
+		for (size_t i=0; i < count; ++i) {
+			if ( const char* whyNot = this->resolveImport(context, imports[i].name, imports[i].flags, imports[i].ordinal, &targetImages[i], runResolver, &targets[i]) )
+				return whyNot;
+		}
+		return NULL;
+	}
+
+	// workers only note the first import that failed, its message would be formatted into the
+	// worker's own ring, so the calling thread looks that one up again to report it
+	std::atomic<size_t> firstFailed(count);
+	context.bindPool->parallelFor(count, kResolveImportsGrain, [&](size_t begin, size_t end) {
+		for (size_t i=begin; (i < end) && (i < firstFailed.load(std::memory_order_relaxed)); ++i) {
+			if ( this->resolveImport(context, imports[i].name, imports[i].flags, imports[i].ordinal, &targetImages[i], runResolver, &targets[i]) != NULL ) {
+				size_t failed = firstFailed.load(std::memory_order_relaxed);
+				while ( (i < failed) && !firstFailed.compare_exchange_weak(failed, i, std::memory_order_relaxed) )
+					;
+				return;
+			}
+		}
+	});
+	const size_t failed = firstFailed.load(std::memory_order_relaxed);
+	if ( failed == count )
+		return NULL;
+	return this->resolveImport(context, imports[failed].name, imports[failed].flags, imports[failed].ordinal, &targetImages[failed], runResolver, &targets[failed]);
+}
+
+const char* ImageLoaderMachOCompressed::bindGathered(const LinkContext& context)
+{
+	struct PendingBind { uintptr_t addr; intptr_t addend; uint32_t importIndex; uint8_t type; };
+	typedef dyld3::Map<LookupKey, uint32_t, LookupKeyHash, LookupKeyEqual> ImportIndexes;
+	const uint32_t kNoImport = UINT32_MAX;
+
+	// decode all binding opcodes first, keeping each fixup and every distinct import once
+	__block std::vector<PendingBind> binds;
+	__block std::vector<ImportRef> imports;
+	__block ImportIndexes importIndexes;
+	eachBind(context, ^(const LinkContext& ctx, ImageLoaderMachOCompressed* image,
+						uintptr_t addr, uint8_t type, const char* symbolName,
+						uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
+						ExtraBindData *extraBindData,
+						const char* msg, LookupMemo* memo, bool runResolver) {
+		if ( image->fLinkPlanBuilder != NULL )
+			image->recordLinkPlanBind(kLinkPlanBind, addr, type, symbolName, symbolFlags, addend, libraryOrdinal);
+		PendingBind bind = { addr, addend, kNoImport, type };
+		if ( type != BIND_TYPE_THREADED_REBASE ) {
+			LookupKey key = { libraryOrdinal, symbolFlags, symbolName };
+			ImportIndexes::iterator pos = importIndexes.find(key);
+			if ( pos != importIndexes.end() ) {
+				bind.importIndex = pos->second;
+			}
+			else {
+				bind.importIndex = (uint32_t)imports.size();
+				ImportRef import = { symbolName, libraryOrdinal, symbolFlags };
+				imports.push_back(import);
+				importIndexes.insert(std::make_pair(key, bind.importIndex));
+			}
+		}
+		binds.push_back(bind);
+		return (uintptr_t)0;
+	});
+
+	// then resolve the distinct imports, in parallel when there are enough of them
+	std::vector<uintptr_t> targets(imports.size());
+	std::vector<const ImageLoader*> targetImages(imports.size());
+	if ( const char* whyNot = this->resolveImports(context, imports.size(), imports.data(), targets.data(), targetImages.data(), false) )
+		return whyNot;
+	this->addStat(kLoadStatBindSymbolsResolved, binds.size());
+	this->addStat(kLoadStatBindImageSearches, imports.size());
+
+	// forced lazy binds later in this link reuse the results
+	for (size_t i=0; i < imports.size(); ++i) {
+		LookupKey key = { imports[i].ordinal, imports[i].flags, imports[i].name };
+		LookupResult found = { targets[i], targetImages[i] };
+		fLookupMemo.insert(std::make_pair(key, found));
+	}
+
+	// and write every fixup in one pass, in the address order the opcodes produced them
+	const uintptr_t baseAddress = this->imageBaseAddress();
+	for (const PendingBind& bind : binds) {
+		if ( bind.importIndex == kNoImport ) {
+			bindLocation(context, baseAddress, bind.addr, 0, bind.type, NULL, 0, this->getPath(), NULL, "", NULL, fSlide);
+			continue;
+		}
+		const ImageLoader* targetImage = targetImages[bind.importIndex];
+		bindLocation(context, baseAddress, bind.addr, targets[bind.importIndex], bind.type, imports[bind.importIndex].name,
+					 bind.addend, this->getPath(), targetImage ? targetImage->getPath() : NULL, "", NULL, fSlide);
+	}
+	this->addStat(kLoadStatBindFixups, binds.size());
+	return NULL;
+}
+
+
 void ImageLoaderMachOCompressed::throwBadBindingAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 										const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos)
 {
@@ -903,9 +1185,11 @@ void ImageLoaderMachOCompressed::throwBadBindingAddress(uintptr_t address, uintp
 }
 
 
-void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent)
+const char* ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent)
 {
 	CRSetCrashLogMessage2(this->getPath());
+	// start with an empty memo, an earlier link of this image may have thrown half way
+	LookupMemo().swap(fLookupMemo);
 
 	// if prebound and loaded at prebound address, and all libraries are same as when this was prebound, then no need to bind
 	// note: flat-namespace binaries need to have imports rebound (even if correctly prebound)
@@ -918,12 +1202,12 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 								uintptr_t addr, uint8_t type, const char* symbolName,
 								uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 								ExtraBindData *extraBindData,
-								const char* msg, LastLookup* last, bool runResolver) {
+								const char* msg, LookupMemo* memo, bool runResolver) {
 				if ( libraryOrdinal != BIND_SPECIAL_DYLIB_WEAK_LOOKUP )
 					return (uintptr_t)0;
 				return ImageLoaderMachOCompressed::bindAt(ctx, image, addr, type, symbolName, symbolFlags,
 														  addend, libraryOrdinal, extraBindData,
-														  msg, last, runResolver);
+														  msg, memo, runResolver);
 			});
 		}
 	}
@@ -935,13 +1219,9 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 		vmAccountingSetSuspended(context, bindingBecauseOfRoot);
 
 		if ( fChainedFixups != NULL ) {
-#if !UNSIGN_TOLERANT
 			const dyld_chained_fixups_header* fixupsHeader = (dyld_chained_fixups_header*)(fLinkEditBase + fChainedFixups->dataoff);
-			doApplyFixups(context, fixupsHeader);
-#else
-            printf("fChainedFixups");
-			dyld::throwf("Unimplemented");
-#endif
+			if ( const char* whyNot = doApplyFixups(context, fixupsHeader) )
+				return whyNot;
 		}
 		else if ( fDyldInfo != nullptr ) {
 		#if TEXT_RELOC_SUPPORT
@@ -950,16 +1230,24 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 				this->makeTextSegmentWritable(context, true);
 		#endif
 
-			// run through all binding opcodes
-			eachBind(context, ^(const LinkContext& ctx, ImageLoaderMachOCompressed* image,
-								uintptr_t addr, uint8_t type, const char* symbolName,
-								uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
-								ExtraBindData *extraBindData,
-								const char* msg, LastLookup* last, bool runResolver) {
-				return ImageLoaderMachOCompressed::bindAt(ctx, image, addr, type, symbolName, symbolFlags,
-														  addend, libraryOrdinal, extraBindData,
-														  msg, last, runResolver);
-			});
+			// if this image is in the shared cache, but depends on something no longer in the shared cache,
+			// there is no way to reset the lazy pointers, so force bind them now
+			const bool bindLazies = ( forceLazysBound || fInSharedCache );
+
+			// a plan recorded without lazy binds can't be used when they are needed now
+			CachedLinkPlan* plan = this->linkPlan(context);
+			if ( (plan != NULL) && bindLazies && !(LinkPlanView(plan->file.address()).header().flags & kLinkPlanHasLazyBinds) )
+				plan = NULL;
+
+			// imports that can't be bound are reported before any of them is written
+			const char* whyNot;
+			if ( plan != NULL ) {
+				whyNot = this->applyLinkPlanBinds(context, plan, bindLazies);
+			}
+			else {
+				// run through all binding opcodes
+				whyNot = this->bindGathered(context);
+			}
 
 		#if TEXT_RELOC_SUPPORT
 			// if there were __TEXT fixups, restore write protection
@@ -967,11 +1255,18 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 				this->makeTextSegmentWritable(context, false);
 		#endif
 
-			// if this image is in the shared cache, but depends on something no longer in the shared cache,
-			// there is no way to reset the lazy pointers, so force bind them now
-			if ( forceLazysBound || fInSharedCache )
+			if ( whyNot != NULL )
+				return whyNot;
+
+			if ( bindLazies && (plan == NULL) )
 				this->doBindJustLazies(context);
 
+			if ( fLinkPlanBuilder != NULL ) {
+				if ( bindLazies )
+					fLinkPlanBuilder->setFlag(kLinkPlanHasLazyBinds);
+				this->saveLinkPlan(context);
+			}
+
 			// this image is in cache, but something below it is not.  If
 			// this image has lazy pointer to a resolver function, then
 			// the stub may have been altered to point to a shared lazy pointer.
@@ -980,7 +1275,7 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 		}
 
 		uint64_t t1 = mach_absolute_time();
-		ImageLoader::fgTotalRebindCacheTime += (t1-t0);
+		this->addStat(kLoadStatRebindCacheTime, t1-t0);
 	}
 
 	// See if this dylib overrides something in the dyld cache
@@ -1015,10 +1310,14 @@ void ImageLoaderMachOCompressed::doBind(const LinkContext& context, bool forceLa
 		});
 	}
 #endif
+	// the memo is only valid for this link
+	LookupMemo().swap(fLookupMemo);
+
 	// set up dyld entry points in image
 	// do last so flat main executables will have __dyld or __program_vars set up
 	this->setupLazyPointerHandler(context);
 	CRSetCrashLogMessage2(NULL);
+	return NULL;
 }
 
 
@@ -1028,38 +1327,266 @@ void ImageLoaderMachOCompressed::doBindJustLazies(const LinkContext& context)
 							uintptr_t addr, uint8_t type, const char* symbolName,
 							uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 							ExtraBindData *extraBindData,
-							const char* msg, LastLookup* last, bool runResolver) {
+							const char* msg, LookupMemo* memo, bool runResolver) {
+		if ( image->fLinkPlanBuilder != NULL )
+			image->recordLinkPlanBind(kLinkPlanLazyBind, addr, type, symbolName, symbolFlags, addend, libraryOrdinal);
 		return ImageLoaderMachOCompressed::bindAt(ctx, image, addr, type, symbolName, symbolFlags,
 												  addend, libraryOrdinal, extraBindData,
-												  msg, last, runResolver);
+												  msg, memo, runResolver);
 	});
 }
-#if !UNSIGN_TOLERANT
-void ImageLoaderMachOCompressed::doApplyFixups(const LinkContext& context, const dyld_chained_fixups_header* fixupsHeader)
+
+bool ImageLoaderMachOCompressed::linkPlanPath(const LinkContext& context, uint8_t uuid[16], uint64_t* dependencyHash, char path[PATH_MAX]) const
+{
+	// only opcode based LINKEDIT is planned, chained fixups are already a flat table
+	if ( (context.linkPlanCacheDir == NULL) || (fDyldInfo == NULL) )
+		return false;
+	if ( !this->getUUID(uuid) )
+		return false;
+
+	// imports are recorded by ordinal, so the plan is only valid for the same dependency list
+	uint64_t hash = linkPlanHash(NULL, 0);
+	for (unsigned int i=0, e=libraryCount(); i < e; ++i) {
+		const char* depPath = libPath(i);
+		if ( depPath != NULL )
+			hash = linkPlanHash(depPath, strlen(depPath)+1, hash);
+		else
+			hash = linkPlanHash("", 1, hash);
+	}
+	*dependencyHash = hash;
+
+	char uuidStr[33];
+	for (int i=0; i < 16; ++i)
+		snprintf(&uuidStr[i*2], 3, "%02X", uuid[i]);
+	int len = snprintf(path, PATH_MAX, "%s/%s-%016llX.linkplan", context.linkPlanCacheDir, uuidStr, (unsigned long long)hash);
+	return (len > 0) && (len < PATH_MAX);
+}
+
+CachedLinkPlan* ImageLoaderMachOCompressed::linkPlan(const LinkContext& context)
+{
+	if ( fLinkPlanLookedUp )
+		return fLinkPlan;
+	fLinkPlanLookedUp = true;
+
+	uint8_t uuid[16];
+	uint64_t dependencyHash;
+	char path[PATH_MAX];
+	if ( !this->linkPlanPath(context, uuid, &dependencyHash, path) )
+		return NULL;
+
+	std::lock_guard<std::mutex> guard(sLinkPlansLock);
+	std::map<std::string, CachedLinkPlan*>::iterator pos = sLinkPlans.find(path);
+	if ( pos != sLinkPlans.end() ) {
+		fLinkPlan = pos->second;
+		return fLinkPlan;
+	}
+
+	CachedLinkPlan* plan = new CachedLinkPlan();
+	if ( plan->file.map(path) == 0 ) {
+		std::vector<uint64_t> writableSizes(fSegmentsCount);
+		for (unsigned int i=0; i < fSegmentsCount; ++i)
+			writableSizes[i] = segWriteable(i) ? segSize(i) : 0;
+		const char* whyInvalid = LinkPlanView::validate(plan->file.address(), plan->file.length(), uuid, dependencyHash,
+														 sizeof(uintptr_t), fSegmentsCount, writableSizes.data());
+		if ( whyInvalid == NULL ) {
+			const uint32_t importCount = LinkPlanView(plan->file.address()).header().importCount;
+			plan->file.closeDescriptor();
+			plan->resolved.resize(importCount, false);
+			plan->resolvedAddress.resize(importCount, 0);
+			plan->resolvedIn.resize(importCount, NULL);
+			sLinkPlans[path] = plan;
+			if ( context.verboseBind )
+				dyld::log("dyld: using link plan %s for %s\n", path, this->getPath());
+			fLinkPlan = plan;
+			return plan;
+		}
+		if ( context.verboseBind )
+			dyld::log("dyld: ignoring link plan %s: %s\n", path, whyInvalid);
+	}
+	delete plan;
+
+	// nothing usable on disk, record one while the opcodes are interpreted
+	fLinkPlanBuilder = new LinkPlanBuilder(uuid, dependencyHash, sizeof(uintptr_t), fSegmentsCount);
+	return NULL;
+}
+
+const char* ImageLoaderMachOCompressed::applyLinkPlanBinds(const LinkContext& context, CachedLinkPlan* plan, bool bindLazies)
+{
+	LinkPlanView view(plan->file.address());
+	const uint32_t importCount = view.header().importCount;
+
+	// resolve each distinct import once
+	std::vector<uintptr_t> targets(importCount);
+	std::vector<const ImageLoader*> targetImages(importCount);
+	{
+		std::lock_guard<std::mutex> guard(plan->lock);
+		std::vector<uint32_t> missing;
+		std::vector<ImportRef> missingImports;
+		for (uint32_t i=0; i < importCount; ++i) {
+			if ( plan->resolved[i] ) {
+				targets[i] = plan->resolvedAddress[i];
+				targetImages[i] = plan->resolvedIn[i];
+				continue;
+			}
+			const LinkPlanImport& import = view.imports()[i];
+			ImportRef ref = { view.importName(i), import.libraryOrdinal, import.symbolFlags };
+			missing.push_back(i);
+			missingImports.push_back(ref);
+		}
+
+		std::vector<uintptr_t> missingTargets(missing.size());
+		std::vector<const ImageLoader*> missingTargetImages(missing.size());
+		if ( const char* whyNot = this->resolveImports(context, missing.size(), missingImports.data(), missingTargets.data(), missingTargetImages.data(), false) )
+			return whyNot;
+		for (size_t j=0; j < missing.size(); ++j) {
+			const uint32_t i = missing[j];
+			targets[i] = missingTargets[j];
+			targetImages[i] = missingTargetImages[j];
+			if ( (targetImages[i] == NULL) || (dynamic_cast<const ImageLoaderProxy*>(targetImages[i]) != NULL) ) {
+				plan->resolved[i] = true;
+				plan->resolvedAddress[i] = targets[i];
+				plan->resolvedIn[i] = targetImages[i];
+			}
+		}
+	}
+
+	const LinkPlanFixup* const fixups = view.fixups();
+	uint64_t bound = 0;
+	for (uint32_t i=0, e=view.header().fixupCount; i < e; ++i) {
+		const LinkPlanFixup& fixup = fixups[i];
+		if ( fixup.kind == kLinkPlanRebase )
+			continue;
+		if ( (fixup.kind == kLinkPlanLazyBind) && !bindLazies )
+			continue;
+		const ImageLoader* targetImage = targetImages[fixup.importIndex];
+		bindLocation(context, this->imageBaseAddress(), segActualLoadAddress(fixup.segIndex) + fixup.segOffset,
+					 targets[fixup.importIndex], fixup.type, view.importName(fixup.importIndex),
+					 (intptr_t)view.imports()[fixup.importIndex].addend, this->getPath(),
+					 targetImage ? targetImage->getPath() : NULL,
+					 (fixup.kind == kLinkPlanLazyBind) ? "forced lazy " : "", NULL, fSlide);
+		++bound;
+	}
+	this->addStat(kLoadStatBindFixups, bound);
+	return NULL;
+}
+
+void ImageLoaderMachOCompressed::recordLinkPlanBind(uint8_t kind, uintptr_t addr, uint8_t type, const char* symbolName,
+													uint8_t symbolFlags, intptr_t addend, long libraryOrdinal)
+{
+	// threaded binds rewrite the chain they are read from, they can't be replayed
+	if ( (type == BIND_TYPE_THREADED_BIND) || (type == BIND_TYPE_THREADED_REBASE) ) {
+		fLinkPlanBuilder->abandon();
+		return;
+	}
+	for (unsigned int i=0; i < fSegmentsCount; ++i) {
+		if ( (addr >= segActualLoadAddress(i)) && (addr < segActualEndAddress(i)) ) {
+			fLinkPlanBuilder->addBind(kind, i, addr - segActualLoadAddress(i), type, symbolName, symbolFlags, addend, libraryOrdinal);
+			return;
+		}
+	}
+	fLinkPlanBuilder->abandon();
+}
+
+void ImageLoaderMachOCompressed::saveLinkPlan(const LinkContext& context)
+{
+	LinkPlanBuilder* builder = fLinkPlanBuilder;
+	fLinkPlanBuilder = NULL;
+
+	// rebase() is skipped when loaded at the preferred address, so rebases may be missing
+	const bool complete = !builder->abandoned()
+						&& ( (fDyldInfo->rebase_size == 0) || builder->hasFlag(kLinkPlanHasRebases) );
+	uint8_t uuid[16];
+	uint64_t dependencyHash;
+	char path[PATH_MAX];
+	if ( complete && this->linkPlanPath(context, uuid, &dependencyHash, path) ) {
+		bool written = builder->writeToFile(path);
+		if ( context.verboseBind )
+			dyld::log("dyld: %s link plan %s for %s\n", written ? "wrote" : "failed to write", path, this->getPath());
+	}
+	delete builder;
+}
+
+#if UNSIGN_TOLERANT
+const char* ImageLoaderMachOCompressed::doApplyFixups(const LinkContext& context, const dyld_chained_fixups_header* fixupsHeader)
+{
+	// chains may only touch memory between the mach header and the end of the last segment
+	const uintptr_t imageStart = (uintptr_t)fMachOData;
+	uint64_t imageSize = 0;
+	for (unsigned int i=0; i < fSegmentsCount; ++i) {
+		const uintptr_t segEnd = segActualEndAddress(i);
+		if ( (segEnd > imageStart) && (segEnd - imageStart > imageSize) )
+			imageSize = segEnd - imageStart;
+	}
+	const char* whyInvalid = ChainedFixups::validate(fixupsHeader, fChainedFixups->datasize, imageSize);
+	if ( whyInvalid != NULL )
+		dyld::throwf("malformed chained fixups (%s) in %s", whyInvalid, this->getPath());
+
+	// resolve every entry of the import table
+	const ChainedFixups fixups(fixupsHeader);
+	const uint32_t importCount = fixups.importCount();
+	std::vector<ImportRef> imports(importCount);
+	std::vector<int64_t> addends(importCount);
+	for (uint32_t i=0; i < importCount; ++i) {
+		const ChainedImport chainedImport = fixups.import(i);
+		imports[i].name = chainedImport.name;
+		imports[i].ordinal = chainedImport.libOrdinal;
+		imports[i].flags = chainedImport.weakImport ? BIND_SYMBOL_FLAGS_WEAK_IMPORT : 0;
+		addends[i] = chainedImport.addend;
+	}
+	std::vector<uintptr_t> targets(importCount);
+	std::vector<const ImageLoader*> targetImages(importCount);
+	if ( const char* whyNot = this->resolveImports(context, importCount, imports.data(), targets.data(), targetImages.data(), true) )
+		return whyNot;
+	for (uint32_t i=0; i < importCount; ++i) {
+		targets[i] += (uintptr_t)addends[i];
+		if ( context.verboseBind )
+			dyld::log("dyld: chained import #%u: %s:%s = 0x%08lX\n", i, this->getShortName(), imports[i].name, targets[i]);
+	}
+
+	// then rewrite the chains, pages are shared out between the bind threads
+	ChainedFixupStats stats = {};
+	const char* whyFailed = fixups.apply((uint8_t*)fMachOData, imageSize, fSlide, targets.data(), targets.size(), context.bindPool, &stats);
+	if ( whyFailed != NULL )
+		dyld::throwf("chained fixups failed (%s) in %s", whyFailed, this->getPath());
+	this->addStat(kLoadStatRebaseFixups, stats.rebases);
+	this->addStat(kLoadStatBindFixups, stats.binds);
+	this->addStat(kLoadStatBindImageSearches, importCount);
+	if ( context.verboseBind )
+		dyld::log("dyld: %s: %lu chained rebases and %lu binds on %lu pages\n", this->getShortName(), stats.rebases, stats.binds, stats.pages);
+	return NULL;
+}
+#else
+const char* ImageLoaderMachOCompressed::doApplyFixups(const LinkContext& context, const dyld_chained_fixups_header* fixupsHeader)
 {
 	const dyld3::MachOLoaded* ml = (dyld3::MachOLoaded*)machHeader();
 	const dyld_chained_starts_in_image* starts = (dyld_chained_starts_in_image*)((uint8_t*)fixupsHeader + fixupsHeader->starts_offset);
 
-	// build table of resolved targets for each symbol ordinal
-	STACK_ALLOC_OVERFLOW_SAFE_ARRAY(const void*, targetAddrs, 128);
-	targetAddrs.reserve(fixupsHeader->imports_count);
+	// collect the import table, then resolve every entry of it
+	__block std::vector<ImportRef> imports;
+	__block std::vector<uint64_t> addends;
+	imports.reserve(fixupsHeader->imports_count);
+	addends.reserve(fixupsHeader->imports_count);
 	__block Diagnostics diag;
 	const dyld3::MachOAnalyzer* ma = (dyld3::MachOAnalyzer*)ml;
 	ma->forEachChainedFixupTarget(diag, ^(int libOrdinal, const char* symbolName, uint64_t addend, bool weakImport, bool& stop) {
-		const ImageLoader*	targetImage;
-		uint8_t symbolFlags = weakImport ? BIND_SYMBOL_FLAGS_WEAK_IMPORT : 0;
-		try {
-			uintptr_t symbolAddress = this->resolve(context, symbolName, symbolFlags, libOrdinal, &targetImage, NULL, true);
-			targetAddrs.push_back((void*)(symbolAddress + addend));
-		}
-		catch (const char* msg) {
-			stop = true;
-			diag.error("%s", msg);
-		}
+		ImportRef import = { symbolName, libOrdinal, (uint8_t)(weakImport ? BIND_SYMBOL_FLAGS_WEAK_IMPORT : 0) };
+		imports.push_back(import);
+		addends.push_back(addend);
 	});
 	if ( diag.hasError() )
 		throw strdup(diag.errorMessage());
 
+	std::vector<uintptr_t> targets(imports.size());
+	std::vector<const ImageLoader*> targetImages(imports.size());
+	if ( const char* whyNot = this->resolveImports(context, imports.size(), imports.data(), targets.data(), targetImages.data(), true) )
+		return whyNot;
+
+	// build table of resolved targets for each symbol ordinal
+	STACK_ALLOC_OVERFLOW_SAFE_ARRAY(const void*, targetAddrs, 128);
+	targetAddrs.reserve(imports.size());
+	for (size_t i=0; i < imports.size(); ++i)
+		targetAddrs.push_back((void*)(targets[i] + addends[i]));
+
 	auto logFixups = ^(void* loc, void* newValue) {
 		dyld::log("dyld: fixup: %s:%p = %p\n", this->getShortName(), loc, newValue);
 	};
@@ -1069,6 +1596,7 @@ void ImageLoaderMachOCompressed::doApplyFixups(const LinkContext& context, const
 	ml->fixupAllChainedFixups(diag, starts, fSlide, targetAddrs, logFixups);
 	if ( diag.hasError() )
 		throw strdup(diag.errorMessage());
+	return NULL;
 }
 #endif
 
@@ -1103,11 +1631,11 @@ void ImageLoaderMachOCompressed::registerInterposing(const LinkContext& context)
 						ma->forEachChainedFixupTarget(diag, ^(int libraryOrdinal, const char* symbolName, uint64_t addend, bool weakImport, bool& stop) {
 							if ( targetBindIndex == bindOrdinal ) {
 								//dyld::log("interpose bind fixup at %p is to %s libOrdinal=%d\n", fixupLoc, symbolName, libraryOrdinal);
-								LastLookup* last = NULL;
+								LookupMemo* memo = NULL;
 								const ImageLoader* targetImage;
 								uintptr_t targetBindAddress = 0;
 								try {
-									targetBindAddress = this->resolve(context, symbolName, 0, libraryOrdinal, &targetImage, last, false);
+									targetBindAddress = this->resolve(context, symbolName, 0, libraryOrdinal, &targetImage, memo, false);
 								}
 								catch (const char* msg) {
 									if ( !weakImport )
@@ -1154,11 +1682,11 @@ void ImageLoaderMachOCompressed::registerInterposing(const LinkContext& context)
 					if ( bindOffset != runtimeOffset )
 						return;
 					stopBinds = true;
-					LastLookup* last = NULL;
+					LookupMemo* memo = NULL;
 					const ImageLoader* targetImage;
 					uintptr_t targetBindAddress = 0;
 					try {
-						targetBindAddress = this->resolve(context, symbolName, 0, libOrdinal, &targetImage, last, false);
+						targetBindAddress = this->resolve(context, symbolName, 0, libOrdinal, &targetImage, memo, false);
 					}
 					catch (const char* msg) {
 						if ( !weakImport )
@@ -1200,7 +1728,7 @@ bool ImageLoaderMachOCompressed::usesChainedFixups() const
 #if !UNSIGN_TOLERANT
 	return ((dyld3::MachOLoaded*)machHeader())->hasChainedFixups();
 #else
-	return false;
+	return (fChainedFixups != NULL);
 #endif
 }
 
@@ -1263,7 +1791,6 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
 		dyld3::OverflowSafeArray<ThreadedBindData> ordinalTable;
         bool useThreadedRebaseBind = false;
         ExtraBindData extraBindData;
-		LastLookup last = { 0, 0, NULL, 0, NULL };
 		const uint8_t* const start = fLinkEditBase + fDyldInfo->bind_off;
 		const uint8_t* const end = &start[fDyldInfo->bind_size];
 		const uint8_t* p = start;
@@ -1339,7 +1866,7 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
                         if ( !libraryOrdinalSet )
                             dyld::throwf("BIND_OPCODE_DO_BIND missing preceding BIND_OPCODE_SET_DYLIB_ORDINAL*");
                         handler(context, this, address, type, symbolName, symboFlags, addend, libraryOrdinal,
-								&extraBindData, "", &last, false);
+								&extraBindData, "", &fLookupMemo, false);
                         address += sizeof(intptr_t);
                     } else {
                         ordinalTable.push_back(ThreadedBindData(symbolName, addend, libraryOrdinal, symboFlags, type));
@@ -1355,7 +1882,7 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
 					if ( !libraryOrdinalSet )
 						dyld::throwf("BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB missing preceding BIND_OPCODE_SET_DYLIB_ORDINAL*");
                     handler(context, this, address, type, symbolName, symboFlags, addend, libraryOrdinal,
-                                     &extraBindData, "", &last, false);
+                                     &extraBindData, "", &fLookupMemo, false);
 					address += read_uleb128(p, end) + sizeof(intptr_t);
 					break;
 				case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
@@ -1368,7 +1895,7 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
 					if ( !libraryOrdinalSet )
 						dyld::throwf("BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED missing preceding BIND_OPCODE_SET_DYLIB_ORDINAL*");
                     handler(context, this, address, type, symbolName, symboFlags, addend, libraryOrdinal,
-                                     &extraBindData, "", &last, false);
+                                     &extraBindData, "", &fLookupMemo, false);
 					address += immediate*sizeof(intptr_t) + sizeof(intptr_t);
 					break;
 				case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
@@ -1384,7 +1911,7 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
 						if ( (address < segmentStartAddress) || (address >= segmentEndAddress) )
 							throwBadBindingAddress(address, segmentEndAddress, segmentIndex, start, end, p);
                         handler(context, this, address, type, symbolName, symboFlags, addend, libraryOrdinal,
-                                         &extraBindData, "", &last, false);
+                                         &extraBindData, "", &fLookupMemo, false);
 						address += skip + sizeof(intptr_t);
 					}
                     break;
@@ -1414,7 +1941,7 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
                                     {
                                         // Call the bind handler which knows about our bind type being set to rebase
                                         handler(context, this, address, BIND_TYPE_THREADED_REBASE, nullptr, 0, 0, 0,
-                                                         nullptr, "", &last, false);
+                                                         nullptr, "", &fLookupMemo, false);
                                     }
                                 } else {
                                     // the ordinal is bits [0..15]
@@ -1430,7 +1957,7 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
                                     {
                                         handler(context, this, address, BIND_TYPE_THREADED_BIND,
                                                          symbolName, symboFlags, addend, libraryOrdinal,
-                                                         nullptr, "", &last, false);
+                                                         nullptr, "", &fLookupMemo, false);
                                     }
                                 }
 
@@ -1454,7 +1981,6 @@ void ImageLoaderMachOCompressed::eachBind(const LinkContext& context, bind_handl
 	}
 	catch (const char* msg) {
 		const char* newMsg = dyld::mkstringf("%s in %s", msg, this->getPath());
-		free((void*)msg);
 		throw newMsg;
 	}
 }
@@ -1537,7 +2063,7 @@ void ImageLoaderMachOCompressed::eachLazyBind(const LinkContext& context, bind_h
 					if ( symbolName  == NULL )
 						dyld::throwf("BIND_OPCODE_DO_BIND missing preceding BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM");
                     handler(context, this, address, type, symbolName, symboFlags, addend, libraryOrdinal,
-                                     NULL, "forced lazy ", NULL, false);
+                                     NULL, "forced lazy ", &fLookupMemo, false);
 					address += sizeof(intptr_t);
 					break;
 				case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
@@ -1551,7 +2077,6 @@ void ImageLoaderMachOCompressed::eachLazyBind(const LinkContext& context, bind_h
 
 	catch (const char* msg) {
 		const char* newMsg = dyld::mkstringf("%s in %s", msg, this->getPath());
-		free((void*)msg);
 		throw newMsg;
 	}
 }
@@ -1618,7 +2143,7 @@ uintptr_t ImageLoaderMachOCompressed::doBindLazySymbol(uintptr_t* lazyPointer, c
 							uintptr_t ptrToBind = (uintptr_t)lazyPointer;
                             uintptr_t symbolAddr = bindAt(context, this, ptrToBind, BIND_TYPE_POINTER, symbolName, 0, 0, libraryOrdinal,
                                                           NULL, "lazy ", NULL);
-							++fgTotalLazyBindFixups;
+							this->addStat(kLoadStatLazyBindFixups, 1);
 							return symbolAddr;
 						}
 					}
@@ -1861,16 +2386,19 @@ void ImageLoaderMachOCompressed::updateUsesCoalIterator(CoalIterator& it, uintpt
 				break;
 			case BIND_OPCODE_DO_BIND:
 				bindLocation(context, this->imageBaseAddress(), address, value, type, symbolName, addend, this->getPath(), targetImage ? targetImage->getPath() : NULL, "weak ", NULL, fSlide);
+				this->addStat(kLoadStatBindFixups, 1);
 				boundSomething = true;
 				address += sizeof(intptr_t);
 				break;
 			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
 				bindLocation(context, this->imageBaseAddress(), address, value, type, symbolName, addend, this->getPath(), targetImage ? targetImage->getPath() : NULL, "weak ", NULL, fSlide);
+				this->addStat(kLoadStatBindFixups, 1);
 				boundSomething = true;
 				address += read_uleb128(p, end) + sizeof(intptr_t);
 				break;
 			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
 				bindLocation(context, this->imageBaseAddress(), address, value, type, symbolName, addend, this->getPath(), targetImage ? targetImage->getPath() : NULL, "weak ", NULL, fSlide);
+				this->addStat(kLoadStatBindFixups, 1);
 				boundSomething = true;
 				address += immediate*sizeof(intptr_t) + sizeof(intptr_t);
 				break;
@@ -1882,6 +2410,7 @@ void ImageLoaderMachOCompressed::updateUsesCoalIterator(CoalIterator& it, uintpt
 					boundSomething = true;
 					address += skip + sizeof(intptr_t);
 				}
+				this->addStat(kLoadStatBindFixups, count);
 				break;
 			default:
 				dyld::throwf("bad bind opcode %d in weak binding info", *p);
@@ -1896,7 +2425,7 @@ uintptr_t ImageLoaderMachOCompressed::interposeAt(const LinkContext& context, Im
 												  uintptr_t addr, uint8_t type, const char*,
                                                   uint8_t, intptr_t, long,
                                                   ExtraBindData *extraBindData,
-                                                  const char*, LastLookup*, bool runResolver)
+                                                  const char*, LookupMemo*, bool runResolver)
 {
 	if ( type == BIND_TYPE_POINTER ) {
 		uintptr_t* fixupLocation = (uintptr_t*)addr;
@@ -1925,10 +2454,10 @@ void ImageLoaderMachOCompressed::doInterpose(const LinkContext& context)
 								uintptr_t addr, uint8_t type, const char* symbolName,
 								uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 								ExtraBindData *extraBindData,
-								const char* msg, LastLookup* last, bool runResolver) {
+								const char* msg, LookupMemo* memo, bool runResolver) {
 			return ImageLoaderMachOCompressed::interposeAt(ctx, image, addr, type, symbolName, symbolFlags,
 														   addend, libraryOrdinal, extraBindData,
-														   msg, last, runResolver);
+														   msg, memo, runResolver);
 		});
 
 	  	// 2) non-lazy pointers in the dyld cache need to be interposed
@@ -1937,10 +2466,10 @@ void ImageLoaderMachOCompressed::doInterpose(const LinkContext& context)
 								uintptr_t addr, uint8_t type, const char* symbolName,
 								uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 								ExtraBindData *extraBindData,
-								const char* msg, LastLookup* last, bool runResolver) {
+								const char* msg, LookupMemo* memo, bool runResolver) {
 				return ImageLoaderMachOCompressed::interposeAt(ctx, image, addr, type, symbolName, symbolFlags,
 															   addend, libraryOrdinal, extraBindData,
-															   msg, last, runResolver);
+															   msg, memo, runResolver);
 			});
 		}
 
@@ -1955,7 +2484,7 @@ uintptr_t ImageLoaderMachOCompressed::dynamicInterposeAt(const LinkContext& cont
 														 uintptr_t addr, uint8_t type, const char* symbolName,
                                                          uint8_t, intptr_t, long,
                                                          ExtraBindData *extraBindData,
-                                                         const char*, LastLookup*, bool runResolver)
+                                                         const char*, LookupMemo*, bool runResolver)
 {
 	if ( type == BIND_TYPE_POINTER ) {
 		uintptr_t* fixupLocation = (uintptr_t*)addr;
@@ -1986,19 +2515,19 @@ void ImageLoaderMachOCompressed::dynamicInterpose(const LinkContext& context)
 						uintptr_t addr, uint8_t type, const char* symbolName,
 						uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 						ExtraBindData *extraBindData,
-						const char* msg, LastLookup* last, bool runResolver) {
+						const char* msg, LookupMemo* memo, bool runResolver) {
 		return ImageLoaderMachOCompressed::dynamicInterposeAt(ctx, image, addr, type, symbolName, symbolFlags,
 															  addend, libraryOrdinal, extraBindData,
-															  msg, last, runResolver);
+															  msg, memo, runResolver);
 	});
 	eachLazyBind(context, ^(const LinkContext& ctx, ImageLoaderMachOCompressed* image,
 							uintptr_t addr, uint8_t type, const char* symbolName,
 							uint8_t symbolFlags, intptr_t addend, long libraryOrdinal,
 							ExtraBindData *extraBindData,
-							const char* msg, LastLookup* last, bool runResolver) {
+							const char* msg, LookupMemo* memo, bool runResolver) {
 		return ImageLoaderMachOCompressed::dynamicInterposeAt(ctx, image, addr, type, symbolName, symbolFlags,
 															  addend, libraryOrdinal, extraBindData,
-															  msg, last, runResolver);
+															  msg, memo, runResolver);
 	});
 }
 
@@ -29,9 +29,17 @@
 #include <stdint.h> 
 
 #include "ImageLoaderMachO.h"
+#include "LinkPlan.h"
+#include "ExportIndex.h"
+
+#include <mach-o/fixup-chains.h>
+#include <mutex>
 
 namespace isolator {
 
+struct CachedLinkPlan;
+class RebaseSlider;
+
 //
 // ImageLoaderMachOCompressed is the concrete subclass of ImageLoader which loads mach-o files 
 // that use the compressed LINKEDIT format.  
@@ -49,7 +57,8 @@ public:
 	static ImageLoaderMachOCompressed*	instantiateFromCache(const macho_header* mh, const char* path, long slide, const struct stat& info,
 																unsigned int segCount, unsigned int libCount, const LinkContext& context);
 	static ImageLoaderMachOCompressed*	instantiateFromMemory(const char* moduleName, const macho_header* mh, uint64_t len,
-															unsigned int segCount, unsigned int libCount, const LinkContext& context);
+															unsigned int segCount, unsigned int libCount, const LinkContext& context,
+															int fd=-1, bool adoptMemory=false);
 
 
 	virtual								~ImageLoaderMachOCompressed();
@@ -58,7 +67,7 @@ public:
 	virtual bool						libReExported(unsigned int) const;
 	virtual bool						libIsUpward(unsigned int) const;
 	virtual void						setLibImage(unsigned int, ImageLoader*, bool, bool);
-	virtual void						doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent);
+	virtual const char*					doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent);
 	virtual void						doBindJustLazies(const LinkContext& context);
 	virtual uintptr_t					doBindLazySymbol(uintptr_t* lazyPointer, const LinkContext& context);
 	virtual uintptr_t					doBindFastLazySymbol(uint32_t lazyBindingInfoOffset, const LinkContext& context, void (*lock)(), void (*unlock)());
@@ -83,6 +92,8 @@ protected:
 	virtual uint32_t*					segmentCommandOffsets() const;
 	virtual	void						rebase(const LinkContext& context, uintptr_t slide);
 	virtual const ImageLoader::Symbol*	findShallowExportedSymbol(const char* name, const ImageLoader** foundIn) const;
+	virtual void						findExportedSymbols(const char* prefix, const char* const names[], size_t count,
+															const Symbol* results[], const ImageLoader* foundIn[]) const;
 	virtual bool						containsSymbol(const void* addr) const;
 	virtual uintptr_t					exportedSymbolAddress(const LinkContext& context, const Symbol* symbol, const ImageLoader* requestor, bool runResolver) const;
 	virtual bool						exportedSymbolIsWeakDefintion(const Symbol* symbol) const;
@@ -96,17 +107,27 @@ protected:
 	virtual void						resetPreboundLazyPointers(const LinkContext& context);
 #endif
 	virtual uintptr_t					resolveWeak(const LinkContext& context, const char* symbolName, bool weak_import, bool runResolver,
-													const ImageLoader** foundIn);
+													const ImageLoader** foundIn, const char** whyNot=NULL);
 
 		
 private:
-	struct LastLookup { long ordinal; uint8_t flags; const char* name; uintptr_t result; const ImageLoader* foundIn; };
+	// Imports resolved so far in the current link, so that each distinct (ordinal, flags, name) is
+	// looked up once no matter how the bind streams interleave. Names are compared by content since
+	// the regular and lazy bind opcodes carry separate copies of them.
+	struct LookupKey		{ long ordinal; uint8_t flags; const char* name; };
+	struct LookupResult		{ uintptr_t result; const ImageLoader* foundIn; };
+	struct LookupKeyHash	{ static size_t hash(const LookupKey&); };
+	struct LookupKeyEqual	{ static bool equal(const LookupKey&, const LookupKey&); };
+	typedef dyld3::Map<LookupKey, LookupResult, LookupKeyHash, LookupKeyEqual> LookupMemo;
+
+	// One distinct import, as handed to resolveImports()
+	struct ImportRef		{ const char* name; long ordinal; uint8_t flags; };
 
 
 	typedef uintptr_t                   (^bind_handler)(const LinkContext& context, ImageLoaderMachOCompressed* image, uintptr_t addr, uint8_t type,
 														const char* symbolName, uint8_t symboFlags, intptr_t addend, long libraryOrdinal,
 														ExtraBindData *extraBindData,
-														const char* msg, LastLookup* last, bool runResolver);
+														const char* msg, LookupMemo* memo, bool runResolver);
 
 	void								eachLazyBind(const LinkContext& context, bind_handler);
 	void								eachBind(const LinkContext& context, bind_handler);
@@ -117,43 +138,63 @@ private:
 	static ImageLoaderMachOCompressed*	instantiateStart(const macho_header* mh, const char* path, unsigned int segCount, unsigned int libCount);
 	void								instantiateFinish(const LinkContext& context);
 
-	void								rebaseAt(const LinkContext& context, uintptr_t addr, uintptr_t slide, uint8_t type);
+	void								addRebaseRun(const LinkContext& context, RebaseSlider& slider, uintptr_t address, uintptr_t count, uintptr_t stride);
 	void								throwBadRebaseAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 												const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos);
 	static uintptr_t					bindAt(const LinkContext& context, ImageLoaderMachOCompressed* image, uintptr_t addr, uint8_t type, const char* symbolName,
                                                uint8_t symboFlags, intptr_t addend, long libraryOrdinal,
                                                ExtraBindData *extraBindData,
                                                const char* msg,
-												LastLookup* last, bool runResolver=false);
+												LookupMemo* memo, bool runResolver=false);
 	void								bindCompressed(const LinkContext& context);
 	void								throwBadBindingAddress(uintptr_t address, uintptr_t segmentEndAddress, int segmentIndex, 
 												const uint8_t* startOpcodes, const uint8_t* endOpcodes, const uint8_t* pos);
 	uintptr_t							resolve(const LinkContext& context, const char* symbolName, 
 												uint8_t symboFlags, long libraryOrdinal, const ImageLoader** targetImage, 
-												LastLookup* last = NULL, bool runResolver=false);
+												LookupMemo* memo = NULL, bool runResolver=false);
+	// resolve() without the memo, returns why the import can't be bound instead of throwing it
+	const char*							resolveImport(const LinkContext& context, const char* symbolName, uint8_t symboFlags, long libraryOrdinal,
+													  const ImageLoader** targetImage, bool runResolver, uintptr_t* symbolAddress);
+	// NULL once every import is resolved, otherwise why the first one that failed can't be bound
+	const char*							resolveImports(const LinkContext& context, size_t count, const ImportRef imports[],
+													   uintptr_t targets[], const ImageLoader* targetImages[], bool runResolver);
+	const char*							bindGathered(const LinkContext& context);
+	// a symbol that is not found is thrown, or reported in *whyNot (returning 0) when whyNot is given
 	uintptr_t							resolveFlat(const LinkContext& context, const char* symbolName, bool weak_import, bool runResolver,
-													const ImageLoader** foundIn);
+													const ImageLoader** foundIn, const char** whyNot=NULL);
 	uintptr_t							resolveCoalesced(const LinkContext& context, const char* symbolName, const ImageLoader** foundIn);
 	uintptr_t							resolveTwolevel(const LinkContext& context, const char* symbolName, const ImageLoader* definedInImage,
 													  const ImageLoader* requestorImage, unsigned requestorOrdinalOfDef, bool weak_import, bool runResolver,
-													  const ImageLoader** foundInn);
+													  const ImageLoader** foundInn, const char** whyNot=NULL);
 	static uintptr_t					interposeAt(const LinkContext& context, ImageLoaderMachOCompressed* image, uintptr_t addr, uint8_t type, const char*, 
                                                     uint8_t, intptr_t, long,
                                                     ExtraBindData *extraBindData,
-                                                    const char*, LastLookup*, bool runResolver);
+                                                    const char*, LookupMemo*, bool runResolver);
 	static uintptr_t					dynamicInterposeAt(const LinkContext& context, ImageLoaderMachOCompressed* image, uintptr_t addr, uint8_t type, const char*, 
                                                            uint8_t, intptr_t, long,
                                                            ExtraBindData *extraBindData,
-                                                           const char*, LastLookup*, bool runResolver);
+                                                           const char*, LookupMemo*, bool runResolver);
     void                                updateOptimizedLazyPointers(const LinkContext& context);
     void                                updateAlternateLazyPointer(uint8_t* stub, void** originalLazyPointerAddr, const LinkContext& context);
 	void								registerEncryption(const struct encryption_info_command* encryptCmd, const LinkContext& context);
-#if !UNSIGN_TOLERANT
-	void								doApplyFixups(const LinkContext& context, const dyld_chained_fixups_header* fixupsHeader);
-#endif
+	const char*							doApplyFixups(const LinkContext& context, const dyld_chained_fixups_header* fixupsHeader);
+	bool								linkPlanPath(const LinkContext& context, uint8_t uuid[16], uint64_t* dependencyHash, char path[PATH_MAX]) const;
+	CachedLinkPlan*						linkPlan(const LinkContext& context);
+	const char*							applyLinkPlanBinds(const LinkContext& context, CachedLinkPlan* plan, bool bindLazies);
+	void								recordLinkPlanBind(uint8_t kind, uintptr_t addr, uint8_t type, const char* symbolName,
+														   uint8_t symbolFlags, intptr_t addend, long libraryOrdinal);
+	void								saveLinkPlan(const LinkContext& context);
+	const ExportIndex*					exportIndex() const;
+
 	const struct dyld_info_command*			fDyldInfo;
 	const struct linkedit_data_command*		fChainedFixups;
 	const struct linkedit_data_command*		fExportsTrie;
+	CachedLinkPlan*							fLinkPlan;			// plan being replayed, shared by all loads of this image
+	LinkPlanBuilder*						fLinkPlanBuilder;	// plan being recorded, when none could be loaded
+	bool									fLinkPlanLookedUp;
+	LookupMemo								fLookupMemo;		// only populated while doBind() runs
+	mutable std::once_flag					fExportIndexOnce;
+	mutable ExportIndex*					fExportIndex;		// NULL until built, or if the trie is malformed
 };
 
 }
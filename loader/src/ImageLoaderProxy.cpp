@@ -24,22 +24,100 @@
 
 #include "ImageLoaderProxy.h"
 #include <dlfcn.h>
+#include <string.h>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 namespace isolator {
 
-ImageLoaderProxy* ImageLoaderProxy::instantiate(const char* modulePath) {
-    std::string moduleName_str = modulePath;
+namespace {
+
+// One proxy per normalized install name, shared by every image that depends
+// on it. Allocated once and never destroyed so it outlives static destructors
+// of images unloaded at exit.
+struct ProxyCache {
+    std::mutex lock;
+    std::unordered_map<std::string, ImageLoaderProxy*> proxies;
+};
 
-    // we cannot handle rpath properly. So there are two cases to support:
-    //  * Load by absolute path, rare case for iOS
-    //  * Load by file name. Assume that moduleName format is "@rpath/libXXX.dylib".
-    //    Have to just remove rpath prefix.
+ProxyCache& proxyCache() {
+    static ProxyCache* cache = new ProxyCache();
+    return *cache;
+}
+
+// we cannot handle rpath properly. So there are two cases to support:
+//  * Load by absolute path, rare case for iOS
+//  * Load by file name. Assume that moduleName format is "@rpath/libXXX.dylib".
+//    Have to just remove rpath prefix.
+std::string normalizedName(const char* modulePath) {
+    std::string moduleName_str = modulePath;
     std::string prefix = "@rpath/";
     if (!moduleName_str.compare(0, prefix.size(), prefix))
         moduleName_str.erase(0, prefix.size());
+    return moduleName_str;
+}
+
+const ImageLoader::Symbol* lookup(void* handle, const char* name) {
+    // TODO: dyld_stub_binder is special function from libdyld.dylib which
+    //  doesn't available via regular dlopen/dlsym interface cause it looks
+    //  only for underscored export symbols.
+    //  ===
+    //  So will return any func pointer(like "instantiate") and hope it will
+    //  be called never. Because it requires only for lazy binding, but we
+    //  enforced immediate binding.
+    if (strcmp(name, "dyld_stub_binder") == 0) {
+        ImageLoaderProxy* (*anyFunction)(const char*) = &ImageLoaderProxy::instantiate;
+        return reinterpret_cast<const ImageLoader::Symbol*>(anyFunction);
+    }
+
+    if (name[0] == '_') // remove leading underscore
+        name ++;
+
+    return reinterpret_cast<const ImageLoader::Symbol*>(dlsym(handle, name));
+}
+
+}
+
+ImageLoaderProxy* ImageLoaderProxy::instantiate(const char* modulePath) {
+    const char* whyNot = nullptr;
+    ImageLoaderProxy* proxy = instantiate(modulePath, &whyNot);
+    if (proxy == nullptr)
+        throw whyNot;
+    return proxy;
+}
+
+ImageLoaderProxy* ImageLoaderProxy::instantiate(const char* modulePath, const char** whyNot) {
+    const std::string moduleName_str = normalizedName(modulePath);
+
+    ProxyCache& cache = proxyCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    auto pos = cache.proxies.find(moduleName_str);
+    if (pos != cache.proxies.end())
+        return pos->second;
+
+    // dlopen() happens under the lock so concurrent loaders of the same
+    // library wait for one handle instead of racing to open it twice
+    void* handle = dlopen(moduleName_str.c_str(), RTLD_NOW);
+    if (!handle) {
+        *whyNot = dyld::mkstringf("ImageLoaderProxy: cannot load image %s \n\n reason: %s", moduleName_str.c_str(), dlerror());
+        return nullptr;
+    }
+    ImageLoaderProxy* proxy = new ImageLoaderProxy(moduleName_str.c_str(), handle);
+    cache.proxies.emplace(moduleName_str, proxy);
+    return proxy;
+}
+
+const ImageLoader::Symbol* ImageLoaderProxy::findInLoaded(const char* modulePath, const char* name, bool* loaded) {
+    // RTLD_NOLOAD takes a reference on a library that is loaded, and nothing else
+    void* handle = dlopen(normalizedName(modulePath).c_str(), RTLD_NOLOAD | RTLD_LAZY);
+    *loaded = (handle != nullptr);
+    if (!handle || !name)
+        return nullptr;
 
-    return new ImageLoaderProxy(moduleName_str.c_str());
+    auto sym = lookup(handle, name);
+    dlclose(handle);
+    return sym;
 }
 
 ImageLoaderProxy* ImageLoaderProxy::instantiateDefault() {
@@ -49,11 +127,7 @@ ImageLoaderProxy* ImageLoaderProxy::instantiateDefault() {
 
 ImageLoaderProxy::ImageLoaderProxy(): ImageLoaderUnimplementedStub("", 0), hdl(RTLD_DEFAULT) {}
 
-ImageLoaderProxy::ImageLoaderProxy(const char* modulePath): ImageLoaderUnimplementedStub(modulePath, 0) {
-    hdl = dlopen(modulePath, RTLD_NOW);
-    if (!hdl)
-        dyld::throwf("ImageLoaderProxy: cannot load image %s \n\n reason: %s", modulePath, dlerror());
-}
+ImageLoaderProxy::ImageLoaderProxy(const char* modulePath, void* handle): ImageLoaderUnimplementedStub(modulePath, 0), hdl(handle) {}
 
 ImageLoaderProxy::~ImageLoaderProxy() {
     if (hdl)
@@ -62,30 +136,9 @@ ImageLoaderProxy::~ImageLoaderProxy() {
 
 const ImageLoader::Symbol* ImageLoaderProxy::findExportedSymbol(const char* name, bool searchReExports,
         const char* thisPath, const ImageLoader** foundIn) const {
-    // TODO: dyld_stub_binder is special function from libdyld.dylib which
-    //  doesn't available via regular dlopen/dlsym interface cause it looks
-    //  only for underscored export symbols.
-    //  ===
-    //  So will return any func pointer(like "instantiate") and hope it will
-    //  be called never. Because it requires only for week binding, but we
-    //  enforced immediate flat binding.
-    if (std::string(name) == "dyld_stub_binder") {
-        *foundIn = this;
-        return reinterpret_cast<const ImageLoader::Symbol*>(instantiate);
-    }
-
-    if (name[0] == '_') // remove leading underscore
-        name ++;
-
-    auto sym = reinterpret_cast<const ImageLoader::Symbol*>(dlsym(hdl, name));
-
-    if (sym) {
-        *foundIn = this;
-        return sym;
-    } else {
-        *foundIn = nullptr;
-        return nullptr;
-    }
+    auto sym = lookup(hdl, name);
+    *foundIn = sym ? this : nullptr;
+    return sym;
 }
 
 uintptr_t ImageLoaderProxy::getExportedSymbolAddress(const ImageLoader::Symbol* sym, const ImageLoader::LinkContext& context,
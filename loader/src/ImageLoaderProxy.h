@@ -121,7 +121,7 @@ private:
     virtual void			doGetDependentLibraries(DependentLibraryInfo libs[]) STUB_NOTHING;
     virtual LibraryInfo			doGetLibraryInfo(const LibraryInfo& requestorInfo) { return {}; };
     virtual void			doRebase(const LinkContext& context) STUB_NOTHING;
-    virtual void			doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent) STUB_NOTHING;
+    virtual const char*			doBind(const LinkContext& context, bool forceLazysBound, const ImageLoader* reExportParent) STUB_METHOD(nullptr);
     virtual void			doBindJustLazies(const LinkContext& context) UNIMPLEMENTED_METHOD;
     virtual void			doGetDOFSections(const LinkContext& context, std::vector<DOFInfo>& dofs) UNIMPLEMENTED_METHOD;
     virtual void			doInterpose(const LinkContext& context) UNIMPLEMENTED_METHOD;
@@ -147,9 +147,29 @@ public:
      * Will look up symbols in this module and dependencies.
      *
      * Note: limited(minimal) support of rpath specification.
+     *
+     * Proxies are cached process-wide by install name, so every dependent
+     * shares one dlopen handle. They are never released: images loaded from
+     * memory are never unloaded and their fixups point into the library, so
+     * the proxy and its handle live as long as the process.
      */
     static ImageLoaderProxy* instantiate(const char* modulePath);
 
+    /**
+     * instantiate() that returns nullptr and sets whyNot, formatted like
+     * every other loader message (see Messages.h), when the library does
+     * not open, instead of throwing.
+     */
+    static ImageLoaderProxy* instantiate(const char* modulePath, const char** whyNot);
+
+    /**
+     * Look name up in modulePath only if the process already has that
+     * library loaded: it is checked with dlopen(RTLD_NOLOAD), so nothing
+     * gets opened, initialized or pinned. Returns nullptr with loaded set to
+     * false when it is not loaded. A null name only checks that it is.
+     */
+    static const Symbol* findInLoaded(const char* modulePath, const char* name, bool* loaded);
+
     /**
      * Construct ImageLoaderProxy based on RTLD_DEFAULT.
      * Will look up symbols in global space
@@ -164,7 +184,7 @@ public:
         const ImageLoader* requestor, bool runResolver, const char* symbolName) const;
 
 private:
-    ImageLoaderProxy(const char* moduleName);
+    ImageLoaderProxy(const char* moduleName, void* handle);
     ImageLoaderProxy();
     void* hdl = 0;
 };
@@ -0,0 +1,213 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "LinkPlan.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits.h>
+#include <unistd.h>
+
+namespace isolator {
+
+static const char sLinkPlanMagic[8] = { 'l', 'i', 'n', 'k', 'p', 'l', 'a', 'n' };
+
+uint64_t linkPlanHash(const void* data, size_t length, uint64_t seed)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t hash = seed;
+	for (size_t i=0; i < length; ++i) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+LinkPlanBuilder::LinkPlanBuilder(const uint8_t uuid[16], uint64_t dependencyHash, uint32_t pointerSize, uint32_t segmentCount)
+	: fDependencyHash(dependencyHash), fPointerSize(pointerSize), fSegmentCount(segmentCount), fFlags(0), fAbandoned(false)
+{
+	memcpy(fUUID, uuid, sizeof(fUUID));
+}
+
+void LinkPlanBuilder::addRebase(uint32_t segIndex, uint64_t segOffset, uint8_t type)
+{
+	if ( (segIndex > UINT8_MAX) || (segOffset > UINT32_MAX) ) {
+		fAbandoned = true;
+		return;
+	}
+	LinkPlanFixup fixup = {};
+	fixup.segOffset = (uint32_t)segOffset;
+	fixup.segIndex	= (uint8_t)segIndex;
+	fixup.kind		= kLinkPlanRebase;
+	fixup.type		= type;
+	fFixups.push_back(fixup);
+	fFlags |= kLinkPlanHasRebases;
+}
+
+void LinkPlanBuilder::addBind(uint8_t kind, uint32_t segIndex, uint64_t segOffset, uint8_t type, const char* symbolName,
+							  uint8_t symbolFlags, int64_t addend, long libraryOrdinal)
+{
+	if ( (segIndex > UINT8_MAX) || (segOffset > UINT32_MAX) || (symbolName == NULL) ) {
+		fAbandoned = true;
+		return;
+	}
+	ImportKey key(symbolName, libraryOrdinal, symbolFlags, addend);
+	std::map<ImportKey, uint32_t>::iterator pos = fImportIndex.find(key);
+	uint32_t importIndex;
+	if ( pos == fImportIndex.end() ) {
+		LinkPlanImport import = {};
+		import.addend			= addend;
+		import.libraryOrdinal	= (int32_t)libraryOrdinal;
+		import.nameOffset		= (uint32_t)fStrings.size();
+		import.symbolFlags		= symbolFlags;
+		fStrings.append(symbolName, strlen(symbolName)+1);
+		importIndex = (uint32_t)fImports.size();
+		fImports.push_back(import);
+		fImportIndex[key] = importIndex;
+	}
+	else {
+		importIndex = pos->second;
+	}
+	LinkPlanFixup fixup = {};
+	fixup.segOffset		= (uint32_t)segOffset;
+	fixup.segIndex		= (uint8_t)segIndex;
+	fixup.kind			= kind;
+	fixup.type			= type;
+	fixup.importIndex	= importIndex;
+	fFixups.push_back(fixup);
+	if ( kind == kLinkPlanLazyBind )
+		fFlags |= kLinkPlanHasLazyBinds;
+}
+
+std::vector<uint8_t> LinkPlanBuilder::serialize() const
+{
+	const size_t importsSize = fImports.size() * sizeof(LinkPlanImport);
+	const size_t fixupsSize  = fFixups.size() * sizeof(LinkPlanFixup);
+	std::vector<uint8_t> result(sizeof(LinkPlanHeader) + importsSize + fixupsSize + fStrings.size());
+	uint8_t* payload = &result[sizeof(LinkPlanHeader)];
+	if ( importsSize != 0 )
+		memcpy(payload, fImports.data(), importsSize);
+	if ( fixupsSize != 0 )
+		memcpy(payload + importsSize, fFixups.data(), fixupsSize);
+	if ( !fStrings.empty() )
+		memcpy(payload + importsSize + fixupsSize, fStrings.data(), fStrings.size());
+
+	LinkPlanHeader header = {};
+	memcpy(header.magic, sLinkPlanMagic, sizeof(header.magic));
+	header.version			= kLinkPlanVersion;
+	header.pointerSize		= fPointerSize;
+	memcpy(header.uuid, fUUID, sizeof(header.uuid));
+	header.dependencyHash	= fDependencyHash;
+	header.payloadHash		= linkPlanHash(payload, result.size() - sizeof(LinkPlanHeader));
+	header.segmentCount		= fSegmentCount;
+	header.fixupCount		= (uint32_t)fFixups.size();
+	header.importCount		= (uint32_t)fImports.size();
+	header.stringsSize		= (uint32_t)fStrings.size();
+	header.flags			= fFlags;
+	memcpy(&result[0], &header, sizeof(header));
+	return result;
+}
+
+bool LinkPlanBuilder::writeToFile(const char* path) const
+{
+	if ( fAbandoned )
+		return false;
+	std::vector<uint8_t> bytes = serialize();
+	char tempPath[PATH_MAX];
+	if ( snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tempPath) )
+		return false;
+	FILE* file = fopen(tempPath, "wb");
+	if ( file == NULL )
+		return false;
+	bool ok = (fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+	ok = (fclose(file) == 0) && ok;
+	if ( ok )
+		ok = (rename(tempPath, path) == 0);
+	if ( !ok )
+		unlink(tempPath);
+	return ok;
+}
+
+
+const char* LinkPlanView::validate(const void* buffer, uint64_t length, const uint8_t uuid[16], uint64_t dependencyHash,
+								   uint32_t pointerSize, uint32_t segmentCount, const uint64_t segmentSizes[])
+{
+	if ( length < sizeof(LinkPlanHeader) )
+		return "truncated header";
+	if ( ((uintptr_t)buffer % alignof(LinkPlanHeader)) != 0 )
+		return "misaligned buffer";
+	const LinkPlanHeader* header = (const LinkPlanHeader*)buffer;
+	if ( memcmp(header->magic, sLinkPlanMagic, sizeof(header->magic)) != 0 )
+		return "bad magic";
+	if ( header->version != kLinkPlanVersion )
+		return "unsupported version";
+	if ( header->pointerSize != pointerSize )
+		return "pointer size mismatch";
+	if ( memcmp(header->uuid, uuid, sizeof(header->uuid)) != 0 )
+		return "UUID mismatch";
+	if ( header->dependencyHash != dependencyHash )
+		return "dependencies changed";
+	if ( header->segmentCount != segmentCount )
+		return "segment count mismatch";
+
+	const uint64_t expected = sizeof(LinkPlanHeader) + (uint64_t)header->importCount * sizeof(LinkPlanImport)
+							+ (uint64_t)header->fixupCount * sizeof(LinkPlanFixup) + header->stringsSize;
+	if ( expected != length )
+		return "size mismatch";
+	const uint8_t* payload = (const uint8_t*)buffer + sizeof(LinkPlanHeader);
+	if ( linkPlanHash(payload, (size_t)(length - sizeof(LinkPlanHeader))) != header->payloadHash )
+		return "checksum mismatch";
+
+	LinkPlanView view(buffer);
+	const char* strings = (const char*)&view.fixups()[header->fixupCount];
+	if ( (header->stringsSize != 0) && (strings[header->stringsSize-1] != '\0') )
+		return "unterminated string pool";
+	for (uint32_t i=0; i < header->importCount; ++i) {
+		if ( view.imports()[i].nameOffset >= header->stringsSize )
+			return "import name out of range";
+	}
+	const LinkPlanFixup* fixups = view.fixups();
+	for (uint32_t i=0; i < header->fixupCount; ++i) {
+		const LinkPlanFixup& fixup = fixups[i];
+		if ( fixup.segIndex >= segmentCount )
+			return "fixup segment out of range";
+		if ( (uint64_t)fixup.segOffset + pointerSize > segmentSizes[fixup.segIndex] )
+			return "fixup outside writable segment";
+		switch ( fixup.kind ) {
+			case kLinkPlanRebase:
+				break;
+			case kLinkPlanBind:
+			case kLinkPlanLazyBind:
+				if ( fixup.importIndex >= header->importCount )
+					return "fixup import out of range";
+				break;
+			default:
+				return "bad fixup kind";
+		}
+	}
+	return NULL;
+}
+
+}
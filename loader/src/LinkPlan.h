@@ -0,0 +1,159 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Precompiled link plan: a flat, position independent record of the rebase and
+ * bind fixups of one image, in the order its opcodes produce them. Imports are
+ * de-duplicated into a table, so replaying a plan needs one symbol lookup per
+ * distinct import and no opcode decoding at all.
+ *
+ * A plan is stored as a single file that is mmap()ed and used in place once
+ * validate() accepted it:
+ *
+ *     LinkPlanHeader | LinkPlanImport[importCount] | LinkPlanFixup[fixupCount] | strings
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __LINK_PLAN__
+#define __LINK_PLAN__
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace isolator {
+
+enum {
+	kLinkPlanVersion		= 1,
+
+	// LinkPlanFixup::kind
+	kLinkPlanRebase			= 1,
+	kLinkPlanBind			= 2,
+	kLinkPlanLazyBind		= 3,
+
+	// LinkPlanHeader::flags
+	kLinkPlanHasRebases		= 0x1,
+	kLinkPlanHasLazyBinds	= 0x2,
+};
+
+struct LinkPlanHeader {
+	char		magic[8];			// "linkplan"
+	uint32_t	version;
+	uint32_t	pointerSize;
+	uint8_t		uuid[16];
+	uint64_t	dependencyHash;
+	uint64_t	payloadHash;		// linkPlanHash() of everything after the header
+	uint32_t	segmentCount;
+	uint32_t	fixupCount;
+	uint32_t	importCount;
+	uint32_t	stringsSize;
+	uint32_t	flags;
+	uint32_t	reserved;
+};
+
+struct LinkPlanFixup {
+	uint32_t	segOffset;
+	uint8_t		segIndex;
+	uint8_t		kind;
+	uint8_t		type;				// REBASE_TYPE_* or BIND_TYPE_*
+	uint8_t		reserved;
+	uint32_t	importIndex;		// binds only
+};
+
+struct LinkPlanImport {
+	int64_t		addend;
+	int32_t		libraryOrdinal;
+	uint32_t	nameOffset;			// into strings
+	uint8_t		symbolFlags;
+	uint8_t		reserved[7];
+};
+
+// FNV-1a, used for the payload checksum and for hashing dependency lists
+uint64_t linkPlanHash(const void* data, size_t length, uint64_t seed=0xcbf29ce484222325ULL);
+
+
+// Collects fixups while the opcodes are interpreted, then serializes them.
+class LinkPlanBuilder {
+public:
+								LinkPlanBuilder(const uint8_t uuid[16], uint64_t dependencyHash, uint32_t pointerSize, uint32_t segmentCount);
+
+	void						addRebase(uint32_t segIndex, uint64_t segOffset, uint8_t type);
+	void						addBind(uint8_t kind, uint32_t segIndex, uint64_t segOffset, uint8_t type, const char* symbolName,
+										uint8_t symbolFlags, int64_t addend, long libraryOrdinal);
+	void						setFlag(uint32_t flag) { fFlags |= flag; }
+	bool						hasFlag(uint32_t flag) const { return (fFlags & flag) != 0; }
+
+	// fixups that cannot be expressed in a plan (e.g. threaded binds) make the whole plan unusable
+	void						abandon() { fAbandoned = true; }
+	bool						abandoned() const { return fAbandoned; }
+
+	std::vector<uint8_t>		serialize() const;
+	// writes to a temporary file and renames it into place, so readers never see a partial plan
+	bool						writeToFile(const char* path) const;
+
+private:
+	typedef std::tuple<std::string, long, uint8_t, int64_t> ImportKey;
+
+	uint8_t						fUUID[16];
+	uint64_t					fDependencyHash;
+	uint32_t					fPointerSize;
+	uint32_t					fSegmentCount;
+	uint32_t					fFlags;
+	bool						fAbandoned;
+	std::vector<LinkPlanFixup>	fFixups;
+	std::vector<LinkPlanImport>	fImports;
+	std::string					fStrings;
+	std::map<ImportKey, uint32_t> fImportIndex;
+};
+
+
+// Read-only access to a serialized plan.
+class LinkPlanView {
+public:
+	// Returns NULL if |buffer| is a well formed plan for the given image, otherwise why it is not.
+	// segmentSizes[i] is the number of writable bytes in segment i (0 for read-only segments),
+	// so every fixup of an accepted plan is known to land inside a writable segment.
+	static const char*			validate(const void* buffer, uint64_t length, const uint8_t uuid[16], uint64_t dependencyHash,
+										 uint32_t pointerSize, uint32_t segmentCount, const uint64_t segmentSizes[]);
+
+	explicit					LinkPlanView(const void* buffer) : fBuffer((const uint8_t*)buffer) {}
+
+	const LinkPlanHeader&		header() const { return *(const LinkPlanHeader*)fBuffer; }
+	const LinkPlanImport*		imports() const { return (const LinkPlanImport*)(fBuffer + sizeof(LinkPlanHeader)); }
+	const LinkPlanFixup*		fixups() const { return (const LinkPlanFixup*)&imports()[header().importCount]; }
+	const char*					importName(uint32_t index) const { return strings() + imports()[index].nameOffset; }
+
+private:
+	const char*					strings() const { return (const char*)&fixups()[header().fixupCount]; }
+
+	const uint8_t*				fBuffer;
+};
+
+}
+
+#endif // __LINK_PLAN__
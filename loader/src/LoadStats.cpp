@@ -0,0 +1,137 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "LoadStats.h"
+
+#include <mutex>
+#include <new>
+#include <vector>
+#include <stdlib.h>
+
+namespace isolator {
+
+namespace {
+
+// a cache line (or several) each, so threads counting into neighbouring shards do not share a line
+struct alignas(64) Shard {
+	std::atomic<uint64_t>	values[kLoadStatCount];
+	Shard*					nextFree;
+};
+static_assert(sizeof(Shard) % 64 == 0, "shards must not share a cache line");
+
+struct Registry {
+	std::mutex				lock;
+	std::vector<Shard*>		shards;
+	Shard*					freeList = nullptr;
+};
+
+// never destroyed, images may still be unloaded (and counted) while static destructors run
+Registry& registry()
+{
+	static Registry* sRegistry = new Registry();
+	return *sRegistry;
+}
+
+// Gives the thread's shard back when the thread exits.
+struct ShardOwner {
+	Shard*	shard = nullptr;
+
+	~ShardOwner() {
+		if ( shard == nullptr )
+			return;
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		shard->nextFree = reg.freeList;
+		reg.freeList = shard;
+		shard = nullptr;
+	}
+};
+
+thread_local ShardOwner tShardOwner;
+
+Shard* threadShard()
+{
+	Shard* shard = tShardOwner.shard;
+	if ( shard == nullptr ) {
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		if ( reg.freeList != nullptr ) {
+			shard = reg.freeList;
+			reg.freeList = shard->nextFree;
+		}
+		else {
+			// C++11 operator new only guarantees alignof(max_align_t)
+			void* memory = nullptr;
+			if ( posix_memalign(&memory, alignof(Shard), sizeof(Shard)) != 0 )
+				throw std::bad_alloc();
+			shard = new (memory) Shard();
+			for (std::atomic<uint64_t>& value : shard->values)
+				value.store(0, std::memory_order_relaxed);
+			reg.shards.push_back(shard);
+		}
+		tShardOwner.shard = shard;
+	}
+	return shard;
+}
+
+}
+
+namespace loadstats {
+
+void add(LoadStat stat, uint64_t count)
+{
+	// only this thread writes the shard, readers just need a value that is not torn
+	std::atomic<uint64_t>& value = threadShard()->values[stat];
+	value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+void snapshot(LoadStatValues& out)
+{
+	for (uint64_t& value : out.value)
+		value = 0;
+	Registry& reg = registry();
+	std::lock_guard<std::mutex> guard(reg.lock);
+	for (Shard* shard : reg.shards) {
+		for (int i=0; i < kLoadStatCount; ++i)
+			out.value[i] += shard->values[i].load(std::memory_order_relaxed);
+	}
+}
+
+}
+
+ImageLoadStats::ImageLoadStats()
+{
+	for (std::atomic<uint64_t>& value : fValues)
+		value.store(0, std::memory_order_relaxed);
+}
+
+void ImageLoadStats::snapshot(LoadStatValues& out) const
+{
+	for (int i=0; i < kLoadStatCount; ++i)
+		out.value[i] = fValues[i].load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,115 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Load statistics: how many bytes were mapped, fixups applied, symbols
+ * looked up and how long each phase took, per image and for the process.
+ *
+ * Process totals live in one shard of counters per thread. Only the owning
+ * thread writes its shard, with a plain load and store, so loads running in
+ * parallel never share a cache line or wait on a lock; reading sums every
+ * shard. A thread's shard, counts included, is handed to the next new thread
+ * once it exits, so the number of shards stays at the most threads that ever
+ * loaded at the same time.
+ *
+ * Counters of one image can be bumped from several threads (worker pools,
+ * lazy binds), they are relaxed atomics. Counts that go down (bytes mapped,
+ * when an image is unloaded) are added as negative values and wrap around
+ * like any unsigned sum. Times are in mach_absolute_time() units.
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __LOAD_STATS__
+#define __LOAD_STATS__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace isolator {
+
+enum LoadStat {
+	kLoadStatSegmentsMapped,
+	kLoadStatBytesMapped,
+	kLoadStatBytesRemapped,
+	kLoadStatBytesCopied,
+	kLoadStatBytesZeroPagesSkipped,
+	kLoadStatImagesAdoptedInPlace,
+	kLoadStatImagesAdoptedByCopy,
+	kLoadStatImagesRebaseSkipped,
+	kLoadStatPreferredLoadAddressMisses,
+	kLoadStatRebaseFixups,
+	kLoadStatBindFixups,
+	kLoadStatLazyBindFixups,
+	kLoadStatBindSymbolsResolved,
+	kLoadStatBindImageSearches,
+	kLoadStatSymbolTrieSearches,
+	kLoadStatObjCClassesRegistered,
+	kLoadStatObjCSelectorsRegistered,
+	kLoadStatLoadLibrariesTime,
+	kLoadStatMapTime,
+	kLoadStatRebaseTime,
+	kLoadStatBindTime,
+	kLoadStatWeakBindTime,
+	kLoadStatRebindCacheTime,
+	kLoadStatDOFTime,
+	kLoadStatObjCSetupTime,
+	kLoadStatInitTime,
+	kLoadStatCount
+};
+
+struct LoadStatValues {
+	uint64_t		value[kLoadStatCount];
+
+	uint64_t		operator[](LoadStat stat) const { return value[stat]; }
+};
+
+namespace loadstats {
+
+// Adds to the calling thread's shard of the process totals.
+void		add(LoadStat stat, uint64_t count);
+// Sums the process totals over all shards.
+void		snapshot(LoadStatValues& out);
+
+}
+
+class ImageLoadStats {
+public:
+					ImageLoadStats();
+
+	void			add(LoadStat stat, uint64_t count) { fValues[stat].fetch_add(count, std::memory_order_relaxed); }
+	uint64_t		get(LoadStat stat) const { return fValues[stat].load(std::memory_order_relaxed); }
+	void			snapshot(LoadStatValues& out) const;
+
+private:
+					ImageLoadStats(const ImageLoadStats&) = delete;
+	ImageLoadStats&	operator=(const ImageLoadStats&) = delete;
+
+	std::atomic<uint64_t>	fValues[kLoadStatCount];
+};
+
+}
+
+#endif // __LOAD_STATS__
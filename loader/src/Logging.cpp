@@ -0,0 +1,89 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "Logging.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace isolator {
+namespace logging {
+
+std::atomic<uint32_t> gCategories(0);
+
+void setCategories(uint32_t categories)
+{
+	gCategories.store(categories, std::memory_order_relaxed);
+}
+
+uint32_t parseCategories(const char* list)
+{
+	static const struct { const char* name; uint32_t category; } sNames[] = {
+		{ "load",		kLogLoad },
+		{ "mapping",	kLogMapping },
+		{ "rebase",		kLogRebase },
+		{ "bind",		kLogBind },
+		{ "init",		kLogInit },
+		{ "objc",		kLogObjC },
+		{ "codesign",	kLogCodeSign },
+		{ "all",		kLogAll },
+	};
+	uint32_t categories = 0;
+	for (const char* p = list; (p != NULL) && (*p != '\0'); ) {
+		const char* comma = strchr(p, ',');
+		const size_t length = (comma != NULL) ? (size_t)(comma - p) : strlen(p);
+		for (const auto& entry : sNames) {
+			if ( (strlen(entry.name) == length) && (strncmp(entry.name, p, length) == 0) )
+				categories |= entry.category;
+		}
+		p = (comma != NULL) ? comma + 1 : p + length;
+	}
+	return categories;
+}
+
+void vwrite(int level, const char* format, va_list list)
+{
+	// one fwrite per message, longer ones are cut rather than split across calls.
+	// errors and warnings go to stderr, tracing to stdout as dyld::log() always did
+	char buffer[1024];
+	int length = vsnprintf(buffer, sizeof(buffer), format, list);
+	if ( length < 0 )
+		return;
+	if ( (size_t)length >= sizeof(buffer) )
+		length = sizeof(buffer) - 1;
+	fwrite(buffer, 1, (size_t)length, (level <= DL_LOG_LEVEL_WARN) ? stderr : stdout);
+}
+
+void write(int level, const char* format, ...)
+{
+	va_list list;
+	va_start(list, format);
+	vwrite(level, format, list);
+	va_end(list);
+}
+
+}
+}
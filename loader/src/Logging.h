@@ -0,0 +1,122 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Loader logging. Every message has a level and a category:
+ *
+ *  - Levels are filtered at compile time. A DL_LOG_* statement above
+ *    DL_LOG_MIN_LEVEL expands to nothing, its arguments are not evaluated.
+ *    The default keeps errors and warnings in NDEBUG builds and everything
+ *    otherwise.
+ *  - Categories are filtered at run time by a mask, set from CUSTOM_DL_LOG
+ *    (comma separated category names, or "all"). Errors and warnings are
+ *    printed whatever the mask, the rest only for enabled categories. With
+ *    the mask empty, a compiled-in statement costs one relaxed atomic load.
+ *
+ * The mask also sets the matching verbose* flags of the default link
+ * context, so the dyld::log() tracing they guard follows the same switch.
+ * A message is formatted on the stack and written with a single call, so
+ * lines from loads on different threads do not interleave. Errors and
+ * warnings go to stderr, everything else to stdout.
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __LOGGING__
+#define __LOGGING__
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+
+#define DL_LOG_LEVEL_ERROR		0
+#define DL_LOG_LEVEL_WARN		1
+#define DL_LOG_LEVEL_INFO		2
+#define DL_LOG_LEVEL_DEBUG		3
+
+#ifndef DL_LOG_MIN_LEVEL
+	#if defined(NDEBUG)
+		#define DL_LOG_MIN_LEVEL	DL_LOG_LEVEL_WARN
+	#else
+		#define DL_LOG_MIN_LEVEL	DL_LOG_LEVEL_DEBUG
+	#endif
+#endif
+
+namespace isolator {
+namespace logging {
+
+enum Category : uint32_t {
+	kLogLoad		= 1 << 0,	// dlopen steps and failures
+	kLogMapping		= 1 << 1,
+	kLogRebase		= 1 << 2,
+	kLogBind		= 1 << 3,
+	kLogInit		= 1 << 4,
+	kLogObjC		= 1 << 5,
+	kLogCodeSign	= 1 << 6,
+	kLogAll			= 0xFFFFFFFF
+};
+
+extern std::atomic<uint32_t>	gCategories;
+
+inline bool enabled(uint32_t categories) { return (gCategories.load(std::memory_order_relaxed) & categories) != 0; }
+void		setCategories(uint32_t categories);
+// "mapping,bind" -> kLogMapping|kLogBind, unknown names are ignored, NULL gives 0
+uint32_t	parseCategories(const char* list);
+
+void		write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void		vwrite(int level, const char* format, va_list list);
+
+}
+}
+
+#define DL_LOG_AT(level, category, ...) \
+	do { \
+		if ( ((level) <= DL_LOG_LEVEL_WARN) || isolator::logging::enabled(category) ) \
+			isolator::logging::write((level), __VA_ARGS__); \
+	} while (0)
+
+#define DL_LOG_NOTHING()	do { } while (0)
+
+#if DL_LOG_MIN_LEVEL >= DL_LOG_LEVEL_ERROR
+	#define DL_LOG_ERROR(category, ...)		DL_LOG_AT(DL_LOG_LEVEL_ERROR, category, __VA_ARGS__)
+#else
+	#define DL_LOG_ERROR(category, ...)		DL_LOG_NOTHING()
+#endif
+#if DL_LOG_MIN_LEVEL >= DL_LOG_LEVEL_WARN
+	#define DL_LOG_WARN(category, ...)		DL_LOG_AT(DL_LOG_LEVEL_WARN, category, __VA_ARGS__)
+#else
+	#define DL_LOG_WARN(category, ...)		DL_LOG_NOTHING()
+#endif
+#if DL_LOG_MIN_LEVEL >= DL_LOG_LEVEL_INFO
+	#define DL_LOG_INFO(category, ...)		DL_LOG_AT(DL_LOG_LEVEL_INFO, category, __VA_ARGS__)
+#else
+	#define DL_LOG_INFO(category, ...)		DL_LOG_NOTHING()
+#endif
+#if DL_LOG_MIN_LEVEL >= DL_LOG_LEVEL_DEBUG
+	#define DL_LOG_DEBUG(category, ...)		DL_LOG_AT(DL_LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#else
+	#define DL_LOG_DEBUG(category, ...)		DL_LOG_NOTHING()
+#endif
+
+#endif // __LOGGING__
@@ -0,0 +1,268 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "MachOLayout.h"
+#include "Messages.h"
+
+#include <cstring>
+#include <mach-o/nlist.h>
+
+namespace isolator {
+
+#if __LP64__
+	static const uint32_t kMagic			= MH_MAGIC_64;
+	static const uint32_t kSegmentCommand	= LC_SEGMENT_64;
+	static const uint32_t kWrongSegment		= LC_SEGMENT;
+	static const uint32_t kCommandAlignment	= 8;
+	typedef struct nlist_64					Symbol;
+#else
+	static const uint32_t kMagic			= MH_MAGIC;
+	static const uint32_t kSegmentCommand	= LC_SEGMENT;
+	static const uint32_t kWrongSegment		= LC_SEGMENT_64;
+	static const uint32_t kCommandAlignment	= 4;
+	typedef struct nlist					Symbol;
+#endif
+
+#if __arm64__
+	static const cpu_type_t kCpuType		= CPU_TYPE_ARM64;
+#elif __x86_64__
+	static const cpu_type_t kCpuType		= CPU_TYPE_X86_64;
+#elif __arm__
+	static const cpu_type_t kCpuType		= CPU_TYPE_ARM;
+#elif __i386__
+	static const cpu_type_t kCpuType		= CPU_TYPE_I386;
+#else
+	static const cpu_type_t kCpuType		= CPU_TYPE_ANY;
+#endif
+
+// true if [offset, offset+size) lies inside [0, length), without overflowing
+static bool inside(uint64_t offset, uint64_t size, uint64_t length)
+{
+	return (offset <= length) && (size <= length - offset);
+}
+
+// empty ranges are accepted wherever they point
+static bool insideLinkEdit(const MachOLayout::Segment* linkedit, uint64_t offset, uint64_t size)
+{
+	return (size == 0) || ((offset >= linkedit->fileoff) && inside(offset - linkedit->fileoff, size, linkedit->filesize));
+}
+
+const char* MachOLayout::validate(const void* image, uint64_t length, MachOLayout* layout)
+{
+	if ( (image == NULL) || (length < sizeof(Header)) )
+		return "malformed mach-o image: too small for a mach header";
+	const Header* mh = (const Header*)image;
+	if ( mh->magic != kMagic )
+		return messages::format("not a mach-o image for this architecture: magic 0x%08X", mh->magic);
+	if ( (kCpuType != CPU_TYPE_ANY) && (mh->cputype != kCpuType) )
+		return messages::format("mach-o image built for cpu type 0x%X, this process is 0x%X", mh->cputype, kCpuType);
+	if ( !inside(sizeof(Header), mh->sizeofcmds, length) )
+		return messages::format("malformed mach-o image: sizeofcmds (%u) extends beyond end of image", mh->sizeofcmds);
+	if ( mh->ncmds > (mh->sizeofcmds / sizeof(load_command)) )
+		return messages::format("malformed mach-o image: ncmds (%u) too large to fit in sizeofcmds (%u)", mh->ncmds, mh->sizeofcmds);
+
+	MachOLayout found;
+	memset(&found, 0, sizeof(found));
+	found.header = mh;
+	found.vmStart = UINT64_MAX;
+	bool hasStartOfFile = false;
+
+	const uint8_t* const startCmds = (const uint8_t*)image + sizeof(Header);
+	const uint8_t* const endCmds = startCmds + mh->sizeofcmds;
+	const uint8_t* p = startCmds;
+	for (uint32_t i=0; i < mh->ncmds; ++i) {
+		const load_command* cmd = (const load_command*)p;
+		if ( (size_t)(endCmds - p) < sizeof(load_command) )
+			return messages::format("malformed mach-o image: load command #%u extends beyond sizeofcmds", i);
+		const uint32_t cmdLength = cmd->cmdsize;
+		if ( cmdLength < sizeof(load_command) )
+			return messages::format("malformed mach-o image: load command #%u length (%u) too small", i, cmdLength);
+		if ( (cmdLength % kCommandAlignment) != 0 )
+			return messages::format("malformed mach-o image: load command #%u length (%u) is not a multiple of %u", i, cmdLength, kCommandAlignment);
+		if ( cmdLength > (size_t)(endCmds - p) )
+			return messages::format("malformed mach-o image: load command #%u length (%u) would exceed sizeofcmds (%u)", i, cmdLength, mh->sizeofcmds);
+
+		switch ( cmd->cmd ) {
+			case kSegmentCommand: {
+				const Segment* seg = (const Segment*)cmd;
+				if ( cmdLength < sizeof(Segment) )
+					return "malformed mach-o image: LC_SEGMENT size too small";
+				if ( cmdLength != sizeof(Segment) + (uint64_t)seg->nsects * sizeof(Section) )
+					return "malformed mach-o image: LC_SEGMENT size wrong for number of sections";
+				if ( (seg->vmsize != 0) && (seg->filesize > seg->vmsize) )
+					return messages::format("malformed mach-o image: segment %.16s filesize (0x%llX) is larger than vmsize (0x%llX)",
+											seg->segname, (unsigned long long)seg->filesize, (unsigned long long)seg->vmsize);
+				if ( !inside(seg->fileoff, seg->filesize, length) )
+					return messages::format("malformed mach-o image: segment %.16s extends beyond end of image", seg->segname);
+				if ( seg->vmaddr + seg->vmsize < seg->vmaddr )
+					return messages::format("malformed mach-o image: segment %.16s wraps around address space", seg->segname);
+				if ( seg->vmsize != 0 ) {
+					++found.segmentCount;
+					if ( seg->vmaddr < found.vmStart )
+						found.vmStart = seg->vmaddr;
+					if ( seg->vmaddr + seg->vmsize > found.vmEnd )
+						found.vmEnd = seg->vmaddr + seg->vmsize;
+				}
+				if ( strncmp(seg->segname, "__LINKEDIT", sizeof(seg->segname)) == 0 ) {
+					if ( found.linkedit != NULL )
+						return "malformed mach-o image: multiple __LINKEDIT segments";
+					if ( seg->fileoff == 0 )
+						return "malformed mach-o image: __LINKEDIT has fileoff==0 which overlaps mach_header";
+					found.linkedit = seg;
+				}
+				if ( (seg->fileoff == 0) && (seg->filesize != 0) ) {
+					if ( seg->filesize < sizeof(Header) + mh->sizeofcmds )
+						return messages::format("malformed mach-o image: %.16s segment does not map all of load commands", seg->segname);
+					hasStartOfFile = true;
+					found.headerVMAddress = seg->vmaddr;
+				}
+				break;
+			}
+			case kWrongSegment:
+				return "malformed mach-o image: wrong LC_SEGMENT[_64] for architecture";
+			case LC_DYLD_INFO:
+			case LC_DYLD_INFO_ONLY:
+				if ( cmdLength != sizeof(dyld_info_command) )
+					return "malformed mach-o image: LC_DYLD_INFO size wrong";
+				found.dyldInfo = (const dyld_info_command*)cmd;
+				break;
+			case LC_DYLD_CHAINED_FIXUPS:
+				if ( cmdLength != sizeof(linkedit_data_command) )
+					return "malformed mach-o image: LC_DYLD_CHAINED_FIXUPS size wrong";
+				found.chainedFixups = (const linkedit_data_command*)cmd;
+				break;
+			case LC_DYLD_EXPORTS_TRIE:
+				if ( cmdLength != sizeof(linkedit_data_command) )
+					return "malformed mach-o image: LC_DYLD_EXPORTS_TRIE size wrong";
+				found.exportsTrie = (const linkedit_data_command*)cmd;
+				break;
+			case LC_SYMTAB:
+				if ( cmdLength != sizeof(symtab_command) )
+					return "malformed mach-o image: LC_SYMTAB size wrong";
+				found.symtab = (const symtab_command*)cmd;
+				break;
+			case LC_DYSYMTAB:
+				if ( cmdLength != sizeof(dysymtab_command) )
+					return "malformed mach-o image: LC_DYSYMTAB size wrong";
+				found.dysymtab = (const dysymtab_command*)cmd;
+				break;
+			case LC_LOAD_DYLIB:
+			case LC_LOAD_WEAK_DYLIB:
+			case LC_REEXPORT_DYLIB:
+			case LC_LOAD_UPWARD_DYLIB:
+				++found.libraryCount;
+				// fall thru
+				[[clang::fallthrough]];
+			case LC_ID_DYLIB: {
+				if ( cmdLength < sizeof(dylib_command) )
+					return messages::format("malformed mach-o image: dylib load command #%u too small", i);
+				const dylib_command* dylibCmd = (const dylib_command*)cmd;
+				const uint32_t nameOffset = dylibCmd->dylib.name.offset;
+				if ( (nameOffset >= cmdLength) || (memchr(p + nameOffset, '\0', cmdLength - nameOffset) == NULL) )
+					return messages::format("malformed mach-o image: dylib load command #%u string extends beyond end of load command", i);
+				break;
+			}
+		}
+		p += cmdLength;
+	}
+
+	if ( found.linkedit == NULL )
+		return "malformed mach-o image: missing __LINKEDIT segment";
+	if ( !hasStartOfFile )
+		return "malformed mach-o image: missing __TEXT segment that maps start of file";
+	if ( (found.dyldInfo == NULL) && (found.chainedFixups == NULL) )
+		return "missing LC_DYLD_INFO load command";
+	if ( found.dysymtab == NULL )
+		return "malformed mach-o image: missing LC_DYSYMTAB";
+
+	// everything the loader reads out of __LINKEDIT has to be inside it
+	const Segment* const le = found.linkedit;
+	if ( const dyld_info_command* info = found.dyldInfo ) {
+		if ( !insideLinkEdit(le, info->rebase_off, info->rebase_size)
+		  || !insideLinkEdit(le, info->bind_off, info->bind_size)
+		  || !insideLinkEdit(le, info->weak_bind_off, info->weak_bind_size)
+		  || !insideLinkEdit(le, info->lazy_bind_off, info->lazy_bind_size)
+		  || !insideLinkEdit(le, info->export_off, info->export_size) )
+			return "malformed mach-o image: LC_DYLD_INFO content not within __LINKEDIT";
+	}
+	if ( (found.chainedFixups != NULL) && !insideLinkEdit(le, found.chainedFixups->dataoff, found.chainedFixups->datasize) )
+		return "malformed mach-o image: chained fixups not within __LINKEDIT";
+	if ( (found.chainedFixups != NULL) && ((found.chainedFixups->dataoff % sizeof(uint64_t)) != 0) )
+		return "malformed mach-o image: chained fixups not aligned";
+	if ( (found.exportsTrie != NULL) && !insideLinkEdit(le, found.exportsTrie->dataoff, found.exportsTrie->datasize) )
+		return "malformed mach-o image: exports trie not within __LINKEDIT";
+	if ( const symtab_command* symtab = found.symtab ) {
+		if ( !insideLinkEdit(le, symtab->symoff, (uint64_t)symtab->nsyms * sizeof(Symbol)) )
+			return "malformed mach-o image: symbol table not within __LINKEDIT";
+		if ( !insideLinkEdit(le, symtab->stroff, symtab->strsize) )
+			return "malformed mach-o image: string pool not within __LINKEDIT";
+	}
+	if ( !insideLinkEdit(le, found.dysymtab->indirectsymoff, (uint64_t)found.dysymtab->nindirectsyms * sizeof(uint32_t)) )
+		return "malformed mach-o image: indirect symbol table not within __LINKEDIT";
+
+	if ( layout != NULL )
+		*layout = found;
+	return NULL;
+}
+
+const MachOLayout::Segment* MachOLayout::segment(uint32_t index) const
+{
+	const uint8_t* p = (const uint8_t*)header + sizeof(Header);
+	for (uint32_t i=0; i < header->ncmds; ++i) {
+		const load_command* cmd = (const load_command*)p;
+		if ( cmd->cmd == kSegmentCommand ) {
+			const Segment* seg = (const Segment*)cmd;
+			if ( (seg->vmsize != 0) && (index-- == 0) )
+				return seg;
+		}
+		p += cmd->cmdsize;
+	}
+	return NULL;
+}
+
+const char* MachOLayout::libraryPath(uint32_t ordinal, bool* weak) const
+{
+	const uint8_t* p = (const uint8_t*)header + sizeof(Header);
+	for (uint32_t i=0; i < header->ncmds; ++i) {
+		const load_command* cmd = (const load_command*)p;
+		switch ( cmd->cmd ) {
+			case LC_LOAD_DYLIB:
+			case LC_LOAD_WEAK_DYLIB:
+			case LC_REEXPORT_DYLIB:
+			case LC_LOAD_UPWARD_DYLIB:
+				if ( --ordinal == 0 ) {
+					if ( weak != NULL )
+						*weak = (cmd->cmd == LC_LOAD_WEAK_DYLIB);
+					return (const char*)cmd + ((const dylib_command*)cmd)->dylib.name.offset;
+				}
+				break;
+		}
+		p += cmd->cmdsize;
+	}
+	return NULL;
+}
+
+}
@@ -0,0 +1,88 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Structural check of a mach-o image held in memory, done before any loader
+ * object is created for it. validate() walks the header and load commands,
+ * checks that they and every segment's file range lie inside the buffer and
+ * that the image carries what the compressed loader needs, and records the
+ * commands it found. It never throws and never allocates: a rejected image
+ * costs one pass over its load commands and a message from the calling
+ * thread's ring (Messages.h).
+ *
+ * The checks are the ones that depend only on the image bytes. Those that
+ * depend on the link context (strict mach-o rules, code signatures) are left
+ * to ImageLoaderMachO::sniffLoadCommands(), which still runs afterwards.
+ *
+ * Nothing in here depends on the Mach kernel API, so it builds and runs on
+ * any host that has the mach-o headers.
+ */
+
+#ifndef __MACHO_LAYOUT__
+#define __MACHO_LAYOUT__
+
+#include <cstddef>
+#include <cstdint>
+#include <mach-o/loader.h>
+
+namespace isolator {
+
+struct MachOLayout {
+#if __LP64__
+	typedef mach_header_64		Header;
+	typedef segment_command_64	Segment;
+	typedef section_64			Section;
+#else
+	typedef mach_header			Header;
+	typedef segment_command		Segment;
+	typedef section				Section;
+#endif
+
+	// Returns NULL if the `length` bytes at `image` hold a mach-o image this loader can
+	// instantiate, otherwise why not. `layout` may be NULL, and is only filled in on success.
+	static const char*			validate(const void* image, uint64_t length, MachOLayout* layout);
+
+	// The index-th segment with a non zero vmsize, as the loader and the fixup streams number them.
+	const Segment*				segment(uint32_t index) const;
+	// Install name of the dylib a bind with this (1 based) ordinal comes from, NULL if out of range.
+	// weak, if not NULL, is set to whether the image links it weakly (LC_LOAD_WEAK_DYLIB).
+	const char*					libraryPath(uint32_t ordinal, bool* weak=NULL) const;
+
+	const Header*				header;
+	uint32_t					segmentCount;		// segments with a non zero vmsize
+	uint32_t					libraryCount;
+	uint64_t					vmStart;			// lowest and highest vm address of those segments
+	uint64_t					vmEnd;
+	uint64_t					headerVMAddress;	// vmaddr of the segment that maps the start of the file
+	const Segment*				linkedit;
+	const dyld_info_command*	dyldInfo;			// NULL for images with chained fixups only
+	const linkedit_data_command* chainedFixups;
+	const linkedit_data_command* exportsTrie;
+	const symtab_command*		symtab;				// NULL if the image has none
+	const dysymtab_command*		dysymtab;
+};
+
+}
+
+#endif // __MACHO_LAYOUT__
@@ -0,0 +1,94 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "MappedFile.h"
+#include "MachOLayout.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace isolator {
+
+int MappedFile::map(const char* path)
+{
+    unmap();
+
+    int fd = ::open(path, O_RDONLY);
+    if ( fd == -1 )
+        return errno;
+
+    struct stat info;
+    if ( ::fstat(fd, &info) == -1 ) {
+        int err = errno;
+        ::close(fd);
+        return err;
+    }
+    if ( info.st_size <= 0 ) {
+        ::close(fd);
+        return EINVAL;
+    }
+
+    void* addr = ::mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if ( addr == MAP_FAILED ) {
+        int err = errno;
+        ::close(fd);
+        return err;
+    }
+
+    fFd = fd;
+    fAddress = addr;
+    fLength = (uint64_t)info.st_size;
+    return 0;
+}
+
+void MappedFile::closeDescriptor()
+{
+    if ( fFd != -1 )
+        ::close(fFd);
+    fFd = -1;
+}
+
+void MappedFile::unmap()
+{
+    if ( fAddress != nullptr )
+        ::munmap(fAddress, (size_t)fLength);
+    if ( fFd != -1 )
+        ::close(fFd);
+    fFd = -1;
+    fAddress = nullptr;
+    fLength = 0;
+}
+
+const char* validateAdoptedBuffer(void* buffer, uint64_t length, size_t pageSize)
+{
+    const char* whyNot = MachOLayout::validate(buffer, length, nullptr);
+    if ( whyNot != nullptr )
+        ::munmap(buffer, (size_t)((length + pageSize - 1) & ~(uint64_t)(pageSize - 1)));
+    return whyNot;
+}
+
+}
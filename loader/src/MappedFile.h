@@ -0,0 +1,77 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Read-only view of a whole file on disk. Pages are faulted in from the page
+ * cache on demand, so loading an image through it never copies bytes the
+ * loader does not touch. Also the check of buffers handed over to the
+ * loader, which has to give them back when it turns them down. Uses plain
+ * POSIX calls only.
+ */
+
+#ifndef __MAPPED_FILE__
+#define __MAPPED_FILE__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace isolator {
+
+class MappedFile {
+public:
+    MappedFile() : fFd(-1), fAddress(nullptr), fLength(0) {}
+    ~MappedFile() { unmap(); }
+
+    // Opens and maps |path| PROT_READ/MAP_PRIVATE. Returns 0 on success or
+    // an errno value. Empty files are rejected with EINVAL.
+    int map(const char* path);
+    void unmap();
+    // Keeps the mapping but gives up the descriptor, for long lived mappings.
+    void closeDescriptor();
+
+    const void* address() const { return fAddress; }
+    uint64_t length() const { return fLength; }
+
+    // Descriptor stays open while mapped so callers can map pieces of the
+    // file at other addresses (e.g. read-only segments).
+    int fd() const { return fFd; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    int fFd;
+    void* fAddress;
+    uint64_t fLength;
+};
+
+// Buffers given to custom_dlopen_from_memory_adopt() belong to the loader from then on: page
+// aligned mmap() memory that it unmaps once it is done with it. Returns NULL if the image in
+// the length bytes at buffer passes MachOLayout::validate(), otherwise why not, in which case
+// the buffer, rounded up to whole pages, has already been unmapped.
+const char* validateAdoptedBuffer(void* buffer, uint64_t length, size_t pageSize);
+
+}
+
+#endif // __MAPPED_FILE__
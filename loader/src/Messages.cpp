@@ -0,0 +1,64 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "Messages.h"
+
+#include <cstdio>
+
+namespace isolator {
+namespace messages {
+
+namespace {
+
+struct Ring {
+	char		slots[kMessageSlots][kMessageSize];
+	unsigned	next;
+};
+
+thread_local Ring tRing;
+
+}
+
+const char* vformat(const char* format, va_list list)
+{
+	char* slot = tRing.slots[tRing.next];
+	tRing.next = (tRing.next + 1) % kMessageSlots;
+	if ( vsnprintf(slot, kMessageSize, format, list) < 0 )
+		slot[0] = '\0';
+	return slot;
+}
+
+const char* format(const char* format, ...)
+{
+	va_list list;
+	va_start(list, format);
+	const char* result = vformat(format, list);
+	va_end(list);
+	return result;
+}
+
+}
+}
@@ -0,0 +1,59 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Storage for formatted error messages. dyld::throwf() and dyld::mkstringf()
+ * format into a ring of fixed size slots owned by the calling thread, so a
+ * failing load allocates nothing: messages used to be malloc()ed, thrown as
+ * const char* and then either freed by whoever caught them or leaked.
+ *
+ * A message stays valid until the same thread formats kMessageSlots more
+ * messages. That covers the usual chain of catch, add context and rethrow,
+ * and copying the result into the dlerror() buffer. One thrown on a worker
+ * pool thread stays readable for as long, the pool stops handing out work
+ * once a chunk throws. Nothing here is ever passed to free().
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __MESSAGES__
+#define __MESSAGES__
+
+#include <cstdarg>
+#include <cstddef>
+
+namespace isolator {
+namespace messages {
+
+const size_t	kMessageSize	= 2048;		// longer messages are truncated
+const unsigned	kMessageSlots	= 8;
+
+// Formats into the next slot of the calling thread's ring.
+const char*		vformat(const char* format, va_list list);
+const char*		format(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+}
+}
+
+#endif // __MESSAGES__
@@ -0,0 +1,71 @@
+// Hash set of classes known to be registered with the Objective-C runtime.
+// Only talks to the runtime through RuntimeInterface.
+
+#include "ObjCClassIndex.h"
+
+#include <vector>
+
+namespace mull
+{
+  namespace objc
+  {
+
+    ClassIndex::ClassIndex(RuntimeInterface &runtime)
+        : runtime(runtime), seeded(false)
+    {
+    }
+
+    void ClassIndex::seedIfNeeded()
+    {
+      if (seeded)
+        return;
+
+      std::vector<const void *> list;
+      int count = runtime.copyClassList(NULL, 0);
+      // The class list can grow between the two calls, retry until it fits.
+      while (count > 0)
+      {
+        list.resize(count);
+        int copied = runtime.copyClassList(list.data(), count);
+        if (copied <= count)
+        {
+          list.resize(copied);
+          break;
+        }
+        count = copied;
+      }
+
+      classes.reserve(list.size());
+      classes.insert(list.begin(), list.end());
+      seeded = true;
+    }
+
+    bool ClassIndex::contains(const void *cls)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      seedIfNeeded();
+      return classes.count(cls) != 0;
+    }
+
+    void ClassIndex::insert(const void *cls)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      seedIfNeeded();
+      classes.insert(cls);
+    }
+
+    void ClassIndex::erase(const void *cls)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      classes.erase(cls);
+    }
+
+    size_t ClassIndex::size()
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      seedIfNeeded();
+      return classes.size();
+    }
+
+  }
+}
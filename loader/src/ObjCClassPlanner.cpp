@@ -0,0 +1,85 @@
+// Superclass-first ordering of an image's classes. No Objective-C runtime
+// dependency.
+
+#include "ObjCClassPlanner.h"
+
+#include <unordered_map>
+
+namespace mull
+{
+  namespace objc
+  {
+
+    ClassPlanStatus planClassRegistration(const std::vector<ClassPlanEntry> &entries,
+                                          std::vector<size_t> &order,
+                                          std::vector<size_t> &parents,
+                                          size_t *culprit)
+    {
+      const size_t count = entries.size();
+
+      std::unordered_map<const void *, size_t> indexOf;
+      indexOf.reserve(count);
+      for (size_t i = 0; i < count; i++)
+        indexOf.emplace(entries[i].cls, i);
+
+      // Children of each entry as singly linked lists threaded through
+      // `nextSibling`, kept in __objc_classlist order.
+      std::vector<size_t> firstChild(count, kClassPlanNoParent);
+      std::vector<size_t> lastChild(count, kClassPlanNoParent);
+      std::vector<size_t> nextSibling(count, kClassPlanNoParent);
+
+      parents.assign(count, kClassPlanNoParent);
+      order.clear();
+      order.reserve(count);
+
+      for (size_t i = 0; i < count; i++)
+      {
+        auto it = indexOf.find(entries[i].superclass);
+        if (it == indexOf.end())
+        {
+          order.push_back(i);
+          continue;
+        }
+
+        size_t parent = it->second;
+        parents[i] = parent;
+        if (lastChild[parent] == kClassPlanNoParent)
+          firstChild[parent] = i;
+        else
+          nextSibling[lastChild[parent]] = i;
+        lastChild[parent] = i;
+      }
+
+      // Breadth-first from the classes whose superclass is outside the image;
+      // `order` doubles as the work queue.
+      for (size_t head = 0; head < order.size(); head++)
+      {
+        for (size_t child = firstChild[order[head]];
+             child != kClassPlanNoParent;
+             child = nextSibling[child])
+        {
+          order.push_back(child);
+        }
+      }
+
+      if (order.size() == count)
+        return ClassPlanOK;
+
+      // Whatever was not reached hangs off a superclass cycle.
+      std::vector<bool> placed(count, false);
+      for (size_t i : order)
+        placed[i] = true;
+      for (size_t i = 0; i < count; i++)
+      {
+        if (!placed[i])
+        {
+          if (culprit)
+            *culprit = i;
+          break;
+        }
+      }
+      return ClassPlanCycle;
+    }
+
+  }
+}
@@ -0,0 +1,30 @@
+// Source class -> registered class map. No Objective-C runtime dependency.
+
+#include "ObjCClassRefMap.h"
+
+namespace mull
+{
+  namespace objc
+  {
+
+    void ClassRefMap::reserve(size_t classCount)
+    {
+      // a metaclass for every class
+      registered.reserve(registered.size() + 2 * classCount);
+    }
+
+    void ClassRefMap::add(const void *cls, const void *runtimeClass,
+                          const void *metaclass, const void *runtimeMetaclass)
+    {
+      registered[cls] = runtimeClass;
+      registered[metaclass] = runtimeMetaclass;
+    }
+
+    const void *ClassRefMap::find(const void *ref) const
+    {
+      auto it = registered.find(ref);
+      return (it != registered.end()) ? it->second : NULL;
+    }
+
+  }
+}
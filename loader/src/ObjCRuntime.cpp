@@ -3,6 +3,9 @@
 // as POC from article at https://stanislaw.github.io/2018-09-03-llvm-jit-objc-and-swift-knowledge-dump.html
 
 #include "ObjCRuntime.h"
+#include "ObjCClassIndex.h"
+#include "ObjCClassPlanner.h"
+#include "Logging.h"
 
 #include <objc/message.h>
 
@@ -11,30 +14,46 @@
 
 extern "C" Class objc_readClassPair(Class bits, const struct objc_image_info *info);
 
+namespace isolator
+{
+  namespace dyld
+  {
+    extern __attribute__((noreturn)) void throwf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+  }
+}
+
 namespace mull
 {
   namespace objc
   {
 
-    bool objc_classIsRegistered(Class cls)
+    namespace
     {
-      int numRegisteredClasses = objc_getClassList(NULL, 0);
-
-      Class *classes = (Class *)malloc(sizeof(Class) * numRegisteredClasses);
-
-      numRegisteredClasses = objc_getClassList(classes, numRegisteredClasses);
-
-      for (int i = 0; i < numRegisteredClasses; i++)
+      class SystemRuntime : public RuntimeInterface
       {
-        if (classes[i] == cls)
+      public:
+        int copyClassList(const void **buffer, int capacity) override
         {
-          free(classes);
-          return true;
+          return objc_getClassList((Class *)buffer, capacity);
         }
-      }
+      };
+    }
 
-      free(classes);
-      return false;
+    RuntimeInterface &systemRuntime()
+    {
+      static SystemRuntime runtime;
+      return runtime;
+    }
+
+    ClassIndex &registeredClasses()
+    {
+      static ClassIndex index(systemRuntime());
+      return index;
+    }
+
+    bool objc_classIsRegistered(Class cls)
+    {
+      return registeredClasses().contains(cls);
     }
 
     mull::objc::Runtime::~Runtime()
@@ -43,30 +62,71 @@ namespace mull
       {
 
         objc_disposeClassPair(clz);
+        registeredClasses().erase(clz);
 
         // assert(objc_classIsRegistered(clz) == false);
       }
     }
 
-    void mull::objc::Runtime::registerSelectors(void *selRefsSectionPtr,
-                                                uintptr_t selRefsSectionSize)
+    SEL mull::objc::Runtime::uniqueSelector(SEL selector)
     {
-      uint8_t *sectionStart = (uint8_t *)selRefsSectionPtr;
+      auto byRef = selectorsByRef.find(selector);
+      if (byRef != selectorsByRef.end())
+      {
+        return byRef->second;
+      }
 
-      for (uint8_t *cursor = sectionStart;
-           cursor < (sectionStart + selRefsSectionSize);
-           cursor = cursor + sizeof(SEL))
+      const char *name = sel_getName(selector);
+      auto byName = selectorsByName.find(name);
+      SEL registered;
+      if (byName != selectorsByName.end())
+      {
+        registered = byName->second;
+      }
+      else
       {
-        SEL *selector = (SEL *)cursor;
+        registered = sel_registerName(name);
+        selectorsByName.emplace(name, registered);
+      }
+      selectorsByRef.emplace(selector, registered);
+      return registered;
+    }
 
-        // TODO: memory padded/aligned by JIT.
-        if (*selector == NULL)
+    void mull::objc::Runtime::registerSelectors(void *selRefsSectionPtr,
+                                                uintptr_t selRefsSectionSize)
+    {
+      SEL *selectors = (SEL *)selRefsSectionPtr;
+      size_t count = selRefsSectionSize / sizeof(SEL);
+
+      // First pass: give each slot the index of its unique selector. Index 0
+      // is reserved for empty slots (TODO: memory padded/aligned by JIT).
+      std::vector<SEL> uniqueSelectors(1, (SEL)NULL);
+      std::vector<uint32_t> slotToUnique(count);
+      std::unordered_map<const void *, uint32_t> indexByRef;
+      for (size_t i = 0; i < count; i++)
+      {
+        SEL selector = selectors[i];
+        if (selector == NULL)
         {
+          slotToUnique[i] = 0;
           continue;
         }
-        const char *name = sel_getName(*selector);
 
-        *selector = sel_registerName(name);
+        auto it = indexByRef.find(selector);
+        if (it == indexByRef.end())
+        {
+          it = indexByRef.emplace(selector, (uint32_t)uniqueSelectors.size()).first;
+          uniqueSelectors.push_back(uniqueSelector(selector));
+        }
+        slotToUnique[i] = it->second;
+      }
+
+      // Second pass: branch-free gather over the section.
+      const SEL *unique = uniqueSelectors.data();
+      const uint32_t *indices = slotToUnique.data();
+      for (size_t i = 0; i < count; i++)
+      {
+        selectors[i] = unique[indices[i]];
       }
     }
 
@@ -97,15 +157,11 @@ namespace mull
       for (uint32_t i = 0; i < count / 2; i++)
       {
         Class *classrefPtr = (&classrefs[i]);
-        const char *className = object_getClassName((id)*classrefPtr);
-        // assert(className);
-
-        Class newClz = objc_getRequiredClass(className);
-        // assert(class_isMetaClass(newClz) == false);
+        Class newClz = remapClassRef(*classrefPtr);
 
         if (*classrefPtr != newClz)
         {
-          *classrefPtr = objc_getRequiredClass(className);
+          *classrefPtr = newClz;
         }
       }
     }
@@ -119,71 +175,8 @@ namespace mull
 
       for (uint32_t i = 0; i < count / 2; i++)
       {
-        int refType = 0; // 0 - unknown, 1 - class, 2 - metaclass
-
         Class *classrefPtr = (&classrefs[i]);
-        Class classref = *classrefPtr;
-
-        class64_t *ref = NULL;
-        for (auto &clref : classRefs)
-        {
-          if ((void *)clref == (void *)classref)
-          {
-
-            refType = 1;
-            ref = clref;
-
-            // assert(ref);
-
-            break;
-          }
-        }
-
-        if (refType == 0)
-        {
-          for (auto &metaclref : metaclassRefs)
-          {
-            if ((void *)metaclref == (void *)classref)
-            {
-              refType = 2;
-              ref = metaclref;
-              break;
-            }
-          }
-        }
-
-        // assert(refType != 0);
-        const char *className;
-        if (ref == NULL)
-        {
-          className = object_getClassName((id)classref);
-        }
-        else
-        {
-          className = ref->getDataPointer()->getName();
-        }
-        here_objc_class *objcClass = (here_objc_class *)classref;
-        if (refType == 1 && runtimeClasses.count(classref) > 0)
-        {
-          className = objcClass->data()->ro->name;
-        }
-        else if (refType == 2)
-        {
-          Class classForMetaClass = objc_getClass(object_getClassName((id)classref));
-          // assert(classForMetaClass);
-          className = objcClass->data()->ro->name;
-        }
-        // assert(className);
-
-        Class newClz = objc_getClass(className);
-
-        // assert(refType != 0);
-        if (refType == 2)
-        {
-          newClz = objc_getMetaClass(className);
-          // assert(newClz);
-          // assert(class_isMetaClass(newClz));
-        }
+        Class newClz = remapClassRef(*classrefPtr);
 
         if (*classrefPtr != newClz)
         {
@@ -218,7 +211,7 @@ namespace mull
             IMP imp = (IMP)methodPtr->imp;
 
             BOOL success = class_addMethod(clz,
-                                           sel_registerName(sel_getName(methodPtr->name)),
+                                           uniqueSelector(methodPtr->name),
                                            (IMP)imp,
                                            (const char *)methodPtr->types);
             // assert(success);
@@ -231,14 +224,14 @@ namespace mull
         {
           const method64_t *methods = (const method64_t *)metaclassMethodListPtr->getFirstMethodPointer();
 
-          for (uint32_t i = 0; i < clzMethodListPtr->count; i++)
+          for (uint32_t i = 0; i < metaclassMethodListPtr->count; i++)
           {
             const method64_t *methodPtr = &methods[i];
 
             IMP imp = (IMP)methodPtr->imp;
 
             BOOL success = class_addMethod(metaClz,
-                                           sel_registerName(sel_getName(methodPtr->name)),
+                                           uniqueSelector(methodPtr->name),
                                            (IMP)imp,
                                            (const char *)methodPtr->types);
             // assert(success);
@@ -251,15 +244,41 @@ namespace mull
 
     void mull::objc::Runtime::registerClasses()
     {
+      std::vector<class64_t **> classrefPtrs;
+      std::vector<ClassPlanEntry> entries;
+      classrefPtrs.reserve(classesToRegister.size());
+      entries.reserve(classesToRegister.size());
+      classRefs.reserve(classesToRegister.size());
       while (classesToRegister.empty() == false)
       {
         class64_t **classrefPtr = classesToRegister.front();
-        class64_t *classref = *classrefPtr;
         classesToRegister.pop();
 
+        class64_t *classref = *classrefPtr;
+        classrefPtrs.push_back(classrefPtr);
+        entries.push_back({classref, classref->getSuperclassPointer()});
+      }
+
+      std::vector<size_t> order;
+      std::vector<size_t> parents;
+      size_t culprit = 0;
+      if (planClassRegistration(entries, order, parents, &culprit) != ClassPlanOK)
+      {
+        isolator::dyld::throwf("ObjC class '%s' has a cyclic superclass chain",
+                               (*classrefPtrs[culprit])->getDataPointer()->getName());
+      }
+
+      for (size_t index : order)
+      {
+        class64_t **classrefPtr = classrefPtrs[index];
+        class64_t *classref = *classrefPtr;
+
+        // Superclasses from this image were registered earlier in `order`;
+        // anything else must already be known to the runtime.
         class64_t *superClz64 = classref->getSuperclassPointer();
         Class superClz = (Class)superClz64;
-        if (objc_classIsRegistered(superClz) == false)
+        if (parents[index] == kClassPlanNoParent && superClz != NULL &&
+            objc_classIsRegistered(superClz) == false)
         {
           const char *superclzName = superClz64->getDataPointer()->getName();
           if (Class registeredSuperClz = objc_getClass(superclzName))
@@ -268,14 +287,11 @@ namespace mull
           }
           else
           {
-
-            classesToRegister.push(classrefPtr);
-            continue;
+            isolator::dyld::throwf("superclass '%s' of ObjC class '%s' is not registered",
+                                   superclzName, classref->getDataPointer()->getName());
           }
         }
 
-        // assert(superClz);
-
         Class runtimeClass = registerOneClass(classrefPtr, superClz);
         // assert(objc_classIsRegistered(runtimeClass));
 
@@ -283,8 +299,24 @@ namespace mull
 
         oldAndNewClassesMap.push_back(std::pair<class64_t **, Class>(classrefPtr, runtimeClass));
       }
+    }
+
+    Class mull::objc::Runtime::remapClassRef(Class classref)
+    {
+      // Classes and metaclasses defined by this image.
+      if (const void *registered = classRefs.find(classref))
+      {
+        return (Class)registered;
+      }
 
-      // assert(classesToRegister.empty());
+      // References bound to other images already point at live runtime
+      // classes/metaclasses.
+      if (classref == NULL || objc_classIsRegistered(classref) || class_isMetaClass(classref))
+      {
+        return classref;
+      }
+
+      return objc_getRequiredClass(object_getClassName((id)classref));
     }
 
     Class mull::objc::Runtime::registerOneClass(class64_t **classrefPtr,
@@ -295,18 +327,13 @@ namespace mull
       class64_t *metaclassRef = classref->getIsaPointer();
 
       // assert(strlen(classref->getDataPointer()->name) > 0);
-      printf("registerOneClass: %s \n", classref->getDataPointer()->name);
-      printf("\t"
-             "source ptr: 0x%016" PRIxPTR "\n",
-             (uintptr_t)classref);
-      printf("0x%016" PRIXPTR "\n", (uintptr_t)classref);
-
-      classRefs.push_back(classref);
-      metaclassRefs.push_back(metaclassRef);
+      DL_LOG_DEBUG(isolator::logging::kLogObjC, "registerOneClass: %s (source ptr: 0x%016" PRIxPTR ")\n",
+                   classref->getDataPointer()->name, (uintptr_t)classref);
 
       if (objc_getClass(classref->getDataPointer()->name) != nullptr)
       {
-        exit(1);
+        isolator::dyld::throwf("ObjC class '%s' is already registered",
+                               classref->getDataPointer()->name);
       }
       // assert(objc_classIsRegistered((Class)classref) == false);
 
@@ -328,6 +355,9 @@ namespace mull
       sourceClassData->flags |= RW_CONSTRUCTING;
       sourceMetaclassData->flags |= RW_CONSTRUCTING;
       objc_registerClassPair(runtimeClass);
+      registeredClasses().insert(runtimeClass);
+
+      classRefs.add(classref, runtimeClass, metaclassRef, runtimeMetaclassInternal);
 
       return runtimeClass;
     }
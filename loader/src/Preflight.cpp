@@ -0,0 +1,485 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "Preflight.h"
+#include "ChainedFixups.h"
+#include "MachOLayout.h"
+#include "Messages.h"
+
+#include <cstring>
+
+namespace isolator {
+
+namespace {
+
+enum BindKind { kBind, kLazyBind, kWeakBind };
+
+static const char* const kBindStreamNames[] = { "bind", "lazy bind", "weak bind" };
+
+struct Checker {
+	const MachOLayout&		layout;
+	PreflightResolver		resolver;
+	void*					context;
+	PreflightResult&		result;
+	// binds of one symbol usually come in a row, it is looked up once for all of them
+	long					lastOrdinal;
+	const char*				lastSymbol;
+};
+
+// Where the next fixup of a stream goes: a writable segment and an offset into it.
+struct Cursor {
+	const MachOLayout::Segment*	segment;
+	uint64_t					offset;
+};
+
+// What ChainedFixups::count() reads pages through, chains walk a segment a page at a time
+struct ContentContext {
+	const MachOLayout&			layout;
+	const MachOLayout::Segment*	lastSegment;
+};
+
+}
+
+static bool readUleb(const uint8_t*& p, const uint8_t* end, uint64_t& value)
+{
+	value = 0;
+	unsigned bit = 0;
+	uint8_t byte;
+	do {
+		if ( (p == end) || (bit > 63) )
+			return false;
+		byte = *p++;
+		value |= (uint64_t)(byte & 0x7F) << bit;
+		bit += 7;
+	} while ( byte & 0x80 );
+	return true;
+}
+
+static bool readSleb(const uint8_t*& p, const uint8_t* end, int64_t& value)
+{
+	uint64_t result = 0;
+	unsigned bit = 0;
+	uint8_t byte;
+	do {
+		if ( (p == end) || (bit > 63) )
+			return false;
+		byte = *p++;
+		result |= (uint64_t)(byte & 0x7F) << bit;
+		bit += 7;
+	} while ( byte & 0x80 );
+	// sign extend negative numbers
+	if ( (byte & 0x40) && (bit < 64) )
+		result |= ~(uint64_t)0 << bit;
+	value = (int64_t)result;
+	return true;
+}
+
+static const char* setSegment(const Checker& checker, const char* stream, uint32_t index, Cursor& cursor)
+{
+	cursor.segment = checker.layout.segment(index);
+	if ( cursor.segment == NULL )
+		return messages::format("malformed %s opcodes: segment %u out of range (0..%u)", stream, index, checker.layout.segmentCount - 1);
+	if ( (cursor.segment->initprot & VM_PROT_WRITE) == 0 )
+		return messages::format("malformed %s opcodes: segment %u (%.16s) is not writable", stream, index, cursor.segment->segname);
+	return NULL;
+}
+
+// count fixups stride bytes apart, starting at the cursor, must all start inside its segment
+static const char* checkRun(const char* stream, const Cursor& cursor, uint64_t count, uint64_t stride)
+{
+	if ( count == 0 )
+		return NULL;
+	if ( cursor.segment == NULL )
+		return messages::format("malformed %s opcodes: fixup before any segment was set", stream);
+	const uint64_t size = cursor.segment->vmsize;
+	if ( (cursor.offset >= size) || (count - 1 > (size - 1 - cursor.offset) / stride) )
+		return messages::format("malformed %s opcodes: fixup at offset 0x%llX is outside of segment %.16s (size 0x%llX)",
+								stream, (unsigned long long)cursor.offset, cursor.segment->segname, (unsigned long long)size);
+	return NULL;
+}
+
+static bool listedMissing(const PreflightResult& result, const char* library)
+{
+	for (uint32_t i=0; (i < result.missingLibraryCount) && (i < kPreflightMaxMissingLibraries); ++i) {
+		if ( result.missingLibraries[i] == library )
+			return true;
+	}
+	return false;
+}
+
+// a dylib that is not loaded fails the load by itself, whatever is imported from it
+static void checkLibraries(Checker& checker)
+{
+	PreflightResult& result = checker.result;
+	for (uint32_t ordinal=1; ordinal <= checker.layout.libraryCount; ++ordinal) {
+		bool weak;
+		const char* library = checker.layout.libraryPath(ordinal, &weak);
+		if ( weak || (checker.resolver(checker.context, library, NULL) != kPreflightLibraryNotLoaded) )
+			continue;
+		if ( result.missingLibraryCount < kPreflightMaxMissingLibraries )
+			result.missingLibraries[result.missingLibraryCount] = library;
+		++result.missingLibraryCount;
+	}
+}
+
+static void resolveImport(Checker& checker, long ordinal, const char* symbol, uint8_t flags)
+{
+	if ( (checker.resolver == NULL) || (ordinal == BIND_SPECIAL_DYLIB_SELF) )
+		return;
+	if ( (ordinal == checker.lastOrdinal) && (symbol == checker.lastSymbol) )
+		return;
+	checker.lastOrdinal = ordinal;
+	checker.lastSymbol = symbol;
+
+	bool weakLibrary = false;
+	const char* library = (ordinal > 0) ? checker.layout.libraryPath((uint32_t)ordinal, &weakLibrary) : NULL;
+	PreflightResult& result = checker.result;
+	if ( (library != NULL) && !weakLibrary && listedMissing(result, library) )
+		return;
+	++result.importsChecked;
+	switch ( checker.resolver(checker.context, library, symbol) ) {
+		case kPreflightResolved:
+			return;
+		case kPreflightLibraryNotLoaded:
+			// already counted with the missing dylibs, unless it is weakly linked and this import is not
+			if ( !weakLibrary )
+				return;
+			break;
+		case kPreflightUnresolved:
+			break;
+	}
+	if ( flags & BIND_SYMBOL_FLAGS_WEAK_IMPORT )
+		return;
+	if ( result.unresolvedCount < kPreflightMaxUnresolved )
+		result.unresolved[result.unresolvedCount] = symbol;
+	++result.unresolvedCount;
+}
+
+static const char* checkRebases(const Checker& checker, const uint8_t* p, const uint8_t* end)
+{
+	const char* const stream = "rebase";
+	Cursor cursor = { NULL, 0 };
+	uint8_t type = 0;
+	uint64_t count;
+	uint64_t skip;
+	while ( p < end ) {
+		const uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
+		const uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		++p;
+		switch ( opcode ) {
+			case REBASE_OPCODE_DONE:
+				return NULL;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				if ( const char* whyNot = setSegment(checker, stream, immediate, cursor) )
+					return whyNot;
+				if ( !readUleb(p, end, cursor.offset) )
+					return "malformed rebase opcodes: truncated uleb128";
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				if ( !readUleb(p, end, skip) )
+					return "malformed rebase opcodes: truncated uleb128";
+				cursor.offset += skip;
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				cursor.offset += immediate * sizeof(uintptr_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+				count = 1;
+				skip = 0;
+				if ( opcode == REBASE_OPCODE_DO_REBASE_IMM_TIMES )
+					count = immediate;
+				else if ( (opcode != REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB) && !readUleb(p, end, count) )
+					return "malformed rebase opcodes: truncated uleb128";
+				if ( (opcode == REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB) && !readUleb(p, end, skip) )
+					return "malformed rebase opcodes: truncated uleb128";
+				if ( (count != 0) && (type != REBASE_TYPE_POINTER) && (type != REBASE_TYPE_TEXT_ABSOLUTE32) )
+					return messages::format("bad rebase type %d", type);
+				if ( const char* whyNot = checkRun(stream, cursor, count, skip + sizeof(uintptr_t)) )
+					return whyNot;
+				checker.result.rebaseFixups += count;
+				cursor.offset += count * (skip + sizeof(uintptr_t));
+				if ( opcode == REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB ) {
+					if ( !readUleb(p, end, skip) )
+						return "malformed rebase opcodes: truncated uleb128";
+					cursor.offset += skip;
+				}
+				break;
+			default:
+				return messages::format("bad rebase opcode %d", *(p-1));
+		}
+	}
+	return NULL;
+}
+
+static const char* checkBinds(Checker& checker, BindKind kind, const uint8_t* p, const uint8_t* end)
+{
+	const char* const stream = kBindStreamNames[kind];
+	uint64_t& fixups = (kind == kBind) ? checker.result.bindFixups
+					 : (kind == kLazyBind) ? checker.result.lazyBindFixups : checker.result.weakBindFixups;
+	Cursor cursor = { NULL, 0 };
+	uint8_t type = (kind == kLazyBind) ? BIND_TYPE_POINTER : 0;
+	const char* symbol = NULL;
+	uint8_t flags = 0;
+	long ordinal = 0;
+	bool ordinalSet = (kind != kBind);
+	int64_t addend;
+	uint64_t count;
+	uint64_t skip;
+	bool threaded = false;
+	uint64_t threadedOrdinals = 0;
+	while ( p < end ) {
+		const uint8_t immediate = *p & BIND_IMMEDIATE_MASK;
+		const uint8_t opcode = *p & BIND_OPCODE_MASK;
+		++p;
+		switch ( opcode ) {
+			case BIND_OPCODE_DONE:
+				// lazy binds each end with DONE, the stream goes on to its end
+				if ( kind != kLazyBind )
+					return NULL;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+				ordinal = immediate;
+				ordinalSet = true;
+				break;
+			case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+				if ( !readUleb(p, end, count) )
+					return messages::format("malformed %s opcodes: truncated uleb128", stream);
+				ordinal = (long)count;
+				ordinalSet = true;
+				break;
+			case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+				// the special ordinals are negative numbers
+				ordinal = (immediate == 0) ? 0 : (int8_t)(BIND_OPCODE_MASK | immediate);
+				ordinalSet = true;
+				break;
+			case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM: {
+				const uint8_t* const nul = (const uint8_t*)memchr(p, '\0', end - p);
+				if ( nul == NULL )
+					return messages::format("malformed %s opcodes: symbol name runs past the end", stream);
+				symbol = (const char*)p;
+				flags = immediate;
+				p = nul + 1;
+				break;
+			}
+			case BIND_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case BIND_OPCODE_SET_ADDEND_SLEB:
+				if ( !readSleb(p, end, addend) )
+					return messages::format("malformed %s opcodes: truncated sleb128", stream);
+				break;
+			case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				if ( const char* whyNot = setSegment(checker, stream, immediate, cursor) )
+					return whyNot;
+				if ( !readUleb(p, end, cursor.offset) )
+					return messages::format("malformed %s opcodes: truncated uleb128", stream);
+				if ( cursor.offset > cursor.segment->vmsize )
+					return messages::format("malformed %s opcodes: offset 0x%llX beyond segment size (0x%llX)",
+											stream, (unsigned long long)cursor.offset, (unsigned long long)cursor.segment->vmsize);
+				break;
+			case BIND_OPCODE_ADD_ADDR_ULEB:
+				if ( !readUleb(p, end, skip) )
+					return messages::format("malformed %s opcodes: truncated uleb128", stream);
+				cursor.offset += skip;
+				break;
+			case BIND_OPCODE_DO_BIND:
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+			case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+			case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+				if ( (kind == kLazyBind) && (opcode != BIND_OPCODE_DO_BIND) )
+					return messages::format("bad lazy bind opcode %d", *(p-1));
+				if ( symbol == NULL )
+					return messages::format("malformed %s opcodes: bind without a preceding symbol", stream);
+				if ( !ordinalSet )
+					return messages::format("malformed %s opcodes: bind without a preceding dylib ordinal", stream);
+				if ( (ordinal > 0) && (checker.layout.libraryPath((uint32_t)ordinal) == NULL) )
+					return messages::format("malformed %s opcodes: dylib ordinal %ld out of range (1..%u)", stream, ordinal, checker.layout.libraryCount);
+				if ( (kind != kWeakBind) || ((flags & BIND_SYMBOL_FLAGS_NON_WEAK_DEFINITION) == 0) ) {
+					if ( (type != BIND_TYPE_POINTER) && (type != BIND_TYPE_TEXT_ABSOLUTE32) && (type != BIND_TYPE_TEXT_PCREL32) )
+						return messages::format("bad bind type %d", type);
+				}
+				if ( kind != kWeakBind )
+					resolveImport(checker, ordinal, symbol, flags);
+				if ( threaded ) {
+					// builds the ordinal table the chains apply later bind against
+					if ( opcode != BIND_OPCODE_DO_BIND )
+						return messages::format("malformed %s opcodes: bad opcode %d in threaded binds", stream, *(p-1));
+					++threadedOrdinals;
+					break;
+				}
+				count = 1;
+				skip = 0;
+				if ( opcode == BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB ) {
+					if ( !readUleb(p, end, count) || !readUleb(p, end, skip) )
+						return messages::format("malformed %s opcodes: truncated uleb128", stream);
+				}
+				else if ( opcode == BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED ) {
+					skip = immediate * sizeof(uintptr_t);
+				}
+				if ( const char* whyNot = checkRun(stream, cursor, count, skip + sizeof(uintptr_t)) )
+					return whyNot;
+				fixups += count;
+				cursor.offset += count * (skip + sizeof(uintptr_t));
+				if ( opcode == BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB ) {
+					if ( !readUleb(p, end, skip) )
+						return messages::format("malformed %s opcodes: truncated uleb128", stream);
+					cursor.offset += skip;
+				}
+				break;
+			case BIND_OPCODE_THREADED:
+				if ( (kind != kBind) || (sizeof(uintptr_t) != 8) )
+					return messages::format("bad %s opcode %d", stream, *(p-1));
+				if ( immediate == BIND_SUBOPCODE_THREADED_SET_BIND_ORDINAL_TABLE_SIZE_ULEB ) {
+					if ( !readUleb(p, end, count) )
+						return messages::format("malformed %s opcodes: truncated uleb128", stream);
+					threaded = true;
+					threadedOrdinals = 0;
+				}
+				else if ( immediate == BIND_SUBOPCODE_THREADED_APPLY ) {
+					// walk the chain through the file: bit 62 tells binds from rebases, bits 51..61 hold the
+					// distance to the next entry in pointers, and a bind's ordinal table index is in bits 0..15
+					if ( cursor.segment == NULL )
+						return messages::format("malformed %s opcodes: threaded apply before any segment was set", stream);
+					const uint8_t* const content = (const uint8_t*)checker.layout.header + cursor.segment->fileoff;
+					uint64_t delta;
+					do {
+						if ( cursor.offset + sizeof(uint64_t) > cursor.segment->filesize )
+							return messages::format("malformed %s opcodes: threaded chain leaves segment %.16s", stream, cursor.segment->segname);
+						uint64_t value;
+						memcpy(&value, content + cursor.offset, sizeof(value));
+						if ( value & (1ULL << 62) ) {
+							if ( (value & 0xFFFF) >= threadedOrdinals )
+								return messages::format("bind ordinal (%llu) is out of range (max=%llu)",
+														(unsigned long long)(value & 0xFFFF), (unsigned long long)threadedOrdinals);
+							++fixups;
+						}
+						else {
+							++checker.result.rebaseFixups;
+						}
+						delta = (value & 0x3FF8000000000000ULL) >> 51;
+						cursor.offset += delta * sizeof(uintptr_t);
+					} while ( delta != 0 );
+				}
+				else {
+					return messages::format("bad threaded bind subopcode 0x%02X", immediate);
+				}
+				break;
+			default:
+				return messages::format("bad %s opcode %d", stream, *(p-1));
+		}
+	}
+	return NULL;
+}
+
+// offsets are from the mach header, the file bytes behind them are wherever their segment's are
+static const uint8_t* segmentContent(void* context, uint64_t vmOffset, uint64_t* available)
+{
+	ContentContext& content = *(ContentContext*)context;
+	const uint64_t vmAddress = content.layout.headerVMAddress + vmOffset;
+	const MachOLayout::Segment* seg = content.lastSegment;
+	if ( (seg == NULL) || (vmAddress < seg->vmaddr) || (vmAddress - seg->vmaddr >= seg->filesize) ) {
+		seg = NULL;
+		for (uint32_t i=0; i < content.layout.segmentCount; ++i) {
+			const MachOLayout::Segment* candidate = content.layout.segment(i);
+			if ( (vmAddress >= candidate->vmaddr) && (vmAddress - candidate->vmaddr < candidate->filesize) ) {
+				seg = candidate;
+				break;
+			}
+		}
+		if ( seg == NULL )
+			return NULL;
+		content.lastSegment = seg;
+	}
+	*available = seg->filesize - (vmAddress - seg->vmaddr);
+	return (const uint8_t*)content.layout.header + seg->fileoff + (vmAddress - seg->vmaddr);
+}
+
+static const char* checkChainedFixups(Checker& checker)
+{
+	const MachOLayout& layout = checker.layout;
+	const void* const payload = (const uint8_t*)layout.header + layout.chainedFixups->dataoff;
+	if ( const char* whyInvalid = ChainedFixups::validate(payload, layout.chainedFixups->datasize, layout.vmEnd - layout.headerVMAddress) )
+		return messages::format("malformed chained fixups (%s)", whyInvalid);
+
+	const ChainedFixups fixups(payload);
+	for (uint32_t i=0, count=fixups.importCount(); i < count; ++i) {
+		const ChainedImport import = fixups.import(i);
+		if ( (import.libOrdinal > 0) && (layout.libraryPath((uint32_t)import.libOrdinal) == NULL) )
+			return messages::format("malformed chained fixups (import %s has dylib ordinal %d out of range)", import.name, import.libOrdinal);
+		resolveImport(checker, import.libOrdinal, import.name, import.weakImport ? BIND_SYMBOL_FLAGS_WEAK_IMPORT : 0);
+	}
+
+	ChainedFixupStats stats = {};
+	ContentContext content = { layout, NULL };
+	if ( const char* whyFailed = fixups.count(&segmentContent, &content, &stats) )
+		return messages::format("malformed chained fixups (%s)", whyFailed);
+	checker.result.rebaseFixups += stats.rebases;
+	checker.result.bindFixups += stats.binds;
+	checker.result.chainedFixupPages += stats.pages;
+	return NULL;
+}
+
+const char* preflightImage(const void* image, uint64_t length, uint64_t pageSize,
+						   PreflightResolver resolver, void* context, PreflightResult* result)
+{
+	memset(result, 0, sizeof(*result));
+	MachOLayout layout;
+	if ( const char* whyNot = MachOLayout::validate(image, length, &layout) )
+		return whyNot;
+
+	result->segmentCount = layout.segmentCount;
+	result->libraryCount = layout.libraryCount;
+	if ( layout.segmentCount != 0 )
+		result->mappedSize = ((layout.vmEnd + pageSize - 1) & ~(pageSize - 1)) - (layout.vmStart & ~(pageSize - 1));
+
+	Checker checker = { layout, resolver, context, *result, 0, NULL };
+	if ( resolver != NULL )
+		checkLibraries(checker);
+	const uint8_t* const base = (const uint8_t*)image;
+	if ( const dyld_info_command* info = layout.dyldInfo ) {
+		if ( const char* whyNot = checkRebases(checker, base + info->rebase_off, base + info->rebase_off + info->rebase_size) )
+			return whyNot;
+		if ( const char* whyNot = checkBinds(checker, kBind, base + info->bind_off, base + info->bind_off + info->bind_size) )
+			return whyNot;
+		if ( const char* whyNot = checkBinds(checker, kLazyBind, base + info->lazy_bind_off, base + info->lazy_bind_off + info->lazy_bind_size) )
+			return whyNot;
+		if ( const char* whyNot = checkBinds(checker, kWeakBind, base + info->weak_bind_off, base + info->weak_bind_off + info->weak_bind_size) )
+			return whyNot;
+	}
+	if ( layout.chainedFixups != NULL ) {
+		if ( const char* whyNot = checkChainedFixups(checker) )
+			return whyNot;
+	}
+	return NULL;
+}
+
+}
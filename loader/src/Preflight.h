@@ -0,0 +1,86 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Checks whether an image held in memory would load, without loading it.
+ * preflightImage() runs MachOLayout::validate(), then decodes the rebase,
+ * bind, lazy bind and weak bind opcode streams, or the chained fixups, and
+ * checks every fixup lands inside a writable segment the way the link would.
+ * Given a resolver it also asks whether every dylib the image links against
+ * is loaded and looks up every import. Nothing is reserved,
+ * mapped, copied or run, and nothing is allocated: names in the result
+ * point into the image.
+ *
+ * Nothing in here depends on the Mach kernel API, so it builds and runs on
+ * any host that has the mach-o headers.
+ */
+
+#ifndef __PREFLIGHT__
+#define __PREFLIGHT__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace isolator {
+
+const unsigned kPreflightMaxUnresolved = 16;
+const unsigned kPreflightMaxMissingLibraries = 16;
+
+struct PreflightResult {
+	uint64_t		mappedSize;				// address space the image reserves, in whole pages
+	uint32_t		segmentCount;
+	uint32_t		libraryCount;
+	uint64_t		rebaseFixups;
+	uint64_t		bindFixups;
+	uint64_t		lazyBindFixups;
+	uint64_t		weakBindFixups;
+	uint64_t		chainedFixupPages;
+	uint64_t		importsChecked;			// lookups handed to the resolver
+	uint32_t		unresolvedCount;		// imports that did not resolve, weak imports excepted
+	const char*		unresolved[kPreflightMaxUnresolved];	// the first of them
+	uint32_t		missingLibraryCount;	// dylibs linked against, weakly linked ones excepted, that are not loaded
+	const char*		missingLibraries[kPreflightMaxMissingLibraries];	// the first of them
+};
+
+enum PreflightLookup {
+	kPreflightResolved,
+	kPreflightUnresolved,
+	kPreflightLibraryNotLoaded
+};
+
+// Looks up one import. library is the install name of the dylib it is bound from, or NULL
+// for flat and main executable lookups. A NULL symbol only asks whether library is loaded.
+// Must not throw, and must not load library to find out.
+typedef PreflightLookup (*PreflightResolver)(void* context, const char* library, const char* symbol);
+
+// Returns NULL if the image is well formed, otherwise why not. result is filled in either way
+// with what was found so far. A NULL resolver skips import resolution. Missing dylibs and
+// unresolved imports are reported in result rather than failing the check; the imports of a
+// missing dylib are not looked up one by one.
+const char*		preflightImage(const void* image, uint64_t length, uint64_t pageSize,
+							   PreflightResolver resolver, void* context, PreflightResult* result);
+
+}
+
+#endif // __PREFLIGHT__
@@ -0,0 +1,102 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "RebaseRuns.h"
+
+#if UINTPTR_MAX == UINT64_MAX
+	#if defined(__AVX2__)
+		#include <immintrin.h>
+		#define REBASE_RUNS_AVX2 1
+	#elif defined(__SSE2__)
+		#include <emmintrin.h>
+		#define REBASE_RUNS_SSE2 1
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		#include <arm_neon.h>
+		#define REBASE_RUNS_NEON 1
+	#endif
+#endif
+
+namespace isolator {
+
+void RebaseSlider::slideRun(uintptr_t address, uintptr_t count, uintptr_t stride)
+{
+	if ( count == 0 )
+		return;
+	slidePointers((uintptr_t*)address, count, stride, fSlide);
+	fPointerCount += count;
+	++fRunCount;
+}
+
+static void slideContiguous(uintptr_t* p, size_t count, uintptr_t slide)
+{
+#if REBASE_RUNS_AVX2
+	const __m256i delta = _mm256_set1_epi64x((long long)slide);
+	for (; count >= 8; count -= 8, p += 8) {
+		const __m256i a = _mm256_loadu_si256((const __m256i*)p);
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(p + 4));
+		_mm256_storeu_si256((__m256i*)p, _mm256_add_epi64(a, delta));
+		_mm256_storeu_si256((__m256i*)(p + 4), _mm256_add_epi64(b, delta));
+	}
+#elif REBASE_RUNS_SSE2
+	const __m128i delta = _mm_set1_epi64x((long long)slide);
+	for (; count >= 4; count -= 4, p += 4) {
+		const __m128i a = _mm_loadu_si128((const __m128i*)p);
+		const __m128i b = _mm_loadu_si128((const __m128i*)(p + 2));
+		_mm_storeu_si128((__m128i*)p, _mm_add_epi64(a, delta));
+		_mm_storeu_si128((__m128i*)(p + 2), _mm_add_epi64(b, delta));
+	}
+#elif REBASE_RUNS_NEON
+	const uint64x2_t delta = vdupq_n_u64(slide);
+	for (; count >= 4; count -= 4, p += 4) {
+		const uint64x2_t a = vld1q_u64((const uint64_t*)p);
+		const uint64x2_t b = vld1q_u64((const uint64_t*)(p + 2));
+		vst1q_u64((uint64_t*)p, vaddq_u64(a, delta));
+		vst1q_u64((uint64_t*)(p + 2), vaddq_u64(b, delta));
+	}
+#endif
+	for (; count != 0; --count, ++p)
+		*p += slide;
+}
+
+void slidePointers(uintptr_t* first, size_t count, size_t stride, uintptr_t slide)
+{
+	if ( stride == sizeof(uintptr_t) ) {
+		slideContiguous(first, count, slide);
+		return;
+	}
+	// lone slots and tables of structs with a pointer field, nothing to gain from vectors
+	uint8_t* p = (uint8_t*)first;
+	for (; count >= 4; count -= 4, p += 4 * stride) {
+		*(uintptr_t*)p				+= slide;
+		*(uintptr_t*)(p + stride)	+= slide;
+		*(uintptr_t*)(p + 2*stride)	+= slide;
+		*(uintptr_t*)(p + 3*stride)	+= slide;
+	}
+	for (; count != 0; --count, p += stride)
+		*(uintptr_t*)p += slide;
+}
+
+}
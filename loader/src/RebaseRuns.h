@@ -0,0 +1,87 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Rebases as runs: count pointer slots, stride bytes apart. The loader
+ * decodes REBASE_OPCODE_* into runs and bounds checks each run once, then
+ * RebaseSlider slides it with no decoding and no per-pointer checks.
+ *
+ * Runs are slid as soon as their opcode is decoded, nothing is held back to
+ * see whether the next opcode carries on from it. A lone slot, which is what
+ * REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB gives for every element of an array
+ * of structs and for scattered pointers, is slid in place as the old one
+ * slot at a time interpreter did: buffering such slots into strided runs
+ * measured 35-40% slower for both layouts (RebaseRunsBench). Only runs of
+ * several slots, which ld64 emits for pointer tables, go through
+ * slidePointers().
+ *
+ * Contiguous runs are slid with vector adds (AVX2, SSE2 or NEON, whichever
+ * the build targets, for 64-bit pointers), strided runs with a plain loop.
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __REBASE_RUNS__
+#define __REBASE_RUNS__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace isolator {
+
+class RebaseSlider {
+public:
+	explicit				RebaseSlider(uintptr_t slide) : fSlide(slide), fPointerCount(0), fRunCount(0) {}
+
+	// Slides count slots stride bytes apart from address on.
+	void					add(uintptr_t address, uintptr_t count, uintptr_t stride=sizeof(uintptr_t))
+	{
+		// the common case, one slot, stays inline in the opcode loop
+		if ( count == 1 ) {
+			*(uintptr_t*)address += fSlide;
+			++fPointerCount;
+			return;
+		}
+		slideRun(address, count, stride);
+	}
+
+	uintptr_t				slide() const { return fSlide; }
+	// pointers slid so far, and how many of the runs they came in had more than one slot
+	size_t					pointerCount() const { return fPointerCount; }
+	size_t					runCount() const { return fRunCount; }
+
+private:
+	void					slideRun(uintptr_t address, uintptr_t count, uintptr_t stride);
+
+	uintptr_t				fSlide;
+	size_t					fPointerCount;
+	size_t					fRunCount;
+};
+
+// Adds slide to count pointers stride bytes apart, the first one at first.
+void slidePointers(uintptr_t* first, size_t count, size_t stride, uintptr_t slide);
+
+}
+
+#endif // __REBASE_RUNS__
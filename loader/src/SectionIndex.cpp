@@ -0,0 +1,146 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "SectionIndex.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace isolator {
+
+static size_t nameLength(const char* name, size_t max)
+{
+	size_t len = 0;
+	while ( (len < max) && (name[len] != '\0') )
+		++len;
+	return len;
+}
+
+uint32_t SectionIndex::hash(const char* segmentName, size_t segLen, const char* sectionName, size_t sectLen)
+{
+	// FNV-1a over both names with a separator
+	uint32_t h = 2166136261u;
+	for (size_t i=0; i < segLen; ++i)
+		h = (h ^ (uint8_t)segmentName[i]) * 16777619u;
+	h = (h ^ 0xFF) * 16777619u;
+	for (size_t i=0; i < sectLen; ++i)
+		h = (h ^ (uint8_t)sectionName[i]) * 16777619u;
+	return h;
+}
+
+void SectionIndex::clear()
+{
+	fEntries.clear();
+	fBuckets.clear();
+	fByAddress.clear();
+	fSealed = false;
+}
+
+void SectionIndex::add(const char segname[16], const char sectname[16], uint64_t addr, uint64_t size,
+					   uint32_t type, uint32_t sectionOffset, uint32_t segmentOffset)
+{
+	Entry e;
+	memcpy(e.segname, segname, sizeof(e.segname));
+	memcpy(e.sectname, sectname, sizeof(e.sectname));
+	e.addr			= addr;
+	e.size			= size;
+	e.type			= type;
+	e.sectionOffset	= sectionOffset;
+	e.segmentOffset	= segmentOffset;
+	fEntries.push_back(e);
+	fSealed = false;
+}
+
+void SectionIndex::seal()
+{
+	size_t capacity = 8;
+	while ( capacity < fEntries.size()*2 )
+		capacity *= 2;
+	fBuckets.assign(capacity, 0);
+	const uint32_t mask = (uint32_t)capacity - 1;
+	for (uint32_t i=0; i < fEntries.size(); ++i) {
+		const Entry& e = fEntries[i];
+		uint32_t slot = hash(e.segname, nameLength(e.segname, 16), e.sectname, nameLength(e.sectname, 16)) & mask;
+		// keep the first of duplicate names, like a linear scan would
+		bool duplicate = false;
+		while ( fBuckets[slot] != 0 ) {
+			const Entry& other = fEntries[fBuckets[slot]-1];
+			if ( (strncmp(other.segname, e.segname, 16) == 0) && (strncmp(other.sectname, e.sectname, 16) == 0) ) {
+				duplicate = true;
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+		if ( !duplicate )
+			fBuckets[slot] = i + 1;
+	}
+
+	fByAddress.resize(fEntries.size());
+	for (uint32_t i=0; i < fEntries.size(); ++i)
+		fByAddress[i] = i;
+	const std::vector<Entry>& entries = fEntries;
+	std::stable_sort(fByAddress.begin(), fByAddress.end(), [&entries](uint32_t a, uint32_t b) {
+		return entries[a].addr < entries[b].addr;
+	});
+
+	fSealed = true;
+}
+
+const SectionIndex::Entry* SectionIndex::find(const char* segmentName, const char* sectionName) const
+{
+	if ( fBuckets.empty() )
+		return NULL;
+	// names in load commands are at most 16 bytes, only that much of longer ones is compared (as strncmp(,,16) did)
+	const size_t segLen = nameLength(segmentName, 16);
+	const size_t sectLen = nameLength(sectionName, 16);
+
+	const uint32_t mask = (uint32_t)fBuckets.size() - 1;
+	for (uint32_t slot = hash(segmentName, segLen, sectionName, sectLen) & mask; fBuckets[slot] != 0; slot = (slot + 1) & mask) {
+		const Entry& e = fEntries[fBuckets[slot]-1];
+		if ( (nameLength(e.segname, 16) == segLen) && (memcmp(e.segname, segmentName, segLen) == 0)
+		  && (nameLength(e.sectname, 16) == sectLen) && (memcmp(e.sectname, sectionName, sectLen) == 0) )
+			return &e;
+	}
+	return NULL;
+}
+
+const SectionIndex::Entry* SectionIndex::findContaining(uint64_t unslidAddress) const
+{
+	// last section starting at or below the address; sections do not overlap
+	const std::vector<Entry>& entries = fEntries;
+	std::vector<uint32_t>::const_iterator it = std::upper_bound(fByAddress.begin(), fByAddress.end(), unslidAddress,
+		[&entries](uint64_t addr, uint32_t index) { return addr < entries[index].addr; });
+	while ( it != fByAddress.begin() ) {
+		--it;
+		const Entry& e = fEntries[*it];
+		if ( unslidAddress < e.addr + e.size )
+			return &e;
+		// zero sized sections may share an address with the real one before them
+		if ( e.size != 0 )
+			break;
+	}
+	return NULL;
+}
+
+}
@@ -0,0 +1,84 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Per-image index of the sections named by an image's LC_SEGMENT commands,
+ * filled while parseLoadCmds() walks them once. Lookups by (segment, section)
+ * name go through an open-addressing hash table and lookups by address through
+ * a sorted array, so callers no longer rescan the load commands.
+ *
+ * Entries only record offsets from the mach header and unslid addresses; the
+ * index itself does not depend on mach-o headers.
+ */
+
+#ifndef __SECTION_INDEX__
+#define __SECTION_INDEX__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace isolator {
+
+class SectionIndex {
+public:
+	struct Entry {
+		char		segname[16];		// not necessarily NUL terminated, as in the load command
+		char		sectname[16];
+		uint64_t	addr;				// unslid
+		uint64_t	size;
+		uint32_t	type;				// flags & SECTION_TYPE
+		uint32_t	sectionOffset;		// of the section header, from the mach header
+		uint32_t	segmentOffset;		// of the segment command, from the mach header
+	};
+
+						SectionIndex() : fSealed(false) { }
+
+	void				clear();
+	void				add(const char segname[16], const char sectname[16], uint64_t addr, uint64_t size,
+							uint32_t type, uint32_t sectionOffset, uint32_t segmentOffset);
+	// builds the lookup tables, must be called once all sections were added
+	void				seal();
+	bool				sealed() const { return fSealed; }
+
+	size_t				count() const { return fEntries.size(); }
+	const Entry&		entry(size_t index) const { return fEntries[index]; }
+
+	// first section with these names, in load command order
+	const Entry*		find(const char* segmentName, const char* sectionName) const;
+	// section whose unslid [addr, addr+size) range contains unslidAddress
+	const Entry*		findContaining(uint64_t unslidAddress) const;
+
+private:
+	static uint32_t		hash(const char* segmentName, size_t segLen, const char* sectionName, size_t sectLen);
+
+	std::vector<Entry>		fEntries;
+	std::vector<uint32_t>	fBuckets;		// index+1 into fEntries, 0 for empty; size is a power of two
+	std::vector<uint32_t>	fByAddress;		// indexes into fEntries sorted by addr
+	bool					fSealed;
+};
+
+}
+
+#endif // __SECTION_INDEX__
@@ -0,0 +1,132 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "SegmentCopy.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+namespace isolator {
+
+SegmentCopyStrategy chooseSegmentCopy(uintptr_t dst, uintptr_t src, size_t length, size_t pageSize, bool writable)
+{
+	const bool pageAligned = ((dst | src) & (pageSize - 1)) == 0;
+	if ( pageAligned && (length >= kSegmentCopyRemapMin) )
+		return kSegmentCopyRemap;
+	if ( !writable && (length >= kSegmentCopyStreamMin) )
+		return kSegmentCopyStream;
+	return kSegmentCopyMemcpy;
+}
+
+const char* segmentCopyName(SegmentCopyStrategy strategy)
+{
+	switch ( strategy ) {
+		case kSegmentCopyMemcpy:	return "memcpy";
+		case kSegmentCopyStream:	return "streamed";
+		case kSegmentCopyRemap:		return "remapped";
+		case kSegmentCopyMapFile:	return "mapped";
+	}
+	return "?";
+}
+
+static bool allZero(const uint8_t* p, size_t length)
+{
+	// most data pages have a non-zero byte near the start, so this rarely reads a whole page
+	uint64_t words[8];
+	for (; length >= sizeof(words); p += sizeof(words), length -= sizeof(words)) {
+		memcpy(words, p, sizeof(words));
+		if ( (words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7]) != 0 )
+			return false;
+	}
+	for (; length != 0; ++p, --length) {
+		if ( *p != 0 )
+			return false;
+	}
+	return true;
+}
+
+static void copyStreaming(uint8_t* dst, const uint8_t* src, size_t length)
+{
+#if defined(__SSE2__)
+	// dst is page aligned, so only the tail is left for memcpy
+	for (; length >= 64; dst += 64, src += 64, length -= 64) {
+		const __m128i a = _mm_loadu_si128((const __m128i*)src);
+		const __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+		const __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+		const __m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+		_mm_stream_si128((__m128i*)dst, a);
+		_mm_stream_si128((__m128i*)(dst + 16), b);
+		_mm_stream_si128((__m128i*)(dst + 32), c);
+		_mm_stream_si128((__m128i*)(dst + 48), d);
+	}
+#endif
+	// elsewhere there is no portable non-temporal store, a plain copy it is
+	memcpy(dst, src, length);
+}
+
+size_t copySegment(void* dst, const void* src, size_t length, size_t pageSize, bool nonTemporal)
+{
+	uint8_t* to = (uint8_t*)dst;
+	const uint8_t* from = (const uint8_t*)src;
+	size_t written = 0;
+	for (size_t offset = 0; offset < length; offset += pageSize) {
+		const size_t chunk = (length - offset < pageSize) ? length - offset : pageSize;
+		if ( allZero(&from[offset], chunk) )
+			continue;
+		if ( nonTemporal )
+			copyStreaming(&to[offset], &from[offset], chunk);
+		else
+			memcpy(&to[offset], &from[offset], chunk);
+		written += chunk;
+	}
+#if defined(__SSE2__)
+	if ( nonTemporal )
+		_mm_sfence();
+#endif
+	return written;
+}
+
+SegmentPlacement placeSegment(void* dst, const void* src, size_t length, size_t pageSize, bool writable,
+							  bool executable, int fd, uint64_t fileOffset)
+{
+	SegmentPlacement placed = { kSegmentCopyMapFile, 0, 0 };
+	if ( (fd != -1) && !writable && !executable ) {
+		if ( mmap(dst, length, PROT_READ, MAP_FIXED | MAP_PRIVATE, fd, (off_t)fileOffset) == MAP_FAILED )
+			placed.error = errno;
+		return placed;
+	}
+	placed.strategy = chooseSegmentCopy((uintptr_t)dst, (uintptr_t)src, length, pageSize, writable);
+	if ( placed.strategy != kSegmentCopyRemap )
+		placed.written = copySegment(dst, src, length, pageSize, placed.strategy == kSegmentCopyStream);
+	return placed;
+}
+
+}
@@ -0,0 +1,94 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * How a segment of an in-memory image gets into its mapped range. The
+ * destination is always fresh anonymous memory, so pages whose source is all
+ * zero are simply left alone and stay untouched zero-fill pages. When the
+ * image is a mapping of a file, its read-only data is mapped from the file:
+ *
+ *  - kSegmentCopyMapFile: segments that are neither writable nor executable
+ *    (e.g. __LINKEDIT) are mapped from the file and never copied.
+ *
+ * everything else is chosen by size:
+ *
+ *  - kSegmentCopyRemap: large segments with page aligned source and
+ *    destination are handed to vm_copy(), which remaps them copy-on-write
+ *    instead of touching the bytes (done by the caller, this is Mach only).
+ *    Writable ones too: only the pages their fixups write to get copied.
+ *  - kSegmentCopyStream: very large read-only segments that cannot be
+ *    remapped are copied with non-temporal stores, they are not about to be
+ *    read and would only push the rest of the image out of the cache.
+ *  - kSegmentCopyMemcpy: everything else.
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __SEGMENT_COPY__
+#define __SEGMENT_COPY__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace isolator {
+
+enum SegmentCopyStrategy {
+	kSegmentCopyMemcpy,
+	kSegmentCopyStream,
+	kSegmentCopyRemap,
+	kSegmentCopyMapFile,
+};
+
+// Copies are mostly page faults on the fresh destination. A size sweep on x86-64 showed
+// streaming stores only start to spare the cache once a copy is well past the last level
+// cache; remapping cannot be measured off Mach and starts where a copy is no longer cheap.
+enum {
+	kSegmentCopyRemapMin	= 256 * 1024,
+	kSegmentCopyStreamMin	= 16 * 1024 * 1024,
+};
+
+SegmentCopyStrategy chooseSegmentCopy(uintptr_t dst, uintptr_t src, size_t length, size_t pageSize, bool writable);
+const char*			segmentCopyName(SegmentCopyStrategy strategy);
+
+// What placeSegment() did with a segment: written is what copySegment() wrote, error the errno of a failed mapping.
+struct SegmentPlacement {
+	SegmentCopyStrategy	strategy;
+	size_t				written;
+	int					error;
+};
+
+// Brings length bytes of a segment from src into the page aligned, zero-filled dst. When the image at src
+// is a mapping of fd (-1 if not), read-only and non-executable segments are mapped from it at fileOffset;
+// anything else goes the way chooseSegmentCopy() says, except that kSegmentCopyRemap is left to the caller.
+SegmentPlacement	placeSegment(void* dst, const void* src, size_t length, size_t pageSize, bool writable,
+								 bool executable, int fd, uint64_t fileOffset);
+
+// Copies length bytes from src to the page aligned, zero-filled dst one page at a time, skipping
+// pages whose source is all zero. Returns how many bytes were actually written.
+size_t				copySegment(void* dst, const void* src, size_t length, size_t pageSize, bool nonTemporal);
+
+}
+
+#endif // __SEGMENT_COPY__
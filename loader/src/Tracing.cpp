@@ -0,0 +1,238 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+#include "Tracing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+namespace isolator {
+namespace tracing {
+
+std::atomic<bool> gEnabled(false);
+
+namespace {
+
+const uint32_t	kEventsPerThread = 2048;
+
+struct Event {
+	uint64_t		start;
+	uint64_t		duration;
+	uint64_t		counter;
+	const char*		phase;
+	uint32_t		tid;		// of the thread that recorded it, a buffer outlives its first thread
+	char			image[36];
+};
+
+struct ThreadBuffer {
+	std::mutex		lock;		// only contended while dump() or clear() runs
+	uint32_t		tid;		// order in which threads first recorded, used as the trace's tid
+	uint64_t		written;	// events ever recorded, the ring keeps the last kEventsPerThread of them
+	ThreadBuffer*	nextFree;
+	Event			events[kEventsPerThread];
+};
+
+struct Registry {
+	std::mutex					lock;
+	std::vector<ThreadBuffer*>	buffers;
+	ThreadBuffer*				freeList = nullptr;
+	uint32_t					lastTid = 0;
+};
+
+// never destroyed, images may still be unloaded (and traced) while static destructors run
+Registry& registry()
+{
+	static Registry* sRegistry = new Registry();
+	return *sRegistry;
+}
+
+// Gives the thread's buffer back when the thread exits. Its events stay in the dump until the
+// next thread that takes the buffer over writes over them.
+struct BufferOwner {
+	ThreadBuffer*	buffer = nullptr;
+
+	~BufferOwner() {
+		if ( buffer == nullptr )
+			return;
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		buffer->nextFree = reg.freeList;
+		reg.freeList = buffer;
+		buffer = nullptr;
+	}
+};
+
+thread_local BufferOwner tBufferOwner;
+
+ThreadBuffer* threadBuffer()
+{
+	ThreadBuffer* buffer = tBufferOwner.buffer;
+	if ( buffer == nullptr ) {
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		if ( reg.freeList != nullptr ) {
+			buffer = reg.freeList;
+			reg.freeList = buffer->nextFree;
+		}
+		else {
+			buffer = new ThreadBuffer();
+			buffer->written = 0;
+			reg.buffers.push_back(buffer);
+		}
+		// only touched by its thread and under its lock, and no thread owns it right now
+		buffer->tid = ++reg.lastTid;
+		tBufferOwner.buffer = buffer;
+	}
+	return buffer;
+}
+
+// buffers are never freed, so the copy stays valid after the lock is dropped
+std::vector<ThreadBuffer*> allBuffers()
+{
+	Registry& reg = registry();
+	std::lock_guard<std::mutex> guard(reg.lock);
+	return reg.buffers;
+}
+
+void writeEscaped(FILE* out, const char* str)
+{
+	for (const char* p = str; *p != '\0'; ++p) {
+		const unsigned char c = (unsigned char)*p;
+		if ( (c == '"') || (c == '\\') )
+			fprintf(out, "\\%c", c);
+		else if ( c < 0x20 )
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+}
+
+}
+
+void setEnabled(bool enable)
+{
+	gEnabled.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* phaseName(uint32_t code)
+{
+	switch ( code ) {
+		case DBG_DYLD_TIMING_STATIC_INITIALIZER:	return "static initializer";
+		case DBG_DYLD_TIMING_APPLY_FIXUPS:			return "apply fixups";
+		case DBG_DYLD_TIMING_ATTACH_CODESIGNATURE:	return "attach code signature";
+		case DBG_DYLD_TIMING_APPLY_INTERPOSING:		return "apply interposing";
+		case DBG_DYLD_TIMING_MAP_IMAGE:				return "map image";
+		case DBG_DYLD_TIMING_REBASE:				return "rebase";
+		case DBG_DYLD_TIMING_BIND:					return "bind";
+	}
+	return "unknown";
+}
+
+void record(const char* phase, const char* image, uint64_t start, uint64_t end, uint64_t counter)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	std::lock_guard<std::mutex> guard(buffer->lock);
+	Event& event = buffer->events[buffer->written % kEventsPerThread];
+	event.start    = start;
+	event.duration = (end > start) ? end - start : 0;
+	event.counter  = counter;
+	event.phase    = phase;
+	event.tid      = buffer->tid;
+	if ( image != nullptr ) {
+		strncpy(event.image, image, sizeof(event.image) - 1);
+		event.image[sizeof(event.image) - 1] = '\0';
+	}
+	else {
+		event.image[0] = '\0';
+	}
+	++buffer->written;
+}
+
+bool dump(const char* path)
+{
+	// snapshot under the locks, write without them so recording threads are not held up by I/O
+	const std::vector<ThreadBuffer*> buffers = allBuffers();
+	std::vector<Event> events;
+	std::vector<uint32_t> tids;
+	for (ThreadBuffer* buffer : buffers) {
+		std::lock_guard<std::mutex> guard(buffer->lock);
+		const uint64_t count = (buffer->written < kEventsPerThread) ? buffer->written : kEventsPerThread;
+		for (uint64_t i = buffer->written - count; i != buffer->written; ++i) {
+			const Event& event = buffer->events[i % kEventsPerThread];
+			if ( tids.empty() || (tids.back() != event.tid) )
+				tids.push_back(event.tid);
+			events.push_back(event);
+		}
+	}
+	std::sort(tids.begin(), tids.end());
+	tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+
+	FILE* out = fopen(path, "w");
+	if ( out == nullptr )
+		return false;
+	const int pid = (int)getpid();
+	fprintf(out, "{\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"custom_dlopen\"}}", pid);
+	for (uint32_t tid : tids)
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"loader thread %u\"}}", pid, tid, tid);
+	for (const Event& event : events) {
+		fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"loader\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"image\":\"",
+				event.phase, event.start / 1000.0, event.duration / 1000.0, pid, event.tid);
+		writeEscaped(out, event.image);
+		fprintf(out, "\",\"count\":%llu}}", (unsigned long long)event.counter);
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	const bool ok = !ferror(out);
+	return (fclose(out) == 0) && ok;
+}
+
+size_t threadBufferCount()
+{
+	Registry& reg = registry();
+	std::lock_guard<std::mutex> guard(reg.lock);
+	return reg.buffers.size();
+}
+
+void clear()
+{
+	for (ThreadBuffer* buffer : allBuffers()) {
+		std::lock_guard<std::mutex> guard(buffer->lock);
+		buffer->written = 0;
+	}
+}
+
+}
+}
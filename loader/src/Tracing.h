@@ -23,12 +23,29 @@
  */
 
 /*
- * This file contains ScopedTimer stub implementation which will do nothing
+ * Load tracing. dyld3::ScopedTimer marks a phase (applying fixups, running
+ * an initializer, ...) of one image; while tracing is on, every scope that
+ * ends appends a complete event (start, duration, phase, image, counter) to a
+ * ring buffer owned by the calling thread. custom_dl_trace_dump() writes
+ * every thread's events as Chrome trace event JSON, which chrome://tracing
+ * and Perfetto open as a per-thread timeline.
+ *
+ * While tracing is off a scope costs one relaxed atomic load. Buffers are
+ * only allocated once a thread records its first event. When the thread
+ * exits its buffer is handed to the next thread that records, so there are
+ * never more buffers than threads recording at once; the events of the
+ * exited thread show up in the dump until they are written over.
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
  */
 
 #ifndef __TRACING__
 #define __TRACING__
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
 #define DYLD_EXIT_REASON_DYLIB_MISSING          1
 #define DYLD_EXIT_REASON_DYLIB_WRONG_ARCH       2
 #define DYLD_EXIT_REASON_DYLIB_WRONG_VERSION    3
@@ -41,19 +58,64 @@
 #define DBG_DYLD_TIMING_APPLY_FIXUPS            2
 #define DBG_DYLD_TIMING_ATTACH_CODESIGNATURE    3
 #define DBG_DYLD_TIMING_APPLY_INTERPOSING       4
+#define DBG_DYLD_TIMING_MAP_IMAGE               5
+#define DBG_DYLD_TIMING_REBASE                  6
+#define DBG_DYLD_TIMING_BIND                    7
 
 namespace isolator {
+namespace tracing {
+
+extern std::atomic<bool>	gEnabled;
+
+inline bool enabled() { return gEnabled.load(std::memory_order_relaxed); }
+void		setEnabled(bool enable);
+
+// monotonic nanoseconds
+uint64_t	now();
+// name of a DBG_DYLD_TIMING_* code
+const char*	phaseName(uint32_t code);
+// Appends one complete event to the calling thread's ring buffer, the oldest event of a full
+// buffer is dropped. image is copied (and may be truncated), phase must be a string literal.
+void		record(const char* phase, const char* image, uint64_t start, uint64_t end, uint64_t counter);
+// Writes everything recorded so far as Chrome trace event JSON. Returns false if path could not be written.
+bool		dump(const char* path);
+// Drops everything recorded so far.
+void		clear();
+// Ring buffers allocated so far, at most the number of threads that ever recorded at the same time.
+size_t		threadBufferCount();
+
+}
+
 namespace dyld3 {
 
 /**
- * @brief Empty stub implementation. Just to meet compilation requirements. Do nothing.
+ * @brief Records how long the enclosing scope took, as one event of the given DBG_DYLD_TIMING_* phase.
+ * Must be a named variable, a temporary ends (and records) on the spot.
  */
 class ScopedTimer {
 public:
-    ScopedTimer(uint32_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3) {}
+    ScopedTimer(uint32_t code, uint64_t /*arg1*/, uint64_t /*arg2*/, uint64_t /*arg3*/, const char* image=nullptr)
+        : fCode(code), fImage(image), fCounter(0), fActive(tracing::enabled()), fStart(fActive ? tracing::now() : 0) {}
+    ~ScopedTimer() {
+        if ( fActive )
+            tracing::record(tracing::phaseName(fCode), fImage, fStart, tracing::now(), fCounter);
+    }
+
+    // shown as the event's "count" argument, e.g. how many fixups the phase applied
+    void setCounter(uint64_t counter) { fCounter = counter; }
+
+private:
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    uint32_t        fCode;
+    const char*     fImage;
+    uint64_t        fCounter;
+    bool            fActive;
+    uint64_t        fStart;
 };
 
 }
 }
 
-#endif // __TRACING__
\ No newline at end of file
+#endif // __TRACING__
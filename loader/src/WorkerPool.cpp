@@ -0,0 +1,162 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#include "WorkerPool.h"
+
+#include <cstdint>
+
+namespace isolator {
+
+static std::atomic<WorkerPool*>	sSharedPool(nullptr);
+static std::mutex				sSharedPoolLock;
+
+WorkerPool::WorkerPool(unsigned threadCount)
+	: fJob(NULL), fGeneration(0), fStopping(false)
+{
+	for (unsigned i=1; i < threadCount; ++i)
+		fThreads.emplace_back(&WorkerPool::workerMain, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(fLock);
+		fStopping = true;
+	}
+	fWake.notify_all();
+	for (std::thread& thread : fThreads)
+		thread.join();
+}
+
+WorkerPool* WorkerPool::shared()
+{
+	return sSharedPool.load(std::memory_order_acquire);
+}
+
+WorkerPool* WorkerPool::createShared(unsigned threadCount)
+{
+	std::lock_guard<std::mutex> guard(sSharedPoolLock);
+	WorkerPool* pool = sSharedPool.load(std::memory_order_relaxed);
+	if ( pool == NULL ) {
+		// never destroyed, workers may still be parked when static destructors run
+		pool = new WorkerPool(threadCount);
+		sSharedPool.store(pool, std::memory_order_release);
+	}
+	return pool;
+}
+
+unsigned WorkerPool::defaultThreadCount()
+{
+	// symbol lookups stop scaling well before the core count of a big machine
+	unsigned cores = std::thread::hardware_concurrency();
+	if ( cores == 0 )
+		return 1;
+	return (cores < 4) ? cores : 4;
+}
+
+void WorkerPool::runChunks(Job& job)
+{
+	const size_t chunkCount = (job.count + job.grain - 1) / job.grain;
+	for (;;) {
+		const size_t chunk = job.nextChunk.fetch_add(1, std::memory_order_relaxed);
+		if ( (chunk >= chunkCount) || (chunk > job.failedChunk.load(std::memory_order_relaxed)) )
+			return;
+		const size_t begin = chunk * job.grain;
+		const size_t end = (begin + job.grain < job.count) ? begin + job.grain : job.count;
+		try {
+			(*job.body)(begin, end);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> guard(fLock);
+			if ( chunk < job.failedChunk.load(std::memory_order_relaxed) ) {
+				job.failedChunk.store(chunk, std::memory_order_relaxed);
+				job.error = std::current_exception();
+			}
+		}
+	}
+}
+
+void WorkerPool::workerMain()
+{
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(fLock);
+	for (;;) {
+		fWake.wait(lock, [&] { return fStopping || (fGeneration != seen); });
+		if ( fStopping )
+			return;
+		seen = fGeneration;
+		// the job may already be over if this worker woke up late
+		Job* job = fJob;
+		if ( job == NULL )
+			continue;
+		++job->busy;
+		lock.unlock();
+		runChunks(*job);
+		lock.lock();
+		if ( --job->busy == 0 )
+			fIdle.notify_all();
+	}
+}
+
+void WorkerPool::parallelFor(size_t count, size_t grain, const RangeBody& body)
+{
+	if ( count == 0 )
+		return;
+	if ( grain == 0 )
+		grain = 1;
+
+	std::unique_lock<std::mutex> jobLock(fJobLock, std::try_to_lock);
+	if ( fThreads.empty() || (count <= grain) || !jobLock.owns_lock() ) {
+		body(0, count);
+		return;
+	}
+
+	Job job;
+	job.body = &body;
+	job.count = count;
+	job.grain = grain;
+	job.nextChunk.store(0, std::memory_order_relaxed);
+	job.failedChunk.store(SIZE_MAX, std::memory_order_relaxed);
+	job.busy = 0;
+	{
+		std::lock_guard<std::mutex> guard(fLock);
+		fJob = &job;
+		++fGeneration;
+	}
+	fWake.notify_all();
+
+	runChunks(job);
+
+	// unpublish the job before it goes out of scope, workers still in it are waited for
+	{
+		std::unique_lock<std::mutex> lock(fLock);
+		fJob = NULL;
+		fIdle.wait(lock, [&] { return job.busy == 0; });
+	}
+	if ( job.error )
+		std::rethrow_exception(job.error);
+}
+
+}
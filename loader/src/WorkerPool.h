@@ -0,0 +1,105 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Small pool of worker threads for the embarrassingly parallel parts of a
+ * link, such as resolving the distinct imports of an image. parallelFor()
+ * splits an index range into chunks that the workers and the calling thread
+ * claim from a shared counter, and returns once every chunk is done.
+ *
+ * One job runs at a time. A caller that finds the pool busy (another thread
+ * linking, or a job started from inside a job) runs its range inline, so the
+ * pool never deadlocks and never oversubscribes the machine.
+ *
+ * Nothing in here depends on mach-o headers or the Mach kernel API.
+ */
+
+#ifndef __WORKER_POOL__
+#define __WORKER_POOL__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace isolator {
+
+class WorkerPool {
+public:
+	// body(begin, end) handles indexes [begin, end)
+	typedef std::function<void(size_t begin, size_t end)> RangeBody;
+
+	// threadCount counts the caller, so 1 means no extra threads at all
+	explicit				WorkerPool(unsigned threadCount);
+							~WorkerPool();
+
+	// process wide pool, NULL until createShared() made one
+	static WorkerPool*		shared();
+	// creates the shared pool once, sized by the process wide setting (CUSTOM_DL_BIND_THREADS)
+	// read at startup; later calls return the existing pool whatever size they ask for
+	static WorkerPool*		createShared(unsigned threadCount);
+	// what CUSTOM_DL_BIND_THREADS=0 (or unset) means: the core count, capped
+	static unsigned			defaultThreadCount();
+
+	unsigned				threadCount() const { return (unsigned)fThreads.size() + 1; }
+
+	// Runs body over [0, count) in chunks of `grain` indexes. If body throws,
+	// chunks after the one that threw are skipped and the exception of the
+	// lowest chunk that threw is rethrown here once all workers have left the
+	// job, so the error is the same one a serial loop would have hit first.
+	void					parallelFor(size_t count, size_t grain, const RangeBody& body);
+
+private:
+	// lives on the stack of parallelFor(), published to the workers through fJob
+	struct Job {
+		const RangeBody*	body;
+		size_t				count;
+		size_t				grain;
+		std::atomic<size_t>	nextChunk;
+		std::atomic<size_t>	failedChunk;	// lowest chunk that threw so far, SIZE_MAX if none
+		std::exception_ptr	error;			// guarded by fLock, thrown by failedChunk
+		unsigned			busy;			// guarded by fLock, workers inside runChunks()
+	};
+
+	void					workerMain();
+	void					runChunks(Job& job);
+
+	std::vector<std::thread>	fThreads;
+	std::mutex					fJobLock;		// held by the caller for the whole job
+	std::mutex					fLock;			// guards fJob, fGeneration, fStopping
+	std::condition_variable		fWake;
+	std::condition_variable		fIdle;
+	Job*						fJob;
+	uint64_t					fGeneration;
+	bool						fStopping;
+};
+
+}
+
+#endif // __WORKER_POOL__
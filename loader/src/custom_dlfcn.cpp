@@ -23,10 +23,16 @@
  */
 
 #include <custom_dlfcn.h>
-#include <fstream>
 #include <sys/mman.h>
 
 #include "ImageLoaderMachO.h"
+#include "ImageLoaderProxy.h"
+#include "Logging.h"
+#include "MachOLayout.h"
+#include "MappedFile.h"
+#include "Messages.h"
+#include "Preflight.h"
+#include "Tracing.h"
 
 #include "mach-o/dyld.h"
 
@@ -56,26 +62,29 @@ namespace isolator
 
   extern ImageLoader::LinkContext g_linkContext;
 
-  thread_local char *_err_buf = nullptr;
-  thread_local size_t _err_buf_size = 0;
+  // Preallocated per thread, so reporting a failure never allocates. Room
+  // for a full loader message (see Messages.h) plus the prefix put before it.
+  thread_local char _err_buf[messages::kMessageSize + 256];
 
   void clean_error()
   {
-    if (_err_buf)
-      _err_buf[0] = 0;
+    _err_buf[0] = 0;
   }
 
-  void set_dlerror(const std::string &msg)
+  __attribute__((format(printf, 1, 0)))
+  static void vset_dlerror(const char *format, va_list list)
   {
-    if (msg.size() >= _err_buf_size)
-    {
-      if (_err_buf)
-        free(_err_buf);
+    if (vsnprintf(_err_buf, sizeof(_err_buf), format, list) < 0)
+      strcpy(_err_buf, "Unknown error");
+  }
 
-      _err_buf = static_cast<char *>(malloc(msg.size() + 1));
-      _err_buf_size = msg.size() + 1;
-    }
-    strcpy(_err_buf, msg.c_str());
+  __attribute__((format(printf, 1, 2)))
+  void set_dlerror(const char *format, ...)
+  {
+    va_list list;
+    va_start(list, format);
+    vset_dlerror(format, list);
+    va_end(list);
   }
 
   static bool is_absolute_path(const char *path)
@@ -83,23 +92,28 @@ namespace isolator
     return path && path[0] == '/';
   }
 
-  std::string base_name(const std::string &path)
+  const char *base_name(const char *path)
   {
-    return path.substr(path.find_last_of("/\\") + 1);
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
   }
 
-  void *with_limitation(std::string msg)
+  void *with_limitation(const char *msg)
   {
-    static std::string disclaimer = "\n"
-                                    "DISCLAIMER: You are using non system mach-o dynamic loader. "
-                                    "Avoid to using it in production code.\n";
-    set_dlerror("Limitation: " + msg + disclaimer);
+    set_dlerror("Limitation: %s\n"
+                "DISCLAIMER: You are using non system mach-o dynamic loader. "
+                "Avoid to using it in production code.\n",
+                msg);
     return nullptr;
   }
 
-  void *with_error(std::string msg)
+  __attribute__((format(printf, 1, 2)))
+  void *with_error(const char *format, ...)
   {
-    set_dlerror(msg);
+    va_list list;
+    va_start(list, format);
+    vset_dlerror(format, list);
+    va_end(list);
     return nullptr;
   }
 
@@ -118,7 +132,8 @@ namespace isolator
 
   void registerObjC(ImageLoaderMachO *image)
   {
-    printf("dyld: registerObjC() starting\n");
+    DL_LOG_DEBUG(logging::kLogObjC, "dyld: registerObjC() starting\n");
+    const uint64_t t0 = mach_absolute_time();
 
     // Create ObjC runtime instance
     mull::objc::Runtime runtime;
@@ -167,7 +182,7 @@ namespace isolator
 
     if (objcSections.empty())
     {
-      printf("dyld: No ObjC sections found in image\n");
+      DL_LOG_DEBUG(logging::kLogObjC, "dyld: No ObjC sections found in image\n");
       return;
     }
 
@@ -195,7 +210,7 @@ namespace isolator
     }
 
     // Register all classes
-    printf("dyld: Registering classes\n");
+    DL_LOG_DEBUG(logging::kLogObjC, "dyld: Registering classes\n");
     runtime.registerClasses();
 
     // Add class references
@@ -228,15 +243,16 @@ namespace isolator
       }
     }
 
-    printf("dyld: registerObjC() completed\n");
+    image->addStat(kLoadStatObjCClassesRegistered, runtime.registeredClassCount());
+    image->addStat(kLoadStatObjCSelectorsRegistered, runtime.registeredSelectorCount());
+    image->addStat(kLoadStatObjCSetupTime, mach_absolute_time() - t0);
+
+    DL_LOG_DEBUG(logging::kLogObjC, "dyld: registerObjC() completed\n");
   }
 
   extern "C" char *custom_dlerror(void)
   {
-    if (_err_buf && _err_buf[0] == 0)
-      return nullptr;
-
-    return _err_buf;
+    return _err_buf[0] ? _err_buf : nullptr;
   }
 
   extern "C" void *custom_dlopen(const char *__path, int __mode)
@@ -248,33 +264,35 @@ namespace isolator
         return with_limitation("Only absolute path is supported. Please specify "
                                "full path to binary.");
 
-      std::fstream lib_f(__path, std::ios::in | std::ios::binary);
-      if (!lib_f.is_open())
-        return with_error("File does not exist.");
-
-      std::streampos fsize = lib_f.tellg();
-      lib_f.seekg(0, std::ios::end);
-      fsize = lib_f.tellg() - fsize;
-      lib_f.seekg(0, std::ios::beg);
+      // Map the file instead of reading it, so only pages the loader
+      // actually touches are faulted in and read-only segments are
+      // mapped straight from the file.
+      MappedFile lib_f;
+      if (int err = lib_f.map(__path))
+        return with_error("Can't open file. %s", strerror(err));
 
-      std::vector<char> buff(fsize);
-      lib_f.read(buff.data(), fsize);
-      lib_f.close();
-
-      std::string file_name = base_name(__path);
-      auto mh = reinterpret_cast<const macho_header *>(buff.data());
+      // Reject malformed images before anything is allocated for them
+      auto mh = reinterpret_cast<const macho_header *>(lib_f.address());
+      if (const char *whyNot = MachOLayout::validate(mh, lib_f.length(), nullptr))
+        return with_error("Error happens during dlopen execution. %s", whyNot);
 
       // Load image step
-      auto image = ImageLoaderMachO::instantiateFromMemory(file_name.c_str(), mh, fsize, g_linkContext);
+      auto image = ImageLoaderMachO::instantiateFromMemory(base_name(__path), mh, lib_f.length(), g_linkContext, lib_f.fd());
+      lib_f.unmap();
 
       bool forceLazysBound = true;
       bool preflightOnly = false;
       bool neverUnload = false;
 
-      // Link step
+      // Link step. A dependency that does not open or an import that does
+      // not resolve is reported without unwinding, and the image let go.
       std::vector<const char *> rpaths;
       ImageLoader::RPathChain loaderRPaths(NULL, &rpaths);
-      image->link(g_linkContext, forceLazysBound, preflightOnly, neverUnload, loaderRPaths, __path);
+      if (const char *whyNot = image->tryLink(g_linkContext, forceLazysBound, preflightOnly, neverUnload, loaderRPaths, __path))
+      {
+        ImageLoader::deleteImage(image);
+        return with_error("Error happens during dlopen execution. %s", whyNot);
+      }
 
       // Initialization of static objects step
       ImageLoader::InitializerTimingList initializerTimes[1];
@@ -285,39 +303,50 @@ namespace isolator
     }
     catch (const char *msg)
     {
-      printf("custom_dlopen: error %s\n", msg);
+      DL_LOG_INFO(logging::kLogLoad, "custom_dlopen: error %s\n", msg);
 
-      return with_error("Error happens during dlopen execution. " + std::string(msg));
+      return with_error("Error happens during dlopen execution. %s", msg);
     }
     catch (...)
     {
-      printf("custom_dlopen: error ??\n");
+      DL_LOG_INFO(logging::kLogLoad, "custom_dlopen: error ??\n");
 
       return with_error("Error happens during dlopen execution. Unknown reason...");
     }
   }
 
-  extern "C" void *custom_dlopen_from_memory(void *mh, int len)
+  static void *load_from_memory(const char *api, void *mh, uint64_t len, bool adopt)
   {
     try
     {
       const char *path = "foobar";
 
+      // Reject malformed images before anything is allocated for them, an adopted
+      // buffer is ours to release either way
+      const char *whyRejected = adopt ? validateAdoptedBuffer(mh, len, dyld_page_size) : MachOLayout::validate(mh, len, nullptr);
+      if (whyRejected != nullptr)
+        return with_error("Error happens during %s execution. %s", api, whyRejected);
+
       // Load image step
-      auto image = ImageLoaderMachO::instantiateFromMemory(path, (macho_header *)mh, len, g_linkContext);
+      auto image = ImageLoaderMachO::instantiateFromMemory(path, (macho_header *)mh, len, g_linkContext, -1, adopt);
 
-      printf("dyld: 'ImageLoaderMachO::instantiateFromMemory' completed (image addr: %p)\n", image);
+      DL_LOG_DEBUG(logging::kLogLoad, "dyld: 'ImageLoaderMachO::instantiateFromMemory' completed (image addr: %p)\n", image);
 
       bool forceLazysBound = true;
       bool preflightOnly = false;
       bool neverUnload = false;
 
-      // Link step
+      // Link step, failures to find dependencies or imports come back as status
       std::vector<const char *> rpaths;
       ImageLoader::RPathChain loaderRPaths(NULL, &rpaths);
-      image->link(g_linkContext, forceLazysBound, preflightOnly, neverUnload, loaderRPaths, path);
+      if (const char *whyNot = image->tryLink(g_linkContext, forceLazysBound, preflightOnly, neverUnload, loaderRPaths, path))
+      {
+        DL_LOG_INFO(logging::kLogLoad, "%s: error %s\n", api, whyNot);
+        ImageLoader::deleteImage(image);
+        return with_error("Error happens during %s execution. %s", api, whyNot);
+      }
 
-      printf("dyld: 'image->link' completed\n");
+      DL_LOG_DEBUG(logging::kLogLoad, "dyld: 'image->link' completed\n");
 
       // Register ObjC classes step
       registerObjC(static_cast<ImageLoaderMachO *>(image));
@@ -327,22 +356,182 @@ namespace isolator
       initializerTimes[0].count = 0;
       image->runInitializers(g_linkContext, initializerTimes[0]);
 
-      printf("dyld: 'image->runInitializers' completed\n");
+      DL_LOG_DEBUG(logging::kLogLoad, "dyld: 'image->runInitializers' completed\n");
 
       return image;
     }
     catch (const char *msg)
     {
-      printf("custom_dlopen_from_memory: error %s\n", msg);
+      DL_LOG_INFO(logging::kLogLoad, "%s: error %s\n", api, msg);
 
-      return with_error("Error happens during custom_dlopen_from_memory execution. " + std::string(msg));
+      return with_error("Error happens during %s execution. %s", api, msg);
     }
     catch (...)
     {
-      printf("custom_dlopen_from_memory: error ??\n");
+      DL_LOG_INFO(logging::kLogLoad, "%s: error ??\n", api);
+
+      return with_error("Error happens during %s execution. Unknown reason...", api);
+    }
+  }
+
+  extern "C" void *custom_dlopen_from_memory(void *mh, int len)
+  {
+    clean_error();
+    return load_from_memory("custom_dlopen_from_memory", mh, len, false);
+  }
+
+  extern "C" void *custom_dlopen_from_memory_adopt(void *mh, size_t len)
+  {
+    clean_error();
+    return load_from_memory("custom_dlopen_from_memory_adopt", mh, len, true);
+  }
+
+  extern "C" void custom_dlopen_adopt_counters(unsigned *in_place, unsigned *copied)
+  {
+    LoadStatValues stats;
+    loadstats::snapshot(stats);
+    if (in_place)
+      *in_place = (unsigned)stats[kLoadStatImagesAdoptedInPlace];
+    if (copied)
+      *copied = (unsigned)stats[kLoadStatImagesAdoptedByCopy];
+  }
+
+  static uint64_t ticks_to_ns(uint64_t ticks)
+  {
+    static const mach_timebase_info_data_t timebase = [] {
+      mach_timebase_info_data_t info;
+      mach_timebase_info(&info);
+      return info;
+    }();
+    return ticks * timebase.numer / timebase.denom;
+  }
+
+  extern "C" int custom_dl_stats(void *__handle, struct custom_dl_stats *__stats)
+  {
+    if (__stats == nullptr)
+    {
+      set_dlerror("Error happens during stats execution. No place to store them.");
+      return -1;
+    }
+    LoadStatValues stats;
+    if (__handle != nullptr)
+      reinterpret_cast<ImageLoader *>(__handle)->loadStats().snapshot(stats);
+    else
+      loadstats::snapshot(stats);
+
+    __stats->segments_mapped = stats[kLoadStatSegmentsMapped];
+    __stats->bytes_mapped = stats[kLoadStatBytesMapped];
+    __stats->bytes_remapped = stats[kLoadStatBytesRemapped];
+    __stats->bytes_copied = stats[kLoadStatBytesCopied];
+    __stats->bytes_zero_pages_skipped = stats[kLoadStatBytesZeroPagesSkipped];
+    __stats->images_adopted_in_place = stats[kLoadStatImagesAdoptedInPlace];
+    __stats->images_adopted_by_copy = stats[kLoadStatImagesAdoptedByCopy];
+    __stats->images_rebase_skipped = stats[kLoadStatImagesRebaseSkipped];
+    __stats->preferred_address_misses = stats[kLoadStatPreferredLoadAddressMisses];
+    __stats->rebase_fixups = stats[kLoadStatRebaseFixups];
+    __stats->bind_fixups = stats[kLoadStatBindFixups];
+    __stats->lazy_bind_fixups = stats[kLoadStatLazyBindFixups];
+    __stats->symbols_resolved = stats[kLoadStatBindSymbolsResolved];
+    __stats->symbol_lookups = stats[kLoadStatBindImageSearches];
+    __stats->trie_searches = stats[kLoadStatSymbolTrieSearches];
+    __stats->objc_classes_registered = stats[kLoadStatObjCClassesRegistered];
+    __stats->objc_selectors_registered = stats[kLoadStatObjCSelectorsRegistered];
+    __stats->load_dependents_ns = ticks_to_ns(stats[kLoadStatLoadLibrariesTime]);
+    __stats->map_ns = ticks_to_ns(stats[kLoadStatMapTime]);
+    __stats->rebase_ns = ticks_to_ns(stats[kLoadStatRebaseTime]);
+    __stats->bind_ns = ticks_to_ns(stats[kLoadStatBindTime]);
+    __stats->weak_bind_ns = ticks_to_ns(stats[kLoadStatWeakBindTime]);
+    __stats->dof_ns = ticks_to_ns(stats[kLoadStatDOFTime]);
+    __stats->objc_setup_ns = ticks_to_ns(stats[kLoadStatObjCSetupTime]);
+    __stats->init_ns = ticks_to_ns(stats[kLoadStatInitTime]);
+    return 0;
+  }
+
+  extern "C" void custom_dl_trace_enable(int enable)
+  {
+    tracing::setEnabled(enable != 0);
+  }
+
+  extern "C" int custom_dl_trace_dump(const char *__path)
+  {
+    if (__path == nullptr || !tracing::dump(__path))
+    {
+      set_dlerror("Error happens during trace dump. Cannot write %s", __path ? __path : "(null)");
+      return -1;
+    }
+    return 0;
+  }
+
+  // Looks an import up the way binding it would: in the dylib it comes from, then in
+  // everything loaded. Only dylibs the process already has are looked at, opening one
+  // would run its initializers; one that is not loaded fails the whole load.
+  static PreflightLookup preflight_resolve(void *, const char *library, const char *symbol)
+  {
+    if (library != nullptr)
+    {
+      bool loaded = false;
+      const bool found = ImageLoaderProxy::findInLoaded(library, symbol, &loaded) != nullptr;
+      if (!loaded)
+        return kPreflightLibraryNotLoaded;
+      if (symbol == nullptr || (found && !g_linkContext.bindFlat))
+        return kPreflightResolved;
+    }
+    const ImageLoader *foundIn = nullptr;
+    const ImageLoader *everything = ImageLoaderProxy::instantiateDefault();
+    return everything->findExportedSymbol(symbol, true, &foundIn) != nullptr ? kPreflightResolved : kPreflightUnresolved;
+  }
+
+  static_assert(kPreflightMaxUnresolved == CUSTOM_DL_PREFLIGHT_MAX_UNRESOLVED, "report lists as many names as the result");
+  static_assert(kPreflightMaxMissingLibraries == CUSTOM_DL_PREFLIGHT_MAX_MISSING, "report lists as many dylibs as the result");
 
-      return with_error("Error happens during custom_dlopen_from_memory execution. Unknown reason...");
+  extern "C" int custom_dlpreflight(const void *__buffer, size_t __len,
+                                    struct custom_dl_preflight_report *__report, int __mode)
+  {
+    clean_error();
+    if (__report == nullptr)
+    {
+      set_dlerror("Error happens during dlpreflight execution. No place to store the report.");
+      return -1;
     }
+
+    PreflightResult result;
+    const PreflightResolver resolver = (__mode & CUSTOM_DL_PREFLIGHT_RESOLVE) ? &preflight_resolve : nullptr;
+    const char *whyNot = preflightImage(__buffer, __len, dyld_page_size, resolver, nullptr, &result);
+
+    __report->mapped_size = result.mappedSize;
+    __report->segment_count = result.segmentCount;
+    __report->library_count = result.libraryCount;
+    __report->rebase_fixups = result.rebaseFixups;
+    __report->bind_fixups = result.bindFixups;
+    __report->lazy_bind_fixups = result.lazyBindFixups;
+    __report->weak_bind_fixups = result.weakBindFixups;
+    __report->chained_fixup_pages = result.chainedFixupPages;
+    __report->imports_checked = result.importsChecked;
+    __report->unresolved_count = result.unresolvedCount;
+    for (unsigned i = 0; i < CUSTOM_DL_PREFLIGHT_MAX_UNRESOLVED; i++)
+      __report->unresolved[i] = (i < result.unresolvedCount) ? result.unresolved[i] : nullptr;
+    __report->missing_library_count = result.missingLibraryCount;
+    for (unsigned i = 0; i < CUSTOM_DL_PREFLIGHT_MAX_MISSING; i++)
+      __report->missing_libraries[i] = (i < result.missingLibraryCount) ? result.missingLibraries[i] : nullptr;
+
+    if (whyNot != nullptr)
+    {
+      set_dlerror("Error happens during dlpreflight execution. %s", whyNot);
+      return -1;
+    }
+    if (result.missingLibraryCount != 0)
+    {
+      set_dlerror("Error happens during dlpreflight execution. Library %s is not loaded (%u missing).",
+                  result.missingLibraries[0], result.missingLibraryCount);
+      return -1;
+    }
+    if (result.unresolvedCount != 0)
+    {
+      set_dlerror("Error happens during dlpreflight execution. Symbol %s is not found (%u unresolved).",
+                  result.unresolved[0], result.unresolvedCount);
+      return -1;
+    }
+    return 0;
   }
 
   extern "C" void *custom_dlsym(void *__handle, const char *__symbol)
@@ -351,21 +540,35 @@ namespace isolator
     {
       clean_error();
 
-      std::string underscoredName = "_" + std::string(__symbol);
+      // "_" + name, on the stack unless the name is unusually long
+      char buffer[256];
+      std::string longName;
+      const char *underscoredName = buffer;
+      const size_t length = strlen(__symbol);
+      if (length + 2 <= sizeof(buffer))
+      {
+        buffer[0] = '_';
+        memcpy(buffer + 1, __symbol, length + 1);
+      }
+      else
+      {
+        longName = std::string("_") + __symbol;
+        underscoredName = longName.c_str();
+      }
       const ImageLoader *image = reinterpret_cast<ImageLoader *>(__handle);
 
-      auto sym = image->findExportedSymbol(underscoredName.c_str(), true, &image);
+      auto sym = image->findExportedSymbol(underscoredName, true, &image);
       if (sym != NULL)
       {
         auto addr = image->getExportedSymbolAddress(sym, g_linkContext, nullptr, false,
-                                                    underscoredName.c_str());
+                                                    underscoredName);
         return reinterpret_cast<void *>(addr);
       }
-      return with_error("Symbol " + std::string(__symbol) + " is not found.");
+      return with_error("Symbol %s is not found.", __symbol);
     }
     catch (const char *msg)
     {
-      return with_error("Error happens during dlsym execution. " + std::string(msg));
+      return with_error("Error happens during dlsym execution. %s", msg);
     }
     catch (...)
     {
@@ -373,6 +576,55 @@ namespace isolator
     }
   }
 
+  extern "C" int custom_dlsym_many(void *__handle, const char *const *__symbols, size_t __count,
+                                   void **__addresses, int *__found)
+  {
+    try
+    {
+      clean_error();
+
+      const ImageLoader *image = reinterpret_cast<ImageLoader *>(__handle);
+      std::vector<const ImageLoader::Symbol *> syms(__count);
+      std::vector<const ImageLoader *> images(__count);
+
+      // Names are looked up as "_" + name without building that string
+      image->findExportedSymbols("_", __symbols, __count, syms.data(), images.data());
+
+      int resolved = 0;
+      const char *firstMissing = nullptr;
+      for (size_t i = 0; i < __count; i++)
+      {
+        __addresses[i] = nullptr;
+        if (syms[i] != NULL)
+        {
+          __addresses[i] = reinterpret_cast<void *>(
+              images[i]->getExportedSymbolAddress(syms[i], g_linkContext, nullptr, false, nullptr));
+          ++resolved;
+        }
+        else if (firstMissing == nullptr)
+        {
+          firstMissing = __symbols[i];
+        }
+        if (__found)
+          __found[i] = (syms[i] != NULL);
+      }
+
+      if (firstMissing != nullptr)
+        with_error("Symbol %s is not found.", firstMissing);
+      return resolved;
+    }
+    catch (const char *msg)
+    {
+      with_error("Error happens during dlsym execution. %s", msg);
+      return -1;
+    }
+    catch (...)
+    {
+      with_error("Error happens during dlsym execution. Unknown reason...");
+      return -1;
+    }
+  }
+
   extern "C" int custom_dlclose(void *__handle)
   {
     if (__handle == nullptr)
@@ -30,8 +30,13 @@
 
 #include "dyld_stubs.h"
 
+#include "AddressArena.h"
 #include "ImageLoader.h"
 #include "ImageLoaderProxy.h"
+#include "Logging.h"
+#include "Messages.h"
+#include "Tracing.h"
+#include "WorkerPool.h"
 
 #include <mach/mach_init.h>
 #include <mach/vm_map.h>
@@ -48,38 +53,35 @@ namespace dyld {
     struct LibSystemHelpers gLibSystemHelpers_t;
     const struct LibSystemHelpers *gLibSystemHelpers = &gLibSystemHelpers_t;
 
-    constexpr int BUFF_SIZE = 2048;
-
+    // Messages live in the calling thread's ring (see Messages.h), never free() them.
     void throwf(const char* format, ...) {
-        char *buf = reinterpret_cast<char*>(malloc(BUFF_SIZE*sizeof(char)));
         va_list list;
         va_start(list, format);
-        vsprintf(buf, format, list);
+        const char* msg = messages::vformat(format, list);
         va_end(list);
-        throw static_cast<const char*>(buf);
+        throw msg;
     }
 
     void log(const char* format, ...) {
         va_list	list;
         va_start(list, format);
-        vprintf(format, list);
+        logging::vwrite(DL_LOG_LEVEL_INFO, format, list);
         va_end(list);
     }
 
     void warn(const char* format, ...) {
         va_list	list;
         va_start(list, format);
-        printf(format, list);
+        logging::vwrite(DL_LOG_LEVEL_WARN, format, list);
         va_end(list);
     }
 
     const char* mkstringf(const char* format, ...) {
-        char *buf = reinterpret_cast<char*>(malloc(BUFF_SIZE*sizeof(char)));
         va_list	list;
         va_start(list, format);
-        vsprintf(buf, format, list);
+        const char* msg = messages::vformat(format, list);
         va_end(list);
-        return buf;
+        return msg;
     }
 
     bool isTranslated() {
@@ -127,7 +129,7 @@ bool stub_flatExportFinder(const char* name, const ImageLoader::Symbol** sym, co
     ImageLoader* globImage = ImageLoaderProxy::instantiateDefault();
 
     *sym = globImage->findExportedSymbol(name, true, image);
-    return sym != nullptr;
+    return *sym != nullptr;
 }
 
 ImageLoader* stub_loadLibrary(const char* libraryName, bool search, const char* origin,
@@ -135,6 +137,10 @@ ImageLoader* stub_loadLibrary(const char* libraryName, bool search, const char*
     return ImageLoaderProxy::instantiate(libraryName);
 }
 
+ImageLoader* stub_tryLoadLibrary(const char* libraryName, const char** whyNot) {
+    return ImageLoaderProxy::instantiate(libraryName, whyNot);
+}
+
 unsigned int stub_getCoalescedImages(ImageLoader* images[], unsigned imageIndex[]) {
     return 0;
 }
@@ -150,8 +156,10 @@ static ImageLoader::LinkContext make_default_link_context() {
     ctx.clearAllDepths = stub_clearAllDepths;
     ctx.imageCount = stub_imageCount;
 
-    // Enforce flat bind
-    ctx.bindFlat = true; //
+    // Two-level bind: each library ordinal resolves against its own
+    // ImageLoaderProxy handle, RTLD_DEFAULT is only the fallback.
+    // Flat binding of everything can still be forced for odd images.
+    ctx.bindFlat = (getenv("CUSTOM_DL_BIND_FLAT") != NULL);
     ctx.prebindUsage = ImageLoader::kUseNoPrebinding;
 
     // Integrate ImageLoaderProxy image into recurrent
@@ -160,6 +168,43 @@ static ImageLoader::LinkContext make_default_link_context() {
     ctx.flatExportFinder = stub_flatExportFinder;
     ctx.getCoalescedImages = stub_getCoalescedImages;
     ctx.loadLibrary = stub_loadLibrary;
+    ctx.tryLoadLibrary = stub_tryLoadLibrary;
+
+    // Opt-in cache of decoded rebase/bind fixups, reused across runs
+    ctx.linkPlanCacheDir = getenv("CUSTOM_DL_LINK_PLAN_DIR");
+
+    // Export hash index is built on first lookup unless asked for up front
+    ctx.eagerExportIndex = (getenv("CUSTOM_DL_EAGER_EXPORT_INDEX") != NULL);
+
+    // Imports are resolved on a small worker pool, 1 keeps binding serial. The pool is
+    // process wide, so its size is read once here and fixed from then on
+    const char* bindThreadsEnv = getenv("CUSTOM_DL_BIND_THREADS");
+    unsigned bindThreads = bindThreadsEnv ? (unsigned)atoi(bindThreadsEnv) : 0;
+    if (bindThreads == 0)
+        bindThreads = WorkerPool::defaultThreadCount();
+    ctx.bindPool = (bindThreads > 1) ? WorkerPool::createShared(bindThreads) : NULL;
+
+    // Opt-in: load at the linked address when it is free so nothing needs rebasing
+    ctx.preferLoadAddress = (getenv("CUSTOM_DL_PREFER_LOAD_ADDRESS") != NULL);
+
+    // Opt-in: pack images into one reservation of this many MB
+    const char* arenaMB = getenv("CUSTOM_DL_ADDRESS_ARENA_MB");
+    const size_t arenaSize = arenaMB ? (size_t)strtoull(arenaMB, NULL, 10) << 20 : 0;
+    ctx.addressArena = arenaSize ? AddressArena::createShared(arenaSize, dyld_page_size) : NULL;
+
+    // Opt-in: log categories, e.g. CUSTOM_DL_LOG=mapping,bind, also turn on the matching verbose tracing
+    logging::setCategories(logging::parseCategories(getenv("CUSTOM_DL_LOG")));
+    ctx.verboseLoading = logging::enabled(logging::kLogLoad);
+    ctx.verboseMapping = logging::enabled(logging::kLogMapping);
+    ctx.verboseRebase = logging::enabled(logging::kLogRebase);
+    ctx.verboseBind = logging::enabled(logging::kLogBind);
+    ctx.verboseWeakBind = logging::enabled(logging::kLogBind);
+    ctx.verboseInit = logging::enabled(logging::kLogInit);
+    ctx.verboseCodeSignatures = logging::enabled(logging::kLogCodeSign);
+
+    // Opt-in: record load phases from the start, custom_dl_trace_dump() writes them out
+    if ( getenv("CUSTOM_DL_TRACE") != NULL )
+        tracing::setEnabled(true);
 
     return ctx;
 }
@@ -0,0 +1,148 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+/*
+ * AddressArena hands out granule aligned, writable ranges of its
+ * reservation, reuses released ranges best fit first and merges them with
+ * their free neighbours, reports when it is full, and refuses releases that
+ * do not name a live range exactly, such as one by the address an image
+ * slid to inside its range rather than the start allocate() returned.
+ */
+
+#include "AddressArena.h"
+#include "TestSupport.h"
+
+#include <unistd.h>
+
+using namespace isolator;
+
+static const size_t kGranule = (size_t)getpagesize();
+
+static bool isZero(uintptr_t start, size_t length)
+{
+	for (size_t i = 0; i < length; i += sizeof(uint64_t)) {
+		if ( *(const uint64_t*)(start + i) != 0 )
+			return false;
+	}
+	return true;
+}
+
+static void testAllocateRelease()
+{
+	AddressArena arena(64 * kGranule, kGranule);
+	CHECK(arena.reserved());
+
+	// ranges are granule aligned, inside the arena, back to back, and writable
+	const uintptr_t a = arena.allocate(kGranule);
+	const uintptr_t b = arena.allocate(2 * kGranule - 100);
+	const uintptr_t c = arena.allocate(3 * kGranule);
+	CHECK((a != 0) && (b == a + kGranule) && (c == b + 2 * kGranule));
+	CHECK(arena.contains(a) && arena.contains(c + 3 * kGranule - 1));
+	CHECK((a & (kGranule - 1)) == 0);
+	CHECK(arena.bytesInUse() == 6 * kGranule);
+	memset((void*)a, 0xAB, 6 * kGranule);
+
+	// a released range is handed out again, with its pages dropped
+	CHECK(arena.release(b, 2 * kGranule - 100));
+	CHECK(arena.bytesInUse() == 4 * kGranule);
+	const uintptr_t b2 = arena.allocate(2 * kGranule);
+	CHECK(b2 == b);
+	CHECK(isZero(b2, 2 * kGranule));
+
+	// the smallest free range that fits is taken, not the first one
+	const uintptr_t d = arena.allocate(kGranule);
+	const uintptr_t e = arena.allocate(kGranule);
+	CHECK(arena.release(a, kGranule));
+	CHECK(arena.release(c, 3 * kGranule));
+	CHECK(arena.release(e, kGranule));		// the top range lowers the bump pointer instead
+	const uintptr_t f = arena.allocate(kGranule);
+	CHECK(f == a);
+	CHECK(arena.release(f, kGranule));
+
+	// neighbours merge: a, b2 and c together make room for six granules where a started
+	CHECK(arena.release(b2, 2 * kGranule));
+	const uintptr_t merged = arena.allocate(6 * kGranule);
+	CHECK(merged == a);
+	CHECK(isZero(merged, 6 * kGranule));
+	CHECK(arena.release(merged, 6 * kGranule));
+	CHECK(arena.release(d, kGranule));
+	CHECK(arena.bytesInUse() == 0);
+
+	// with everything back the arena starts over from its base
+	CHECK(arena.allocate(64 * kGranule) == a);
+}
+
+static void testExhaustion()
+{
+	AddressArena arena(8 * kGranule, kGranule);
+	uintptr_t ranges[8];
+	for (size_t i = 0; i < 8; ++i)
+		ranges[i] = arena.allocate(kGranule);
+	CHECK(ranges[7] == ranges[0] + 7 * kGranule);
+	CHECK(arena.allocate(1) == 0);
+	CHECK(arena.allocate(0) == 0);
+
+	// room comes back with a release, but only as much as was released
+	CHECK(arena.release(ranges[3], kGranule));
+	CHECK(arena.allocate(2 * kGranule) == 0);
+	CHECK(arena.allocate(kGranule) == ranges[3]);
+
+	AddressArena tooSmall(4 * kGranule, kGranule);
+	CHECK(tooSmall.allocate(5 * kGranule) == 0);
+	CHECK(tooSmall.allocate(4 * kGranule) != 0);
+}
+
+static void testReleaseNotAtBase()
+{
+	AddressArena arena(16 * kGranule, kGranule);
+	const uintptr_t start = arena.allocate(4 * kGranule);
+	memset((void*)start, 0xCD, 4 * kGranule);
+
+	// the lowest segment of an image that slid inside its range is not the range
+	CHECK(!arena.release(start + kGranule, 3 * kGranule));
+	// nor is the right start with another length
+	CHECK(!arena.release(start, 2 * kGranule));
+	CHECK(!arena.release(start, 8 * kGranule));
+	// and the range is still live: in use, untouched and not handed out again
+	CHECK(arena.bytesInUse() == 4 * kGranule);
+	CHECK(*(const uint8_t*)(start + kGranule) == 0xCD);
+	const uintptr_t next = arena.allocate(kGranule);
+	CHECK(next == start + 4 * kGranule);
+
+	CHECK(arena.release(start, 4 * kGranule));
+	// a second release of the same range is refused
+	CHECK(!arena.release(start, 4 * kGranule));
+	CHECK(arena.release(next, kGranule));
+	CHECK(arena.bytesInUse() == 0);
+}
+
+int main()
+{
+	testAllocateRelease();
+	testExhaustion();
+	testReleaseNotAtBase();
+	return testResult();
+}
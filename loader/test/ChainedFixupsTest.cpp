@@ -0,0 +1,349 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * ChainedFixups::validate() and apply() on generated images, for every
+ * pointer format it handles, on the calling thread and on a WorkerPool:
+ * each entry is checked against the value it was built to end up as. Then
+ * the import formats, several chains on a page, and the payloads and chains
+ * that have to be refused.
+ */
+
+#include "ChainedFixups.h"
+#include "ChainedImage.h"
+#include "TestSupport.h"
+#include "WorkerPool.h"
+
+#include <string>
+
+using namespace isolator;
+
+static const uintptr_t kTargets[] = { 0x10000000, 0, 0x30000000 };
+static const size_t kTargetCount = sizeof(kTargets) / sizeof(kTargets[0]);
+static const uintptr_t kSlide = 0x7000;
+// apply() only wakes the pool from 32 pages up
+static const uint32_t kPageCount = 64;
+static const uint32_t kMaxValidPointer = 0x00200000;
+
+struct Expected {
+	uint64_t		offset;
+	uint64_t		value;
+	bool			bind;
+	bool			pointer;
+};
+
+static const char* formatName(uint16_t format)
+{
+	switch ( format ) {
+		case DYLD_CHAINED_PTR_ARM64E:				return "ARM64E";
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND:		return "ARM64E_USERLAND";
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND24:	return "ARM64E_USERLAND24";
+		case DYLD_CHAINED_PTR_64:					return "64";
+		case DYLD_CHAINED_PTR_64_OFFSET:			return "64_OFFSET";
+		case DYLD_CHAINED_PTR_32:					return "32";
+	}
+	return "?";
+}
+
+static bool isARM64E(uint16_t format)
+{
+	return (format == DYLD_CHAINED_PTR_ARM64E) || (format == DYLD_CHAINED_PTR_ARM64E_USERLAND) || (format == DYLD_CHAINED_PTR_ARM64E_USERLAND24);
+}
+
+// Fills the pages with chains of every kind of entry the format has, returns what apply() has to leave behind.
+static std::vector<Expected> fillImage(ChainedImage& image)
+{
+	const uint16_t format = image.format();
+	const uint64_t base = (uint64_t)(uintptr_t)image.bytes();
+	// rebase targets of the first ARM64E format and of DYLD_CHAINED_PTR_64 are vmaddrs, the later ones offsets
+	const bool vmAddr = (format == DYLD_CHAINED_PTR_ARM64E) || (format == DYLD_CHAINED_PTR_64);
+	std::vector<Expected> expected;
+	for (uint32_t page = 0; page < kPageCount; ++page) {
+		if ( page % 7 == 3 )
+			continue;
+		const uint32_t count = 1 + (page * 13) % 60;
+		uint32_t offset = 8 * (page % 3);
+		for (uint32_t k = 0; k < count; ++k, offset += 16) {
+			const uint32_t ordinal = k % kTargetCount;
+			Expected entry = { image.pageOffset(page) + offset, 0, false, true };
+			uint64_t raw;
+			switch ( k % 5 ) {
+				case 0:
+				case 2: {
+					const uint64_t target = 0x1000 + 16 * k;
+					if ( format == DYLD_CHAINED_PTR_32 ) {
+						if ( k % 5 == 2 ) {
+							// a value past max_valid_pointer, stored with a bias
+							raw = image.rebase(0x00300000 + k);
+							entry.value = 0x00300000 + k - (0x04000000 + kMaxValidPointer) / 2;
+							entry.pointer = false;
+						}
+						else {
+							raw = image.rebase(target);
+							entry.value = (uint32_t)(target + kSlide);
+						}
+						break;
+					}
+					const uint8_t high8 = (k % 5 == 2) ? 0x80 : 0;
+					raw = image.rebase(target, high8);
+					const uint64_t unpacked = ((uint64_t)high8 << 56) | target;
+					entry.value = vmAddr ? unpacked + kSlide : base + unpacked;
+					break;
+				}
+				case 1:
+					raw = image.bind(ordinal, 5);
+					entry.value = kTargets[ordinal] + 5;
+					entry.bind = true;
+					break;
+				case 3:
+					if ( isARM64E(format) ) {
+						raw = image.authRebase(0x2000 + 8 * k, (uint16_t)(k * 31), k & 1, k % 4);
+						entry.value = base + 0x2000 + 8 * k;
+					}
+					else {
+						raw = image.rebase(0x2000 + 8 * k);
+						entry.value = (format == DYLD_CHAINED_PTR_32) ? (uint32_t)(0x2000 + 8 * k + kSlide)
+																		: (vmAddr ? 0x2000 + 8 * k + kSlide : base + 0x2000 + 8 * k);
+					}
+					break;
+				default:
+					if ( isARM64E(format) ) {
+						// authenticated binds carry no addend, negative addends are ARM64E only
+						if ( k % 2 ) {
+							raw = image.authBind(ordinal, 0x1234, true, 2);
+							entry.value = kTargets[ordinal];
+						}
+						else {
+							raw = image.bind(ordinal, -7);
+							entry.value = kTargets[ordinal] - 7;
+						}
+					}
+					else {
+						const int32_t addend = (format == DYLD_CHAINED_PTR_32) ? 63 : 255;
+						raw = image.bind(ordinal, addend);
+						entry.value = kTargets[ordinal] + addend;
+					}
+					entry.bind = true;
+					break;
+			}
+			image.add(page, offset, raw);
+			expected.push_back(entry);
+		}
+	}
+	return expected;
+}
+
+static void addImports(ChainedImage& image)
+{
+	image.addImport("_malloc", 1);
+	image.addImport("_weak_missing", 2, true);
+	image.addImport("_free", 1);
+}
+
+static const uint8_t* readContent(void* context, uint64_t vmOffset, uint64_t* available)
+{
+	ChainedImage* image = (ChainedImage*)context;
+	*available = image->size() - vmOffset;
+	return image->bytes() + vmOffset;
+}
+
+static void testFormat(uint16_t format, WorkerPool* pool)
+{
+	ChainedImage image(format, kPageCount);
+	image.setMaxValidPointer((format == DYLD_CHAINED_PTR_32) ? kMaxValidPointer : 0);
+	addImports(image);
+	const std::vector<Expected> expected = fillImage(image);
+	const std::vector<uint8_t> payload = image.build();
+
+	CHECK_OK(ChainedFixups::validate(payload.data(), payload.size(), image.size()));
+	ChainedFixups fixups(payload.data());
+	CHECK(fixups.importCount() == 3);
+
+	size_t rebases = 0;
+	size_t binds = 0;
+	for (const Expected& entry : expected) {
+		binds += entry.bind;
+		rebases += entry.pointer && !entry.bind;
+	}
+
+	// count() reads the same chains from the file
+	ChainedFixupStats counted = { 0, 0, 0 };
+	CHECK_OK(fixups.count(&readContent, &image, &counted));
+	CHECK(counted.rebases == rebases && counted.binds == binds);
+
+	ChainedFixupStats stats = { 0, 0, 0 };
+	CHECK_OK(fixups.apply(image.bytes(), image.size(), kSlide, kTargets, kTargetCount, pool, &stats));
+	CHECK(stats.rebases == rebases && stats.binds == binds);
+	CHECK(stats.pages == kPageCount - kPageCount / 7);
+
+	size_t mismatches = 0;
+	for (const Expected& entry : expected) {
+		uint64_t value = 0;
+		memcpy(&value, image.bytes() + entry.offset, image.entrySize());
+		if ( (value != entry.value) && (mismatches++ < 3) ) {
+			char what[128];
+			snprintf(what, sizeof(what), "%s%s: 0x%llx at 0x%llx, expected 0x%llx", formatName(format), pool ? " on the pool" : "",
+					 (unsigned long long)value, (unsigned long long)entry.offset, (unsigned long long)entry.value);
+			testFailure(__FILE__, __LINE__, what);
+		}
+	}
+}
+
+static void testImportFormats()
+{
+	const uint32_t formats[] = { DYLD_CHAINED_IMPORT, DYLD_CHAINED_IMPORT_ADDEND, DYLD_CHAINED_IMPORT_ADDEND64 };
+	for (uint32_t importsFormat : formats) {
+		ChainedImage image(DYLD_CHAINED_PTR_64_OFFSET, 1, 0x4000, importsFormat);
+		image.addImport("_main_executable", -2 /* BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE */);
+		image.addImport("_weak", 3, true, (importsFormat == DYLD_CHAINED_IMPORT) ? 0 : -16);
+		image.addImport("_flat", -2, false, (importsFormat == DYLD_CHAINED_IMPORT_ADDEND64) ? 0x100000000LL : 0);
+		image.add(0, 0, image.bind(0));
+		const std::vector<uint8_t> payload = image.build();
+		CHECK_OK(ChainedFixups::validate(payload.data(), payload.size(), image.size()));
+
+		ChainedFixups fixups(payload.data());
+		CHECK(fixups.importCount() == 3);
+		const ChainedImport first = fixups.import(0);
+		CHECK(strcmp(first.name, "_main_executable") == 0 && first.libOrdinal == -2 && !first.weakImport && first.addend == 0);
+		const ChainedImport weak = fixups.import(1);
+		CHECK(strcmp(weak.name, "_weak") == 0 && weak.libOrdinal == 3 && weak.weakImport);
+		CHECK(weak.addend == ((importsFormat == DYLD_CHAINED_IMPORT) ? 0 : -16));
+		const ChainedImport flat = fixups.import(2);
+		CHECK(strcmp(flat.name, "_flat") == 0 && flat.libOrdinal == -2);
+		CHECK(flat.addend == ((importsFormat == DYLD_CHAINED_IMPORT_ADDEND64) ? 0x100000000LL : 0));
+	}
+}
+
+static void testMultipleChainsOnAPage()
+{
+	ChainedImage image(DYLD_CHAINED_PTR_32, 2, 0x1000);
+	image.setMaxValidPointer(kMaxValidPointer);
+	addImports(image);
+	// a 32-bit chain can only skip 124 bytes, a page with sparse pointers needs several chains
+	image.add(0, 0x0, image.rebase(0x100));
+	image.add(0, 0x4, image.bind(2, 3));
+	image.addChain(0, 0x400, image.rebase(0x200));
+	image.addChain(0, 0xFFC, image.bind(0));
+	image.add(1, 0x10, image.rebase(0x300));
+	const std::vector<uint8_t> payload = image.build();
+	CHECK_OK(ChainedFixups::validate(payload.data(), payload.size(), image.size()));
+
+	ChainedFixupStats stats = { 0, 0, 0 };
+	CHECK_OK(ChainedFixups(payload.data()).apply(image.bytes(), image.size(), 0x10, kTargets, kTargetCount, NULL, &stats));
+	CHECK(stats.rebases == 3 && stats.binds == 2 && stats.pages == 2);
+	uint32_t value;
+	const uint8_t* page0 = image.bytes() + image.pageOffset(0);
+	memcpy(&value, page0 + 0x0, 4);		CHECK(value == 0x110);
+	memcpy(&value, page0 + 0x4, 4);		CHECK(value == (uint32_t)(kTargets[2] + 3));
+	memcpy(&value, page0 + 0x400, 4);	CHECK(value == 0x210);
+	memcpy(&value, page0 + 0xFFC, 4);	CHECK(value == (uint32_t)kTargets[0]);
+	memcpy(&value, image.bytes() + image.pageOffset(1) + 0x10, 4);	CHECK(value == 0x310);
+}
+
+static void testBadChains(WorkerPool& pool)
+{
+	// an ordinal past the imports, deep in the image so the pool finds it on a worker
+	for (WorkerPool* onPool : { (WorkerPool*)NULL, &pool }) {
+		ChainedImage image(DYLD_CHAINED_PTR_64, kPageCount);
+		addImports(image);
+		for (uint32_t page = 0; page < kPageCount; ++page)
+			image.add(page, 0, (page == 40) ? image.bind(7) : image.rebase(0x1000));
+		const std::vector<uint8_t> payload = image.build();
+		CHECK_OK(ChainedFixups::validate(payload.data(), payload.size(), image.size()));
+		ChainedFixups fixups(payload.data());
+		CHECK_REASON(fixups.apply(image.bytes(), image.size(), kSlide, kTargets, kTargetCount, onPool), "ordinal");
+		ChainedFixupStats counted;
+		CHECK_REASON(fixups.count(&readContent, &image, &counted), "ordinal");
+	}
+
+	// the last entry of a page pointing past its end
+	{
+		ChainedImage image(DYLD_CHAINED_PTR_ARM64E, 2, 0x1000);
+		addImports(image);
+		image.add(0, 0xFF8, image.rebase(0x1000));
+		image.add(1, 0x0, image.rebase(0x1000));
+		const std::vector<uint8_t> payload = image.build();
+		uint64_t raw;
+		uint8_t* last = image.bytes() + image.pageOffset(0) + 0xFF8;
+		memcpy(&raw, last, sizeof(raw));
+		raw |= (uint64_t)1 << 51;
+		memcpy(last, &raw, sizeof(raw));
+		CHECK_REASON(ChainedFixups(payload.data()).apply(image.bytes(), image.size(), 0, kTargets, kTargetCount, NULL), "runs off");
+	}
+}
+
+static void testBadPayloads()
+{
+	ChainedImage image(DYLD_CHAINED_PTR_64, 4, 0x1000);
+	addImports(image);
+	for (uint32_t page = 0; page < 4; ++page)
+		image.add(page, 0, image.rebase(0x1000));
+	const std::vector<uint8_t> good = image.build();
+	CHECK_OK(ChainedFixups::validate(good.data(), good.size(), image.size()));
+
+	// every truncation is looked at without reading past it; cutting into the last name must fail
+	for (size_t size = 0; size < good.size(); ++size) {
+		std::vector<uint8_t> truncated(good.begin(), good.begin() + size);
+		const char* why = ChainedFixups::validate(truncated.data(), truncated.size(), image.size());
+		if ( (why == NULL) && (size < good.size() - 1) )
+			testFailure(__FILE__, __LINE__, ("truncated to " + std::to_string(size) + " bytes was accepted").c_str());
+	}
+
+	const dyld_chained_fixups_header* goodHeader = (const dyld_chained_fixups_header*)good.data();
+	const uint32_t segInfoOffset = ((const dyld_chained_starts_in_image*)(good.data() + goodHeader->starts_offset))->seg_info_offset[1];
+	auto corrupt = [&](void (*change)(dyld_chained_fixups_header*, dyld_chained_starts_in_segment*)) {
+		std::vector<uint8_t> payload = good;
+		dyld_chained_fixups_header* header = (dyld_chained_fixups_header*)payload.data();
+		change(header, (dyld_chained_starts_in_segment*)(payload.data() + header->starts_offset + segInfoOffset));
+		return ChainedFixups::validate(payload.data(), payload.size(), image.size());
+	};
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header* h, dyld_chained_starts_in_segment*) { h->fixups_version = 1; }), "version");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header* h, dyld_chained_starts_in_segment*) { h->symbols_format = 1; }), "compressed");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header* h, dyld_chained_starts_in_segment*) { h->imports_format = 4; }), "imports format");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header* h, dyld_chained_starts_in_segment*) { h->imports_count = 1000; }), "imports table");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header* h, dyld_chained_starts_in_segment*) { h->starts_offset = 0x10000; }), "starts overrun");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header*, dyld_chained_starts_in_segment* s) { s->page_size = 0x2000; }), "page size");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header*, dyld_chained_starts_in_segment* s) { s->pointer_format = DYLD_CHAINED_PTR_64_KERNEL_CACHE; }), "pointer format");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header*, dyld_chained_starts_in_segment* s) { s->segment_offset = 0x100000; }), "segment outside");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header*, dyld_chained_starts_in_segment* s) { s->page_count = 200; }), "overrun");
+	CHECK_REASON(corrupt([](dyld_chained_fixups_header*, dyld_chained_starts_in_segment* s) { s->page_start[1] = DYLD_CHAINED_PTR_START_MULTI | 2; }), "multiple chain starts");
+	CHECK_REASON(ChainedFixups::validate(good.data(), good.size(), image.pageOffset(2)), "page outside");
+}
+
+int main()
+{
+	WorkerPool pool(4);
+	const uint16_t formats[] = { DYLD_CHAINED_PTR_ARM64E, DYLD_CHAINED_PTR_ARM64E_USERLAND, DYLD_CHAINED_PTR_ARM64E_USERLAND24,
+								 DYLD_CHAINED_PTR_64, DYLD_CHAINED_PTR_64_OFFSET, DYLD_CHAINED_PTR_32 };
+	for (uint16_t format : formats) {
+		testFormat(format, NULL);
+		testFormat(format, &pool);
+	}
+	testImportFormats();
+	testMultipleChainsOnAPage();
+	testBadChains(pool);
+	testBadPayloads();
+	return testResult();
+}
@@ -0,0 +1,326 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Writes an image whose one data segment is fixed up by chains, and the
+ * LC_DYLD_CHAINED_FIXUPS payload that describes it, for a given pointer
+ * format. Entries are added page by page in address order; the builder
+ * links each one to the previous entry of its chain, so callers only encode
+ * what an entry points to. Shared by ChainedFixupsTest and the benchmark.
+ */
+
+#ifndef __CHAINED_IMAGE__
+#define __CHAINED_IMAGE__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mach-o/fixup-chains.h>
+
+class ChainedImage {
+public:
+	// the segment starts one page in, as __DATA does after __TEXT
+	ChainedImage(uint16_t pointerFormat, uint32_t pageCount, uint16_t pageSize = 0x4000,
+				 uint32_t importsFormat = DYLD_CHAINED_IMPORT)
+		: fFormat(pointerFormat), fPageSize(pageSize), fImportsFormat(importsFormat), fMaxValidPointer(0),
+		  fImage((uint64_t)pageSize * (pageCount + 1), 0), fPages(pageCount)
+	{
+	}
+
+	uint16_t		format() const			{ return fFormat; }
+	uint64_t		segmentOffset() const	{ return fPageSize; }
+	uint64_t		pageOffset(uint32_t page) const { return segmentOffset() + (uint64_t)page * fPageSize; }
+	uint8_t*		bytes()					{ return fImage.data(); }
+	uint64_t		size() const			{ return fImage.size(); }
+	std::vector<uint8_t>&	image()			{ return fImage; }
+
+	// bytes between entries of a chain are counted in this unit
+	uint32_t		stride() const
+	{
+		return ( (fFormat == DYLD_CHAINED_PTR_ARM64E) || (fFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND)
+			  || (fFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND24) ) ? 8 : 4;
+	}
+	size_t			entrySize() const		{ return (fFormat == DYLD_CHAINED_PTR_32) ? 4 : 8; }
+
+	void			setMaxValidPointer(uint32_t max) { fMaxValidPointer = max; }
+
+	void addImport(const char* name, int libOrdinal, bool weakImport = false, int64_t addend = 0)
+	{
+		Import import = { name, libOrdinal, weakImport, addend };
+		fImports.push_back(import);
+	}
+
+	// Appends raw (its next field left zero) to the last chain of the page. Entries of a chain
+	// must be added in address order.
+	void add(uint32_t page, uint32_t offset, uint64_t raw)
+	{
+		if ( fPages[page].empty() )
+			fPages[page].push_back(Chain());
+		fPages[page].back().push_back(Entry(offset, raw));
+	}
+
+	// Starts another chain on the page, which only DYLD_CHAINED_PTR_32 allows.
+	void addChain(uint32_t page, uint32_t offset, uint64_t raw)
+	{
+		fPages[page].push_back(Chain());
+		add(page, offset, raw);
+	}
+
+	// Writes the chains into the image and returns the payload describing them.
+	std::vector<uint8_t> build()
+	{
+		writeChains();
+
+		std::vector<uint8_t> payload(sizeof(dyld_chained_fixups_header), 0);
+		align(payload, 8);
+
+		// starts for two segments, __TEXT without chains and the data segment
+		const uint32_t startsOffset = (uint32_t)payload.size();
+		const uint32_t segInfoOffset = 16;
+		std::vector<uint16_t> pageStarts(fPages.size(), DYLD_CHAINED_PTR_START_NONE);
+		std::vector<uint16_t> chainStarts;
+		for (size_t page = 0; page < fPages.size(); ++page) {
+			if ( fPages[page].size() == 1 ) {
+				pageStarts[page] = (uint16_t)fPages[page][0][0].first;
+			}
+			else if ( fPages[page].size() > 1 ) {
+				pageStarts[page] = (uint16_t)(DYLD_CHAINED_PTR_START_MULTI | (fPages.size() + chainStarts.size()));
+				for (const Chain& chain : fPages[page])
+					chainStarts.push_back((uint16_t)chain[0].first);
+				chainStarts.back() |= DYLD_CHAINED_PTR_START_LAST;
+			}
+		}
+		pageStarts.insert(pageStarts.end(), chainStarts.begin(), chainStarts.end());
+		const size_t segInfoSize = offsetof(dyld_chained_starts_in_segment, page_start) + pageStarts.size() * sizeof(uint16_t);
+		payload.resize(startsOffset + segInfoOffset + segInfoSize, 0);
+		uint32_t* imageStarts = (uint32_t*)&payload[startsOffset];
+		imageStarts[0] = 2;
+		imageStarts[1] = 0;
+		imageStarts[2] = segInfoOffset;
+		dyld_chained_starts_in_segment* segInfo = (dyld_chained_starts_in_segment*)&payload[startsOffset + segInfoOffset];
+		segInfo->size				= (uint32_t)segInfoSize;
+		segInfo->page_size			= fPageSize;
+		segInfo->pointer_format		= fFormat;
+		segInfo->segment_offset		= segmentOffset();
+		segInfo->max_valid_pointer	= fMaxValidPointer;
+		segInfo->page_count			= (uint16_t)fPages.size();
+		memcpy(segInfo->page_start, pageStarts.data(), pageStarts.size() * sizeof(uint16_t));
+		align(payload, 8);
+
+		const uint32_t importsOffset = (uint32_t)payload.size();
+		std::string symbols(1, '\0');
+		for (const Import& import : fImports) {
+			const uint32_t nameOffset = (uint32_t)symbols.size();
+			symbols.append(import.name).push_back('\0');
+			appendImport(payload, import, nameOffset);
+		}
+		const uint32_t symbolsOffset = (uint32_t)payload.size();
+		payload.insert(payload.end(), symbols.begin(), symbols.end());
+
+		dyld_chained_fixups_header* header = (dyld_chained_fixups_header*)payload.data();
+		header->fixups_version	= 0;
+		header->starts_offset	= startsOffset;
+		header->imports_offset	= importsOffset;
+		header->symbols_offset	= symbolsOffset;
+		header->imports_count	= (uint32_t)fImports.size();
+		header->imports_format	= fImportsFormat;
+		header->symbols_format	= 0;
+		return payload;
+	}
+
+	// Entry encoders, next left zero.
+	uint64_t rebase(uint64_t target, uint8_t high8 = 0) const
+	{
+		if ( fFormat == DYLD_CHAINED_PTR_32 ) {
+			dyld_chained_ptr_32_rebase entry = {};
+			entry.target = (uint32_t)target;
+			return raw(entry);
+		}
+		if ( stride() == 4 ) {
+			dyld_chained_ptr_64_rebase entry = {};
+			entry.target = target;
+			entry.high8 = high8;
+			return raw(entry);
+		}
+		dyld_chained_ptr_arm64e_rebase entry = {};
+		entry.target = target;
+		entry.high8 = high8;
+		return raw(entry);
+	}
+
+	uint64_t bind(uint32_t ordinal, int32_t addend = 0) const
+	{
+		if ( fFormat == DYLD_CHAINED_PTR_32 ) {
+			dyld_chained_ptr_32_bind entry = {};
+			entry.ordinal = ordinal;
+			entry.addend = (uint32_t)addend;
+			entry.bind = 1;
+			return raw(entry);
+		}
+		if ( stride() == 4 ) {
+			dyld_chained_ptr_64_bind entry = {};
+			entry.ordinal = ordinal;
+			entry.addend = (uint64_t)addend;
+			entry.bind = 1;
+			return raw(entry);
+		}
+		if ( fFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND24 ) {
+			dyld_chained_ptr_arm64e_bind24 entry = {};
+			entry.ordinal = ordinal;
+			entry.addend = (uint64_t)addend & 0x7FFFF;
+			entry.bind = 1;
+			return raw(entry);
+		}
+		dyld_chained_ptr_arm64e_bind entry = {};
+		entry.ordinal = ordinal;
+		entry.addend = (uint64_t)addend & 0x7FFFF;
+		entry.bind = 1;
+		return raw(entry);
+	}
+
+	// arm64e formats only
+	uint64_t authRebase(uint32_t target, uint16_t diversity, bool addrDiv, uint8_t key) const
+	{
+		dyld_chained_ptr_arm64e_auth_rebase entry = {};
+		entry.target = target;
+		entry.diversity = diversity;
+		entry.addrDiv = addrDiv;
+		entry.key = key;
+		entry.auth = 1;
+		return raw(entry);
+	}
+
+	uint64_t authBind(uint32_t ordinal, uint16_t diversity, bool addrDiv, uint8_t key) const
+	{
+		if ( fFormat == DYLD_CHAINED_PTR_ARM64E_USERLAND24 ) {
+			dyld_chained_ptr_arm64e_auth_bind24 entry = {};
+			entry.ordinal = ordinal;
+			entry.diversity = diversity;
+			entry.addrDiv = addrDiv;
+			entry.key = key;
+			entry.bind = 1;
+			entry.auth = 1;
+			return raw(entry);
+		}
+		dyld_chained_ptr_arm64e_auth_bind entry = {};
+		entry.ordinal = ordinal;
+		entry.diversity = diversity;
+		entry.addrDiv = addrDiv;
+		entry.key = key;
+		entry.bind = 1;
+		entry.auth = 1;
+		return raw(entry);
+	}
+
+private:
+	typedef std::pair<uint32_t, uint64_t>	Entry;		// offset in page, raw value
+	typedef std::vector<Entry>				Chain;
+
+	struct Import {
+		const char*		name;
+		int				libOrdinal;
+		bool			weakImport;
+		int64_t			addend;
+	};
+
+	template <typename T>
+	static uint64_t raw(const T& entry)
+	{
+		uint64_t value = 0;
+		memcpy(&value, &entry, sizeof(entry));
+		return value;
+	}
+
+	static void align(std::vector<uint8_t>& bytes, size_t alignment)
+	{
+		bytes.resize((bytes.size() + alignment - 1) & ~(alignment - 1), 0);
+	}
+
+	void writeChains()
+	{
+		for (size_t page = 0; page < fPages.size(); ++page) {
+			for (const Chain& chain : fPages[page]) {
+				for (size_t i = 0; i < chain.size(); ++i) {
+					const uint64_t next = (i + 1 < chain.size()) ? (chain[i + 1].first - chain[i].first) / stride() : 0;
+					uint64_t value = chain[i].second;
+					// next sits at the same bits in every entry of a format
+					if ( fFormat == DYLD_CHAINED_PTR_32 )
+						value |= next << 26;
+					else
+						value |= next << 51;
+					memcpy(&fImage[pageOffset((uint32_t)page) + chain[i].first], &value, entrySize());
+				}
+			}
+		}
+	}
+
+	void appendImport(std::vector<uint8_t>& payload, const Import& import, uint32_t nameOffset) const
+	{
+		const size_t at = payload.size();
+		switch ( fImportsFormat ) {
+			case DYLD_CHAINED_IMPORT: {
+				dyld_chained_import entry = {};
+				entry.lib_ordinal = (uint8_t)import.libOrdinal;
+				entry.weak_import = import.weakImport;
+				entry.name_offset = nameOffset;
+				payload.resize(at + sizeof(entry));
+				memcpy(&payload[at], &entry, sizeof(entry));
+				break;
+			}
+			case DYLD_CHAINED_IMPORT_ADDEND: {
+				dyld_chained_import_addend entry = {};
+				entry.lib_ordinal = (uint8_t)import.libOrdinal;
+				entry.weak_import = import.weakImport;
+				entry.name_offset = nameOffset;
+				entry.addend = (int32_t)import.addend;
+				payload.resize(at + sizeof(entry));
+				memcpy(&payload[at], &entry, sizeof(entry));
+				break;
+			}
+			default: {
+				dyld_chained_import_addend64 entry = {};
+				entry.lib_ordinal = (uint16_t)import.libOrdinal;
+				entry.weak_import = import.weakImport;
+				entry.name_offset = nameOffset;
+				entry.addend = (uint64_t)import.addend;
+				payload.resize(at + sizeof(entry));
+				memcpy(&payload[at], &entry, sizeof(entry));
+				break;
+			}
+		}
+	}
+
+	uint16_t					fFormat;
+	uint16_t					fPageSize;
+	uint32_t					fImportsFormat;
+	uint32_t					fMaxValidPointer;
+	std::vector<uint8_t>		fImage;
+	std::vector<std::vector<Chain>>	fPages;
+	std::vector<Import>			fImports;
+};
+
+#endif // __CHAINED_IMAGE__
@@ -0,0 +1,74 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Stand-in for libobjc behind RuntimeInterface. Classes are opaque
+ * pointers that are never dereferenced: registered ones are handed out in
+ * order, unregistered(i) names classes the runtime has never seen.
+ */
+
+#ifndef __FAKE_OBJC_RUNTIME__
+#define __FAKE_OBJC_RUNTIME__
+
+#include "ObjCRuntimeInterface.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class FakeObjCRuntime : public mull::objc::RuntimeInterface {
+public:
+	// classes registered behind the loader's back each time growOnCopy strikes
+	static const int		kGrowth = 10;
+
+	explicit FakeObjCRuntime(size_t classCount) : listCalls(0), growOnCopy(0) { add(classCount); }
+
+	void add(size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			classes.push_back((const void*)(uintptr_t)(0x100000 + 16 * classes.size()));
+	}
+
+	static const void* unregistered(size_t index) { return (const void*)(uintptr_t)(0x80000000 + 16 * index); }
+
+	int copyClassList(const void** buffer, int capacity) override
+	{
+		++listCalls;
+		if ( (buffer != NULL) && (growOnCopy > 0) ) {
+			--growOnCopy;
+			add(kGrowth);
+		}
+		if ( buffer != NULL )
+			memcpy(buffer, classes.data(), std::min((size_t)capacity, classes.size()) * sizeof(const void*));
+		return (int)classes.size();
+	}
+
+	std::vector<const void*>	classes;
+	unsigned					listCalls;
+	unsigned					growOnCopy;		// copies that find more classes than the count said
+};
+
+#endif // __FAKE_OBJC_RUNTIME__
@@ -0,0 +1,231 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * A plan written by LinkPlanBuilder reads back the same through
+ * LinkPlanView, and validate() turns down plans that belong to another
+ * image, to other dependencies, were damaged on disk, or would write
+ * outside a writable segment.
+ */
+
+#include "LinkPlan.h"
+#include "TestSupport.h"
+
+#include <mach-o/loader.h>
+#include <string>
+#include <unistd.h>
+
+using namespace isolator;
+
+static const uint8_t	kUUID[16]			= { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+static const uint64_t	kDependencyHash		= 0x1234567890ABCDEFULL;
+static const uint32_t	kSegmentCount		= 3;
+// __TEXT and __LINKEDIT are read-only, only __DATA takes fixups
+static const uint64_t	kSegmentSizes[kSegmentCount] = { 0, 0x1000, 0 };
+
+static std::vector<uint8_t> makePlan()
+{
+	LinkPlanBuilder builder(kUUID, kDependencyHash, sizeof(uintptr_t), kSegmentCount);
+	builder.addRebase(1, 0x00, REBASE_TYPE_POINTER);
+	builder.addRebase(1, 0x08, REBASE_TYPE_POINTER);
+	builder.addBind(kLinkPlanBind, 1, 0x10, BIND_TYPE_POINTER, "_malloc", 0, 0, 1);
+	builder.addBind(kLinkPlanBind, 1, 0x18, BIND_TYPE_POINTER, "_free", 0, 0, 1);
+	builder.addBind(kLinkPlanBind, 1, 0x20, BIND_TYPE_POINTER, "_malloc", 0, 0, 1);
+	builder.addBind(kLinkPlanBind, 1, 0x28, BIND_TYPE_POINTER, "_malloc", 0, 16, 1);
+	builder.addBind(kLinkPlanLazyBind, 1, 0x30, BIND_TYPE_POINTER, "_puts", 0, 0, 2);
+	return builder.serialize();
+}
+
+static const char* validate(const std::vector<uint8_t>& plan, const uint8_t* uuid = kUUID, uint64_t dependencyHash = kDependencyHash,
+							const uint64_t* segmentSizes = kSegmentSizes)
+{
+	return LinkPlanView::validate(plan.data(), plan.size(), uuid, dependencyHash, sizeof(uintptr_t), kSegmentCount, segmentSizes);
+}
+
+// Edits a plan behind the checksum's back, the way a plan written by a broken builder would look.
+static void rehash(std::vector<uint8_t>& plan)
+{
+	LinkPlanHeader* header = (LinkPlanHeader*)plan.data();
+	header->payloadHash = linkPlanHash(plan.data() + sizeof(LinkPlanHeader), plan.size() - sizeof(LinkPlanHeader));
+}
+
+static LinkPlanFixup* fixups(std::vector<uint8_t>& plan)
+{
+	const LinkPlanHeader* header = (const LinkPlanHeader*)plan.data();
+	return (LinkPlanFixup*)(plan.data() + sizeof(LinkPlanHeader) + header->importCount * sizeof(LinkPlanImport));
+}
+
+static void testRoundTrip()
+{
+	const std::vector<uint8_t> plan = makePlan();
+	CHECK_OK(validate(plan));
+
+	LinkPlanView view(plan.data());
+	CHECK(view.header().fixupCount == 7);
+	// the two plain _malloc binds share an import, the one with an addend does not
+	CHECK(view.header().importCount == 4);
+	CHECK(view.header().flags == (kLinkPlanHasRebases | kLinkPlanHasLazyBinds));
+	CHECK(view.fixups()[2].importIndex == view.fixups()[4].importIndex);
+	CHECK(view.fixups()[2].importIndex != view.fixups()[5].importIndex);
+	CHECK(strcmp(view.importName(view.fixups()[3].importIndex), "_free") == 0);
+	CHECK(view.imports()[view.fixups()[5].importIndex].addend == 16);
+	CHECK(view.imports()[view.fixups()[6].importIndex].libraryOrdinal == 2);
+	CHECK(view.fixups()[6].kind == kLinkPlanLazyBind);
+}
+
+static void testRejectsOtherImages()
+{
+	const std::vector<uint8_t> plan = makePlan();
+
+	std::vector<uint8_t> badMagic = plan;
+	badMagic[0] = 'L';
+	CHECK_REASON(validate(badMagic), "bad magic");
+
+	uint8_t otherUUID[16];
+	memcpy(otherUUID, kUUID, sizeof(otherUUID));
+	otherUUID[15] ^= 1;
+	CHECK_REASON(validate(plan, otherUUID), "UUID mismatch");
+
+	CHECK_REASON(validate(plan, kUUID, kDependencyHash + 1), "dependencies changed");
+
+	CHECK_REASON(LinkPlanView::validate(plan.data(), plan.size(), kUUID, kDependencyHash, 2 * sizeof(uintptr_t), kSegmentCount, kSegmentSizes),
+				 "pointer size mismatch");
+	CHECK_REASON(LinkPlanView::validate(plan.data(), plan.size(), kUUID, kDependencyHash, sizeof(uintptr_t), 2, kSegmentSizes),
+				 "segment count mismatch");
+
+	std::vector<uint8_t> newer = plan;
+	((LinkPlanHeader*)newer.data())->version = kLinkPlanVersion + 1;
+	CHECK_REASON(validate(newer), "unsupported version");
+}
+
+static void testRejectsDamage()
+{
+	const std::vector<uint8_t> plan = makePlan();
+
+	for (size_t length : { (size_t)0, sizeof(LinkPlanHeader) - 1 }) {
+		std::vector<uint8_t> truncated(plan.begin(), plan.begin() + length);
+		CHECK_REASON(validate(truncated), "truncated header");
+	}
+	std::vector<uint8_t> shorter(plan.begin(), plan.end() - 1);
+	CHECK_REASON(validate(shorter), "size mismatch");
+	std::vector<uint8_t> longer = plan;
+	longer.push_back(0);
+	CHECK_REASON(validate(longer), "size mismatch");
+
+	// every byte of the payload is covered by the checksum
+	for (size_t i = sizeof(LinkPlanHeader); i < plan.size(); ++i) {
+		std::vector<uint8_t> damaged = plan;
+		damaged[i] ^= 0x40;
+		CHECK_REASON(validate(damaged), "checksum mismatch");
+	}
+
+	std::vector<uint8_t> badImport = plan;
+	fixups(badImport)[2].importIndex = 99;
+	rehash(badImport);
+	CHECK_REASON(validate(badImport), "fixup import out of range");
+
+	std::vector<uint8_t> badKind = plan;
+	fixups(badKind)[0].kind = 9;
+	rehash(badKind);
+	CHECK_REASON(validate(badKind), "bad fixup kind");
+
+	std::vector<uint8_t> unterminated = plan;
+	unterminated.back() = 'x';
+	rehash(unterminated);
+	CHECK_REASON(validate(unterminated), "unterminated string pool");
+}
+
+static void testRejectsFixupsOutsideWritableSegments()
+{
+	std::vector<uint8_t> plan = makePlan();
+
+	// into read-only __TEXT
+	std::vector<uint8_t> intoText = plan;
+	fixups(intoText)[0].segIndex = 0;
+	rehash(intoText);
+	CHECK_REASON(validate(intoText), "fixup outside writable segment");
+
+	// the last pointer of __DATA is fine, one byte further is not
+	std::vector<uint8_t> atEnd = plan;
+	fixups(atEnd)[1].segOffset = 0x1000 - sizeof(uintptr_t);
+	rehash(atEnd);
+	CHECK_OK(validate(atEnd));
+	fixups(atEnd)[1].segOffset += 1;
+	rehash(atEnd);
+	CHECK_REASON(validate(atEnd), "fixup outside writable segment");
+
+	// the same plan against an image whose __DATA has become read-only
+	const uint64_t readOnly[kSegmentCount] = { 0, 0, 0 };
+	CHECK_REASON(validate(plan, kUUID, kDependencyHash, readOnly), "fixup outside writable segment");
+
+	std::vector<uint8_t> noSuchSegment = plan;
+	fixups(noSuchSegment)[3].segIndex = kSegmentCount;
+	rehash(noSuchSegment);
+	CHECK_REASON(validate(noSuchSegment), "fixup segment out of range");
+}
+
+static void testBuilderAbandons()
+{
+	LinkPlanBuilder builder(kUUID, kDependencyHash, sizeof(uintptr_t), kSegmentCount);
+	builder.addRebase(1, 0, REBASE_TYPE_POINTER);
+	CHECK(!builder.abandoned());
+	builder.addRebase(1, 0x100000000ULL, REBASE_TYPE_POINTER);
+	CHECK(builder.abandoned());
+	CHECK(!builder.writeToFile("/nonexistent/plan"));
+}
+
+static void testFileRoundTrip()
+{
+	char path[] = "/tmp/LinkPlanTest.XXXXXX";
+	const int fd = mkstemp(path);
+	CHECK(fd != -1);
+	close(fd);
+
+	LinkPlanBuilder builder(kUUID, kDependencyHash, sizeof(uintptr_t), kSegmentCount);
+	builder.addBind(kLinkPlanBind, 1, 0x10, BIND_TYPE_POINTER, "_malloc", 0, 0, 1);
+	CHECK(builder.writeToFile(path));
+
+	std::vector<uint8_t> read(4096);
+	FILE* file = fopen(path, "rb");
+	CHECK(file != NULL);
+	if ( file != NULL ) {
+		read.resize(fread(read.data(), 1, read.size(), file));
+		fclose(file);
+	}
+	unlink(path);
+	CHECK(read == builder.serialize());
+	CHECK_OK(validate(read));
+}
+
+int main()
+{
+	testRoundTrip();
+	testRejectsOtherImages();
+	testRejectsDamage();
+	testRejectsFixupsOutsideWritableSegments();
+	testBuilderAbandons();
+	testFileRoundTrip();
+	return testResult();
+}
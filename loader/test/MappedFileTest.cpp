@@ -0,0 +1,194 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+/*
+ * MappedFile maps a whole file read-only and turns down files it cannot
+ * map, and validateAdoptedBuffer() leaves a buffer holding a loadable image
+ * alone but unmaps, down to its last partial page, one it turns down: that
+ * is what custom_dlopen_from_memory_adopt() does with a malformed image
+ * before anything else sees it. placeSegment() maps the read-only data of
+ * a mapped file from its descriptor and copies the rest, skipping zero
+ * pages and leaving large aligned segments for vm_copy().
+ */
+
+#include "MappedFile.h"
+#include "SegmentCopy.h"
+#include "TestSupport.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace isolator;
+
+static const size_t kPage = 4096;
+
+// __TEXT, __DATA and __LINKEDIT one page each, the smallest image MachOLayout::validate() takes
+static std::vector<uint8_t> makeImage()
+{
+	TestImage image(3 * kPage, MH_BUNDLE);
+	image.addSegment("__TEXT", 0, kPage, 0, kPage, VM_PROT_READ | VM_PROT_EXECUTE);
+	image.addSegment("__DATA", kPage, kPage, kPage, kPage, VM_PROT_READ | VM_PROT_WRITE);
+	image.addSegment("__LINKEDIT", 2 * kPage, kPage, 2 * kPage, kPage, VM_PROT_READ);
+	image.addCommand<dyld_info_command>(LC_DYLD_INFO_ONLY);
+	image.addCommand<dysymtab_command>(LC_DYSYMTAB);
+	return image.buffer();
+}
+
+// a buffer the way callers of custom_dlopen_from_memory_adopt() get one
+static uint8_t* adoptableCopy(const std::vector<uint8_t>& image)
+{
+	void* buffer = mmap(NULL, image.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( buffer == MAP_FAILED ) {
+		perror("mmap");
+		exit(1);
+	}
+	memcpy(buffer, image.data(), image.size());
+	return (uint8_t*)buffer;
+}
+
+static bool isMapped(const void* address, size_t length)
+{
+	return (msync((void*)address, length, MS_ASYNC) == 0) || (errno != ENOMEM);
+}
+
+static void testMap()
+{
+	char path[] = "/tmp/MappedFileTest.XXXXXX";
+	const int fd = mkstemp(path);
+	CHECK(fd != -1);
+	const std::vector<uint8_t> image = makeImage();
+	CHECK(write(fd, image.data(), image.size()) == (ssize_t)image.size());
+	close(fd);
+
+	MappedFile file;
+	CHECK(file.map(path) == 0);
+	CHECK(file.length() == image.size());
+	CHECK((file.address() != NULL) && (memcmp(file.address(), image.data(), image.size()) == 0));
+	CHECK(file.fd() != -1);
+	file.closeDescriptor();
+	CHECK(file.fd() == -1);
+	CHECK((file.address() != NULL) && (memcmp(file.address(), image.data(), image.size()) == 0));
+	const void* address = file.address();
+	file.unmap();
+	CHECK(file.address() == NULL);
+	CHECK(!isMapped(address, kPage));
+
+	CHECK(truncate(path, 0) == 0);
+	CHECK(file.map(path) == EINVAL);
+	unlink(path);
+	CHECK(file.map(path) == ENOENT);
+	CHECK(file.address() == NULL);
+}
+
+static void testAdoptedBuffer()
+{
+	const std::vector<uint8_t> image = makeImage();
+
+	// a loadable image is still the caller's to load
+	uint8_t* buffer = adoptableCopy(image);
+	CHECK_OK(validateAdoptedBuffer(buffer, image.size(), kPage));
+	CHECK(isMapped(buffer, image.size()));
+	CHECK(memcmp(buffer, image.data(), image.size()) == 0);
+	munmap(buffer, image.size());
+
+	// a malformed one is gone on return
+	buffer = adoptableCopy(image);
+	((TestImage::Header*)buffer)->magic = 0xFEEDBEEF;
+	CHECK_REASON(validateAdoptedBuffer(buffer, image.size(), kPage), "not a mach-o image");
+	CHECK(!isMapped(buffer, kPage));
+	CHECK(!isMapped(buffer + image.size() - kPage, kPage));
+
+	// one whose length stops short of its last page loses that page too
+	buffer = adoptableCopy(image);
+	CHECK_REASON(validateAdoptedBuffer(buffer, image.size() - kPage / 2, kPage), "extends beyond end of image");
+	CHECK(!isMapped(buffer + image.size() - kPage, kPage));
+
+	// pages past the length handed over are not the loader's
+	buffer = adoptableCopy(image);
+	CHECK_REASON(validateAdoptedBuffer(buffer, 16, kPage), "too small for a mach header");
+	CHECK(!isMapped(buffer, kPage));
+	CHECK(isMapped(buffer + kPage, image.size() - kPage));
+	munmap(buffer + kPage, image.size() - kPage);
+}
+
+static void testPlaceSegment()
+{
+	char path[] = "/tmp/MappedFileTest.XXXXXX";
+	const int fd = mkstemp(path);
+	CHECK(fd != -1);
+	std::vector<uint8_t> image = makeImage();
+	memset(&image[2 * kPage], 0x5A, kPage);
+	CHECK(write(fd, image.data(), image.size()) == (ssize_t)image.size());
+	close(fd);
+	MappedFile file;
+	CHECK(file.map(path) == 0);
+	const uint8_t* src = (const uint8_t*)file.address();
+
+	// __TEXT is copied, the all-zero __DATA page is left alone and __LINKEDIT comes from the file
+	uint8_t* range = adoptableCopy(std::vector<uint8_t>(image.size()));
+	SegmentPlacement text = placeSegment(range, src, kPage, kPage, false, true, file.fd(), 0);
+	CHECK((text.strategy == kSegmentCopyMemcpy) && (text.written == kPage) && (text.error == 0));
+	SegmentPlacement data = placeSegment(range + kPage, src + kPage, kPage, kPage, true, false, file.fd(), kPage);
+	CHECK((data.strategy == kSegmentCopyMemcpy) && (data.written == 0));
+	SegmentPlacement linkedit = placeSegment(range + 2 * kPage, src + 2 * kPage, kPage, kPage, false, false, file.fd(), 2 * kPage);
+	CHECK((linkedit.strategy == kSegmentCopyMapFile) && (linkedit.written == 0) && (linkedit.error == 0));
+	CHECK(memcmp(range, image.data(), image.size()) == 0);
+	CHECK(strcmp(segmentCopyName(linkedit.strategy), "mapped") == 0);
+
+	munmap(range, image.size());
+
+	// without a descriptor read-only data is copied too
+	range = adoptableCopy(std::vector<uint8_t>(image.size()));
+	linkedit = placeSegment(range + 2 * kPage, src + 2 * kPage, kPage, kPage, false, false, -1, 2 * kPage);
+	CHECK((linkedit.strategy == kSegmentCopyMemcpy) && (linkedit.written == kPage));
+
+	// a failed mapping is reported, not thrown
+	linkedit = placeSegment(range + 2 * kPage, src + 2 * kPage, kPage, kPage, false, false, 999, 2 * kPage);
+	CHECK((linkedit.strategy == kSegmentCopyMapFile) && (linkedit.error == EBADF));
+	munmap(range, image.size());
+
+	// large page aligned segments are left to the caller's vm_copy()
+	const std::vector<uint8_t> large(kSegmentCopyRemapMin, 1);
+	range = adoptableCopy(std::vector<uint8_t>(kSegmentCopyRemapMin));
+	uint8_t* source = adoptableCopy(large);
+	SegmentPlacement remapped = placeSegment(range, source, large.size(), kPage, true, false, -1, 0);
+	CHECK((remapped.strategy == kSegmentCopyRemap) && (remapped.written == 0) && (range[0] == 0));
+	munmap(source, large.size());
+	munmap(range, large.size());
+	unlink(path);
+}
+
+int main()
+{
+	testMap();
+	testAdoptedBuffer();
+	testPlaceSegment();
+	return testResult();
+}
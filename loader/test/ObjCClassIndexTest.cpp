@@ -0,0 +1,126 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * ClassIndex against a fake runtime: it seeds itself from the class list
+ * once, copes with the list growing while it is copied, and tracks the
+ * classes the loader registers and disposes of afterwards.
+ */
+
+#include "ObjCClassIndex.h"
+#include "FakeObjCRuntime.h"
+#include "TestSupport.h"
+
+#include <thread>
+
+using namespace mull::objc;
+
+static void testSeedsOnce()
+{
+	FakeObjCRuntime runtime(100);
+	ClassIndex index(runtime);
+	CHECK(runtime.listCalls == 0);
+
+	CHECK(index.contains(runtime.classes[0]));
+	CHECK(index.contains(runtime.classes[99]));
+	CHECK(!index.contains(runtime.unregistered(0)));
+	CHECK(index.size() == 100);
+	// one call for the count, one to copy
+	CHECK(runtime.listCalls == 2);
+
+	// classes the runtime gains later are only known if the loader inserts them
+	runtime.add(1);
+	CHECK(!index.contains(runtime.classes[100]));
+	CHECK(runtime.listCalls == 2);
+}
+
+static void testInsertAndErase()
+{
+	FakeObjCRuntime runtime(10);
+	ClassIndex index(runtime);
+
+	const void* loaded = runtime.unregistered(1);
+	index.insert(loaded);
+	CHECK(index.contains(loaded));
+	CHECK(index.size() == 11);
+	// inserting seeded first, so the runtime's classes are there as well
+	CHECK(index.contains(runtime.classes[3]));
+
+	index.erase(loaded);
+	CHECK(!index.contains(loaded));
+	index.erase(runtime.classes[3]);
+	CHECK(!index.contains(runtime.classes[3]));
+	CHECK(index.size() == 9);
+}
+
+static void testListGrowsWhileCopying()
+{
+	FakeObjCRuntime runtime(50);
+	// another thread registers classes between the count and the copy, twice
+	runtime.growOnCopy = 2;
+	ClassIndex index(runtime);
+	CHECK(index.size() == 50 + 2 * FakeObjCRuntime::kGrowth);
+	CHECK(index.contains(runtime.classes.back()));
+	CHECK(runtime.listCalls == 4);
+}
+
+static void testEmptyRuntime()
+{
+	FakeObjCRuntime runtime(0);
+	ClassIndex index(runtime);
+	CHECK(index.size() == 0);
+	CHECK(!index.contains(runtime.unregistered(0)));
+}
+
+static void testConcurrentUse()
+{
+	FakeObjCRuntime runtime(1000);
+	ClassIndex index(runtime);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&runtime, &index, t] {
+			for (int i = 0; i < 1000; ++i) {
+				const void* cls = runtime.unregistered(t * 1000 + i);
+				index.insert(cls);
+				if ( !index.contains(cls) || !index.contains(runtime.classes[i]) )
+					testFailure(__FILE__, __LINE__, "class missing under concurrent use");
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	CHECK(index.size() == 5000);
+	CHECK(runtime.listCalls == 2);
+}
+
+int main()
+{
+	testSeedsOnce();
+	testInsertAndErase();
+	testListGrowsWhileCopying();
+	testEmptyRuntime();
+	testConcurrentUse();
+	return testResult();
+}
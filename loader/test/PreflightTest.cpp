@@ -0,0 +1,383 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+/*
+ * preflightImage() decodes the opcode streams of a synthetic image the way
+ * the link would: it counts fixups, turns down streams that are cut short,
+ * bind to a dylib ordinal the image does not have, or chain threaded binds
+ * outside their table, and, given a resolver, reports dylibs that are not
+ * loaded apart from the imports that do not resolve.
+ */
+
+#include "Preflight.h"
+#include "TestSupport.h"
+
+#include <mach-o/loader.h>
+#include <string>
+
+using namespace isolator;
+
+static const uint64_t	kPageSize		= 0x1000;
+static const uint64_t	kDataOffset		= 0x1000;	// __DATA, in the file and in memory
+static const uint64_t	kLinkeditOffset	= 0x2000;
+static const uint64_t	kLinkeditSize	= 0x2000;
+
+// ordinal 1 is loaded, 2 is not, 3 is not either but only linked weakly
+static const char* const kLoadedLibrary	= "/usr/lib/libSystem.B.dylib";
+static const char* const kMissingLibrary	= "@rpath/libmissing.dylib";
+static const char* const kWeakLibrary		= "/usr/lib/libweakgone.dylib";
+
+struct Streams {
+	std::vector<uint8_t>	rebase;
+	std::vector<uint8_t>	bind;
+	std::vector<uint8_t>	lazyBind;
+	std::vector<uint8_t>	weakBind;
+};
+
+static void uleb(std::vector<uint8_t>& stream, uint64_t value)
+{
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		if ( value != 0 )
+			byte |= 0x80;
+		stream.push_back(byte);
+	} while ( value != 0 );
+}
+
+static void symbol(std::vector<uint8_t>& stream, const char* name, uint8_t flags = 0)
+{
+	stream.push_back(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM | flags);
+	stream.insert(stream.end(), name, name + strlen(name) + 1);
+}
+
+// one bind of name from ordinal at offset into __DATA
+static void bind(std::vector<uint8_t>& stream, uint8_t ordinal, const char* name, uint64_t offset, uint8_t flags = 0)
+{
+	stream.push_back(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | ordinal);
+	symbol(stream, name, flags);
+	stream.push_back(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+	stream.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	uleb(stream, offset);
+	stream.push_back(BIND_OPCODE_DO_BIND);
+}
+
+// __TEXT, a writable __DATA and __LINKEDIT holding the streams, linked against the three dylibs above
+static std::vector<uint8_t> makeImage(const Streams& streams)
+{
+	TestImage image(kLinkeditOffset + kLinkeditSize);
+	image.addSegment("__TEXT", 0, kDataOffset, 0, kDataOffset, VM_PROT_READ | VM_PROT_EXECUTE);
+	image.addSegment("__DATA", kDataOffset, 0x1000, kDataOffset, 0x1000, VM_PROT_READ | VM_PROT_WRITE);
+	image.addSegment("__LINKEDIT", kLinkeditOffset, kLinkeditSize, kLinkeditOffset, kLinkeditSize, VM_PROT_READ);
+	image.addDylib(kLoadedLibrary);
+	image.addDylib(kMissingLibrary);
+	image.addDylib(kWeakLibrary, LC_LOAD_WEAK_DYLIB);
+	dyld_info_command* info = image.addCommand<dyld_info_command>(LC_DYLD_INFO_ONLY);
+	image.addCommand<symtab_command>(LC_SYMTAB);
+	image.addCommand<dysymtab_command>(LC_DYSYMTAB);
+
+	uint32_t next = (uint32_t)kLinkeditOffset;
+	const auto place = [&](const std::vector<uint8_t>& stream, uint32_t& offset, uint32_t& size) {
+		offset = next;
+		size = (uint32_t)stream.size();
+		if ( !stream.empty() )
+			memcpy(image.bytes() + next, stream.data(), stream.size());
+		next += size;
+	};
+	place(streams.rebase, info->rebase_off, info->rebase_size);
+	place(streams.bind, info->bind_off, info->bind_size);
+	place(streams.lazyBind, info->lazy_bind_off, info->lazy_bind_size);
+	place(streams.weakBind, info->weak_bind_off, info->weak_bind_size);
+	return image.buffer();
+}
+
+static const char* preflight(const std::vector<uint8_t>& image, PreflightResult& result,
+							 PreflightResolver resolver = NULL, void* context = NULL)
+{
+	return preflightImage(image.data(), image.size(), kPageSize, resolver, context, &result);
+}
+
+// What the resolver below was asked.
+struct FakeProcess {
+	unsigned				libraryQueries;
+	std::vector<std::string> lookups;		// "library:symbol"
+};
+
+// Only kLoadedLibrary is loaded, and it exports everything but _nothere.
+static PreflightLookup fakeResolver(void* context, const char* library, const char* symbol)
+{
+	FakeProcess& process = *(FakeProcess*)context;
+	if ( symbol == NULL )
+		++process.libraryQueries;
+	else
+		process.lookups.push_back(std::string(library ? library : "(flat)") + ":" + symbol);
+	if ( (library != NULL) && (strcmp(library, kLoadedLibrary) != 0) )
+		return kPreflightLibraryNotLoaded;
+	if ( (symbol != NULL) && (strcmp(symbol, "_nothere") == 0) )
+		return kPreflightUnresolved;
+	return kPreflightResolved;
+}
+
+static void testCounts()
+{
+	Streams streams;
+	streams.rebase.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	streams.rebase.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	uleb(streams.rebase, 0);
+	streams.rebase.push_back(REBASE_OPCODE_DO_REBASE_IMM_TIMES | 4);
+	streams.rebase.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB);
+	uleb(streams.rebase, 2);
+	uleb(streams.rebase, 8);
+	streams.rebase.push_back(REBASE_OPCODE_DONE);
+
+	bind(streams.bind, 1, "_malloc", 0x100);
+	streams.bind.push_back(BIND_OPCODE_DO_BIND);
+	streams.bind.push_back(BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB);
+	uleb(streams.bind, 3);
+	uleb(streams.bind, 8);
+	bind(streams.bind, 1, "_free", 0x200);
+	streams.bind.push_back(BIND_OPCODE_DONE);
+
+	bind(streams.lazyBind, 1, "_puts", 0x300);
+	streams.lazyBind.push_back(BIND_OPCODE_DONE);
+	bind(streams.lazyBind, 1, "_exit", 0x308);
+	streams.lazyBind.push_back(BIND_OPCODE_DONE);
+
+	symbol(streams.weakBind, "_strong", BIND_SYMBOL_FLAGS_NON_WEAK_DEFINITION);
+	symbol(streams.weakBind, "_coalesced");
+	streams.weakBind.push_back(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+	streams.weakBind.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	uleb(streams.weakBind, 0x400);
+	streams.weakBind.push_back(BIND_OPCODE_DO_BIND);
+	streams.weakBind.push_back(BIND_OPCODE_DONE);
+
+	const std::vector<uint8_t> image = makeImage(streams);
+	PreflightResult result;
+	CHECK_OK(preflight(image, result));
+	CHECK(result.mappedSize == kLinkeditOffset + kLinkeditSize);
+	CHECK(result.segmentCount == 3);
+	CHECK(result.libraryCount == 3);
+	CHECK(result.rebaseFixups == 6);
+	CHECK(result.bindFixups == 6);
+	CHECK(result.lazyBindFixups == 2);
+	CHECK(result.weakBindFixups == 1);
+	// without a resolver nothing is looked up
+	CHECK(result.importsChecked == 0);
+	CHECK(result.missingLibraryCount == 0);
+
+	// with one, every distinct import of the bind and lazy bind streams once
+	FakeProcess process = {};
+	CHECK_OK(preflight(image, result, &fakeResolver, &process));
+	CHECK(result.importsChecked == 4);
+	CHECK(process.lookups.size() == 4);
+	CHECK(result.unresolvedCount == 0);
+}
+
+static void testTruncatedStreams()
+{
+	Streams streams;
+	streams.rebase.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	streams.rebase.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	streams.rebase.push_back(0x80);
+	PreflightResult result;
+	CHECK_REASON(preflight(makeImage(streams), result), "malformed rebase opcodes: truncated uleb128");
+
+	streams = Streams();
+	bind(streams.bind, 1, "_malloc", 0x100);
+	streams.bind.push_back(BIND_OPCODE_ADD_ADDR_ULEB);
+	streams.bind.push_back(0xFF);
+	CHECK_REASON(preflight(makeImage(streams), result), "malformed bind opcodes: truncated uleb128");
+
+	streams = Streams();
+	streams.lazyBind.push_back(BIND_OPCODE_SET_ADDEND_SLEB);
+	streams.lazyBind.push_back(0x80);
+	CHECK_REASON(preflight(makeImage(streams), result), "malformed lazy bind opcodes: truncated sleb128");
+
+	streams = Streams();
+	streams.weakBind.push_back(BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM);
+	streams.weakBind.push_back('_');
+	streams.weakBind.push_back('x');
+	CHECK_REASON(preflight(makeImage(streams), result), "malformed weak bind opcodes: symbol name runs past the end");
+
+	// every prefix of a good stream either checks out or is turned down, never with more fixups than the whole
+	Streams whole;
+	bind(whole.bind, 1, "_malloc", 0x100);
+	whole.bind.push_back(BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB);
+	uleb(whole.bind, 300);
+	uleb(whole.bind, 0);
+	bind(whole.bind, 1, "_free", 0x1000 - 8);
+	whole.bind.push_back(BIND_OPCODE_DONE);
+	CHECK_OK(preflight(makeImage(whole), result));
+	const uint64_t allFixups = result.bindFixups;
+	CHECK(allFixups == 302);
+	for (size_t length = 0; length < whole.bind.size(); ++length) {
+		Streams prefix;
+		prefix.bind.assign(whole.bind.begin(), whole.bind.begin() + length);
+		preflight(makeImage(prefix), result);
+		CHECK(result.bindFixups <= allFixups);
+	}
+}
+
+static void testOrdinalOutOfRange()
+{
+	Streams streams;
+	bind(streams.bind, 4, "_malloc", 0x100);
+	PreflightResult result;
+	CHECK_REASON(preflight(makeImage(streams), result), "malformed bind opcodes: dylib ordinal 4 out of range (1..3)");
+
+	streams = Streams();
+	streams.lazyBind.push_back(BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB);
+	uleb(streams.lazyBind, 300);
+	symbol(streams.lazyBind, "_puts");
+	streams.lazyBind.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	uleb(streams.lazyBind, 0x100);
+	streams.lazyBind.push_back(BIND_OPCODE_DO_BIND);
+	CHECK_REASON(preflight(makeImage(streams), result), "malformed lazy bind opcodes: dylib ordinal 300 out of range (1..3)");
+
+	// the special ordinals are not dylibs: self is not looked up, the main executable flat
+	streams = Streams();
+	streams.bind.push_back(BIND_OPCODE_SET_DYLIB_SPECIAL_IMM | (BIND_SPECIAL_DYLIB_SELF & BIND_IMMEDIATE_MASK));
+	symbol(streams.bind, "_own");
+	streams.bind.push_back(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+	streams.bind.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	uleb(streams.bind, 0x100);
+	streams.bind.push_back(BIND_OPCODE_DO_BIND);
+	streams.bind.push_back(BIND_OPCODE_SET_DYLIB_SPECIAL_IMM | (BIND_SPECIAL_DYLIB_MAIN_EXECUTABLE & BIND_IMMEDIATE_MASK));
+	symbol(streams.bind, "_main");
+	streams.bind.push_back(BIND_OPCODE_DO_BIND);
+	streams.bind.push_back(BIND_OPCODE_DONE);
+	FakeProcess process = {};
+	CHECK_OK(preflight(makeImage(streams), result, &fakeResolver, &process));
+	CHECK(result.bindFixups == 2);
+	CHECK(process.lookups.size() == 1);
+	CHECK(!process.lookups.empty() && (process.lookups[0] == "(flat):_main"));
+}
+
+// a table of two imports, then one chain through __DATA the table binds against
+static Streams threadedBinds(uint64_t tableSize)
+{
+	Streams streams;
+	streams.bind.push_back(BIND_OPCODE_THREADED | BIND_SUBOPCODE_THREADED_SET_BIND_ORDINAL_TABLE_SIZE_ULEB);
+	uleb(streams.bind, tableSize);
+	bind(streams.bind, 1, "_malloc", 0);
+	streams.bind.push_back(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1);
+	symbol(streams.bind, "_free");
+	streams.bind.push_back(BIND_OPCODE_DO_BIND);
+	streams.bind.push_back(BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	uleb(streams.bind, 0);
+	streams.bind.push_back(BIND_OPCODE_THREADED | BIND_SUBOPCODE_THREADED_APPLY);
+	streams.bind.push_back(BIND_OPCODE_DONE);
+	return streams;
+}
+
+// bit 62 marks a bind, bits 51..61 hold the distance to the next entry in pointers
+static void setChainEntry(std::vector<uint8_t>& image, uint32_t slot, bool isBind, uint64_t next, uint64_t payload)
+{
+	const uint64_t value = (isBind ? (1ULL << 62) : 0) | (next << 51) | payload;
+	memcpy(image.data() + kDataOffset + slot * sizeof(uint64_t), &value, sizeof(value));
+}
+
+static void testThreadedBinds()
+{
+	PreflightResult result;
+	if ( sizeof(uintptr_t) != 8 ) {
+		CHECK_REASON(preflight(makeImage(threadedBinds(2)), result), "bad bind opcode");
+		return;
+	}
+
+	// bind 0, rebase, a slot the chain skips, bind 1
+	std::vector<uint8_t> image = makeImage(threadedBinds(2));
+	setChainEntry(image, 0, true, 1, 0);
+	setChainEntry(image, 1, false, 2, 0x1000);
+	setChainEntry(image, 3, true, 0, 1);
+	FakeProcess process = {};
+	CHECK_OK(preflight(image, result, &fakeResolver, &process));
+	CHECK(result.bindFixups == 2);
+	CHECK(result.rebaseFixups == 1);
+	CHECK(result.importsChecked == 2);
+
+	// an entry past the end of the ordinal table
+	setChainEntry(image, 3, true, 0, 2);
+	CHECK_REASON(preflight(image, result), "bind ordinal (2) is out of range (max=2)");
+
+	// a chain that runs off the end of the segment's file contents
+	image = makeImage(threadedBinds(2));
+	setChainEntry(image, 0, true, 0x7FF, 0);
+	CHECK_REASON(preflight(image, result), "threaded chain leaves segment __DATA");
+
+	// only DO_BIND builds the table
+	Streams streams;
+	streams.bind.push_back(BIND_OPCODE_THREADED | BIND_SUBOPCODE_THREADED_SET_BIND_ORDINAL_TABLE_SIZE_ULEB);
+	uleb(streams.bind, 1);
+	streams.bind.push_back(BIND_OPCODE_SET_DYLIB_ORDINAL_IMM | 1);
+	symbol(streams.bind, "_malloc");
+	streams.bind.push_back(BIND_OPCODE_SET_TYPE_IMM | BIND_TYPE_POINTER);
+	streams.bind.push_back(BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB);
+	uleb(streams.bind, 8);
+	CHECK_REASON(preflight(makeImage(streams), result), "bad opcode");
+}
+
+static void testMissingLibraries()
+{
+	Streams streams;
+	bind(streams.bind, 1, "_malloc", 0x100);
+	bind(streams.bind, 1, "_nothere", 0x108);
+	bind(streams.bind, 2, "_fromMissing", 0x110);
+	bind(streams.bind, 2, "_alsoFromMissing", 0x118);
+	bind(streams.bind, 3, "_weakImport", 0x120, BIND_SYMBOL_FLAGS_WEAK_IMPORT);
+	bind(streams.bind, 3, "_strongImport", 0x128);
+	streams.bind.push_back(BIND_OPCODE_DONE);
+	bind(streams.lazyBind, 2, "_lazyFromMissing", 0x200);
+	streams.lazyBind.push_back(BIND_OPCODE_DONE);
+
+	// names in the result point into the image
+	const std::vector<uint8_t> image = makeImage(streams);
+	PreflightResult result;
+	FakeProcess process = {};
+	CHECK_OK(preflight(image, result, &fakeResolver, &process));
+	// each dylib the image needs is asked about once, weakly linked ones are allowed to be missing
+	CHECK(process.libraryQueries == 2);
+	CHECK(result.missingLibraryCount == 1);
+	CHECK(strcmp(result.missingLibraries[0], kMissingLibrary) == 0);
+	// the imports of the missing dylib are reported through it, not one by one
+	for (const std::string& lookup : process.lookups)
+		CHECK(lookup.find(kMissingLibrary) == std::string::npos);
+	CHECK(result.importsChecked == 4);
+	// a missing weakly linked dylib only leaves its weak imports unbound
+	CHECK(result.unresolvedCount == 2);
+	CHECK(strcmp(result.unresolved[0], "_nothere") == 0);
+	CHECK(strcmp(result.unresolved[1], "_strongImport") == 0);
+}
+
+int main()
+{
+	testCounts();
+	testTruncatedStreams();
+	testOrdinalOutOfRange();
+	testThreadedBinds();
+	testMissingLibraries();
+	return testResult();
+}
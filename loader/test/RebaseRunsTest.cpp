@@ -0,0 +1,129 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * RebaseSlider and slidePointers() against sliding one slot at a time:
+ * lone slots, contiguous and strided runs, runs that touch or repeat slots
+ * slid before, and every small count and stride the vector kernels and
+ * their tails see. Also built with the NEON kernel (RebaseRunsNeonTest).
+ */
+
+#include "RebaseRuns.h"
+#include "TestSupport.h"
+
+#include <string>
+
+using namespace isolator;
+
+static const uintptr_t kSlide = 0x123400;
+
+class Memory {
+public:
+	explicit Memory(size_t slots) : fSlots(slots), fExpected(slots)
+	{
+		for (size_t i = 0; i < slots; ++i)
+			fSlots[i] = fExpected[i] = 0x100000 + i * 0x10;
+	}
+
+	uintptr_t	address(size_t slot)	{ return (uintptr_t)&fSlots[slot]; }
+	// what sliding the slot on its own does
+	void		expect(size_t slot)		{ fExpected[slot] += kSlide; }
+	bool		matches() const			{ return fSlots == fExpected; }
+
+private:
+	std::vector<uintptr_t>	fSlots;
+	std::vector<uintptr_t>	fExpected;
+};
+
+static void testSlider()
+{
+	Memory memory(4096);
+	RebaseSlider slider(kSlide);
+
+	// lone slots are slid as they come, whatever gap they leave
+	for (size_t i = 0; i < 64; ++i) {
+		slider.add(memory.address(i), 1);
+		memory.expect(i);
+	}
+	for (size_t i = 100; i < 400; i += 3) {
+		slider.add(memory.address(i), 1);
+		memory.expect(i);
+	}
+	CHECK(memory.matches());
+	CHECK(slider.runCount() == 0);
+
+	// a contiguous run right after them, and a strided one
+	slider.add(memory.address(64), 16);
+	for (size_t i = 64; i < 80; ++i)
+		memory.expect(i);
+	slider.add(memory.address(505), 10, 5 * sizeof(uintptr_t));
+	for (size_t i = 505; i < 555; i += 5)
+		memory.expect(i);
+	CHECK(memory.matches());
+	CHECK(slider.runCount() == 2);
+
+	// a run over slots slid before slides them again, as rebasing them twice would
+	slider.add(memory.address(600), 1);
+	memory.expect(600);
+	slider.add(memory.address(600), 4);
+	for (size_t i = 600; i < 604; ++i)
+		memory.expect(i);
+	slider.add(memory.address(700), 1);
+	slider.add(memory.address(700), 1);
+	memory.expect(700);
+	memory.expect(700);
+	CHECK(slider.runCount() == 3);
+
+	// empty runs are ignored
+	slider.add(memory.address(800), 0);
+	CHECK(slider.runCount() == 3);
+
+	CHECK(memory.matches());
+	CHECK(slider.pointerCount() == 64 + 100 + 16 + 10 + 1 + 4 + 2);
+}
+
+static void testSlidePointers()
+{
+	for (size_t stride : { sizeof(uintptr_t), 2 * sizeof(uintptr_t), 3 * sizeof(uintptr_t), 5 * sizeof(uintptr_t) }) {
+		for (size_t count = 0; count < 40; ++count) {
+			// one slot of headroom on each side, and an offset start to exercise unaligned vector loads
+			for (size_t first = 1; first < 3; ++first) {
+				Memory memory(count * stride / sizeof(uintptr_t) + 4);
+				for (size_t i = 0; i < count; ++i)
+					memory.expect(first + i * stride / sizeof(uintptr_t));
+				slidePointers((uintptr_t*)memory.address(first), count, stride, kSlide);
+				if ( !memory.matches() )
+					testFailure(__FILE__, __LINE__, ("slidePointers count " + std::to_string(count) + " stride " + std::to_string(stride)).c_str());
+			}
+		}
+	}
+}
+
+int main()
+{
+	testSlider();
+	testSlidePointers();
+	return testResult();
+}
@@ -0,0 +1,246 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * SectionIndex filled from synthetic load commands the way parseLoadCmds()
+ * fills it, checked against a scan of the same load commands: the hashed
+ * lookup by name behind getSectionContent() and the lookup of an interior
+ * address behind findSection().
+ */
+
+#include "SectionIndex.h"
+#include "TestSupport.h"
+
+#include <string>
+
+using namespace isolator;
+
+typedef TestImage::Segment Segment;
+typedef TestImage::Section Section;
+
+static void setSection(Segment* seg, uint32_t index, const char* sectname, uint64_t addr, uint64_t size, uint32_t type = S_REGULAR)
+{
+	Section* sect = TestImage::section(seg, index);
+	memcpy(sect->segname, seg->segname, sizeof(sect->segname));
+	setName(sect->sectname, sectname);
+	sect->addr	= addr;
+	sect->size	= size;
+	sect->flags	= type;
+}
+
+// what parseLoadCmds() does
+static void indexSections(const TestImage& image, SectionIndex& index)
+{
+	const uint8_t* machO = image.bytes();
+	const load_command* cmd = (const load_command*)(machO + sizeof(TestImage::Header));
+	for (uint32_t i = 0; i < ((const TestImage::Header*)machO)->ncmds; ++i) {
+		if ( cmd->cmd == TestImage::kSegmentCommand ) {
+			const Segment* seg = (const Segment*)cmd;
+			const Section* sectionsStart = (const Section*)(seg + 1);
+			for (const Section* sect = sectionsStart; sect < &sectionsStart[seg->nsects]; ++sect) {
+				index.add(sect->segname, sect->sectname, sect->addr, sect->size, sect->flags & SECTION_TYPE,
+						  (uint32_t)((const uint8_t*)sect - machO), (uint32_t)((const uint8_t*)seg - machO));
+			}
+		}
+		cmd = (const load_command*)((const uint8_t*)cmd + cmd->cmdsize);
+	}
+	index.seal();
+}
+
+// what getSectionContent() and findSection() did before the index
+static const Section* scanByName(const TestImage& image, const char* segmentName, const char* sectionName)
+{
+	const load_command* cmd = (const load_command*)(image.bytes() + sizeof(TestImage::Header));
+	for (uint32_t i = 0; i < ((const TestImage::Header*)image.bytes())->ncmds; ++i) {
+		if ( cmd->cmd == TestImage::kSegmentCommand ) {
+			const Segment* seg = (const Segment*)cmd;
+			const Section* sectionsStart = (const Section*)(seg + 1);
+			for (const Section* sect = sectionsStart; sect < &sectionsStart[seg->nsects]; ++sect) {
+				if ( (strncmp(sect->segname, segmentName, 16) == 0) && (strncmp(sect->sectname, sectionName, 16) == 0) )
+					return sect;
+			}
+		}
+		cmd = (const load_command*)((const uint8_t*)cmd + cmd->cmdsize);
+	}
+	return NULL;
+}
+
+static const Section* scanByAddress(const TestImage& image, uint64_t unslidAddress)
+{
+	const load_command* cmd = (const load_command*)(image.bytes() + sizeof(TestImage::Header));
+	for (uint32_t i = 0; i < ((const TestImage::Header*)image.bytes())->ncmds; ++i) {
+		if ( cmd->cmd == TestImage::kSegmentCommand ) {
+			const Segment* seg = (const Segment*)cmd;
+			const Section* sectionsStart = (const Section*)(seg + 1);
+			for (const Section* sect = sectionsStart; sect < &sectionsStart[seg->nsects]; ++sect) {
+				if ( (sect->addr <= unslidAddress) && (unslidAddress < sect->addr + sect->size) )
+					return sect;
+			}
+		}
+		cmd = (const load_command*)((const uint8_t*)cmd + cmd->cmdsize);
+	}
+	return NULL;
+}
+
+static const Section* sectionOf(const TestImage& image, const SectionIndex::Entry* entry)
+{
+	return (entry != NULL) ? (const Section*)(image.bytes() + entry->sectionOffset) : NULL;
+}
+
+static void makeImage(TestImage& image)
+{
+	Segment* text = image.addSegment("__TEXT", 0, 0x4000, 0, 0x4000, VM_PROT_READ | VM_PROT_EXECUTE, 3);
+	setSection(text, 0, "__text", 0x1000, 0x2000, S_REGULAR | S_ATTR_PURE_INSTRUCTIONS);
+	setSection(text, 1, "__stubs", 0x3000, 0x100, S_SYMBOL_STUBS);
+	setSection(text, 2, "__cstring", 0x3100, 0x80, S_CSTRING_LITERALS);
+
+	Segment* data = image.addSegment("__DATA", 0x4000, 0x4000, 0x4000, 0x4000, VM_PROT_READ | VM_PROT_WRITE, 5);
+	setSection(data, 0, "__la_symbol_ptr", 0x4000, 0x40, S_LAZY_SYMBOL_POINTERS);
+	// an empty section at the same address as the next one
+	setSection(data, 1, "__empty", 0x4040, 0);
+	setSection(data, 2, "__objc_classlist", 0x4040, 0x20);
+	// names use all 16 bytes, with no terminator
+	setSection(data, 3, "__mod_init_func_", 0x4060, 0x10, S_MOD_INIT_FUNC_POINTERS);
+	setSection(data, 4, "__bss", 0x5000, 0x1000, S_ZEROFILL);
+
+	// the same section name in another segment, and a repeat of a name already seen
+	Segment* dataConst = image.addSegment("__DATA_CONST", 0x8000, 0x1000, 0x8000, 0x1000, VM_PROT_READ, 2);
+	setSection(dataConst, 0, "__objc_classlist", 0x8000, 0x8);
+	setName(TestImage::section(dataConst, 1)->segname, "__DATA");
+	memcpy(TestImage::section(dataConst, 1)->sectname, "__objc_classlist", 16);
+	TestImage::section(dataConst, 1)->addr = 0x8008;
+	TestImage::section(dataConst, 1)->size = 0x8;
+}
+
+static void testFindByName()
+{
+	TestImage image(0x1000);
+	makeImage(image);
+	SectionIndex index;
+	indexSections(image, index);
+	CHECK(index.sealed());
+	CHECK(index.count() == 10);
+
+	const char* names[][2] = {
+		{ "__TEXT", "__text" }, { "__TEXT", "__stubs" }, { "__TEXT", "__cstring" },
+		{ "__DATA", "__la_symbol_ptr" }, { "__DATA", "__empty" }, { "__DATA", "__objc_classlist" },
+		{ "__DATA", "__mod_init_func_" }, { "__DATA", "__bss" }, { "__DATA_CONST", "__objc_classlist" },
+		// only the first 16 bytes of a longer name count, as with strncmp()
+		{ "__DATA", "__mod_init_func_x" },
+		// not there
+		{ "__DATA", "__mod_init_func" }, { "__DATA", "__objc_catlist" },
+		{ "__TEXT", "__objc_classlist" }, { "__TEXT", "" }, { "", "__text" }, { "__LINKEDIT", "" },
+	};
+	for (const auto& name : names) {
+		const Section* expected = scanByName(image, name[0], name[1]);
+		const Section* found = sectionOf(image, index.find(name[0], name[1]));
+		if ( found != expected )
+			testFailure(__FILE__, __LINE__, (std::string("find ") + name[0] + "," + name[1]).c_str());
+	}
+
+	// the first of duplicate names wins, as with a scan
+	const SectionIndex::Entry* classList = index.find("__DATA", "__objc_classlist");
+	CHECK(classList != NULL && classList->addr == 0x4040);
+	CHECK(classList != NULL && strncmp(((const Segment*)(image.bytes() + classList->segmentOffset))->segname, "__DATA", 16) == 0);
+	const SectionIndex::Entry* stubs = index.find("__TEXT", "__stubs");
+	CHECK(stubs != NULL && stubs->type == S_SYMBOL_STUBS);
+	// the type drops the attribute bits
+	const SectionIndex::Entry* code = index.find("__TEXT", "__text");
+	CHECK(code != NULL && code->type == S_REGULAR);
+	CHECK(code != NULL && strncmp(((const Segment*)(image.bytes() + code->segmentOffset))->segname, "__TEXT", 16) == 0);
+}
+
+static void testFindInteriorAddress()
+{
+	TestImage image(0x1000);
+	makeImage(image);
+	SectionIndex index;
+	indexSections(image, index);
+
+	// every address in and around the image, on both sides of each section boundary
+	for (uint64_t address = 0; address < 0xA000; address += 4) {
+		const Section* expected = scanByAddress(image, address);
+		const Section* found = sectionOf(image, index.findContaining(address));
+		if ( found != expected ) {
+			char what[64];
+			snprintf(what, sizeof(what), "findContaining(0x%llx)", (unsigned long long)address);
+			testFailure(__FILE__, __LINE__, what);
+		}
+	}
+
+	// findSection(): an interior pointer of the slid image, and its offset in the section
+	const uintptr_t slide = 0x10000000;
+	const uintptr_t interior = 0x4050 + slide;
+	const Section* sect = sectionOf(image, index.findContaining(interior - slide));
+	CHECK(sect != NULL && strncmp(sect->sectname, "__objc_classlist", 16) == 0);
+	CHECK(sect != NULL && (interior - slide) - sect->addr == 0x10);
+	CHECK(index.findContaining(0x4FFF) == NULL);
+	CHECK(index.findContaining(UINT64_MAX) == NULL);
+}
+
+static void testManySections()
+{
+	const uint32_t count = 400;
+	TestImage image(sizeof(TestImage::Header) + 4 * sizeof(Segment) + count * sizeof(Section));
+	for (uint32_t s = 0; s < 4; ++s) {
+		char segname[16];
+		snprintf(segname, sizeof(segname), "__SEG%u", s);
+		Segment* seg = image.addSegment(segname, s * 0x100000, 0x100000, 0, 0, VM_PROT_READ, count / 4);
+		// sections listed in descending address order
+		for (uint32_t i = 0; i < count / 4; ++i) {
+			char sectname[17];
+			snprintf(sectname, sizeof(sectname), "__sect%u", i);
+			setSection(seg, i, sectname, s * 0x100000 + (count / 4 - i) * 0x100, 0x80);
+		}
+	}
+	SectionIndex index;
+	indexSections(image, index);
+	CHECK(index.count() == count);
+	for (uint32_t s = 0; s < 4; ++s) {
+		for (uint32_t i = 0; i < count / 4; ++i) {
+			char segname[16], sectname[17];
+			snprintf(segname, sizeof(segname), "__SEG%u", s);
+			snprintf(sectname, sizeof(sectname), "__sect%u", i);
+			CHECK(sectionOf(image, index.find(segname, sectname)) == scanByName(image, segname, sectname));
+			const uint64_t address = s * 0x100000 + (count / 4 - i) * 0x100;
+			CHECK(sectionOf(image, index.findContaining(address + 0x7F)) == scanByName(image, segname, sectname));
+			CHECK(index.findContaining(address + 0x80) == NULL);
+		}
+	}
+
+	// refilling for another image starts from scratch
+	index.clear();
+	CHECK(!index.sealed() && index.count() == 0);
+	CHECK(index.find("__SEG0", "__sect0") == NULL);
+	CHECK(index.findContaining(0x100) == NULL);
+}
+
+int main()
+{
+	testFindByName();
+	testFindInteriorAddress();
+	testManySections();
+	return testResult();
+}
@@ -0,0 +1,185 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Shared by the tests and benchmarks: CHECK() records a failure and carries
+ * on so one run reports every broken expectation, TestImage writes a mach-o
+ * image for the host architecture into a buffer one load command at a time,
+ * and nanosecondsPer() times a loop.
+ */
+
+#ifndef __TEST_SUPPORT__
+#define __TEST_SUPPORT__
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <mach-o/loader.h>
+
+#define CHECK(condition) \
+	do { if ( !(condition) ) testFailure(__FILE__, __LINE__, #condition); } while (0)
+
+// Checks a NULL-or-reason result, printing the reason if there was one.
+#define CHECK_OK(reason) \
+	do { const char* _why = (reason); if ( _why != NULL ) testFailure(__FILE__, __LINE__, _why); } while (0)
+#define CHECK_FAILS(reason) \
+	do { if ( (reason) == NULL ) testFailure(__FILE__, __LINE__, "expected " #reason " to fail"); } while (0)
+// Checks that a NULL-or-reason result failed, and that the reason mentions `expected`.
+#define CHECK_REASON(reason, expected) \
+	do { const char* _why = (reason); \
+		 if ( (_why == NULL) || (strstr(_why, expected) == NULL) ) testReasonFailure(__FILE__, __LINE__, _why, expected); } while (0)
+
+inline unsigned& testFailureCount()
+{
+	static unsigned count = 0;
+	return count;
+}
+
+inline void testFailure(const char* file, int line, const char* what)
+{
+	fprintf(stderr, "%s:%d: FAILED: %s\n", file, line, what);
+	++testFailureCount();
+}
+
+inline void testReasonFailure(const char* file, int line, const char* reason, const char* expected)
+{
+	fprintf(stderr, "%s:%d: FAILED: expected \"%s\", got \"%s\"\n", file, line, expected, reason ? reason : "success");
+	++testFailureCount();
+}
+
+// What main() returns.
+inline int testResult()
+{
+	if ( testFailureCount() != 0 ) {
+		fprintf(stderr, "%u check(s) failed\n", testFailureCount());
+		return 1;
+	}
+	return 0;
+}
+
+template <typename Body>
+double nanosecondsPer(size_t iterations, Body body)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i)
+		body(i);
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / (double)iterations;
+}
+
+// Keeps the compiler from discarding a result that is only computed to be timed.
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Fills a fixed size segment or section name field, which has no terminator when the name fills it.
+template <size_t N>
+inline void setName(char (&field)[N], const char* name)
+{
+	memset(field, 0, N);
+	memcpy(field, name, strnlen(name, N));
+}
+
+class TestImage {
+public:
+#if __LP64__
+	typedef mach_header_64		Header;
+	typedef segment_command_64	Segment;
+	typedef section_64			Section;
+	enum { kSegmentCommand = LC_SEGMENT_64, kMagic = MH_MAGIC_64 };
+#else
+	typedef mach_header			Header;
+	typedef segment_command		Segment;
+	typedef section				Section;
+	enum { kSegmentCommand = LC_SEGMENT, kMagic = MH_MAGIC };
+#endif
+
+	explicit TestImage(size_t size, uint32_t fileType = MH_BUNDLE) : fBytes(size, 0), fNext(sizeof(Header))
+	{
+		Header* mh = header();
+		mh->magic		= kMagic;
+#if __x86_64__ || __i386__
+		mh->cputype		= __LP64__ ? CPU_TYPE_X86_64 : CPU_TYPE_I386;
+#else
+		mh->cputype		= __LP64__ ? CPU_TYPE_ARM64 : CPU_TYPE_ARM;
+#endif
+		mh->filetype	= fileType;
+	}
+
+	uint8_t*		bytes()			{ return fBytes.data(); }
+	const uint8_t*	bytes() const	{ return fBytes.data(); }
+	size_t			size() const	{ return fBytes.size(); }
+	Header*			header()		{ return (Header*)fBytes.data(); }
+	std::vector<uint8_t>&	buffer() { return fBytes; }
+
+	// Appends a zeroed load command of `size` bytes (rounded up to 8) and returns it.
+	template <typename Command>
+	Command* addCommand(uint32_t cmd, uint32_t size = sizeof(Command))
+	{
+		size = (size + 7) & ~7u;
+		load_command* lc = (load_command*)(fBytes.data() + fNext);
+		lc->cmd		= cmd;
+		lc->cmdsize	= size;
+		fNext += size;
+		header()->ncmds += 1;
+		header()->sizeofcmds += size;
+		return (Command*)lc;
+	}
+
+	Segment* addSegment(const char* name, uint64_t vmAddress, uint64_t vmSize, uint64_t fileOffset, uint64_t fileSize,
+						vm_prot_t protection, uint32_t sectionCount = 0)
+	{
+		Segment* seg = addCommand<Segment>(kSegmentCommand, sizeof(Segment) + sectionCount * sizeof(Section));
+		setName(seg->segname, name);
+		seg->vmaddr		= vmAddress;
+		seg->vmsize		= vmSize;
+		seg->fileoff	= fileOffset;
+		seg->filesize	= fileSize;
+		seg->maxprot	= protection;
+		seg->initprot	= protection;
+		seg->nsects		= sectionCount;
+		return seg;
+	}
+
+	static Section* section(Segment* seg, uint32_t index) { return (Section*)(seg + 1) + index; }
+
+	dylib_command* addDylib(const char* path, uint32_t cmd = LC_LOAD_DYLIB)
+	{
+		dylib_command* dylib = addCommand<dylib_command>(cmd, (uint32_t)(sizeof(dylib_command) + strlen(path) + 1));
+		dylib->dylib.name.offset = sizeof(dylib_command);
+		strcpy((char*)dylib + sizeof(dylib_command), path);
+		return dylib;
+	}
+
+private:
+	std::vector<uint8_t>	fBytes;
+	size_t					fNext;
+};
+
+#endif // __TEST_SUPPORT__
@@ -0,0 +1,193 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+/*
+ * The trace recorder and its Chrome JSON exporter: a ring keeps the last
+ * 2048 events of a thread, image names are truncated and escaped, clear()
+ * drops everything, ScopedTimer records only while tracing is on, and the
+ * buffers of exited threads are taken over by later ones instead of piling
+ * up.
+ */
+
+#include "Tracing.h"
+#include "TestSupport.h"
+
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace isolator;
+
+static std::string dumpToString()
+{
+	char path[] = "/tmp/TracingTest-XXXXXX";
+	const int fd = mkstemp(path);
+	CHECK(fd != -1);
+	if ( fd == -1 )
+		return std::string();
+	close(fd);
+	CHECK(tracing::dump(path));
+	std::string json;
+	if ( FILE* in = fopen(path, "r") ) {
+		char chunk[4096];
+		size_t size;
+		while ( (size = fread(chunk, 1, sizeof(chunk), in)) != 0 )
+			json.append(chunk, size);
+		fclose(in);
+	}
+	unlink(path);
+	return json;
+}
+
+// the numbers following every occurrence of key, in order
+static std::vector<unsigned long long> values(const std::string& json, const char* key)
+{
+	std::vector<unsigned long long> result;
+	for (size_t at = json.find(key); at != std::string::npos; at = json.find(key, at + 1))
+		result.push_back(strtoull(json.c_str() + at + strlen(key), NULL, 10));
+	return result;
+}
+
+static size_t occurrences(const std::string& json, const std::string& what)
+{
+	size_t count = 0;
+	for (size_t at = json.find(what); at != std::string::npos; at = json.find(what, at + 1))
+		++count;
+	return count;
+}
+
+static void testRingKeepsLatest()
+{
+	tracing::clear();
+	for (uint64_t i = 0; i < 3000; ++i)
+		tracing::record("rebase", "libRing.dylib", 1000 * i, 1000 * i + 500, i);
+	const std::string json = dumpToString();
+	CHECK(json.compare(0, 15, "{\"traceEvents\":") == 0);
+	CHECK(json.find("\"displayTimeUnit\":\"ns\"}") != std::string::npos);
+
+	const std::vector<unsigned long long> counts = values(json, "\"count\":");
+	CHECK(counts.size() == 2048);
+	bool inOrder = true;
+	for (size_t i = 0; i < counts.size(); ++i)
+		inOrder = inOrder && (counts[i] == 3000 - 2048 + i);
+	CHECK(inOrder);
+	CHECK(occurrences(json, "\"dur\":0.500,") == 2048);
+	CHECK(occurrences(json, "\"name\":\"rebase\"") == 2048);
+
+	tracing::clear();
+	CHECK(values(dumpToString(), "\"count\":").empty());
+}
+
+static void testImageNames()
+{
+	tracing::clear();
+	tracing::record("bind", "/a \"quoted\"\\path\n", 0, 1, 1);
+	tracing::record("bind", NULL, 0, 1, 2);
+	const std::string longName(100, 'x');
+	tracing::record("bind", longName.c_str(), 0, 1, 3);
+	// an end before the start is clamped to a zero duration
+	tracing::record("bind", "libClock.dylib", 10, 5, 4);
+	const std::string json = dumpToString();
+
+	CHECK(json.find("\"image\":\"/a \\\"quoted\\\"\\\\path\\u000a\"") != std::string::npos);
+	CHECK(json.find("\"image\":\"\",\"count\":2") != std::string::npos);
+	CHECK(json.find("\"image\":\"" + std::string(35, 'x') + "\",\"count\":3") != std::string::npos);
+	CHECK(json.find("\"dur\":0.000,") != std::string::npos);
+	tracing::clear();
+}
+
+static void testScopedTimer()
+{
+	tracing::clear();
+	tracing::setEnabled(false);
+	{
+		dyld3::ScopedTimer timer(DBG_DYLD_TIMING_BIND, 0, 0, 0, "libOff.dylib");
+		timer.setCounter(7);
+	}
+	CHECK(values(dumpToString(), "\"count\":").empty());
+
+	tracing::setEnabled(true);
+	{
+		dyld3::ScopedTimer timer(DBG_DYLD_TIMING_APPLY_FIXUPS, 0, 0, 0, "libOn.dylib");
+		timer.setCounter(42);
+	}
+	tracing::setEnabled(false);
+	const std::string json = dumpToString();
+	CHECK(json.find("\"name\":\"apply fixups\"") != std::string::npos);
+	CHECK(json.find("\"image\":\"libOn.dylib\",\"count\":42") != std::string::npos);
+	CHECK(json.find("libOff") == std::string::npos);
+	tracing::clear();
+}
+
+static void testExitedThreadsHandBuffersOn()
+{
+	tracing::clear();
+	tracing::record("map image", "main", 0, 1, 0);
+	const size_t before = tracing::threadBufferCount();
+
+	// one thread at a time: each takes over the buffer of the one before
+	for (unsigned i = 1; i <= 64; ++i) {
+		std::thread thread([i] { tracing::record("map image", "worker", i, i + 1, i); });
+		thread.join();
+	}
+	CHECK(tracing::threadBufferCount() <= before + 1);
+
+	// several at once need a buffer each, and no more
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> started(0);
+	for (unsigned i = 0; i < 4; ++i) {
+		threads.emplace_back([&started, i] {
+			tracing::record("bind", "concurrent", i, i + 1, 1000 + i);
+			++started;
+			while ( started.load() != 4 )
+				std::this_thread::yield();
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	CHECK(tracing::threadBufferCount() <= before + 4);
+
+	// the events of the exited threads are all still there, each under its own thread
+	const std::string json = dumpToString();
+	CHECK(values(json, "\"count\":").size() == 1 + 64 + 4);
+	std::set<unsigned long long> eventTids;
+	for (size_t at = json.find("\"ph\":\"X\""); at != std::string::npos; at = json.find("\"ph\":\"X\"", at + 1))
+		eventTids.insert(strtoull(json.c_str() + json.find("\"tid\":", at) + 6, NULL, 10));
+	CHECK(eventTids.size() == 1 + 64 + 4);
+	CHECK(occurrences(json, "\"name\":\"thread_name\"") == eventTids.size());
+	tracing::clear();
+}
+
+int main()
+{
+	testRingKeepsLatest();
+	testImageNames();
+	testScopedTimer();
+	testExitedThreadsHandBuffersOn();
+	return testResult();
+}
@@ -0,0 +1,157 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+
+/*
+ * WorkerPool runs every index of a range exactly once, rethrows the
+ * exception of the lowest chunk that threw (after running every chunk
+ * below it), runs a job inline when it is started from inside a job or
+ * while another thread holds the pool, and keeps the size the shared pool
+ * was created with.
+ */
+
+#include "WorkerPool.h"
+#include "TestSupport.h"
+
+using namespace isolator;
+
+static void testCoversRange()
+{
+	WorkerPool pool(4);
+	CHECK(pool.threadCount() == 4);
+	for (size_t count : { (size_t)1, (size_t)7, (size_t)1000, (size_t)4099 }) {
+		std::vector<std::atomic<unsigned>> hits(count);
+		pool.parallelFor(count, 16, [&](size_t begin, size_t end) {
+			for (size_t i=begin; i < end; ++i)
+				hits[i].fetch_add(1, std::memory_order_relaxed);
+		});
+		bool once = true;
+		for (size_t i=0; i < count; ++i)
+			once = once && (hits[i].load() == 1);
+		CHECK(once);
+	}
+
+	// a pool of one is the calling thread only
+	WorkerPool serial(1);
+	CHECK(serial.threadCount() == 1);
+	const std::thread::id caller = std::this_thread::get_id();
+	bool onCaller = true;
+	serial.parallelFor(100, 1, [&](size_t, size_t) { onCaller = onCaller && (std::this_thread::get_id() == caller); });
+	CHECK(onCaller);
+}
+
+static void testLowestThrowingChunk()
+{
+	WorkerPool pool(4);
+	const size_t grain = 8;
+	for (int round = 0; round < 200; ++round) {
+		// chunks 5, 9 and 30 throw; whichever worker gets there first, chunk 5 wins
+		std::vector<std::atomic<bool>> ran(64);
+		size_t thrown = SIZE_MAX;
+		try {
+			pool.parallelFor(ran.size() * grain, grain, [&](size_t begin, size_t) {
+				const size_t chunk = begin / grain;
+				ran[chunk].store(true);
+				if ( (chunk == 5) || (chunk == 9) || (chunk == 30) )
+					throw chunk;
+			});
+		}
+		catch (size_t chunk) {
+			thrown = chunk;
+		}
+		CHECK(thrown == 5);
+		// everything a serial loop would have run before the error did run
+		bool before = true;
+		for (size_t chunk=0; chunk <= 5; ++chunk)
+			before = before && ran[chunk].load();
+		CHECK(before);
+	}
+}
+
+static void testNestedRunsInline()
+{
+	WorkerPool pool(4);
+	std::atomic<unsigned> inner(0);
+	std::atomic<bool> onCaller(true);
+	pool.parallelFor(64, 1, [&](size_t, size_t) {
+		const std::thread::id outer = std::this_thread::get_id();
+		pool.parallelFor(32, 1, [&](size_t begin, size_t end) {
+			if ( std::this_thread::get_id() != outer )
+				onCaller.store(false);
+			inner.fetch_add((unsigned)(end - begin));
+		});
+	});
+	CHECK(onCaller.load());
+	CHECK(inner.load() == 64 * 32);
+}
+
+static void testBusyRunsInline()
+{
+	WorkerPool pool(4);
+	std::atomic<bool> started(false);
+	std::atomic<bool> otherDone(false);
+	std::thread holder([&] {
+		// holds the pool until the other caller is through
+		pool.parallelFor(8, 1, [&](size_t, size_t) {
+			started.store(true);
+			while ( !otherDone.load() )
+				std::this_thread::yield();
+		});
+	});
+	while ( !started.load() )
+		std::this_thread::yield();
+
+	const std::thread::id caller = std::this_thread::get_id();
+	bool onCaller = true;
+	size_t covered = 0;
+	pool.parallelFor(100, 1, [&](size_t begin, size_t end) {
+		onCaller = onCaller && (std::this_thread::get_id() == caller);
+		covered += end - begin;
+	});
+	otherDone.store(true);
+	holder.join();
+	CHECK(onCaller);
+	CHECK(covered == 100);
+}
+
+static void testShared()
+{
+	CHECK(WorkerPool::shared() == NULL);
+	WorkerPool* pool = WorkerPool::createShared(3);
+	CHECK((pool != NULL) && (WorkerPool::shared() == pool));
+	// the size is fixed by the first call
+	CHECK(WorkerPool::createShared(8) == pool);
+	CHECK(pool->threadCount() == 3);
+}
+
+int main()
+{
+	testCoversRange();
+	testLowestThrowingChunk();
+	testNestedRunsInline();
+	testBusyRunsInline();
+	testShared();
+	return testResult();
+}
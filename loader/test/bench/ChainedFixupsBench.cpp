@@ -0,0 +1,114 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Fixups per second of ChainedFixups::apply() for each pointer format, on
+ * a generated image whose pages are packed with chains: every pointer slot
+ * is an entry, one in four a bind. The image is restored from a pristine
+ * copy before each run, outside the timing, and the best run is reported,
+ * first on the calling thread and then on a WorkerPool.
+ *
+ *	ChainedFixupsBench [pages] [threads]
+ */
+
+#include "ChainedFixups.h"
+#include "ChainedImage.h"
+#include "TestSupport.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace isolator;
+
+static const uintptr_t kTargets[] = { 0x10000000, 0x20000000, 0x30000000 };
+static const int kRuns = 10;
+
+static const char* formatName(uint16_t format)
+{
+	switch ( format ) {
+		case DYLD_CHAINED_PTR_ARM64E:				return "ARM64E";
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND:		return "ARM64E_USERLAND";
+		case DYLD_CHAINED_PTR_ARM64E_USERLAND24:	return "ARM64E_USERLAND24";
+		case DYLD_CHAINED_PTR_64:					return "64";
+		case DYLD_CHAINED_PTR_64_OFFSET:			return "64_OFFSET";
+		case DYLD_CHAINED_PTR_32:					return "32";
+	}
+	return "?";
+}
+
+// Best fixups per second of `kRuns` applications to a fresh copy of the image.
+static double fixupsPerSecond(const ChainedFixups& fixups, const std::vector<uint8_t>& pristine, std::vector<uint8_t>& image,
+							  WorkerPool* pool)
+{
+	double best = 0;
+	for (int run = 0; run < kRuns; ++run) {
+		image = pristine;
+		ChainedFixupStats stats = { 0, 0, 0 };
+		const char* why = NULL;
+		const double ns = nanosecondsPer(1, [&](size_t) {
+			why = fixups.apply(image.data(), image.size(), 0x4000, kTargets, 3, pool, &stats);
+		});
+		CHECK_OK(why);
+		best = std::max(best, (double)(stats.rebases + stats.binds) * 1e9 / ns);
+	}
+	return best;
+}
+
+int main(int argc, const char* argv[])
+{
+	const uint32_t pageCount = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 2000;
+	const unsigned threads = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : WorkerPool::defaultThreadCount();
+	WorkerPool pool(threads);
+
+	printf("%u pages of 16 KB, %u threads\n", pageCount, pool.threadCount());
+	printf("%-18s %10s %14s %14s\n", "format", "fixups", "serial M/s", "pool M/s");
+	const uint16_t formats[] = { DYLD_CHAINED_PTR_ARM64E, DYLD_CHAINED_PTR_ARM64E_USERLAND, DYLD_CHAINED_PTR_ARM64E_USERLAND24,
+								 DYLD_CHAINED_PTR_64, DYLD_CHAINED_PTR_64_OFFSET, DYLD_CHAINED_PTR_32 };
+	for (uint16_t format : formats) {
+		ChainedImage builder(format, pageCount);
+		builder.addImport("_a", 1);
+		builder.addImport("_b", 1);
+		builder.addImport("_c", 2);
+		// 32-bit rebases above this would be plain values, not pointers
+		builder.setMaxValidPointer(0x00200000);
+		const uint32_t entrySize = (uint32_t)builder.entrySize();
+		size_t fixupCount = 0;
+		for (uint32_t page = 0; page < pageCount; ++page) {
+			for (uint32_t offset = 0; offset + entrySize <= 0x4000; offset += entrySize, ++fixupCount)
+				builder.add(page, offset, (fixupCount % 4 == 1) ? builder.bind(fixupCount % 3) : builder.rebase(0x1000 + offset));
+		}
+		const std::vector<uint8_t> payload = builder.build();
+		CHECK_OK(ChainedFixups::validate(payload.data(), payload.size(), builder.size()));
+		const ChainedFixups fixups(payload.data());
+
+		const std::vector<uint8_t> pristine = builder.image();
+		std::vector<uint8_t> image;
+		const double serial = fixupsPerSecond(fixups, pristine, image, NULL);
+		const double pooled = fixupsPerSecond(fixups, pristine, image, &pool);
+		printf("%-18s %10zu %14.1f %14.1f\n", formatName(format), fixupCount, serial / 1e6, pooled / 1e6);
+	}
+	return testResult();
+}
@@ -0,0 +1,286 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Looking exports up by descending the trie, as ImageLoader::trieWalk()
+ * does, against ExportIndex, on synthetic tries of 1k to 1M symbols. The
+ * tries are laid out the way ld64 writes them: prefix compressed edges,
+ * ULEB128 node offsets, nodes in depth first order. Names share long
+ * prefixes, like the mangled names of generated kernels do.
+ *
+ * Every name is looked up once in shuffled order, then as many names that
+ * are not exported. The index build time is what the first lookup in an
+ * image pays (or its load, with CUSTOM_DL_EAGER_EXPORT_INDEX).
+ *
+ *	ExportIndexBench [max symbols]
+ */
+
+#include "ExportIndex.h"
+#include "TestSupport.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using namespace isolator;
+
+static void appendULEB128(std::vector<uint8_t>& out, uint64_t value)
+{
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		if ( value != 0 )
+			byte |= 0x80;
+		out.push_back(byte);
+	} while ( value != 0 );
+}
+
+static size_t sizeOfULEB128(uint64_t value)
+{
+	size_t size = 1;
+	while ( value >>= 7 )
+		++size;
+	return size;
+}
+
+static uint64_t readULEB128(const uint8_t*& p, const uint8_t* end)
+{
+	uint64_t result = 0;
+	int bit = 0;
+	do {
+		if ( p == end )
+			return 0;
+		result |= (uint64_t)(*p & 0x7F) << bit;
+		bit += 7;
+	} while ( *p++ & 0x80 );
+	return result;
+}
+
+class TrieBuilder {
+public:
+	// names must be sorted and unique
+	std::vector<uint8_t> build(const std::vector<std::string>& names)
+	{
+		fNodes.clear();
+		addNode(names, 0, names.size(), 0);
+
+		// node offsets are ULEB128 encoded, so lay out until no offset changes size
+		bool moved = true;
+		while ( moved ) {
+			moved = false;
+			uint32_t offset = 0;
+			for (Node& node : fNodes) {
+				if ( node.offset != offset )
+					moved = true;
+				node.offset = offset;
+				offset += nodeSize(node);
+			}
+		}
+
+		std::vector<uint8_t> trie;
+		for (const Node& node : fNodes) {
+			if ( node.terminal ) {
+				std::vector<uint8_t> payload;
+				appendULEB128(payload, EXPORT_SYMBOL_FLAGS_KIND_REGULAR);
+				appendULEB128(payload, node.address);
+				appendULEB128(trie, payload.size());
+				trie.insert(trie.end(), payload.begin(), payload.end());
+			}
+			else {
+				trie.push_back(0);
+			}
+			trie.push_back((uint8_t)node.children.size());
+			for (const Edge& edge : node.children) {
+				trie.insert(trie.end(), edge.label.begin(), edge.label.end());
+				trie.push_back(0);
+				appendULEB128(trie, fNodes[edge.node].offset);
+			}
+		}
+		return trie;
+	}
+
+private:
+	struct Edge {
+		std::string		label;
+		size_t			node;
+	};
+	struct Node {
+		bool				terminal;
+		uint64_t			address;
+		std::vector<Edge>	children;
+		uint32_t			offset;
+	};
+
+	// node for names[begin, end), which all share their first `depth` characters
+	size_t addNode(const std::vector<std::string>& names, size_t begin, size_t end, size_t depth)
+	{
+		const size_t index = fNodes.size();
+		fNodes.push_back(Node());
+		fNodes[index].terminal = (begin < end) && (names[begin].size() == depth);
+		fNodes[index].address = 0x1000 + 16 * begin;
+		fNodes[index].offset = 0;
+		if ( fNodes[index].terminal )
+			++begin;
+		while ( begin < end ) {
+			// names starting with the same next character go down one edge, as long as they agree
+			size_t last = begin;
+			while ( (last + 1 < end) && (names[last + 1][depth] == names[begin][depth]) )
+				++last;
+			size_t common = depth + 1;
+			while ( (common < names[begin].size()) && (common < names[last].size()) && (names[begin][common] == names[last][common]) )
+				++common;
+			Edge edge = { names[begin].substr(depth, common - depth), 0 };
+			edge.node = addNode(names, begin, last + 1, common);
+			fNodes[index].children.push_back(edge);
+			begin = last + 1;
+		}
+		return index;
+	}
+
+	size_t nodeSize(const Node& node) const
+	{
+		size_t size = 1;
+		if ( node.terminal ) {
+			const size_t payload = sizeOfULEB128(EXPORT_SYMBOL_FLAGS_KIND_REGULAR) + sizeOfULEB128(node.address);
+			size = sizeOfULEB128(payload) + payload;
+		}
+		size += 1;
+		for (const Edge& edge : node.children)
+			size += edge.label.size() + 1 + sizeOfULEB128(fNodes[edge.node].offset);
+		return size;
+	}
+
+	std::vector<Node>	fNodes;
+};
+
+// ImageLoader::trieWalk(), without the logging
+static const uint8_t* trieWalk(const uint8_t* start, const uint8_t* end, const char* s)
+{
+	const uint8_t* p = start;
+	while ( p != NULL ) {
+		uintptr_t terminalSize = *p++;
+		if ( terminalSize > 127 ) {
+			--p;
+			terminalSize = readULEB128(p, end);
+		}
+		if ( (*s == '\0') && (terminalSize != 0) )
+			return p;
+		const uint8_t* children = p + terminalSize;
+		if ( children > end )
+			return NULL;
+		uint8_t childrenRemaining = *children++;
+		p = children;
+		uintptr_t nodeOffset = 0;
+		for (; childrenRemaining > 0; --childrenRemaining) {
+			const char* ss = s;
+			bool wrongEdge = false;
+			char c = *p;
+			while ( c != '\0' ) {
+				if ( !wrongEdge ) {
+					if ( c != *ss )
+						wrongEdge = true;
+					++ss;
+				}
+				++p;
+				c = *p;
+			}
+			if ( wrongEdge ) {
+				++p;
+				while ( (*p & 0x80) != 0 )
+					++p;
+				++p;
+				if ( p > end )
+					return NULL;
+			}
+			else {
+				++p;
+				nodeOffset = readULEB128(p, end);
+				if ( (nodeOffset == 0) || (&start[nodeOffset] > end) )
+					return NULL;
+				s = ss;
+				break;
+			}
+		}
+		p = (nodeOffset != 0) ? &start[nodeOffset] : NULL;
+	}
+	return NULL;
+}
+
+static std::vector<std::string> makeNames(size_t count, std::mt19937& random)
+{
+	static const char* const kNamespaces[] = { "_ZN5tflite3ops7builtin", "_ZN3tvm7runtime", "_ZN4mlir6detail", "_kernel_", "_OBJC_CLASS_$_" };
+	static const char* const kWords[] = { "conv2d", "depthwise", "matmul", "reduce", "softmax", "pool", "relu", "quantize", "fused", "batch", "norm", "gather" };
+	std::vector<std::string> names;
+	names.reserve(count);
+	while ( names.size() < count ) {
+		std::string name = kNamespaces[random() % 5];
+		for (int words = 1 + random() % 3; words > 0; --words) {
+			const char* word = kWords[random() % 12];
+			name += std::to_string(strlen(word)) + word;
+		}
+		name += "_v" + std::to_string(names.size());
+		names.push_back(name);
+	}
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+int main(int argc, const char* argv[])
+{
+	const size_t maxSymbols = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+	std::mt19937 random(42);
+
+	printf("%9s %10s  %10s %10s  %10s %10s  %10s\n", "symbols", "trie KB", "walk ns", "index ns", "walk miss", "index miss", "build ms");
+	for (size_t count = 1000; count <= maxSymbols; count *= 10) {
+		std::vector<std::string> names = makeNames(count, random);
+		TrieBuilder builder;
+		const std::vector<uint8_t> trie = builder.build(names);
+		const uint8_t* start = trie.data();
+		const uint8_t* end = start + trie.size();
+
+		ExportIndex index;
+		const double buildNs = nanosecondsPer(1, [&](size_t) { CHECK(index.build(start, end)); });
+		CHECK(index.count() == count);
+
+		std::shuffle(names.begin(), names.end(), random);
+		std::vector<std::string> missing;
+		for (const std::string& name : names)
+			missing.push_back(name.substr(0, name.size() - 1) + "#");
+		for (size_t i = 0; i < count; i += 97) {
+			const uint8_t* terminal = trieWalk(start, end, names[i].c_str());
+			CHECK(terminal != NULL && index.find(start, names[i].c_str()) == terminal);
+			CHECK(trieWalk(start, end, missing[i].c_str()) == NULL && index.find(start, missing[i].c_str()) == NULL);
+		}
+
+		const double walkNs = nanosecondsPer(count, [&](size_t i) { doNotOptimize(trieWalk(start, end, names[i].c_str())); });
+		const double indexNs = nanosecondsPer(count, [&](size_t i) { doNotOptimize(index.find(start, names[i].c_str())); });
+		const double walkMissNs = nanosecondsPer(count, [&](size_t i) { doNotOptimize(trieWalk(start, end, missing[i].c_str())); });
+		const double indexMissNs = nanosecondsPer(count, [&](size_t i) { doNotOptimize(index.find(start, missing[i].c_str())); });
+		printf("%9zu %10zu  %10.1f %10.1f  %10.1f %10.1f  %10.2f\n", count, trie.size() / 1024, walkNs, indexNs,
+			   walkMissNs, indexMissNs, buildNs / 1e6);
+	}
+	return testResult();
+}
@@ -0,0 +1,190 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * custom_dlopen() reading a file into a std::vector and copying every
+ * segment out of it, against mapping the file with MappedFile and mapping
+ * its read-only __LINKEDIT straight from the descriptor. Synthetic images
+ * of growing size are written to a temporary directory; each load reserves
+ * the image's range, brings the segments in with placeSegment() as
+ * ImageLoaderMachO::mapSegments() does, reads the __LINKEDIT bytes and
+ * writes one pointer per __DATA page the way fixups would.
+ *
+ * Off Mach the segments placeSegment() leaves to vm_copy() are copied with
+ * copySegment() on both paths, so the mapped path is measured at its most
+ * expensive.
+ *
+ *	MappedFileBench [iterations]
+ */
+
+#include "MachOLayout.h"
+#include "MappedFile.h"
+#include "SegmentCopy.h"
+#include "TestSupport.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace isolator;
+
+static const size_t kPage = 4096;
+
+struct Loaded {
+	uint8_t*	base;
+	size_t		size;
+	uint64_t	bytesCopied;
+};
+
+static std::vector<uint8_t> makeImage(size_t textSize, size_t dataSize, size_t linkeditSize)
+{
+	const size_t total = textSize + dataSize + linkeditSize;
+	TestImage image(total, MH_DYLIB);
+	image.addSegment("__TEXT", 0, textSize, 0, textSize, VM_PROT_READ | VM_PROT_EXECUTE);
+	image.addSegment("__DATA", textSize, dataSize, textSize, dataSize, VM_PROT_READ | VM_PROT_WRITE);
+	image.addSegment("__LINKEDIT", textSize + dataSize, linkeditSize, textSize + dataSize, linkeditSize, VM_PROT_READ);
+	image.addDylib("/tmp/libbench.dylib", LC_ID_DYLIB);
+	image.addCommand<dyld_info_command>(LC_DYLD_INFO_ONLY);
+	image.addCommand<dysymtab_command>(LC_DYSYMTAB);
+	for (size_t i = image.header()->sizeofcmds + sizeof(TestImage::Header); i < total; ++i)
+		image.bytes()[i] = (uint8_t)(i * 131);
+	return image.buffer();
+}
+
+static uint8_t* reserve(const MachOLayout& layout)
+{
+	void* base = mmap(NULL, layout.vmEnd - layout.vmStart, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( base == MAP_FAILED ) {
+		perror("mmap");
+		exit(1);
+	}
+	return (uint8_t*)base;
+}
+
+// What the loader does with the image once it is in place: read the fixup streams, write the fixups.
+static uint64_t link(const MachOLayout& layout, uint8_t* base)
+{
+	uint64_t sum = 0;
+	for (uint32_t i = 0; i < layout.segmentCount; ++i) {
+		const TestImage::Segment* seg = layout.segment(i);
+		uint8_t* start = base + seg->vmaddr - layout.vmStart;
+		if ( seg->initprot & VM_PROT_WRITE ) {
+			for (uint64_t offset = 0; offset < seg->vmsize; offset += kPage)
+				*(uintptr_t*)(start + offset) += 0x1000;
+		}
+		else if ( strcmp(seg->segname, "__LINKEDIT") == 0 ) {
+			for (uint64_t offset = 0; offset < seg->vmsize; offset += 64)
+				sum += start[offset];
+		}
+	}
+	return sum;
+}
+
+// Brings the segments of the image at src (a mapping of fd, or -1) into a fresh range and links it.
+static Loaded load(const void* src, size_t length, int fd)
+{
+	MachOLayout layout;
+	CHECK_OK(MachOLayout::validate(src, length, &layout));
+	Loaded loaded = { reserve(layout), (size_t)(layout.vmEnd - layout.vmStart), 0 };
+	for (uint32_t i = 0; i < layout.segmentCount; ++i) {
+		const TestImage::Segment* seg = layout.segment(i);
+		uint8_t* dst = loaded.base + seg->vmaddr - layout.vmStart;
+		const uint8_t* from = (const uint8_t*)src + seg->fileoff;
+		SegmentPlacement placed = placeSegment(dst, from, seg->filesize, kPage, (seg->initprot & VM_PROT_WRITE) != 0,
+											   (seg->initprot & VM_PROT_EXECUTE) != 0, fd, seg->fileoff);
+		if ( placed.error != 0 ) {
+			fprintf(stderr, "mmap: %s\n", strerror(placed.error));
+			exit(1);
+		}
+		if ( placed.strategy == kSegmentCopyRemap )
+			placed.written = copySegment(dst, from, seg->filesize, kPage, false);
+		loaded.bytesCopied += placed.written;
+	}
+	doNotOptimize(link(layout, loaded.base));
+	return loaded;
+}
+
+static Loaded loadRead(const char* path)
+{
+	// what custom_dlopen() did before MappedFile
+	std::fstream file(path, std::ios::in | std::ios::binary);
+	file.seekg(0, std::ios::end);
+	const std::streamsize size = file.tellg();
+	file.seekg(0, std::ios::beg);
+	std::vector<char> buffer(size);
+	file.read(buffer.data(), size);
+	return load(buffer.data(), buffer.size(), -1);
+}
+
+static Loaded loadMapped(const char* path)
+{
+	MappedFile file;
+	if ( int err = file.map(path) ) {
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		exit(1);
+	}
+	return load(file.address(), file.length(), file.fd());
+}
+
+int main(int argc, const char* argv[])
+{
+	const size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20;
+
+	char directory[] = "/tmp/MappedFileBench.XXXXXX";
+	if ( mkdtemp(directory) == NULL ) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	printf("%10s  %12s %12s  %14s %14s\n", "image", "read us", "mapped us", "read copied", "mapped copied");
+	for (size_t size = 64 * 1024; size <= 64 * 1024 * 1024; size *= 4) {
+		// roughly the proportions of a compiled module: mostly code, little data, a large __LINKEDIT
+		const size_t text = (size / 2) & ~(kPage - 1);
+		const size_t data = (size / 8) & ~(kPage - 1);
+		const size_t linkedit = size - text - data;
+		const std::string path = std::string(directory) + "/image.dylib";
+		const std::vector<uint8_t> image = makeImage(text, data, linkedit);
+		std::ofstream(path, std::ios::binary).write((const char*)image.data(), image.size());
+
+		uint64_t readCopied = 0, mappedCopied = 0;
+		const double readNs = nanosecondsPer(iterations, [&](size_t) {
+			Loaded loaded = loadRead(path.c_str());
+			readCopied = loaded.bytesCopied;
+			munmap(loaded.base, loaded.size);
+		});
+		const double mappedNs = nanosecondsPer(iterations, [&](size_t) {
+			Loaded loaded = loadMapped(path.c_str());
+			mappedCopied = loaded.bytesCopied;
+			munmap(loaded.base, loaded.size);
+		});
+		printf("%8zuKB  %12.1f %12.1f  %14llu %14llu\n", size / 1024, readNs / 1000, mappedNs / 1000,
+			   (unsigned long long)readCopied, (unsigned long long)mappedCopied);
+		unlink(path.c_str());
+	}
+	rmdir(directory);
+	return testResult();
+}
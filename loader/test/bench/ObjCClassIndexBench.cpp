@@ -0,0 +1,105 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Registering the classes of one image in a process that already has many:
+ * objc_classIsRegistered() copying and scanning the whole class list for
+ * every class, against ClassIndex. Both run against FakeObjCRuntime, whose
+ * class list copy costs what objc_getClassList()'s does, one pointer per
+ * registered class. The index is seeded once per process, that cost is
+ * shown on its own.
+ *
+ *	ObjCClassIndexBench [iterations]
+ */
+
+#include "ObjCClassIndex.h"
+#include "FakeObjCRuntime.h"
+#include "TestSupport.h"
+
+#include <cstdlib>
+
+using namespace mull::objc;
+
+// objc_classIsRegistered() before ClassIndex
+static bool scanClassList(RuntimeInterface& runtime, const void* cls)
+{
+	int count = runtime.copyClassList(NULL, 0);
+	const void** classes = (const void**)malloc(sizeof(const void*) * count);
+	count = runtime.copyClassList(classes, count);
+	bool found = false;
+	for (int i = 0; i < count && !found; ++i)
+		found = (classes[i] == cls);
+	free(classes);
+	return found;
+}
+
+// Registers imageClasses new classes in a process that has processClasses, returns the nanoseconds it took.
+template <typename Register>
+static double registerImage(size_t processClasses, size_t imageClasses, size_t iterations, Register registerClass)
+{
+	double total = 0;
+	for (size_t n = 0; n < iterations; ++n) {
+		FakeObjCRuntime runtime(processClasses);
+		ClassIndex index(runtime);
+		// seeded once per process, not per image
+		index.size();
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < imageClasses; ++i)
+			registerClass(runtime, index, FakeObjCRuntime::unregistered(i));
+		total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+	return total / (double)iterations;
+}
+
+int main(int argc, const char* argv[])
+{
+	const size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 3;
+
+	printf("%10s %8s  %12s %12s %12s\n", "process", "image", "scan us", "index us", "seed us");
+	for (size_t processClasses : { 1000, 10000, 50000 }) {
+		for (size_t imageClasses : { 100, 1000 }) {
+			const double scanNs = registerImage(processClasses, imageClasses, iterations,
+												[](FakeObjCRuntime& runtime, ClassIndex&, const void* cls) {
+				if ( scanClassList(runtime, cls) )
+					abort();
+				runtime.classes.push_back(cls);
+			});
+			const double indexNs = registerImage(processClasses, imageClasses, iterations,
+												 [](FakeObjCRuntime& runtime, ClassIndex& index, const void* cls) {
+				if ( index.contains(cls) )
+					abort();
+				runtime.classes.push_back(cls);
+				index.insert(cls);
+			});
+			FakeObjCRuntime runtime(processClasses);
+			const double seedNs = nanosecondsPer(iterations, [&](size_t) {
+				ClassIndex index(runtime);
+				doNotOptimize(index.size());
+			});
+			printf("%10zu %8zu  %12.1f %12.1f %12.1f\n", processClasses, imageClasses, scanNs / 1000, indexNs / 1000, seedNs / 1000);
+		}
+	}
+	return testResult();
+}
@@ -0,0 +1,186 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Fixing up __objc_classrefs and __objc_superrefs of a generated bundle
+ * with 10k classes. Before ClassRefMap, a superref was found by scanning
+ * the image's classes, then its metaclasses, and then looked up by name,
+ * and a classref was always looked up by name. The runtime's name lookup
+ * is modelled by a hash table of names, as objc_getClass() has.
+ *
+ *	ObjCClassRefsBench [classes] [iterations]
+ */
+
+#include "ObjCClassRefMap.h"
+#include "TestSupport.h"
+
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using namespace mull::objc;
+
+struct FakeClass {
+	const char*		name;
+	FakeClass*		isa;
+	bool			metaclass;
+};
+
+struct Bundle {
+	std::vector<std::string>	names;
+	std::vector<FakeClass>		classes;			// as in the image
+	std::vector<FakeClass>		metaclasses;
+	std::vector<FakeClass>		runtimeClasses;		// as registered
+	std::vector<FakeClass>		runtimeMetaclasses;
+	std::vector<const void*>	classRefs;			// __objc_classrefs
+	std::vector<const void*>	superRefs;			// __objc_superrefs, classes and metaclasses
+};
+
+struct NameHash {
+	size_t operator()(const char* name) const
+	{
+		size_t hash = (size_t)14695981039346656037ULL;
+		for (; *name; name++)
+			hash = (hash ^ (unsigned char)*name) * (size_t)1099511628211ULL;
+		return hash;
+	}
+};
+
+struct NameEqual {
+	bool operator()(const char* a, const char* b) const { return strcmp(a, b) == 0; }
+};
+
+// objc_getClass() and objc_getMetaClass()
+struct FakeNameLookup {
+	std::unordered_map<const char*, const void*, NameHash, NameEqual>	classes;
+	std::unordered_map<const char*, const void*, NameHash, NameEqual>	metaclasses;
+};
+
+static void makeBundle(size_t count, Bundle& bundle, FakeNameLookup& runtime)
+{
+	bundle.names.resize(count);
+	bundle.classes.resize(count);
+	bundle.metaclasses.resize(count);
+	bundle.runtimeClasses.resize(count);
+	bundle.runtimeMetaclasses.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		bundle.names[i] = "GeneratedClass" + std::to_string(i);
+		const char* name = bundle.names[i].c_str();
+		bundle.metaclasses[i] = { name, NULL, true };
+		bundle.classes[i] = { name, &bundle.metaclasses[i], false };
+		bundle.runtimeMetaclasses[i] = { name, NULL, true };
+		bundle.runtimeClasses[i] = { name, &bundle.runtimeMetaclasses[i], false };
+		runtime.classes[name] = &bundle.runtimeClasses[i];
+		runtime.metaclasses[name] = &bundle.runtimeMetaclasses[i];
+	}
+	std::mt19937 random(42);
+	for (size_t i = 0; i < count; ++i) {
+		bundle.classRefs.push_back(&bundle.classes[random() % count]);
+		// [super ...] in instance methods refers to the class, in class methods to the metaclass
+		const size_t target = random() % count;
+		bundle.superRefs.push_back((random() % 3 == 0) ? (const void*)&bundle.metaclasses[target] : (const void*)&bundle.classes[target]);
+	}
+}
+
+// addClassesFromSuperclassRefsSection() before ClassRefMap
+static const void* linearSuperRef(const Bundle& bundle, const FakeNameLookup& runtime, const void* ref)
+{
+	const FakeClass* found = NULL;
+	bool metaclass = false;
+	for (const FakeClass& cls : bundle.classes) {
+		if ( &cls == ref ) {
+			found = &cls;
+			break;
+		}
+	}
+	if ( found == NULL ) {
+		for (const FakeClass& cls : bundle.metaclasses) {
+			if ( &cls == ref ) {
+				found = &cls;
+				metaclass = true;
+				break;
+			}
+		}
+	}
+	if ( found == NULL )
+		return ref;
+	return metaclass ? runtime.metaclasses.at(found->name) : runtime.classes.at(found->name);
+}
+
+// addClassesFromClassRefsSection() before ClassRefMap
+static const void* namedClassRef(const FakeNameLookup& runtime, const void* ref)
+{
+	return runtime.classes.at(((const FakeClass*)ref)->name);
+}
+
+int main(int argc, const char* argv[])
+{
+	const size_t count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000;
+	const size_t iterations = (argc > 2) ? strtoul(argv[2], NULL, 0) : 3;
+
+	Bundle bundle;
+	FakeNameLookup runtime;
+	makeBundle(count, bundle, runtime);
+
+	ClassRefMap map;
+	map.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		map.add(&bundle.classes[i], &bundle.runtimeClasses[i], &bundle.metaclasses[i], &bundle.runtimeMetaclasses[i]);
+
+	for (size_t i = 0; i < count; ++i) {
+		CHECK(map.find(bundle.superRefs[i]) == linearSuperRef(bundle, runtime, bundle.superRefs[i]));
+		CHECK(map.find(bundle.classRefs[i]) == namedClassRef(runtime, bundle.classRefs[i]));
+	}
+	CHECK(map.find(&runtime) == NULL);
+
+	std::vector<const void*> fixedUp(count);
+	const double linearSuperNs = nanosecondsPer(iterations, [&](size_t) {
+		for (size_t i = 0; i < count; ++i)
+			fixedUp[i] = linearSuperRef(bundle, runtime, bundle.superRefs[i]);
+		doNotOptimize(fixedUp[0]);
+	});
+	const double mapSuperNs = nanosecondsPer(iterations, [&](size_t) {
+		for (size_t i = 0; i < count; ++i)
+			fixedUp[i] = map.find(bundle.superRefs[i]);
+		doNotOptimize(fixedUp[0]);
+	});
+	const double namedClassNs = nanosecondsPer(iterations, [&](size_t) {
+		for (size_t i = 0; i < count; ++i)
+			fixedUp[i] = namedClassRef(runtime, bundle.classRefs[i]);
+		doNotOptimize(fixedUp[0]);
+	});
+	const double mapClassNs = nanosecondsPer(iterations, [&](size_t) {
+		for (size_t i = 0; i < count; ++i)
+			fixedUp[i] = map.find(bundle.classRefs[i]);
+		doNotOptimize(fixedUp[0]);
+	});
+
+	printf("%zu classes, %zu refs in each section\n", count, count);
+	printf("%-16s %14s %14s\n", "", "before us", "ClassRefMap us");
+	printf("%-16s %14.1f %14.1f\n", "__objc_superrefs", linearSuperNs / 1000, mapSuperNs / 1000);
+	printf("%-16s %14.1f %14.1f\n", "__objc_classrefs", namedClassNs / 1000, mapClassNs / 1000);
+	return testResult();
+}
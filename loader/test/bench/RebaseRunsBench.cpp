@@ -0,0 +1,306 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * Applying the rebase opcodes of an 8 MB __DATA segment: the interpreter
+ * ImageLoaderMachOCompressed::rebase() had, which bounds checks and slides
+ * one slot at a time, against decoding into a RebaseSlider as it does now.
+ * Both decoders are copies of the loader's, minus logging and link plans.
+ *
+ * The opcode streams are generated the way ld64 writes them for three kinds
+ * of data: pointer tables (REBASE_OPCODE_DO_REBASE_ULEB_TIMES), arrays of
+ * structs with one pointer field, which come out as one
+ * REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB per element, and pointers scattered
+ * at random gaps.
+ *
+ *	RebaseRunsBench [runs]
+ */
+
+#include "RebaseRuns.h"
+#include "TestSupport.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+using namespace isolator;
+
+static const size_t kSegmentSize = 8 << 20;
+
+struct Segment {
+	uintptr_t		start;
+	uintptr_t		end;
+};
+
+static void appendULEB128(std::vector<uint8_t>& out, uint64_t value)
+{
+	do {
+		uint8_t byte = value & 0x7F;
+		value >>= 7;
+		if ( value != 0 )
+			byte |= 0x80;
+		out.push_back(byte);
+	} while ( value != 0 );
+}
+
+static uint64_t readULEB128(const uint8_t*& p, const uint8_t* end)
+{
+	uint64_t result = 0;
+	int bit = 0;
+	do {
+		if ( p == end )
+			throw "malformed uleb128";
+		result |= (uint64_t)(*p & 0x7F) << bit;
+		bit += 7;
+	} while ( *p++ & 0x80 );
+	return result;
+}
+
+static void rebaseAt(uintptr_t address, uintptr_t slide, uint8_t type)
+{
+	switch ( type ) {
+		case REBASE_TYPE_POINTER:
+		case REBASE_TYPE_TEXT_ABSOLUTE32:
+			*(uintptr_t*)address += slide;
+			break;
+		default:
+			throw "bad rebase type";
+	}
+}
+
+// ImageLoaderMachOCompressed::rebase() before RebaseSlider
+static size_t interpret(const std::vector<uint8_t>& opcodes, const Segment& segment, uintptr_t slide)
+{
+	const uint8_t* p = opcodes.data();
+	const uint8_t* const end = p + opcodes.size();
+	uintptr_t address = segment.start;
+	uint8_t type = 0;
+	size_t pointers = 0;
+	auto checkedRebase = [&]() {
+		if ( (address < segment.start) || (address >= segment.end) )
+			throw "bad rebase address";
+		rebaseAt(address, slide, type);
+		++pointers;
+	};
+	bool done = false;
+	while ( !done && (p < end) ) {
+		const uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
+		const uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		++p;
+		switch ( opcode ) {
+			case REBASE_OPCODE_DONE:
+				done = true;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				address = segment.start + readULEB128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				address += readULEB128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				address += immediate * sizeof(uintptr_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+				for (int i = 0; i < immediate; ++i) {
+					checkedRebase();
+					address += sizeof(uintptr_t);
+				}
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES: {
+				const uint64_t count = readULEB128(p, end);
+				for (uint64_t i = 0; i < count; ++i) {
+					checkedRebase();
+					address += sizeof(uintptr_t);
+				}
+				break;
+			}
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				checkedRebase();
+				address += readULEB128(p, end) + sizeof(uintptr_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB: {
+				const uint64_t count = readULEB128(p, end);
+				const uint64_t skip = readULEB128(p, end);
+				for (uint64_t i = 0; i < count; ++i) {
+					checkedRebase();
+					address += skip + sizeof(uintptr_t);
+				}
+				break;
+			}
+			default:
+				throw "bad rebase opcode";
+		}
+	}
+	return pointers;
+}
+
+// ImageLoaderMachOCompressed::rebase() now
+static size_t decodeRuns(const std::vector<uint8_t>& opcodes, const Segment& segment, uintptr_t slide, size_t* runCount)
+{
+	const uint8_t* p = opcodes.data();
+	const uint8_t* const end = p + opcodes.size();
+	RebaseSlider slider(slide);
+	uintptr_t address = segment.start;
+	uint8_t type = 0;
+	auto addRun = [&](uintptr_t count, uintptr_t stride) {
+		if ( count == 0 )
+			return;
+		if ( (address < segment.start) || (address >= segment.end) )
+			throw "bad rebase address";
+		if ( (count > 1) && (count > (segment.end - 1 - address) / stride + 1) )
+			throw "bad rebase address";
+		if ( (type != REBASE_TYPE_POINTER) && (type != REBASE_TYPE_TEXT_ABSOLUTE32) )
+			throw "bad rebase type";
+		slider.add(address, count, stride);
+		address += count * stride;
+	};
+	bool done = false;
+	while ( !done && (p < end) ) {
+		const uint8_t immediate = *p & REBASE_IMMEDIATE_MASK;
+		const uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		++p;
+		switch ( opcode ) {
+			case REBASE_OPCODE_DONE:
+				done = true;
+				break;
+			case REBASE_OPCODE_SET_TYPE_IMM:
+				type = immediate;
+				break;
+			case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+				address = segment.start + readULEB128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_ULEB:
+				address += readULEB128(p, end);
+				break;
+			case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+				address += immediate * sizeof(uintptr_t);
+				break;
+			case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+				addRun(immediate, sizeof(uintptr_t));
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+				addRun(readULEB128(p, end), sizeof(uintptr_t));
+				break;
+			case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+				addRun(1, sizeof(uintptr_t));
+				address += readULEB128(p, end);
+				break;
+			case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB: {
+				const uint64_t count = readULEB128(p, end);
+				addRun(count, readULEB128(p, end) + sizeof(uintptr_t));
+				break;
+			}
+			default:
+				throw "bad rebase opcode";
+		}
+	}
+	*runCount = slider.runCount();
+	return slider.pointerCount();
+}
+
+enum Layout { kPointerTables, kStructArrays, kScattered };
+
+static std::vector<uint8_t> makeOpcodes(Layout layout, std::mt19937& random)
+{
+	std::vector<uint8_t> opcodes;
+	opcodes.push_back(REBASE_OPCODE_SET_TYPE_IMM | REBASE_TYPE_POINTER);
+	opcodes.push_back(REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB | 1);
+	appendULEB128(opcodes, 0);
+	const size_t pointer = sizeof(uintptr_t);
+	size_t offset = 0;
+	for (;;) {
+		if ( layout == kPointerTables ) {
+			// vtables, method lists, __objc_classlist and the like, a few words apart
+			const size_t count = 16 + random() % 512;
+			const size_t gap = pointer * (1 + random() % 4);
+			if ( offset + count * pointer + gap > kSegmentSize )
+				break;
+			opcodes.push_back(REBASE_OPCODE_DO_REBASE_ULEB_TIMES);
+			appendULEB128(opcodes, count);
+			opcodes.push_back(REBASE_OPCODE_ADD_ADDR_IMM_SCALED | (uint8_t)(gap / pointer));
+			offset += count * pointer + gap;
+		}
+		else if ( layout == kStructArrays ) {
+			// elements of 16 to 64 bytes with one pointer each, then a word to the next array
+			const size_t count = 8 + random() % 256;
+			const size_t skip = pointer * (1 + random() % 7);
+			if ( offset + count * (skip + pointer) + pointer > kSegmentSize )
+				break;
+			for (size_t i = 0; i < count; ++i) {
+				opcodes.push_back(REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB);
+				appendULEB128(opcodes, skip);
+			}
+			opcodes.push_back(REBASE_OPCODE_ADD_ADDR_IMM_SCALED | 1);
+			offset += count * (skip + pointer) + pointer;
+		}
+		else {
+			const size_t skip = pointer * (random() % 24);
+			if ( offset + pointer + skip > kSegmentSize )
+				break;
+			opcodes.push_back(REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB);
+			appendULEB128(opcodes, skip);
+			offset += pointer + skip;
+		}
+	}
+	opcodes.push_back(REBASE_OPCODE_DONE);
+	return opcodes;
+}
+
+int main(int argc, const char* argv[])
+{
+	const size_t repeats = (argc > 1) ? strtoul(argv[1], NULL, 0) : 20;
+	std::mt19937 random(42);
+	const char* const names[] = { "pointer tables", "struct arrays", "scattered" };
+
+	printf("%-16s %10s %10s %10s  %12s %12s\n", "layout", "pointers", "runs", "opcode KB", "interp M/s", "runs M/s");
+	for (Layout layout : { kPointerTables, kStructArrays, kScattered }) {
+		const std::vector<uint8_t> opcodes = makeOpcodes(layout, random);
+		std::vector<uintptr_t> interpreted(kSegmentSize / sizeof(uintptr_t));
+		for (size_t i = 0; i < interpreted.size(); ++i)
+			interpreted[i] = 0x100000000ULL + i * 0x10;
+		std::vector<uintptr_t> slid = interpreted;
+		const Segment interpretedSegment = { (uintptr_t)interpreted.data(), (uintptr_t)interpreted.data() + kSegmentSize };
+		const Segment slidSegment = { (uintptr_t)slid.data(), (uintptr_t)slid.data() + kSegmentSize };
+
+		// both leave the same bytes behind
+		size_t runCount = 0;
+		const size_t pointers = interpret(opcodes, interpretedSegment, 0x4000);
+		CHECK(decodeRuns(opcodes, slidSegment, 0x4000, &runCount) == pointers);
+		CHECK(interpreted == slid);
+
+		double interpretNs = 1e18;
+		double runsNs = 1e18;
+		for (size_t r = 0; r < repeats; ++r) {
+			interpretNs = std::min(interpretNs, nanosecondsPer(1, [&](size_t) { doNotOptimize(interpret(opcodes, interpretedSegment, 1)); }));
+			runsNs = std::min(runsNs, nanosecondsPer(1, [&](size_t) { size_t n; doNotOptimize(decodeRuns(opcodes, slidSegment, 1, &n)); }));
+		}
+		printf("%-16s %10zu %10zu %10zu  %12.0f %12.0f\n", names[layout], pointers, runCount, opcodes.size() / 1024,
+			   pointers * 1e3 / interpretNs, pointers * 1e3 / runsNs);
+	}
+	return testResult();
+}
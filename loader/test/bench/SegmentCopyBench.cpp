@@ -0,0 +1,170 @@
+/* -*- mode: C++; c-basic-offset: 4; tab-width: 4 -*-
+ *
+ * Copyright (c) 2021 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+/*
+ * The segment size sweep behind the SegmentCopy thresholds. For segments
+ * of 16 KB to 64 MB copied into fresh anonymous memory, as the loader does,
+ * it times:
+ *
+ *  - a plain memcpy() of the whole segment,
+ *  - copySegment() with memcpy, and with non-temporal stores,
+ *  - copySegment() on a source with every other page all zero,
+ *  - vm_copy() of the page aligned segment (on Mach only),
+ *
+ * and how long rereading a 2 MB working set takes right after each, which
+ * is what a copy that evicts the cache costs the rest of the load. The
+ * last columns are what chooseSegmentCopy() picks for a read-only segment,
+ * with a page aligned source and with one that is not.
+ *
+ *	SegmentCopyBench [max MB]
+ */
+
+#include "SegmentCopy.h"
+#include "TestSupport.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+#if __APPLE__
+	#include <mach/mach.h>
+#endif
+
+using namespace isolator;
+
+enum Method { kPlainMemcpy, kPages, kPagesStreamed, kPagesHalfZero, kVMCopy, kMethodCount };
+
+struct Timing {
+	double		copyNs;
+	double		rereadNs;
+};
+
+static uint8_t* freshPages(size_t length)
+{
+	void* pages = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if ( pages == MAP_FAILED ) {
+		perror("mmap");
+		exit(1);
+	}
+	return (uint8_t*)pages;
+}
+
+static size_t copyWith(Method method, uint8_t* dst, const uint8_t* src, const uint8_t* halfZero, size_t length, size_t pageSize)
+{
+	switch ( method ) {
+		case kPlainMemcpy:
+			memcpy(dst, src, length);
+			return length;
+		case kPages:
+			return copySegment(dst, src, length, pageSize, false);
+		case kPagesStreamed:
+			return copySegment(dst, src, length, pageSize, true);
+		case kPagesHalfZero:
+			return copySegment(dst, halfZero, length, pageSize, false);
+		case kVMCopy:
+#if __APPLE__
+			if ( vm_copy(mach_task_self(), (vm_address_t)src, length, (vm_address_t)dst) != KERN_SUCCESS )
+				return 0;
+			// the copy-on-write pages have to be touched to cost what a copy does
+			for (size_t offset = 0; offset < length; offset += pageSize)
+				doNotOptimize(((volatile uint8_t*)dst)[offset]);
+			return length;
+#else
+			return 0;
+#endif
+		default:
+			return 0;
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	const size_t maxLength = ((argc > 1) ? strtoul(argv[1], NULL, 0) : 64) << 20;
+	const size_t pageSize = (size_t)getpagesize();
+
+	// every page of the copies is checked once, every other page of halfZero is all zero
+	std::vector<uint64_t> hot((2 << 20) / sizeof(uint64_t), 1);
+	const char* const names[kMethodCount] = { "memcpy", "pages", "streamed", "half zero", "vm_copy" };
+	printf("GB/s of each copy, page faults included / us to reread 2 MB after it\n");
+	printf("%8s", "size");
+	for (const char* name : names)
+		printf(" %16s", name);
+	printf("  %s\n", "chosen aligned/not");
+
+	for (size_t length = 16 * 1024; length <= maxLength; length *= 2) {
+		uint8_t* src = freshPages(length);
+		uint8_t* halfZero = freshPages(length);
+		for (size_t i = 0; i < length; ++i) {
+			src[i] = (uint8_t)(i | 1);
+			halfZero[i] = ((i / pageSize) % 2 == 1) ? 0 : src[i];
+		}
+
+		Timing best[kMethodCount];
+		for (Timing& timing : best)
+			timing = { 1e18, 1e18 };
+		const int repeats = (length < (1 << 20)) ? 100 : ((length < (16 << 20)) ? 20 : 5);
+		for (int r = 0; r < repeats; ++r) {
+			for (int method = 0; method < kMethodCount; ++method) {
+				uint8_t* dst = freshPages(length);
+				uint64_t sum = 0;
+				for (uint64_t value : hot)
+					sum += value;
+				size_t written = 0;
+				const double copyNs = nanosecondsPer(1, [&](size_t) {
+					written = copyWith((Method)method, dst, src, halfZero, length, pageSize);
+				});
+				const double rereadNs = nanosecondsPer(1, [&](size_t) {
+					for (uint64_t value : hot)
+						sum += value;
+				});
+				doNotOptimize(sum);
+				if ( (r == 0) && (written != 0) ) {
+					const uint8_t* expected = (method == kPagesHalfZero) ? halfZero : src;
+					CHECK(memcmp(dst, expected, length) == 0);
+					CHECK(written == ((method == kPagesHalfZero) ? length - (length / pageSize / 2) * pageSize : length));
+				}
+				if ( written != 0 ) {
+					best[method].copyNs = std::min(best[method].copyNs, copyNs);
+					best[method].rereadNs = std::min(best[method].rereadNs, rereadNs);
+				}
+				munmap(dst, length);
+			}
+		}
+
+		printf("%7zuK", length >> 10);
+		for (const Timing& timing : best) {
+			if ( timing.copyNs < 1e18 )
+				printf(" %8.1f / %5.0f", length / timing.copyNs, timing.rereadNs / 1000);
+			else
+				printf(" %16s", "-");
+		}
+		const SegmentCopyStrategy aligned = chooseSegmentCopy((uintptr_t)halfZero, (uintptr_t)src, length, pageSize, false);
+		const SegmentCopyStrategy unaligned = chooseSegmentCopy((uintptr_t)halfZero, (uintptr_t)src + 16, length, pageSize, false);
+		printf("  %s/%s\n", segmentCopyName(aligned), segmentCopyName(unaligned));
+		munmap(src, length);
+		munmap(halfZero, length);
+	}
+	return testResult();
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 1999-2019 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The part of <mach-o/nlist.h> the portable loader sources and their tests
+ * use, for hosts without the Apple SDK.
+ */
+
+#ifndef _MACHO_NLIST_H_
+#define _MACHO_NLIST_H_
+
+#include <stdint.h>
+
+struct nlist {
+	union {
+		uint32_t n_strx;
+	} n_un;
+	uint8_t		n_type;
+	uint8_t		n_sect;
+	int16_t		n_desc;
+	uint32_t	n_value;
+};
+
+struct nlist_64 {
+	union {
+		uint32_t n_strx;
+	} n_un;
+	uint8_t		n_type;
+	uint8_t		n_sect;
+	uint16_t	n_desc;
+	uint64_t	n_value;
+};
+
+#define	N_STAB	0xe0
+#define	N_PEXT	0x10
+#define	N_TYPE	0x0e
+#define	N_EXT	0x01
+
+#define	N_UNDF	0x0
+#define	N_ABS	0x2
+#define	N_SECT	0xe
+
+#define	NO_SECT		0
+
+#endif /* _MACHO_NLIST_H_ */
@@ -0,0 +1,40 @@
+/*
+ * Stand-in for the <arm_neon.h> intrinsics RebaseRuns.cpp uses, written
+ * with GCC vector extensions so its NEON kernel builds and runs on hosts
+ * without an AArch64 toolchain. Only RebaseRunsNeonTest puts this on the
+ * include path, together with __ARM_NEON and without the x86 vector macros.
+ */
+
+#ifndef __ARM_NEON_STANDIN_H
+#define __ARM_NEON_STANDIN_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uint64_t uint64x2_t __attribute__((vector_size(16)));
+
+static inline uint64x2_t vdupq_n_u64(uint64_t value)
+{
+	const uint64x2_t result = { value, value };
+	return result;
+}
+
+// vld1q/vst1q need no alignment beyond the element's
+static inline uint64x2_t vld1q_u64(const uint64_t* p)
+{
+	uint64x2_t result;
+	memcpy(&result, p, sizeof(result));
+	return result;
+}
+
+static inline void vst1q_u64(uint64_t* p, uint64x2_t value)
+{
+	memcpy(p, &value, sizeof(value));
+}
+
+static inline uint64x2_t vaddq_u64(uint64x2_t a, uint64x2_t b)
+{
+	return a + b;
+}
+
+#endif // __ARM_NEON_STANDIN_H